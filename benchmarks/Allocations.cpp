@@ -0,0 +1,73 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/*
+* To count allocations we replace the global new and delete. Every new in the program comes through here, including
+* the ones inside std::string and std::unordered_map, and the array forms that new[] and delete[] use.
+*
+* These live in a file of their own on purpose. The compiler can't see into them from the code it's compiling
+* elsewhere, so it can't inline a delete (which calls free) into code that got its memory from new, and then warn that
+* the two don't match. They do match: all of them go through malloc and free.
+*/
+using namespace std;
+
+atomic<size_t> allocationCount = 0;
+
+inline void* countedAllocation(size_t size)
+{
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    return malloc(size == 0 ? 1 : size);
+}
+
+void* operator new(size_t size)
+{
+    if (void* memory = countedAllocation(size)) return memory;
+    throw bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    if (void* memory = countedAllocation(size)) return memory;
+    throw bad_alloc();
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+    return countedAllocation(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+    return countedAllocation(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void* memory, const nothrow_t&) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void* memory, const nothrow_t&) noexcept
+{
+    free(memory);
+}
@@ -0,0 +1,216 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "HttpMessage.hpp"
+#include "HttpParser.hpp"
+#include "HttpRequestView.hpp"
+#include "Router.hpp"
+#include "StringManip.hpp"
+
+/*
+* Micro benchmarks for the code every request goes through: parsing requests, routing them and printing responses. Each benchmark
+* runs against a corpus of requests from tiny to huge, so a change that helps small requests but hurts big ones (or
+* the other way around) shows up. Run with:
+*   ./benchmarks/benchmarks
+*   ./benchmarks/benchmarks --benchmark_filter=Parser
+*
+* Besides time, every benchmark reports bytes/second and allocs/op, which is how many times the heap was asked for
+* memory per run. Allocations are slow and fight over locks between threads, so that number going down matters.
+*/
+using namespace std;
+
+extern atomic<size_t> allocationCount; //counted by our own new and delete, see Allocations.cpp
+
+//Keeps count of allocations made while a benchmark runs and reports them per iteration when it's done.
+struct AllocationCounter
+{
+    benchmark::State& state;
+    size_t start;
+
+    AllocationCounter(benchmark::State& state) : state(state), start(allocationCount.load()) {}
+
+    ~AllocationCounter()
+    {
+        state.counters["allocs/op"] = benchmark::Counter(allocationCount.load() - start, benchmark::Counter::kAvgIterations);
+    }
+};
+
+//a request with the given number of made up headers and a body of the given size
+string makeRequest(int headerCount, size_t bodySize)
+{
+    string output = "POST /api/v2/accounts/12345/orders?expand=items&limit=50 HTTP/1.1\r\n";
+    output += "host: shop.example.com\r\n";
+    output += "user-agent: Mozilla/5.0 (X11; Linux x86_64; rv:124.0) Gecko/20100101 Firefox/124.0\r\n";
+    output += "accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n";
+    for (int i = 3; i < headerCount; i++)
+    {
+        output += "x-custom-header-" + to_string(i) + ": some-value-that-is-a-little-long-" + to_string(i * 7919) + "\r\n";
+    }
+    output += "content-length: " + to_string(bodySize) + "\r\n\r\n";
+    output += string(bodySize, 'b');
+    return output;
+}
+
+/*
+* The corpus. Benchmarks take an index into it as their argument:
+* 0: tiny GET with one header, 1: a typical browser request, 2: many headers, 3: a 64KB body, 4: a 1MB body
+*/
+const vector<string>& corpus()
+{
+    static const vector<string> requests =
+    {
+        "GET / HTTP/1.1\r\nhost: a\r\n\r\n",
+        makeRequest(12, 0),
+        makeRequest(60, 256),
+        makeRequest(8, 64 << 10),
+        makeRequest(8, 1 << 20)
+    };
+    return requests;
+}
+
+void addCorpus(benchmark::internal::Benchmark* benchmark)
+{
+    for (size_t i = 0; i < corpus().size(); i++) benchmark->Arg(i);
+}
+
+//parseString is protected, so we borrow it through a struct of our own
+struct ParseableMessage : HttpMessage
+{
+    ParseableMessage() : HttpMessage(0) {}
+    using HttpMessage::parseString;
+};
+
+void HttpMessage_parseString(benchmark::State& state)
+{
+    const string& request = corpus()[state.range(0)];
+    AllocationCounter counter(state);
+    for (auto _ : state)
+    {
+        ParseableMessage message;
+        message.parseString(request);
+        benchmark::DoNotOptimize(message);
+    }
+    state.SetBytesProcessed(state.iterations() * request.size());
+}
+BENCHMARK(HttpMessage_parseString)->Apply(addCorpus);
+
+//The constructor that reads from a socket. Here the "socket" hands out the request 4KB at a time.
+void HttpMessage_readerConstructor(benchmark::State& state)
+{
+    const string& request = corpus()[state.range(0)];
+    AllocationCounter counter(state);
+    for (auto _ : state)
+    {
+        size_t position = 0;
+        HttpMessage message(0, [&](int, char* buffer, int size)
+        {
+            int readBytes = min((size_t)size, request.size() - position);
+            memcpy(buffer, request.data() + position, readBytes);
+            position += readBytes;
+            return readBytes;
+        });
+        benchmark::DoNotOptimize(message);
+    }
+    state.SetBytesProcessed(state.iterations() * request.size());
+}
+BENCHMARK(HttpMessage_readerConstructor)->Apply(addCorpus);
+
+//The zero copy path the event loop uses: scan the buffer in place and fill in a view. The body is only measured,
+//never copied, so the bytes/second for the big bodies comes out silly high. That's the point of the parser.
+void HttpParser_scanToView(benchmark::State& state)
+{
+    const string& request = corpus()[state.range(0)];
+    HttpParser parser;
+    HttpRequestView view;
+    AllocationCounter counter(state);
+    for (auto _ : state)
+    {
+        parser.reset();
+        parser.scan(request);
+        parser.getView(request, view);
+        benchmark::DoNotOptimize(view);
+    }
+    state.SetBytesProcessed(state.iterations() * request.size());
+}
+BENCHMARK(HttpParser_scanToView)->Apply(addCorpus);
+
+void StringManip_parseMap(benchmark::State& state)
+{
+    const string& request = corpus()[state.range(0)];
+    size_t start = request.find("\r\n") + 2;
+    string headers = request.substr(start, request.find("\r\n\r\n") - start);
+    AllocationCounter counter(state);
+    for (auto _ : state) benchmark::DoNotOptimize(parseMap(headers, ": ", "\r\n"));
+    state.SetBytesProcessed(state.iterations() * headers.size());
+}
+BENCHMARK(StringManip_parseMap)->Apply(addCorpus);
+
+void StringManip_parseToDelim(benchmark::State& state)
+{
+    const string& request = corpus()[state.range(0)];
+    AllocationCounter counter(state);
+    for (auto _ : state) benchmark::DoNotOptimize(parseToDelim(request, "\r\n\r\n"));
+    state.SetBytesProcessed(state.iterations() * request.find("\r\n\r\n"));
+}
+BENCHMARK(StringManip_parseToDelim)->Apply(addCorpus);
+
+void StringManip_scanHeaders(benchmark::State& state)
+{
+    const string& request = corpus()[state.range(0)];
+    size_t start = request.find("\r\n") + 2;
+    size_t length = request.find("\r\n\r\n") + 2 - start;
+    HeaderLine lines[HttpRequestView::MAX_HEADERS];
+    AllocationCounter counter(state);
+    for (auto _ : state) benchmark::DoNotOptimize(scanHeaders(request.data() + start, length, lines, HttpRequestView::MAX_HEADERS));
+    state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(StringManip_scanHeaders)->Apply(addCorpus);
+
+/*
+* Finding a route among the given number of them. Half are plain text and half have a parameter, and the one we look
+* for is one of the last added, so a router that tried every route in turn would do badly here. The time should stay
+* about the same as the number of routes goes up, and allocs/op should be 0.
+*/
+void Router_find(benchmark::State& state)
+{
+    Router router;
+    for (int i = 0; i < state.range(0); i += 2)
+    {
+        router.add(HttpMessage::GET, "/api/v2/resource" + to_string(i) + "/list", [](auto...) {});
+        router.add(HttpMessage::GET, "/api/v2/resource" + to_string(i + 1) + "/:id/items/:item", [](auto...) {});
+    }
+    string path = "/api/v2/resource" + to_string(state.range(0) - 1) + "/12345/items/67890";
+    RouteParameters parameters;
+    AllocationCounter counter(state);
+    for (auto _ : state) benchmark::DoNotOptimize(router.find(HttpMessage::GET, path, parameters));
+    state.SetBytesProcessed(state.iterations() * path.size());
+}
+BENCHMARK(Router_find)->Arg(10)->Arg(100)->Arg(1000);
+
+//Printing works on messages that were parsed out of the corpus, so they're the same sizes going out as coming in.
+void HttpMessage_printAsRequest(benchmark::State& state)
+{
+    ParseableMessage message;
+    message.parseString(corpus()[state.range(0)]);
+    size_t size = message.printAsRequest().size();
+    AllocationCounter counter(state);
+    for (auto _ : state) benchmark::DoNotOptimize(message.printAsRequest());
+    state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(HttpMessage_printAsRequest)->Apply(addCorpus);
+
+void HttpMessage_printAsResponse(benchmark::State& state)
+{
+    ParseableMessage request;
+    request.parseString(corpus()[state.range(0)]);
+    HttpMessage message(200, request.headers, request.body);
+    size_t size = message.printAsResponse().size();
+    AllocationCounter counter(state);
+    for (auto _ : state) benchmark::DoNotOptimize(message.printAsResponse());
+    state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(HttpMessage_printAsResponse)->Apply(addCorpus);
+
+BENCHMARK_MAIN();
@@ -9,4 +9,12 @@ cd build
 cmake ..
 make install
 cd ..
+cd ..
+git clone https://github.com/google/benchmark.git -b v1.7.1
+cd benchmark
+mkdir build
+cd build
+cmake .. -DCMAKE_BUILD_TYPE=Release -DBENCHMARK_ENABLE_TESTING=OFF
+make install
+cd ..
 cd ..
\ No newline at end of file
@@ -7,9 +7,25 @@
 * The "" marks indicate that the referred to file is a internal project file.
 */
 #include <iostream>
+#include <atomic>
 #include <thread>
-#include <mutex>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "BodySpooler.hpp"
+#include "Compression.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "ResponseCache.hpp"
+#include "ReverseProxy.hpp"
+#include "Router.hpp"
 #include "Socket.hpp"
+#include "StaticFiles.hpp"
+#ifndef MAC
+    #include <unistd.h>
+    #include "EventLoop.hpp" //epoll is a Linux thing, so Mac keeps the old thread per connection model.
+    #include "Handover.hpp"
+#endif
 
 /*
 * C++ allows for both objects and normal functions to exist in the same code base. This can cause problems with name collision if you're not careful.
@@ -19,36 +35,150 @@
 * This means I can write cout instead of std::cout.
 */
 using namespace std;
-mutex consoleWriteMutex; /*A mutex is used to synchronize resources that are shared between threads.
-* While one thread has a lock on a mutex, another thread cannot acquire the lock, until the thread that owns it, unlocks it.
-* This protects us from race conditions where reading and writing could be corrupted by the memory address being modified in unpredictable ways.
-* This mutex is used to insure that writing to the console logs happens as intended.
+Logger accessLog; /*Every thread writes to the console through this logger, one line per request.
+* We used to lock a mutex and print with cout, but then every thread had to wait its turn for the lock, and the one holding it had to wait for the
+* terminal to keep up. The logger gives each thread a buffer of its own to drop lines into, and a background thread prints them in batches.
+* Pass LoggerOptions to it to log to a file, change the format, or only log some of the requests.
 */
+StaticFiles publicFiles("/static/", "public"); //Anything asked for under /static/ is sent from the public folder in the directory the server was started from.
+Router apiRoutes; //Our endpoints, picked by method and path. They're added in addRoutes, before the server starts.
+ResponseCache savedResponses; //Answers to GET requests that we keep for a second, so a popular endpoint doesn't have to build the same answer over and over.
+ReverseProxy backends; //Other servers we pass requests on to, for whichever paths were given with --proxy. See addProxyRoute.
+Compressor compressor; /*Squeezes text before it's sent, for clients that say they can unsqueeze it. Anything under a kilobyte isn't worth the trouble and
+* goes out as it is. Files and saved answers are compressed once and the compressed copy is kept, since compressing takes a lot longer than sending.
+*/
+
+/*
+* This is where endpoints go. Each one is a method, a path, and a function to call when a request for it comes in. A piece of the path that starts
+* with : is a parameter: it matches anything up to the next /, and the handler gets what it matched by name. Try curl localhost:8080/hello/world
+*/
+void addRoutes()
+{
+	/*
+	* The health check says the same thing every time, so we turn it into bytes once, right here, and every request just gets those bytes sent
+	* to it. The lambda captures the frozen response by value, which keeps it alive for as long as the route is. HEAD gets the same handler,
+	* and the connection knows to leave the body off for it.
+	*/
+	shared_ptr<const FrozenResponse> healthy = FrozenResponse::freeze(HttpMessage(200, {{"content-type", "application/json"}}, "{\"status\":\"ok\"}"));
+	RouteHandler health = [healthy](Connection* connection, const HttpRequestView&, const RouteParameters&)
+	{
+		connection->sendFrozen(healthy);
+	};
+	apiRoutes.add(HttpMessage::GET, "/health", health);
+	apiRoutes.add(HttpMessage::HEAD, "/health", health);
+
+	//This one hands its answer back instead of sending it, so savedResponses can keep it and send it again to the next person who asks.
+	RouteHandler hello = savedResponses.cached([](const HttpRequestView&, const RouteParameters& parameters)
+	{
+		return HttpMessage(200, {{"content-type", "text/plain"}}, "Hello, " + string(parameters.get("name")) + "!"); //Say hi to whoever's in the path.
+	});
+	apiRoutes.add(HttpMessage::GET, "/hello/:name", hello);
+	apiRoutes.add(HttpMessage::HEAD, "/hello/:name", hello); //answered from the same kept response, without its body
+
+	/*
+	* Some answers are too big to build all at once. This one counts up to the number in the path, try curl localhost:8080/count/10000000.
+	* The head goes out right away, and then the lambda passed to streamChunks is called for the next thousand numbers each time the client
+	* has room for more, so the whole answer is never in our memory at once, however high you count. Clients that take gzip get each piece
+	* compressed on its way out.
+	*/
+	apiRoutes.add(HttpMessage::GET, "/count/:to", [](Connection* connection, const HttpRequestView& request, const RouteParameters& parameters)
+	{
+		long long to = atoll(string(parameters.get("to")).c_str());
+		Compressor::Encoding encoding = Compressor::chooseEncoding(request);
+		HttpMessage head(200, {{"content-type", "text/plain"}, {"vary", "accept-encoding"}});
+		if (encoding != Compressor::IDENTITY) head.headers["content-encoding"] = Compressor::getEncodingName(encoding);
+		connection->startChunked(head);
+
+		shared_ptr<Compressor::Stream> squeezer = make_shared<Compressor::Stream>(encoding); //shared, because the lambda gets copied around
+		connection->streamChunks([to, encoding, squeezer, next = 1LL](Connection* connection) mutable //mutable lets the lambda change its own copy of next
+		{
+			string numbers;
+			for (int i = 0; i < 1000 && next <= to; i++) numbers.append(to_string(next++)).append("\n");
+			bool finished = next > to;
+
+			if (encoding != Compressor::IDENTITY)
+			{
+				string squeezed;
+				squeezer->write(numbers, squeezed);
+				if (finished) squeezer->finish(squeezed);
+				numbers = std::move(squeezed); //this can come out empty while the compressor fills up, and that's fine
+			}
+			connection->sendChunk(std::move(numbers));
+			return !finished; //false tells the connection we're done, and it sends the end of the response
+		});
+	});
+
+	/*
+	* Uploads can be far bigger than we'd want to hold in memory. A body over a megabyte isn't waited for: the handler is called as soon as the head
+	* is in, and the body is handed to the spooler a piece at a time as it arrives. Anything over 64KB goes to a file in /tmp instead of staying in
+	* memory. Try curl --data-binary @some_big_file localhost:8080/upload
+	*/
+	apiRoutes.add(HttpMessage::POST, "/upload", [](Connection* connection, const HttpRequestView&, const RouteParameters&)
+	{
+		shared_ptr<BodySpooler> upload = make_shared<BodySpooler>(SpoolOptions{.maximumSize = 1024LL * 1024 * 1024}); //a gigabyte is plenty
+		connection->streamBody(BodySpooler::sinkInto(upload, [](Connection* connection, BodySpooler& body, HttpParser::Status status)
+		{
+			if (status == HttpParser::COMPLETE) //the file goes away with the spooler. Call body.saveAs to keep it.
+			{
+				string answer = "{\"bytes\":" + to_string(body.getSize()) + ",\"spooled\":" + (body.isSpooled() ? "true" : "false") + "}";
+				connection->sendData(HttpMessage(200, {{"content-type", "application/json"}}, answer));
+			}
+			else connection->sendData(HttpMessage(body.isTooBig() ? 413 : 400, {{"connection", "close"}})); //413 is Payload Too Large
+		}));
+	});
+}
+
+/*
+* We can also stand in front of other servers. ./testsocket --proxy /api/=127.0.0.1:9000,127.0.0.1:9001 passes anything asked for under /api/
+* on to one of those two, taking turns, and passes their answer back. Put --balance least-connections (or consistent-hash) in front of --proxy
+* to pick them another way. A server that stops answering is left alone for a while, and the others pick up its share.
+*/
+void addProxyRoute(const string& setting, ReverseProxy::Balance balance)
+{
+	size_t equals = setting.find('=');
+	if (equals == string::npos) return;
+	vector<pair<string,int>> servers;
+	for (size_t start = equals + 1; start < setting.size();) //one host:port after another, with commas in between
+	{
+		size_t comma = min(setting.find(',', start), setting.size());
+		string server = setting.substr(start, comma - start);
+		size_t colon = server.rfind(':');
+		if (colon != string::npos) servers.push_back({server.substr(0, colon), atoi(server.c_str() + colon + 1)});
+		start = comma + 1;
+	}
+	backends.addRoute(setting.substr(0, equals), servers, balance);
+}
 
 /*
 * This function is used to listen to a connection and respond with an HTTP response. This function is intended to be thread safe.
-* The connection it takes in represents a client that is connected to our API.
+* The connection it takes in represents a client that is connected to our API. Whoever calls this function owns
+* the connection and will close it once the response has been sent, so we don't delete it here.
 */
 void listenToConnection(Connection* connection)
 {
 	if (connection->getHandle() > -1) //Make sure that the connection is not closed, or experiencing an error
 	{
-		HttpMessage request = connection->receiveData(); //Get the request from the client
-		HttpMessage msg(200,{{"content-type","application/json"}},"{\"message\":\"You sent a " + request.getHttpMethodAsString() + " request!\"}"); //Create a 200 ok response with a message telling the user what kind of request they made
-		connection->sendData(msg); //Send the response back to the client
-		delete connection; //This will close the connection and free the heap memory allocated by the caller.
+		auto started = chrono::steady_clock::now(); //Note the time, so the log can say how long we took.
+		const HttpRequestView& view = connection->receiveView(); //Get the request from the client, still sitting in the connection's buffer
+		if (!publicFiles.serve(connection, view) && !backends.serve(connection, view) && !apiRoutes.serve(connection, view)) /*If it's asking for one of
+		* our files, it's sent straight from the disk and we're done. If it's for a server we stand in front of, it's passed on, and the answer is
+		* sent back once it comes (so the log says 0 for it, since it hasn't come yet). If it's one of our endpoints, that endpoint answers it.
+		*/
+		{
+			HttpMessage request = view.toMessage(); //Otherwise get our own copy of it to work with
+			HttpMessage msg(200,{{"content-type","application/json"}},"{\"message\":\"You sent a " + request.getHttpMethodAsString() + " request!\"}"); //Create a 200 ok response with a message telling the user what kind of request they made
+			compressor.compressResponse(view, msg); //Compress it if it's big enough to be worth it and the client can take it. This one never is, but yours might be.
+			connection->sendData(msg); //Send the response back to the client
+		}
 
-		lock_guard<mutex> guard(consoleWriteMutex); //Make sure it's safe to write to console. Maintain ownership of mutex till this object leaves scope.
-		cout << request.printAsRequest() << endl  //print the request to console
-		<< "-------------------------" << endl //print a seperator bar to console
-		<< msg.printAsResponse()<<endl // print the response to console
-		<< "-------------------------" << endl; // and another seperator bar.
+		//Drop a line in the access log. This doesn't wait for anything, the line gets printed later by the logger's own thread.
+		accessLog.logAccess(view.httpMethod, view.requestUri, connection->getResponseStatus(), connection->getResponseSize(),
+			chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started).count());
 	}
 	else
 	{
 		//the connection was closed for some reason
-		lock_guard<mutex> guard(consoleWriteMutex); //lock the console mutex 
-		cout << "Thread Closed" << endl; //express our frustration to the world.
+		accessLog.log("Thread Closed"); //express our frustration to the world.
 	}
 }
 
@@ -57,25 +187,50 @@ void listenToConnection(Connection* connection)
 * however i'm going more the spring boot approach where this program stays running in the background on it's own port and can be proxied too.
 * That being said, while this may not be the best solution, for now we are opening a second port to listen for the kill command. Ideally this port
 * will not be public to other systems. Configure your firewall carefully! :)
+*
+* Since we have a private port anyway, it's also where the server tells you how it's doing. GET /metrics on it answers with request counts,
+* response counts, open connections, bytes in and out, and how long each step of a request is taking, in a format monitoring tools understand.
+*
+* main opens the port and hands it to us, so that it can close it again if the server stops some other way. That wakes us up, and we finish.
 */
-void listenForKillCommand(Socket* listeningSocket)
+#ifndef MAC
+void listenForAdminRequests(Socket* killSocket, EventLoop* serverLoop, Metrics* serverMetrics)
+#else
+void listenForAdminRequests(Socket* killSocket, Socket* listeningSocket, Metrics* serverMetrics)
+#endif
 {
-	const HttpMessage KILL_MESSAGE(HttpMessage::DELETE,"/non_public_uri",{{"host", "the_scp_foundation"},{"operation","kill"}}, "死神"); //this message, if received will kill our server!!
-	Socket killSocket(6000); //Open up the socket
-	killSocket.listenPort(); //Request to start listening
+	const HttpMessage KILL_MESSAGE(HttpMessage::DELETE,"/non_public_uri",{{"host", "the_scp_foundation"},{"operation","kill"},{"content-length","6"}}, "死神"); //this message, if received will kill our server!!
+	                                                                                                                         //死神 is 6 bytes in UTF-8. The content-length header is how we know we've read the whole body.
 	bool cont = true; //Our loop condition. Continue is a reserved word so I had to use an abbreviation.
 
 	while (cont) //This loop will end once the kill command is received allowing this thread to die and take the others with it.
 	{
-		Connection* killConnection = killSocket.openConnection(); //wait for a connection. This blocks the thread
+		Connection* killConnection = killSocket->openConnection(); //wait for a connection. This blocks the thread
+		if (killConnection->getHandle() < 0) //nobody came. If main closed the port on its way out, nobody will.
+		{
+			delete killConnection;
+			if (killSocket->getHandle() < 0) break;
+			continue;
+		}
 		HttpMessage response = killConnection->receiveData(); //receive the data.
 		string body; // this will be used for the body of our response
 
+		if (response.httpMethod == HttpMessage::GET && response.requestUri == "/metrics") //Somebody wants to know how we're doing.
+		{
+			killConnection->sendData(HttpMessage(200, {{"content-type", "text/plain; version=0.0.4"}}, serverMetrics->print())); //Add up every worker's numbers and send them.
+			delete killConnection;
+			continue; //Not a kill request, so there's nothing to report in the log.
+		}
+
 		if (response == KILL_MESSAGE) //Did we get a kill message?
 		{
 			cont = false; // stop looping
 			body = "\"俺は死んでいます。\""; //Cry and dramatically raise our hands to the setting sun as we shut down. Sad music plays here.
-			listeningSocket->closePort(); //And this is the part in the horror movie where the villain cuts the phone lines.
+			#ifndef MAC
+				serverLoop->stop(); //And this is the part in the horror movie where the villain cuts the phone lines.
+			#else
+				listeningSocket->closePort(); //And this is the part in the horror movie where the villain cuts the phone lines.
+			#endif
 		}
 		else //but wait! it could be a false alarm.
 		{
@@ -86,31 +241,124 @@ void listenForKillCommand(Socket* listeningSocket)
 		killConnection->sendData(msg); //Message sent!
 		delete killConnection; //And kill the connection with the client. Wouldn't want them to get back in.
 		                       //remember you must delete any heap allocated pointers. This prevents memory leaks.
-		lock_guard<mutex> guard(consoleWriteMutex); //secure a lock on the console write command
-		cout << "kill request received: "<< (cont ? "[continuing]" : "[terminated]"); //Output a tragic news report about our story.
-		cout << endl; //fin.
+		accessLog.log(cont ? "kill request received: [continuing]" : "kill request received: [terminated]"); //Output a tragic news report about our story. fin.
 	}
 }
 
 /*
-* This is the main entry point to our program. The parameters can be ignored for now as we're not taking anything in from the console.
+* This is the main entry point to our program. The parameters hold anything typed after the program name on the console. We look for --io-uring,
+* --upgrade, --balance and --proxy.
 * The return value tells the operating system how we did. Anything other than zero is interpreted as an error. Looking up what went wrong
 * is the caller's responsibility not ours, so we best document our outputs well. Good thing we only output success because everything we do
 * is successful.
 */
 int main(int argc, char const* argv[])
 {
-	Socket listeningSocket(8080); //Get a socket on port 8080.
-	listeningSocket.listenPort(); //Start listening to port 8080.
+	addRoutes(); //The routes have to be in place before anybody can ask for them.
+	publicFiles.setCompressor(&compressor); //Send html, css, js and the like compressed.
+	savedResponses.setCompressor(&compressor); //And keep a compressed copy of saved answers alongside the plain one.
+	ReverseProxy::Balance balance = ReverseProxy::ROUND_ROBIN;
+	for (int i = 1; i + 1 < argc; i++) //these two take a value, the word after them
+	{
+		if (string(argv[i]) == "--balance") balance = string(argv[i + 1]) == "least-connections" ? ReverseProxy::LEAST_CONNECTIONS :
+			string(argv[i + 1]) == "consistent-hash" ? ReverseProxy::CONSISTENT_HASH : ReverseProxy::ROUND_ROBIN;
+		if (string(argv[i]) == "--proxy") addProxyRoute(argv[i + 1], balance);
+	}
+#ifndef MAC
+	/*
+	* Rather than spinning up a thread for every client, we let an event loop juggle all of them. It starts one worker per
+	* CPU core and each worker watches thousands of sockets at once, only calling listenToConnection when a request shows up.
+	* Clients get to keep their connection open between requests, which saves them setting up a new one every time.
+	*
+	* Every worker gets its own socket on port 8080 and the kernel deals new clients out between them, so when a crowd shows
+	* up all at once they're let in on every core instead of lining up at one door.
+	*/
+	bool ioUring = false, upgrade = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (string(argv[i]) == "--io-uring") ioUring = true; //./testsocket --io-uring lets the kernel do the socket work for us.
+		if (string(argv[i]) == "--upgrade") upgrade = true; //./testsocket --upgrade takes over from the server that's already running.
+	}
 
-	thread killThread(listenForKillCommand, &listeningSocket); //Start a new thread that will run the listenForKillCommand function. Pass it the socket memory address.
+	/*
+	* A new version of the server can take over from the old one without a single client being turned away. Start the new one with --upgrade and
+	* it asks the running one for its sockets on port 8080, through a file in /tmp. Both of them listen on the very same sockets for a moment, then
+	* the old one stops letting clients in, finishes the requests it's in the middle of, and exits on its own. Clients waiting to be let in never
+	* notice, because the sockets they're waiting on were never closed. See modules/handover/Handover.hpp for how the sockets get across.
+	*
+	* The admin port isn't handed over. Both servers can listen on it at once, so the new one just opens its own, and the old one's goes with it.
+	*/
+	const string HANDOVER_PATH = "/tmp/testsocket.handover";
+	vector<Socket*> listeningSockets;
+	if (upgrade)
+	{
+		for (int handle : Handover::takeOver(HANDOVER_PATH)) listeningSockets.push_back(new Socket(ExistingSocket{handle})); //Already listening, nothing else to do.
+		if (listeningSockets.empty()) cout << "there was no server to take over from, starting fresh" << endl;
+	}
+	for (unsigned int i = listeningSockets.size(); i < max(1u, thread::hardware_concurrency()); i++)
+	{
+		Socket* listeningSocket = new Socket(8080, SOMAXCONN); //Get a socket on port 8080. Let the OS queue up as many new clients as it allows.
+		listeningSocket->listenPort(); //Start listening to port 8080.
+		listeningSockets.push_back(listeningSocket);
+	}
+
+	Metrics serverMetrics(listeningSockets.size()); //One shard of numbers per worker, so the workers never fight over who gets to count.
+	EventLoop serverLoop(listeningSockets, listenToConnection, {}, true); //Hand the sockets and our handler to the event loop, and keep each worker on its own core.
+	serverLoop.setMetrics(&serverMetrics); //Have the workers count what they do, so the admin port can tell us about it.
+	if (ioUring && !serverLoop.setEngine(EventLoop::IO_URING))
+	{
+		cout << "io_uring is not available here, using epoll" << endl; //Older kernels and a lot of containers don't allow it, so we carry on the old way.
+	}
+
+	//Now we're the one offering our sockets to whoever comes next. This waits on its own thread, since run is about to take this one.
+	Handover handover(HANDOVER_PATH);
+	atomic<bool> handedOver = false; //atomic, because the handover thread sets it and this one reads it
+	vector<int> handles;
+	for (Socket* listeningSocket : listeningSockets) handles.push_back(listeningSocket->getHandle());
+	if (!handover.offer()) cout << "couldn't offer our sockets at " << HANDOVER_PATH << ", --upgrade won't be able to take over from us" << endl;
+	thread handoverThread([&]()
+	{
+		if (!handover.handOver(handles)) return; //withdrawn, because we're shutting down anyway
+		accessLog.log("handed our sockets to a new server, finishing up");
+		handedOver = true;
+		serverLoop.drain(30000); //Give the clients we have half a minute to finish up, then hang up on whoever's left.
+	});
+
+	Socket killSocket(6000); //Open up the admin socket here, so we can close it when we're done.
+	killSocket.listenPort(); //Request to start listening
+	thread killThread(listenForAdminRequests, &killSocket, &serverLoop, &serverMetrics); //Start a new thread that will run the listenForAdminRequests function. Pass it the socket's, the loop's and the metrics' memory addresses.
+	serverLoop.run(); //This blocks until the kill command stops the loop, or we've handed over and finished draining.
+	handover.withdraw(); //If nobody took over, stop waiting for them.
+	handoverThread.join();
+	for (Socket* listeningSocket : listeningSockets)
+	{
+		/*
+		* Closing the port would shut it down for the new server too, since it's the same socket. Letting go of our handle just leaves it to them.
+		* If nobody took over, nobody else has it, so this is where the port is given back.
+		*/
+		if (handedOver) close(listeningSocket->releaseHandle());
+		delete listeningSocket;
+	}
+	killSocket.closePort(); //If we stopped for anything but the kill command, the admin thread is still waiting on port 6000. This lets it go.
+#else
+	Socket listeningSocket(8080, SOMAXCONN); //Get a socket on port 8080. Let the OS queue up as many new clients as it allows.
+	listeningSocket.listenPort(); //Start listening to port 8080.
+	Metrics serverMetrics(1); //Without the event loop nobody counts anything yet, so these stay at zero.
+	Socket killSocket(6000); //Open up the admin socket
+	killSocket.listenPort(); //Request to start listening
+	thread killThread(listenForAdminRequests, &killSocket, &listeningSocket, &serverMetrics); //Start a new thread that will run the listenForAdminRequests function. Pass it the socket and metrics memory addresses.
 		
 	while (listeningSocket.getHandle() > -1) //loop until the socket is closed.
 	{
 		Connection* connection = listeningSocket.openConnection(); //This function will block the thread while looking for a connection. This prevents us from chewing up too many resources.
-		thread listenerThread(listenToConnection, connection); //spin up a new thread
+		thread listenerThread([connection]() //spin up a new thread
+		{
+			listenToConnection(connection);
+			delete connection; //This will close the connection and free the heap memory allocated by openConnection.
+		});
 		listenerThread.detach(); //This detaches the thread from the object, meaning that the thread continues to run even if the object goes out of scope.
 	}
+#endif
 
 	killThread.join(); //wait for the kill thread to finish processing.
 	return 0; //close the program with no errors.
@@ -121,9 +369,8 @@ int main(int argc, char const* argv[])
 * here are some improvement ideas!
 *
 * Make the program read from a config file instead of hardcoding port numbers and messages.
-* Make a switch statement that does different things based on endpoint and http method type.
 * Implement SSL and TLS.
-* Implement a configurable limit on the number of listening threads that can be open.
+* Make the number of event loop workers configurable.
 *
 * And those are just a few ideas.
 *
@@ -0,0 +1,173 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "BodySpooler.hpp"
+
+using namespace std;
+
+//write keeps going until everything is written, since the OS is allowed to take only part of it at a time
+inline bool writeAll(int handle, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(handle, data, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+BodySpooler::BodySpooler(SpoolOptions spoolOptions)
+{
+    options = spoolOptions;
+    size = 0;
+    tooBig = failed = saved = false;
+}
+
+/*
+* Add the next piece of the body. Returns false if the body has grown past maximumSize, or if it couldn't be written to
+* the file (the disk filled up, say). Once that happens every later write is turned down too.
+*/
+bool BodySpooler::write(string_view piece)
+{
+    if (tooBig || failed) return false;
+    if (piece.size() > options.maximumSize - size)
+    {
+        tooBig = true;
+        return false;
+    }
+
+    if (!file && size + piece.size() > options.memoryLimit && !spill()) return false;
+    if (file && !writeFile(piece)) return false;
+    if (!file) memory.append(piece);
+    size += piece.size();
+    if (file) file->size = size;
+    return true;
+}
+
+/*
+* The body has outgrown memory, so make a file for it and move what we have into it. mkstemp makes a file with a name
+* nobody else has, by filling in the X's, and opens it for us in the same step, so nobody can sneak in between.
+*/
+bool BodySpooler::spill()
+{
+    path = options.directory + "/body-XXXXXX";
+    int handle = mkstemp(path.data());
+    if (handle < 0)
+    {
+        failed = true;
+        path.clear();
+        return false;
+    }
+
+    file = make_shared<FileBody>(handle, 0);
+    if (!writeFile(memory)) return false;
+    string().swap(memory); //clear doesn't give the memory back, swapping with an empty string does
+    return true;
+}
+
+bool BodySpooler::writeFile(string_view data)
+{
+    if (!writeAll(file->handle, data.data(), data.size())) failed = true;
+    return !failed;
+}
+
+size_t BodySpooler::getSize() const
+{
+    return size;
+}
+
+//whether the body went to a file
+bool BodySpooler::isSpooled() const
+{
+    return file != nullptr;
+}
+
+bool BodySpooler::isTooBig() const
+{
+    return tooBig;
+}
+
+bool BodySpooler::hasFailed() const
+{
+    return failed;
+}
+
+//The body, if it's small enough to have stayed in memory. Empty once it has gone to a file.
+string_view BodySpooler::getMemory() const
+{
+    return memory;
+}
+
+/*
+* The file the body went to, ready to be sent with Connection::sendFile, or nullptr if it stayed in memory. It stays
+* open for as long as someone holds on to it, even after the spooler deletes its name.
+*/
+shared_ptr<FileBody> BodySpooler::getFile() const
+{
+    return file;
+}
+
+const string& BodySpooler::getPath() const
+{
+    return path;
+}
+
+/*
+* Keep the body as the file at destination. A body that went to a file is just renamed, which costs nothing however big
+* it is, unless destination is on a different disk, where it has to be copied. A body in memory is written out.
+*/
+bool BodySpooler::saveAs(const string& destination)
+{
+    if (tooBig || failed) return false;
+    if (file && rename(path.c_str(), destination.c_str()) == 0)
+    {
+        path = destination;
+        saved = true;
+        return true;
+    }
+
+    int handle = open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (handle < 0) return false;
+
+    bool output = true;
+    if (!file) output = writeAll(handle, memory.data(), memory.size());
+    else
+    {
+        char buffer[65536];
+        for (off_t position = 0; output && position < (off_t)size;)
+        {
+            ssize_t readBytes = pread(file->handle, buffer, sizeof(buffer), position);
+            output = readBytes > 0 && writeAll(handle, buffer, readBytes);
+            position += max(readBytes, (ssize_t)0);
+        }
+    }
+    close(handle);
+    if (!output) unlink(destination.c_str()); //half a file is worse than none
+    return output;
+}
+
+/*
+* Make a sink that writes a streamed body into spooler, and calls finished once it's all in, or once it went wrong. The
+* spooler is shared because with an event loop the sink is still being fed long after the handler that made it has
+* returned. A body that goes past maximumSize is turned down, so the rest of it is never read.
+*/
+BodySink BodySpooler::sinkInto(shared_ptr<BodySpooler> spooler, Finished finished)
+{
+    return [spooler, finished](Connection* connection, string_view piece, HttpParser::Status status)
+    {
+        bool wanted = spooler->write(piece);
+        if (!wanted || status != HttpParser::STREAMING) finished(connection, *spooler, wanted ? status : HttpParser::ERROR);
+        return wanted;
+    };
+}
+
+//The file goes with the spooler, unless it was saved somewhere.
+BodySpooler::~BodySpooler()
+{
+    if (file && !saved) unlink(path.c_str());
+}
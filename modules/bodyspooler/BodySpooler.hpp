@@ -0,0 +1,66 @@
+#ifndef StiltFox_UniversalLibrary_BodySpooler
+#define StiltFox_UniversalLibrary_BodySpooler
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "HttpParser.hpp"
+#include "Socket.hpp"
+
+struct SpoolOptions
+{
+    size_t memoryLimit = 64 * 1024; //bodies up to this size are kept in memory, bigger ones go to a file
+    size_t maximumSize = SIZE_MAX; //bodies bigger than this are turned down
+    std::string directory = "/tmp"; //where the files go
+};
+
+/*
+* A BodySpooler takes a request body a piece at a time and keeps it somewhere. Small bodies stay in memory, where they
+* are cheap to get at. Once a body grows past memoryLimit, everything so far is written out to a file and the rest
+* goes straight after it, so an upload of any size only ever costs the piece being written. The file is deleted when
+* the spooler is, unless saveAs gave it a home of its own first.
+*
+* The easy way to use one is with sinkInto, which makes a BodySink for Connection::streamBody:
+*
+*     auto upload = std::make_shared<BodySpooler>();
+*     connection->streamBody(BodySpooler::sinkInto(upload, [](Connection* connection, BodySpooler& body, HttpParser::Status status)
+*     {
+*         if (status == HttpParser::COMPLETE && body.saveAs("uploads/latest")) connection->sendData(HttpMessage(201, {}));
+*         else connection->sendData(HttpMessage(body.isTooBig() ? 413 : 400, {}));
+*     }));
+*/
+class BodySpooler
+{
+    SpoolOptions options;
+    std::string memory;
+    std::shared_ptr<FileBody> file; //nullptr until the body outgrows memory
+    std::string path; //where the file is
+    size_t size;
+    bool tooBig;
+    bool failed; //the file couldn't be made or written to
+    bool saved; //saveAs moved the file, so it isn't ours to delete
+
+    bool spill();
+    bool writeFile(std::string_view data);
+
+    public:
+    typedef std::function<void(Connection*, BodySpooler&, HttpParser::Status)> Finished;
+
+    BodySpooler(SpoolOptions options = {});
+    BodySpooler(const BodySpooler&) = delete; //two spoolers deleting the same file would be trouble
+    BodySpooler& operator=(const BodySpooler&) = delete;
+    ~BodySpooler();
+    bool write(std::string_view piece);
+    size_t getSize() const;
+    bool isSpooled() const;
+    bool isTooBig() const;
+    bool hasFailed() const;
+    std::string_view getMemory() const;
+    std::shared_ptr<FileBody> getFile() const;
+    const std::string& getPath() const;
+    bool saveAs(const std::string& destination);
+
+    static BodySink sinkInto(std::shared_ptr<BodySpooler> spooler, Finished finished);
+};
+#endif
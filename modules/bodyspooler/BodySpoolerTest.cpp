@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include "BodySpooler.hpp"
+
+using namespace std;
+
+//each test spools into a folder of its own
+string makeFolder()
+{
+    char folder[] = "/tmp/bodyspoolertestXXXXXX";
+    return mkdtemp(folder);
+}
+
+string readFile(const string& path)
+{
+    stringstream output;
+    output << ifstream(path).rdbuf();
+    return output.str();
+}
+
+TEST(BodySpooler, write_will_keep_small_bodies_in_memory_and_move_big_ones_to_a_file)
+{
+    //given a spooler that keeps up to 100 bytes in memory
+    string folder = makeFolder();
+    BodySpooler small({.memoryLimit = 100, .directory = folder});
+    BodySpooler big({.memoryLimit = 100, .directory = folder});
+    string path;
+
+    //when one gets a body that fits and the other gets one that doesn't, and the big one is deleted
+    bool smallWritten = small.write("tiny") && small.write(" body");
+    bool bigWritten = big.write(string(60, 'a')) && big.write(string(60, 'b')) && big.write(string(5000, 'c'));
+    string spooled;
+    {
+        BodySpooler other({.memoryLimit = 100, .directory = folder});
+        other.write(string(200, 'd'));
+        path = other.getPath();
+        spooled = readFile(path);
+    }
+
+    //then the small one is still in memory, and the big one went to a file with what was in memory first
+    ASSERT_TRUE(smallWritten && bigWritten);
+    ASSERT_FALSE(small.isSpooled());
+    ASSERT_EQ(small.getMemory(), "tiny body");
+    ASSERT_TRUE(big.isSpooled());
+    ASSERT_EQ(big.getSize(), 5120);
+    ASSERT_EQ(big.getFile()->size, 5120);
+    ASSERT_TRUE(big.getMemory().empty());
+    ASSERT_EQ(readFile(big.getPath()), string(60, 'a') + string(60, 'b') + string(5000, 'c'));
+    ASSERT_EQ(spooled, string(200, 'd'));
+    ASSERT_NE(access(path.c_str(), F_OK), 0); //the file went with its spooler
+}
+
+TEST(BodySpooler, write_will_turn_down_a_body_bigger_than_the_maximum_and_saveAs_will_keep_the_rest)
+{
+    //given spoolers that take at most 1000 bytes
+    string folder = makeFolder();
+    BodySpooler tooBig({.memoryLimit = 10, .maximumSize = 1000, .directory = folder});
+    BodySpooler spooled({.memoryLimit = 10, .maximumSize = 1000, .directory = folder});
+    BodySpooler inMemory({.memoryLimit = 10, .maximumSize = 1000, .directory = folder});
+
+    //when one is given too much, and the others are saved
+    bool first = tooBig.write(string(900, 'x'));
+    bool second = tooBig.write(string(200, 'y'));
+    bool afterwards = tooBig.write("z");
+    spooled.write(string(1000, 's'));
+    inMemory.write("memory");
+    string temporary = spooled.getPath();
+    bool saved = spooled.saveAs(folder + "/spooled") && inMemory.saveAs(folder + "/memory");
+
+    //then the body is turned down once it's too big, and the saved ones are where we asked, without the temporary file
+    ASSERT_TRUE(first);
+    ASSERT_FALSE(second || afterwards);
+    ASSERT_TRUE(tooBig.isTooBig());
+    ASSERT_FALSE(tooBig.saveAs(folder + "/tooBig"));
+    ASSERT_TRUE(saved);
+    ASSERT_EQ(readFile(folder + "/spooled"), string(1000, 's'));
+    ASSERT_EQ(readFile(folder + "/memory"), "memory");
+    ASSERT_NE(access(temporary.c_str(), F_OK), 0);
+}
+
+TEST(BodySpooler, sinkInto_will_spool_a_body_streamed_from_a_connection)
+{
+    //given a connection that streams bodies over 64KB, and a client sending a chunked upload of 1MB behind a head
+    int handles[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, handles);
+    Connection connection(handles[0]);
+    connection.setLimits({.bodyBuffer = 65536});
+    string folder = makeFolder();
+    string body;
+    for (int i = 0; body.size() < 1024 * 1024; i++) body += "line " + to_string(i) + "\n";
+    thread client([&]()
+    {
+        string request = "POST /upload HTTP/1.1\r\ntransfer-encoding: chunked\r\n\r\n";
+        for (size_t position = 0; position < body.size(); position += 10000)
+        {
+            string chunk = body.substr(position, 10000);
+            char size[16];
+            snprintf(size, sizeof(size), "%zx\r\n", chunk.size());
+            request.append(size).append(chunk).append("\r\n");
+        }
+        request += "0\r\n\r\n";
+        send(handles[1], request.data(), request.size(), MSG_NOSIGNAL);
+    });
+
+    //when the request is received and its body streamed into a spooler
+    const HttpRequestView& request = connection.receiveView();
+    bool streamed = connection.isReceivingBody();
+    auto upload = make_shared<BodySpooler>(SpoolOptions{.directory = folder});
+    HttpParser::Status finishedWith = HttpParser::NEED_MORE;
+    connection.streamBody(BodySpooler::sinkInto(upload, [&](Connection* connection, BodySpooler& spooler, HttpParser::Status status)
+    {
+        finishedWith = status;
+        connection->sendData(HttpMessage(201, {}, to_string(spooler.getSize())));
+    }));
+    client.join();
+    char response[256] = {};
+    recv(handles[1], response, sizeof(response) - 1, 0);
+    close(handles[1]);
+
+    //then the handler had the head before the body, and the whole body ended up in the file
+    ASSERT_TRUE(streamed);
+    ASSERT_EQ(request.requestUri, "/upload");
+    ASSERT_TRUE(request.body.empty());
+    ASSERT_EQ(finishedWith, HttpParser::COMPLETE);
+    ASSERT_EQ(connection.getBodyStatus(), HttpParser::COMPLETE);
+    ASSERT_TRUE(upload->isSpooled());
+    ASSERT_EQ(readFile(upload->getPath()), body);
+    ASSERT_TRUE(string(response).ends_with("\r\n\r\n" + to_string(body.size())));
+    ASSERT_TRUE(connection.keepAlive());
+}
@@ -0,0 +1,368 @@
+#include <algorithm>
+#include "Compression.hpp"
+#include "PerfectHash.hpp"
+#ifdef SF_ZSTD
+    #include <zstd.h>
+#endif
+
+using namespace std;
+
+constexpr string_view ENCODING_NAMES[Compressor::ENCODING_COUNT] = {"identity", "gzip", "deflate", "zstd"};
+constexpr Compressor::Encoding PREFERRED_ENCODINGS[] = {Compressor::ZSTD, Compressor::GZIP, Compressor::DEFLATE}; //best first
+constexpr size_t OUTPUT_STEP = 16 * 1024; //how much room compressed bytes get at a time
+constexpr size_t INPUT_STEP = 64 * 1024; //how much of a body compress hands the stream at a time
+
+inline string_view trim(string_view text)
+{
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) text.remove_suffix(1);
+    return text;
+}
+
+inline bool containsIgnoringCase(string_view text, string_view word)
+{
+    for (size_t i = 0; i + word.size() <= text.size(); i++) if (equalsIgnoringCase(text.substr(i, word.size()), word)) return true;
+    return false;
+}
+
+/*
+* A q value says how much the client would like an encoding, from 0 (not at all) to 1 (the most), ie: "gzip;q=0.8".
+* It's at most 3 digits after the point, so we read it by hand into thousandths instead of dealing with floats.
+* Anything we can't make sense of counts as 1, like it would if the q wasn't there.
+*/
+inline int parseQuality(string_view parameters)
+{
+    for (size_t start = 0; start < parameters.size();)
+    {
+        size_t end = min(parameters.find(';', start), parameters.size());
+        string_view parameter = trim(parameters.substr(start, end - start));
+        start = end + 1;
+        if (parameter.size() < 3 || (parameter[0] != 'q' && parameter[0] != 'Q') || parameter[1] != '=') continue;
+
+        string_view value = parameter.substr(2);
+        if (value[0] != '0' && value[0] != '1') return 1000;
+        int output = (value[0] - '0') * 1000;
+        for (size_t i = 2, scale = 100; i < value.size() && i < 5 && value[1] == '.'; i++, scale /= 10)
+        {
+            if (value[i] < '0' || value[i] > '9') break;
+            output += (value[i] - '0') * scale;
+        }
+        return min(output, 1000);
+    }
+    return 1000;
+}
+
+Compressor::Stream::Stream(Encoding encoding, int level)
+{
+    this->encoding = encoding;
+    zlib = {};
+    if (encoding == GZIP || encoding == DEFLATE) //deflate is the same squeezing with a smaller wrapper around it than gzip
+    {
+        ready = deflateInit2(&zlib, clamp(level, 1, 9), Z_DEFLATED, encoding == GZIP ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+#ifdef SF_ZSTD
+    else if (encoding == ZSTD)
+    {
+        zstd = ZSTD_createCCtx();
+        ready = zstd != nullptr && !ZSTD_isError(ZSTD_CCtx_setParameter(zstd, ZSTD_c_compressionLevel, level));
+    }
+#endif
+}
+
+Compressor::Stream::~Stream()
+{
+    if (encoding == GZIP || encoding == DEFLATE) deflateEnd(&zlib);
+#ifdef SF_ZSTD
+    ZSTD_freeCCtx(zstd);
+#endif
+}
+
+//False if the encoding isn't one we can do, or something went wrong along the way.
+bool Compressor::Stream::isReady() const
+{
+    return ready;
+}
+
+/*
+* Feed input to the compressor and collect whatever it has ready. The compressor holds on to some of what it's fed
+* until it has enough to squeeze well, so output can grow by less than it was given, or not at all. When last is true
+* everything it's holding is let out, along with the end of the stream.
+*/
+bool Compressor::Stream::run(string_view input, string& output, bool last)
+{
+    if (!ready) return false;
+
+    if (encoding == GZIP || encoding == DEFLATE)
+    {
+        do //zlib counts in 32 bits, so a huge input goes in a gigabyte at a time
+        {
+            size_t piece = min(input.size(), (size_t)1 << 30);
+            bool finishing = last && piece == input.size();
+            zlib.next_in = (Bytef*)input.data();
+            zlib.avail_in = piece;
+            int result;
+            do
+            {
+                size_t used = output.size();
+                output.resize(used + OUTPUT_STEP);
+                zlib.next_out = (Bytef*)output.data() + used;
+                zlib.avail_out = OUTPUT_STEP;
+                result = deflate(&zlib, finishing ? Z_FINISH : Z_NO_FLUSH);
+                output.resize(used + OUTPUT_STEP - zlib.avail_out);
+                if (result == Z_STREAM_ERROR) return ready = false;
+            } while (zlib.avail_out == 0 || (finishing && result != Z_STREAM_END));
+            input.remove_prefix(piece);
+        } while (!input.empty());
+        return true;
+    }
+
+#ifdef SF_ZSTD
+    ZSTD_inBuffer in = {input.data(), input.size(), 0};
+    size_t remaining;
+    do
+    {
+        size_t used = output.size();
+        output.resize(used + OUTPUT_STEP);
+        ZSTD_outBuffer out = {output.data() + used, OUTPUT_STEP, 0};
+        remaining = ZSTD_compressStream2(zstd, &out, &in, last ? ZSTD_e_end : ZSTD_e_continue);
+        output.resize(used + out.pos);
+        if (ZSTD_isError(remaining)) return ready = false;
+    } while (last ? remaining != 0 : in.pos < in.size);
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Compressor::Stream::write(string_view input, string& output)
+{
+    return run(input, output, false);
+}
+
+//Let out everything that's left. The stream can't be written to after this.
+bool Compressor::Stream::finish(string& output)
+{
+    bool finished = run({}, output, true);
+    ready = false;
+    return finished;
+}
+
+size_t Compressor::BodyKeyHash::operator()(const BodyKey& key) const
+{
+    return key.hash ^ (key.size * 31) ^ ((size_t)key.encoding << 59);
+}
+
+Compressor::Compressor(CompressionOptions options)
+{
+    this->options = options;
+    this->options.cacheCapacity = max(options.cacheCapacity, (size_t)1);
+}
+
+const CompressionOptions& Compressor::getOptions() const
+{
+    return options;
+}
+
+bool Compressor::isSupported(Encoding encoding)
+{
+#ifdef SF_ZSTD
+    return encoding == GZIP || encoding == DEFLATE || encoding == ZSTD;
+#else
+    return encoding == GZIP || encoding == DEFLATE;
+#endif
+}
+
+string_view Compressor::getEncodingName(Encoding encoding)
+{
+    return encoding >= 0 && encoding < ENCODING_COUNT ? ENCODING_NAMES[encoding] : "";
+}
+
+/*
+* Text of any kind squeezes well. Pictures, video, fonts and archives are already compressed, and compressing them
+* again only wastes time. svg pictures are text, and so are a few others that don't start with text/.
+*/
+bool Compressor::isCompressible(string_view contentType)
+{
+    contentType = trim(contentType.substr(0, contentType.find(';')));
+    if (contentType.size() >= 5 && equalsIgnoringCase(contentType.substr(0, 5), "text/")) return true;
+    for (string_view word : {"json", "xml", "javascript"}) if (containsIgnoringCase(contentType, word)) return true;
+    for (string_view type : {"application/wasm", "image/x-icon", "image/bmp", "font/ttf", "font/otf"})
+    {
+        if (equalsIgnoringCase(contentType, type)) return true;
+    }
+    return false;
+}
+
+bool Compressor::shouldCompress(string_view contentType, size_t size) const
+{
+    return size >= options.minimumSize && isCompressible(contentType);
+}
+
+/*
+* Pick the encoding to answer with, from the Accept-Encoding header. The client's q values come first. When it likes
+* more than one the same, we go with the one that squeezes best. A * stands for every encoding the client didn't name.
+* Returns IDENTITY if the client didn't ask for anything we can do.
+*/
+Compressor::Encoding Compressor::chooseEncoding(string_view acceptEncoding)
+{
+    int quality[ENCODING_COUNT] = {-1, -1, -1, -1}; //-1 means the client didn't say
+    int anything = -1;
+    while (!acceptEncoding.empty())
+    {
+        size_t comma = min(acceptEncoding.find(','), acceptEncoding.size());
+        string_view entry = acceptEncoding.substr(0, comma);
+        acceptEncoding.remove_prefix(min(comma + 1, acceptEncoding.size()));
+
+        size_t semicolon = min(entry.find(';'), entry.size());
+        string_view name = trim(entry.substr(0, semicolon));
+        int value = parseQuality(entry.substr(min(semicolon + 1, entry.size())));
+        if (name == "*") anything = value;
+        else if (equalsIgnoringCase(name, "x-gzip")) quality[GZIP] = value; //what gzip was called long ago
+        else for (int i = 0; i < ENCODING_COUNT; i++) if (equalsIgnoringCase(name, ENCODING_NAMES[i])) quality[i] = value;
+    }
+
+    Encoding output = IDENTITY;
+    int best = 0;
+    for (Encoding encoding : PREFERRED_ENCODINGS)
+    {
+        int value = quality[encoding] > -1 ? quality[encoding] : anything;
+        if (isSupported(encoding) && value > best)
+        {
+            output = encoding;
+            best = value;
+        }
+    }
+    return output;
+}
+
+Compressor::Encoding Compressor::chooseEncoding(const HttpRequestView& request)
+{
+    return chooseEncoding(request.getHeader(HttpRequestView::ACCEPT_ENCODING));
+}
+
+//Squeeze all of input into output in one go. Returns false if the encoding is one we can't do.
+bool Compressor::compress(Encoding encoding, string_view input, string& output, int level)
+{
+    Stream stream(encoding, level);
+    for (size_t position = 0; position < input.size(); position += INPUT_STEP)
+    {
+        if (!stream.write(input.substr(position, INPUT_STEP), output)) return false;
+    }
+    return stream.finish(output);
+}
+
+/*
+* The body compressed with the encoding, from the cache if these exact bytes were compressed before. Bodies are kept
+* by a hash of their content and their size, so it doesn't matter which file or route they came from. Anybody can
+* send bytes that hash the same as somebody else's, so what was found is only used if the bytes it was made from
+* match. The compressing happens outside the lock, so other workers aren't kept waiting on it. Returns nullptr if the
+* encoding is one we can't do.
+*/
+shared_ptr<const string> Compressor::getCompressed(Encoding encoding, string_view body)
+{
+    BodyKey key = {hash<string_view>()(body), body.size(), encoding};
+    {
+        lock_guard<mutex> guard(entriesLock);
+        auto found = entries.find(key);
+        if (found != entries.end() && found->second.source == body)
+        {
+            recentlyUsed.splice(recentlyUsed.begin(), recentlyUsed, found->second.recentPosition);
+            return found->second.body;
+        }
+    }
+
+    shared_ptr<string> compressed = make_shared<string>();
+    if (!compress(encoding, body, *compressed, options.level)) return nullptr;
+    if (body.size() > options.maximumCachedSize) return compressed;
+    compressed->shrink_to_fit(); //it grew a step at a time, so there's probably room on the end we won't use
+
+    lock_guard<mutex> guard(entriesLock);
+    auto found = entries.find(key);
+    if (found != entries.end() && found->second.source == body) return found->second.body; //another worker got here first, so use theirs
+    if (found != entries.end()) return compressed; //different bytes that hash the same. The ones already kept stay.
+    if (entries.size() >= options.cacheCapacity)
+    {
+        entries.erase(recentlyUsed.back());
+        recentlyUsed.pop_back();
+    }
+    recentlyUsed.push_front(key);
+    entries.emplace(key, Entry{compressed, string(body), recentlyUsed.begin()});
+    return compressed;
+}
+
+size_t Compressor::getCachedBodyCount()
+{
+    lock_guard<mutex> guard(entriesLock);
+    return entries.size();
+}
+
+/*
+* A response is worth compressing if it has a body that's big enough and the right type, and nobody has compressed
+* it already.
+*/
+bool Compressor::canCompress(const HttpMessage& response) const
+{
+    bool bodyAllowed = response.statusCode >= 200 && response.statusCode != 204 && response.statusCode != 304;
+    return bodyAllowed && !response.hasHeader("content-encoding") &&
+           shouldCompress(response.getHeader("content-type"), response.body.size());
+}
+
+/*
+* Swap the body of a response for its compressed copy, and fix up the headers to match. Vary tells caches between us
+* and the client that what we send depends on the Accept-Encoding header, so one client isn't handed gzip it asked
+* not to get. It goes on the response whether or not we end up compressing it. If compressing doesn't make the body
+* any smaller, the response is left as it was.
+*/
+bool Compressor::encode(HttpMessage& response, Encoding encoding, bool keep)
+{
+    string* vary = response.headers.find("vary");
+    if (vary == nullptr) response.headers["vary"] = "accept-encoding";
+    else if (!containsIgnoringCase(*vary, "accept-encoding")) vary->append(", accept-encoding");
+    if (encoding == IDENTITY) return false;
+
+    string compressed;
+    if (keep)
+    {
+        shared_ptr<const string> kept = getCompressed(encoding, response.body);
+        if (kept == nullptr) return false;
+        compressed = *kept;
+    }
+    else if (!compress(encoding, response.body, compressed, options.level)) return false;
+    if (compressed.size() >= response.body.size()) return false;
+
+    response.body = std::move(compressed);
+    response.headers["content-encoding"] = getEncodingName(encoding);
+    response.headers.erase("content-length"); //it was the length before compressing. The connection works out the new one.
+    return true;
+}
+
+/*
+* Compress the response in place, with the best encoding the client can read, if it's worth doing. Returns true if the
+* body was compressed. Pass keep as true for bodies that are sent more than once, so they go through the cache.
+*/
+bool Compressor::compressResponse(const HttpRequestView& request, HttpMessage& response, bool keep)
+{
+    return canCompress(response) && encode(response, chooseEncoding(request), keep);
+}
+
+//Freeze a copy of the response compressed with the encoding, or as it is if it isn't worth compressing.
+shared_ptr<const FrozenResponse> Compressor::freeze(HttpMessage response, Encoding encoding)
+{
+    if (canCompress(response)) encode(response, isSupported(encoding) ? encoding : IDENTITY, true);
+    return FrozenResponse::freeze(response);
+}
+
+FrozenVariants::FrozenVariants(Compressor& compressor, const HttpMessage& response)
+{
+    responses[Compressor::IDENTITY] = compressor.freeze(response, Compressor::IDENTITY);
+    for (int i = Compressor::IDENTITY + 1; i < Compressor::ENCODING_COUNT; i++)
+    {
+        Compressor::Encoding encoding = (Compressor::Encoding)i;
+        responses[i] = Compressor::isSupported(encoding) ? compressor.freeze(response, encoding) : responses[Compressor::IDENTITY];
+    }
+}
+
+const shared_ptr<const FrozenResponse>& FrozenVariants::pick(const HttpRequestView& request) const
+{
+    return responses[Compressor::chooseEncoding(request)];
+}
@@ -0,0 +1,127 @@
+#ifndef StiltFox_UniversalLibrary_Compression
+#define StiltFox_UniversalLibrary_Compression
+#include <zlib.h>
+#include <array>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "HttpMessage.hpp"
+#include "HttpRequestView.hpp"
+#include "Socket.hpp"
+
+struct ZSTD_CCtx_s; //zstd's compressor. We only hold a pointer to it, so zstd doesn't have to be installed to use this header.
+
+struct CompressionOptions
+{
+    size_t minimumSize = 1024; //bodies smaller than this are sent as they are, squeezing them isn't worth the work
+    int level = 6; //1 is the fastest, 9 is the smallest. 6 is where most servers land.
+    size_t cacheCapacity = 256; //how many compressed bodies are kept
+    size_t maximumCachedSize = 8 * 1024 * 1024; //bodies bigger than this are compressed every time instead of kept
+};
+
+/*
+* Text squeezes down a lot. A page of html or json is often a quarter of its size after gzip, which means a quarter of
+* the time on the wire for a client on a slow connection. The client tells us what it can unsqueeze in the
+* Accept-Encoding header, ie: "gzip, deflate, br", and we say what we used in the Content-Encoding header.
+*
+* Compressing costs far more time than sending, so a Compressor tries not to do it when it doesn't pay off. Small
+* bodies are sent as they are, and so are images, fonts and the like, which are already compressed and would only get
+* bigger. Bodies that are compressed more than once, like the same file or frozen response sent to every client, are
+* kept in a cache keyed by their content and the encoding, so the same bytes are only ever squeezed once. The cache
+* keeps a copy of the bytes it squeezed too, so a body is only ever answered with what was made from those exact bytes.
+*
+* zstd is used too if it was installed when the server was built. It's faster than gzip and squeezes harder, but not
+* every client knows it yet.
+*
+* The cache is shared by every event loop worker, so it's guarded with a mutex.
+*/
+class Compressor
+{
+    public:
+    enum Encoding {IDENTITY, GZIP, DEFLATE, ZSTD, ENCODING_COUNT}; //identity is the HTTP name for not compressed at all
+
+    /*
+    * A Stream compresses a body a piece at a time, so a big body never has to be in memory twice, and what's been
+    * squeezed so far can be sent before the rest is done. Give it the pieces in order with write, then call finish.
+    * Whatever is ready gets added to the end of output.
+    */
+    class Stream
+    {
+        Encoding encoding;
+        z_stream zlib;
+        ZSTD_CCtx_s* zstd = nullptr;
+        bool ready = false;
+
+        bool run(std::string_view input, std::string& output, bool last);
+
+        public:
+        Stream(Encoding encoding, int level = 6);
+        Stream(const Stream&) = delete; //zlib keeps pointers into itself, so a copy would be trouble
+        Stream& operator=(const Stream&) = delete;
+        ~Stream();
+        bool isReady() const;
+        bool write(std::string_view input, std::string& output);
+        bool finish(std::string& output);
+    };
+
+    private:
+    struct BodyKey
+    {
+        size_t hash;
+        size_t size;
+        Encoding encoding;
+        bool operator==(const BodyKey&) const = default;
+    };
+
+    struct BodyKeyHash
+    {
+        size_t operator()(const BodyKey& key) const;
+    };
+
+    struct Entry
+    {
+        std::shared_ptr<const std::string> body;
+        std::string source; //the bytes that were compressed. Different bytes can hash the same, so a match is checked against these.
+        std::list<BodyKey>::iterator recentPosition; //where this body is in the recently used list
+    };
+
+    CompressionOptions options;
+    std::unordered_map<BodyKey, Entry, BodyKeyHash> entries;
+    std::list<BodyKey> recentlyUsed; //most recently used at the front
+    std::mutex entriesLock;
+
+    bool canCompress(const HttpMessage& response) const;
+    bool encode(HttpMessage& response, Encoding encoding, bool keep);
+
+    public:
+    Compressor(CompressionOptions options = {});
+    const CompressionOptions& getOptions() const;
+    bool shouldCompress(std::string_view contentType, size_t size) const;
+    std::shared_ptr<const std::string> getCompressed(Encoding encoding, std::string_view body);
+    bool compressResponse(const HttpRequestView& request, HttpMessage& response, bool keep = false);
+    std::shared_ptr<const FrozenResponse> freeze(HttpMessage response, Encoding encoding);
+    size_t getCachedBodyCount();
+
+    static bool isSupported(Encoding encoding);
+    static bool isCompressible(std::string_view contentType);
+    static std::string_view getEncodingName(Encoding encoding);
+    static Encoding chooseEncoding(std::string_view acceptEncoding);
+    static Encoding chooseEncoding(const HttpRequestView& request);
+    static bool compress(Encoding encoding, std::string_view input, std::string& output, int level = 6);
+};
+
+/*
+* A frozen copy of a response for every encoding, all made up front. A route handler sends pick(request), so every
+* client gets the bytes it can read and nobody waits on anything being compressed.
+*/
+struct FrozenVariants
+{
+    std::array<std::shared_ptr<const FrozenResponse>, Compressor::ENCODING_COUNT> responses;
+
+    FrozenVariants(Compressor& compressor, const HttpMessage& response);
+    const std::shared_ptr<const FrozenResponse>& pick(const HttpRequestView& request) const;
+};
+#endif
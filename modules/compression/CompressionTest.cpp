@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+#include "Compression.hpp"
+#include "HttpParser.hpp"
+
+using namespace std;
+
+//undo gzip or deflate, whichever it is, so we can check we get back what went in
+string decompress(const string& input)
+{
+    z_stream stream = {};
+    inflateInit2(&stream, 15 + 32);
+    stream.next_in = (Bytef*)input.data();
+    stream.avail_in = input.size();
+
+    string output;
+    char buffer[16384];
+    int result = Z_OK;
+    while (result == Z_OK)
+    {
+        stream.next_out = (Bytef*)buffer;
+        stream.avail_out = sizeof(buffer);
+        result = inflate(&stream, Z_NO_FLUSH);
+        output.append(buffer, sizeof(buffer) - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    return result == Z_STREAM_END ? output : "not compressed right";
+}
+
+//a request with just an Accept-Encoding header, parsed into view. raw has to stay around as long as the view does.
+void parseRequest(const string& raw, HttpRequestView& view)
+{
+    HttpParser parser;
+    parser.scan(raw);
+    parser.getView(raw, view);
+}
+
+TEST(Compression, chooseEncoding_will_go_by_the_clients_q_values_then_by_what_squeezes_best)
+{
+    //given the headers clients send
+    //when we choose an encoding for each
+    //then the client's likes come first, ties go to gzip over deflate, and anything refused or unknown is sent as is
+    ASSERT_EQ(Compressor::chooseEncoding("gzip, deflate, br"), Compressor::GZIP);
+    ASSERT_EQ(Compressor::chooseEncoding("deflate, gzip"), Compressor::GZIP);
+    ASSERT_EQ(Compressor::chooseEncoding("gzip;q=0.5, deflate"), Compressor::DEFLATE);
+    ASSERT_EQ(Compressor::chooseEncoding("GZIP ; Q=0.9 , deflate;q=0.85"), Compressor::GZIP);
+    ASSERT_EQ(Compressor::chooseEncoding("x-gzip"), Compressor::GZIP);
+    ASSERT_EQ(Compressor::chooseEncoding("*;q=0.1, gzip;q=0"), Compressor::DEFLATE);
+    ASSERT_EQ(Compressor::chooseEncoding("gzip;q=0, deflate;q=0.000"), Compressor::IDENTITY);
+    ASSERT_EQ(Compressor::chooseEncoding("br, identity"), Compressor::IDENTITY);
+    ASSERT_EQ(Compressor::chooseEncoding(""), Compressor::IDENTITY);
+    if (Compressor::isSupported(Compressor::ZSTD)) ASSERT_EQ(Compressor::chooseEncoding("gzip, zstd"), Compressor::ZSTD);
+    else ASSERT_EQ(Compressor::chooseEncoding("zstd"), Compressor::IDENTITY);
+}
+
+TEST(Compression, stream_will_compress_a_body_given_in_pieces_the_same_as_all_at_once)
+{
+    //given a few megabytes of text that repeats itself, like html tends to
+    string body;
+    for (int i = 0; body.size() < 3 * 1024 * 1024; i++) body += "<li class=\"item\">item number " + to_string(i) + "</li>\n";
+
+    //when we compress it in one go with each encoding, and a piece at a time with gzip
+    string gzip, deflate, pieces;
+    bool gzipped = Compressor::compress(Compressor::GZIP, body, gzip);
+    bool deflated = Compressor::compress(Compressor::DEFLATE, body, deflate);
+    Compressor::Stream stream(Compressor::GZIP);
+    for (size_t position = 0; position < body.size(); position += 1000) stream.write(string_view(body).substr(position, 1000), pieces);
+    bool finished = stream.finish(pieces);
+    string identity;
+
+    //then every one of them turns back into the body, a lot smaller than it started, and identity isn't a compression
+    ASSERT_TRUE(gzipped && deflated && finished);
+    ASSERT_TRUE(gzip.starts_with("\x1f\x8b"));
+    ASSERT_EQ(decompress(gzip), body);
+    ASSERT_EQ(decompress(deflate), body);
+    ASSERT_EQ(pieces, gzip);
+    ASSERT_LT(gzip.size(), body.size() / 4);
+    ASSERT_FALSE(stream.write("more", pieces));
+    ASSERT_FALSE(Compressor::compress(Compressor::IDENTITY, body, identity));
+}
+
+TEST(Compression, compressResponse_will_only_compress_text_that_is_big_enough_for_clients_that_want_it)
+{
+    //given a client that takes gzip, one that doesn't, and responses of different sizes and types
+    string acceptsRaw = "GET / HTTP/1.1\r\naccept-encoding: gzip\r\n\r\n", refusesRaw = "GET / HTTP/1.1\r\n\r\n";
+    HttpRequestView accepts, refuses;
+    parseRequest(acceptsRaw, accepts);
+    parseRequest(refusesRaw, refuses);
+    Compressor compressor;
+    string text(4096, 'a');
+    HttpMessage page(200, {{"content-type", "text/html; charset=utf-8"}, {"content-length", "4096"}, {"vary", "cookie"}}, text);
+    HttpMessage plain = page;
+    HttpMessage tiny(200, {{"content-type", "text/html"}}, "<p>hi</p>");
+    HttpMessage picture(200, {{"content-type", "image/png"}}, text);
+    HttpMessage missing(404, {{"content-type", "text/html"}}, text);
+
+    //when we compress them
+    bool pageCompressed = compressor.compressResponse(accepts, page);
+    bool plainCompressed = compressor.compressResponse(refuses, plain);
+    bool others = compressor.compressResponse(accepts, tiny) || compressor.compressResponse(accepts, picture);
+
+    //then only the page is compressed, and the headers say so, and errors are still compressed if the client wants
+    ASSERT_TRUE(pageCompressed);
+    ASSERT_EQ(decompress(page.body), text);
+    ASSERT_EQ(page.getHeader("content-encoding"), "gzip");
+    ASSERT_EQ(page.getHeader("vary"), "cookie, accept-encoding");
+    ASSERT_FALSE(page.hasHeader("content-length"));
+    ASSERT_FALSE(plainCompressed);
+    ASSERT_EQ(plain.body, text);
+    ASSERT_EQ(plain.getHeader("vary"), "cookie, accept-encoding");
+    ASSERT_FALSE(others);
+    ASSERT_EQ(tiny.body, "<p>hi</p>");
+    ASSERT_FALSE(picture.hasHeader("content-encoding"));
+    ASSERT_TRUE(compressor.compressResponse(accepts, missing));
+    ASSERT_EQ(compressor.getCachedBodyCount(), 0);
+}
+
+TEST(Compression, getCompressed_will_only_compress_the_same_bytes_once)
+{
+    //given a compressor that keeps 2 bodies
+    Compressor compressor({.cacheCapacity = 2});
+    string first(5000, 'x'), second(5000, 'y'), third(5000, 'z');
+
+    //when the same bytes are compressed more than once, from different strings, and then more bodies push them out
+    shared_ptr<const string> once = compressor.getCompressed(Compressor::GZIP, first);
+    shared_ptr<const string> again = compressor.getCompressed(Compressor::GZIP, string(5000, 'x'));
+    shared_ptr<const string> deflated = compressor.getCompressed(Compressor::DEFLATE, first);
+    compressor.getCompressed(Compressor::GZIP, second);
+    compressor.getCompressed(Compressor::GZIP, third);
+    shared_ptr<const string> pushedOut = compressor.getCompressed(Compressor::GZIP, first);
+
+    //then the second time got the same copy as the first, each encoding is kept apart, and the cache stays its size
+    ASSERT_EQ(once, again);
+    ASSERT_EQ(decompress(*once), first);
+    ASSERT_NE(deflated, once);
+    ASSERT_EQ(decompress(*deflated), first);
+    ASSERT_NE(pushedOut, once);
+    ASSERT_EQ(*pushedOut, *once);
+    ASSERT_EQ(compressor.getCachedBodyCount(), 2);
+    ASSERT_EQ(compressor.getCompressed(Compressor::IDENTITY, first), nullptr);
+}
+
+TEST(Compression, FrozenVariants_will_pick_the_frozen_response_each_client_can_read)
+{
+    //given a response frozen for every encoding, and clients that want different things
+    Compressor compressor;
+    string text;
+    for (int i = 0; i < 200; i++) text += "{\"id\":" + to_string(i) + "},";
+    FrozenVariants variants(compressor, HttpMessage(200, {{"content-type", "application/json"}}, text));
+    string gzipRaw = "GET / HTTP/1.1\r\naccept-encoding: gzip\r\n\r\n", deflateRaw = "GET / HTTP/1.1\r\naccept-encoding: deflate\r\n\r\n";
+    string plainRaw = "GET / HTTP/1.1\r\n\r\n";
+    HttpRequestView gzip, deflate, plain;
+    parseRequest(gzipRaw, gzip);
+    parseRequest(deflateRaw, deflate);
+    parseRequest(plainRaw, plain);
+
+    //when we pick for each of them
+    const FrozenResponse& forGzip = *variants.pick(gzip);
+    const FrozenResponse& forDeflate = *variants.pick(deflate);
+    const FrozenResponse& forPlain = *variants.pick(plain);
+
+    //then each gets its own bytes, all saying they vary by accept-encoding, and both bodies went through the cache
+    ASSERT_NE(forGzip.bytes.find("content-encoding: gzip\r\n"), string::npos);
+    ASSERT_EQ(decompress(forGzip.bytes.substr(forGzip.bytes.size() - forGzip.bodySize)), text);
+    ASSERT_NE(forDeflate.bytes.find("content-encoding: deflate\r\n"), string::npos);
+    ASSERT_TRUE(forPlain.bytes.ends_with(text));
+    ASSERT_EQ(forPlain.bytes.find("content-encoding"), string::npos);
+    ASSERT_NE(forPlain.bytes.find("vary: accept-encoding\r\n"), string::npos);
+    ASSERT_EQ(compressor.getCachedBodyCount(), 2);
+}
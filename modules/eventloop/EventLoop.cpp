@@ -0,0 +1,993 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "EventLoop.hpp"
+
+using namespace std;
+
+/*
+* The handle a streamFrom source waits on is registered with the same epoll as the clients. Its events carry the
+* client's handle in the low half, the same place a client's own events keep it, plus this flag so we can tell them
+* apart.
+*/
+const uint64_t SOURCE_EVENT = 1ull << 32;
+
+inline uint64_t nanosecondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+//The time the timer wheels run on
+inline uint64_t millisecondsNow()
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+* The constructors get each worker's epoll instance ready ahead of time. Every worker also gets a little eventfd
+* that stop() can poke. That's how we wake a worker that is sleeping in epoll_wait with nothing else to do.
+*/
+EventLoop::EventLoop(Socket* listeningSocket, function<void(Connection*)> connectionHandler, int count, ConnectionLimits connectionLimits, bool pin)
+{
+    handler = connectionHandler;
+    limits = connectionLimits;
+    pinToCores = pin;
+    workerCount = count > 0 ? count : max(1u, thread::hardware_concurrency()); //one worker per core by default
+    createWorkers(vector<Socket*>(workerCount, listeningSocket)); //they all share the one socket
+}
+
+//One worker per socket. The sockets should all be bound to the same port, so the kernel can spread clients over them.
+EventLoop::EventLoop(const vector<Socket*>& listeners, function<void(Connection*)> connectionHandler, ConnectionLimits connectionLimits, bool pin)
+{
+    handler = connectionHandler;
+    limits = connectionLimits;
+    pinToCores = pin;
+    workerCount = listeners.size();
+    createWorkers(listeners);
+}
+
+void EventLoop::createWorkers(const vector<Socket*>& listeners)
+{
+    running = true;
+    drainRequested = false;
+    drainedWorkers = 0;
+    drainTimeout = 0;
+    engine = EPOLL;
+    metrics = nullptr;
+    int cores = max(1u, thread::hardware_concurrency());
+
+    for (int i = 0; i < workerCount; i++)
+    {
+        Worker* worker = new Worker();
+        worker->listener = listeners[i];
+        worker->listenHandle = -1;
+        worker->core = i % cores;
+        worker->shard = nullptr;
+        worker->epollHandle = epoll_create1(0);
+        worker->wakeHandle = eventfd(0, EFD_NONBLOCK);
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = worker->wakeHandle;
+        epoll_ctl(worker->epollHandle, EPOLL_CTL_ADD, worker->wakeHandle, &event);
+        workers.push_back(worker);
+    }
+}
+
+/*
+* Start serving. The listening sockets are switched to non-blocking and each one is added to its worker. When the
+* workers share a socket, EPOLLEXCLUSIVE asks the kernel to wake only one worker per incoming connection, so they
+* don't all stampede to accept the same client. The calling thread becomes the first worker, so this blocks until
+* stop() is called.
+*/
+void EventLoop::run()
+{
+    if (workers.empty()) return;
+
+    for (Worker* worker : workers)
+    {
+        worker->listenHandle = worker->listener->getHandle();
+        if (worker->listenHandle < 0 || !worker->listener->setBlocking(false)) return;
+
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.fd = worker->listenHandle;
+        epoll_ctl(worker->epollHandle, EPOLL_CTL_ADD, worker->listenHandle, &event);
+    }
+
+    for (int i = 1; i < workerCount; i++) workers[i]->thread = thread(&EventLoop::runWorker, this, workers[i]);
+    runWorker(workers[0]);
+    for (int i = 1; i < workerCount; i++) workers[i]->thread.join();
+}
+
+/*
+* Pick how the workers talk to the kernel. This has to happen before run. Returns false, and keeps using epoll, if
+* io_uring wasn't built in or this kernel can't do it.
+*/
+bool EventLoop::setEngine(Engine newEngine)
+{
+#ifdef SF_IO_URING
+    if (newEngine == IO_URING && !Uring::isSupported()) return false;
+#else
+    if (newEngine == IO_URING) return false;
+#endif
+    engine = newEngine;
+    return true;
+}
+
+EventLoop::Engine EventLoop::getEngine()
+{
+    return engine;
+}
+
+/*
+* Start counting into the given metrics. Worker number i counts into shard i, so give the metrics at least as many
+* shards as there are workers. If it has fewer, this returns false and nothing is counted. Like setEngine, this has
+* to happen before run.
+*/
+bool EventLoop::setMetrics(Metrics* newMetrics)
+{
+    if (newMetrics != nullptr && newMetrics->getShard(workerCount - 1) == nullptr) return false; //every worker needs a shard of its own
+    metrics = newMetrics;
+    for (int i = 0; i < workerCount; i++) workers[i]->shard = metrics == nullptr ? nullptr : metrics->getShard(i);
+    return true;
+}
+
+//Ask every worker to finish up. This is safe to call from any thread, including from inside a handler.
+void EventLoop::stop()
+{
+    running = false;
+    uint64_t poke = 1;
+    for (Worker* worker : workers) write(worker->wakeHandle, &poke, sizeof(poke));
+}
+
+/*
+* Stop taking new clients, and let go of every connection once it's done with what it's doing. A request that's on
+* its way in is still answered, with "connection: close", and connections with nothing going on are closed right
+* away. run returns once they're all gone, or after timeout milliseconds, whichever comes first. Like stop, this is
+* safe to call from any thread.
+*/
+void EventLoop::drain(int timeout)
+{
+    drainTimeout = timeout;
+    drainRequested = true;
+    uint64_t poke = 1;
+    for (Worker* worker : workers) write(worker->wakeHandle, &poke, sizeof(poke));
+}
+
+/*
+* The worker sleeps until something happens, but never past the next deadline on its timer wheel. With no
+* connections there are no deadlines, and it sleeps until a client shows up or stop() wakes it.
+*/
+void EventLoop::runWorker(Worker* worker)
+{
+    if (pinToCores)
+    {
+        cpu_set_t cores;
+        CPU_ZERO(&cores);
+        CPU_SET(worker->core, &cores);
+        pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores); //if it doesn't work out the worker just floats, no harm done
+    }
+
+#ifdef SF_IO_URING
+    if (engine == IO_URING && runUringWorker(worker)) return; //if the ring can't be set up, this worker falls back to epoll
+#endif
+
+    epoll_event events[64];
+    function<void(TimerWheel::Timer&)> expired = [this, worker](TimerWheel::Timer& timer)
+    {
+        if (&timer == &worker->drainDeadline) stop(); //we waited long enough, hang up on whoever is left
+        else expireConnection(worker, *(Session*)timer.owner);
+    };
+    worker->timers.advance(millisecondsNow(), expired); //bring the wheel's hand up to the clock before anything goes on it
+
+    while (running)
+    {
+        int count = epoll_wait(worker->epollHandle, events, 64, worker->timers.getTimeout(millisecondsNow()));
+        for (int i = 0; i < count && running; i++)
+        {
+            int handle = events[i].data.fd;
+            if (events[i].data.u64 & SOURCE_EVENT) //the handle a source was waiting on is ready, so give it another go
+            {
+                if (worker->sessions.contains(handle)) serviceConnection(worker, worker->sessions[handle], 0);
+            }
+            else if (handle == worker->listenHandle && !worker->draining) acceptConnections(worker);
+            else if (handle == worker->wakeHandle)
+            {
+                uint64_t poke;
+                read(worker->wakeHandle, &poke, sizeof(poke)); //empty it, or epoll would keep telling us about it
+            }
+            else if (worker->sessions.contains(handle)) serviceConnection(worker, worker->sessions[handle], events[i].events);
+        }
+
+        if (drainRequested && !worker->draining)
+        {
+            epoll_ctl(worker->epollHandle, EPOLL_CTL_DEL, worker->listenHandle, nullptr);
+            startDraining(worker);
+        }
+        worker->timers.advance(millisecondsNow(), expired);
+        checkDrained(worker);
+    }
+
+    while (!worker->sessions.empty()) closeConnection(worker, worker->sessions.begin()->first);
+}
+
+/*
+* Take every client that is waiting. Each connection is made non-blocking and registered edge-triggered (EPOLLET),
+* which means epoll tells us once when a socket becomes readable or writable, and it is then our job to read or
+* write until the socket says EAGAIN. New clients get a connection an earlier client is done with whenever we have
+* one, so a busy server isn't forever allocating connections and growing their buffers from nothing.
+*/
+void EventLoop::acceptConnections(Worker* worker)
+{
+    while (true)
+    {
+        auto started = chrono::steady_clock::now();
+        int handle = worker->listener->acceptHandle();
+        if (handle < 0)
+        {
+            if (worker->listener->getHandle() < 0) stop(); //someone closed the port on us, time to go home.
+            break;
+        }
+
+        Connection* connection;
+        if (worker->spares.empty()) connection = new Connection(handle);
+        else
+        {
+            connection = worker->spares.back();
+            worker->spares.pop_back();
+            connection->reset(handle);
+        }
+
+        connection->setBlocking(false);
+        connection->setLimits(limits);
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = handle;
+        epoll_ctl(worker->epollHandle, EPOLL_CTL_ADD, handle, &event);
+        Session& session = worker->sessions[handle];
+        session = Session();
+        session.connection = connection;
+        session.timer.owner = &session;
+        armDeadline(worker, session);
+
+        if (worker->shard != nullptr)
+        {
+            connection->setSendTiming(true);
+            worker->shard->countOpened();
+            worker->shard->recordPhase(Metrics::ACCEPT, nanosecondsSince(started));
+        }
+    }
+}
+
+/*
+* Drain the socket, push out anything that was waiting to be sent, answer every complete request that came in, and
+* close the connection once we're done with it.
+*
+* Draining stops early once the connection has all it wants to hold (see wantsInput), and reading is paused until the
+* handler has caught up. Then we ask epoll to look at the socket afresh, the same way streamResponse does.
+*/
+void EventLoop::serviceConnection(Worker* worker, Session& session, unsigned int events)
+{
+    Connection* connection = session.connection;
+    bool flushed = true;
+
+    if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !session.inputPaused)
+    {
+        auto started = chrono::steady_clock::now();
+        int readBytes;
+        do readBytes = connection->fillBuffer(); while ((readBytes > 0 && connection->wantsInput()) || (readBytes < 0 && errno == EINTR));
+        if (readBytes == 0 || (readBytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) session.peerClosed = true;
+        session.inputPaused = readBytes > 0; //we stopped with more still waiting in the socket
+        if (worker->shard != nullptr) worker->shard->recordPhase(Metrics::READ, nanosecondsSince(started));
+    }
+
+    if (events & EPOLLOUT) flushed = connection->flushBuffer();
+    if (flushed) handleRequests(worker, session);
+    if (flushed && session.peerClosed && connection->isReceivingBody()) connection->pumpBody(true); //the rest of the body isn't coming
+    if (flushed && connection->isStreaming()) streamResponse(worker, session);
+    if (flushed && session.inputPaused && connection->wantsInput())
+    {
+        session.inputPaused = false;
+        rearmConnection(worker, connection->getHandle());
+    }
+    reportTraffic(worker, session);
+
+    bool finished = (session.closing || session.peerClosed) && !connection->hasPendingOutput() && !connection->isStreaming();
+    if (!flushed || finished) closeConnection(worker, connection->getHandle());
+    else armDeadline(worker, session);
+}
+
+/*
+* Modifying a socket's registration makes epoll look at it afresh, so if it's still readable or writable it comes back
+* around on the next trip through the loop, after everyone else has had a turn. Since we're edge-triggered, epoll won't
+* tell us again otherwise.
+*/
+void EventLoop::rearmConnection(Worker* worker, int handle)
+{
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = handle;
+    epoll_ctl(worker->epollHandle, EPOLL_CTL_MOD, handle, &event);
+}
+
+/*
+* Pull more of a streamed response out of its source. If the socket took all of it and the source still has more, the
+* socket is still writable, so we have epoll look at it again. Once the stream is done, any requests that were
+* pipelined behind it get answered.
+*/
+void EventLoop::streamResponse(Worker* worker, Session& session)
+{
+    Connection* connection = session.connection;
+    if (connection->pullChunks()) rearmConnection(worker, connection->getHandle());
+    watchSource(worker, session);
+    if (!connection->isStreaming()) handleRequests(worker, session);
+}
+
+/*
+* Keep epoll watching whatever the source of a streamFrom response is waiting on. Modifying the registration every time
+* it waits makes epoll look at the handle afresh, and covers a source that closed its handle and opened a new one that
+* got the same number (which epoll would have forgotten about). Once the source is done, we stop watching.
+*/
+void EventLoop::watchSource(Worker* worker, Session& session)
+{
+    Connection* connection = session.connection;
+    int handle = connection->isWaiting() ? connection->getWaitHandle() : connection->getWaitHandle() < 0 ? -1 : session.sourceHandle;
+    if (session.sourceHandle > -1 && session.sourceHandle != handle)
+    {
+        epoll_ctl(worker->epollHandle, EPOLL_CTL_DEL, session.sourceHandle, nullptr);
+    }
+    session.sourceHandle = handle;
+    if (!connection->isWaiting()) return;
+
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = SOURCE_EVENT | (uint32_t)connection->getHandle();
+    if (epoll_ctl(worker->epollHandle, EPOLL_CTL_MOD, handle, &event) < 0) epoll_ctl(worker->epollHandle, EPOLL_CTL_ADD, handle, &event);
+}
+
+/*
+* Clients may send several requests without waiting for our answers, so there can be more than one request sitting
+* in the buffer. We answer them one at a time, in order. Once more than outputLimit bytes of responses are waiting to
+* be sent we stop and let the rest wait until they have drained, so a client that never reads can't make us buffer
+* without end. A streamed response has to finish before the next request can be answered, and so does a streamed
+* request body: pollRequest feeds it to the handler's sink as it comes in.
+*/
+void EventLoop::handleRequests(Worker* worker, Session& session, size_t outputLimit)
+{
+    Connection* connection = session.connection;
+    Metrics::Shard* shard = worker->shard;
+
+    while (!session.closing && !connection->isStreaming() &&
+           (!connection->hasPendingOutput() || connection->getPendingOutputSize() < outputLimit))
+    {
+        auto started = chrono::steady_clock::now();
+        HttpParser::Status status = connection->pollRequest();
+        if (connection->getRequestCount() > 0 && !connection->keepAlive()) //a streamed body was cut off or turned down
+        {
+            session.closing = true;
+            break;
+        }
+        if (status == HttpParser::NEED_MORE) break;
+        if (shard != nullptr) shard->recordPhase(Metrics::PARSE, nanosecondsSince(started));
+
+        started = chrono::steady_clock::now();
+        connection->takeSendTime(); //anything sent before now isn't this request's
+        if (status == HttpParser::ERROR)
+        {
+            connection->sendData(HttpMessage(400, {{"connection", "close"}})); //we couldn't make sense of it
+        }
+        else
+        {
+            int served = connection->getRequestCount();
+            handler(connection);
+            if (connection->getRequestCount() == served) connection->receiveView(); //the handler ignored it, so drop it
+        }
+
+        /*
+        * The time the handler spent inside sendData waiting on the socket is counted as writing, and the rest as
+        * handling, so a slow client and a slow handler don't look the same.
+        */
+        if (shard != nullptr)
+        {
+            uint64_t total = nanosecondsSince(started);
+            uint64_t writing = min(connection->takeSendTime(), total);
+            shard->recordPhase(Metrics::HANDLE, total - writing);
+            if (writing > 0) shard->recordPhase(Metrics::WRITE, writing);
+            shard->countRequest(status == HttpParser::ERROR ? HttpMessage::ERROR : connection->getRequest().httpMethod);
+            shard->countResponse(connection->getResponseStatus());
+        }
+
+        session.closing = !connection->keepAlive();
+    }
+}
+
+//Add whatever the connection has read and sent since last time to the metrics.
+void EventLoop::reportTraffic(Worker* worker, Session& session)
+{
+    if (worker->shard == nullptr) return;
+
+    uint64_t in = session.connection->getBytesReceived();
+    uint64_t out = session.connection->getBytesSent();
+    worker->shard->countBytes(in - session.reportedIn, out - session.reportedOut);
+    session.reportedIn = in;
+    session.reportedOut = out;
+}
+
+/*
+* Work out what we're waiting on the client for, and set the session's timer for when we stop waiting. Anything that
+* happens on the connection pushes the deadline back, except while the head of a request is coming in. That deadline
+* runs from the first byte, so a client can't hold a connection forever by sending its headers a byte at a time.
+* millisecondsNow drops the part of the millisecond we're in, so one more is added, or the deadline could come early.
+*/
+void EventLoop::armDeadline(Worker* worker, Session& session)
+{
+    Connection* connection = session.connection;
+    Deadline deadline = IDLE_DEADLINE;
+    int timeout = worker->draining ? 0 : limits.idleTimeout; //a draining worker lets go of idle connections right away
+
+    if (connection->hasPendingOutput() || connection->isStreaming())
+    {
+        deadline = WRITE_DEADLINE;
+        timeout = limits.writeTimeout;
+    }
+    else if (connection->isReadingBody())
+    {
+        deadline = BODY_DEADLINE;
+        timeout = limits.bodyTimeout;
+    }
+    else if (connection->isReadingHead())
+    {
+        deadline = HEAD_DEADLINE;
+        timeout = limits.headerTimeout;
+    }
+
+    if (deadline == HEAD_DEADLINE && session.deadline == HEAD_DEADLINE && session.timer.isScheduled()) return;
+    session.deadline = deadline;
+    worker->timers.schedule(session.timer, millisecondsNow() + 1 + timeout);
+}
+
+/*
+* The client missed its deadline, so nothing more is read from it. One that never finished sending a request is told
+* so with a 408 (Request Timeout), unless a handler is already taking the body. Then the handler's sink hears that the
+* body was cut off, and answers for itself.
+*/
+void EventLoop::timeOut(Worker* worker, Session& session)
+{
+    Connection* connection = session.connection;
+    if (session.deadline == HEAD_DEADLINE || session.deadline == BODY_DEADLINE)
+    {
+        if (connection->isReceivingBody()) connection->pumpBody(true);
+        else
+        {
+            connection->sendData(HttpMessage(408, {{"connection", "close"}}));
+            if (worker->shard != nullptr) worker->shard->countResponse(408);
+        }
+    }
+    session.closing = true;
+}
+
+/*
+* Called by the timer wheel when a connection's deadline passes. A client that went quiet, or stopped taking what we
+* send, is hung up on. A 408 that doesn't go out in one go gets until the write deadline to drain.
+*/
+void EventLoop::expireConnection(Worker* worker, Session& session)
+{
+    Connection* connection = session.connection;
+    bool writing = session.deadline == WRITE_DEADLINE;
+    timeOut(worker, session);
+    if (!writing && connection->flushBuffer() && connection->hasPendingOutput()) armDeadline(worker, session);
+    else closeConnection(worker, connection->getHandle());
+}
+
+/*
+* Make every connection's current request its last. The ones with nothing going on have their idle deadline brought
+* forward to now, so they're closed on the next tick.
+*/
+void EventLoop::startDraining(Worker* worker)
+{
+    worker->draining = true;
+    worker->timers.schedule(worker->drainDeadline, millisecondsNow() + drainTimeout);
+    for (auto& [key, session] : worker->sessions)
+    {
+        session.connection->endKeepAlive();
+        if (session.deadline == IDLE_DEADLINE) armDeadline(worker, session);
+    }
+}
+
+//Once a draining worker has let go of its last connection it's done, and once every worker is, run returns.
+void EventLoop::checkDrained(Worker* worker)
+{
+    if (!worker->draining || worker->drained || !worker->sessions.empty()) return;
+    worker->drained = true;
+    if (++drainedWorkers == workerCount) stop();
+}
+
+void EventLoop::closeConnection(Worker* worker, int handle)
+{
+    Session& session = worker->sessions[handle];
+    epoll_ctl(worker->epollHandle, EPOLL_CTL_DEL, handle, nullptr);
+    if (session.sourceHandle > -1) epoll_ctl(worker->epollHandle, EPOLL_CTL_DEL, session.sourceHandle, nullptr); //before the source closes it
+    Connection* connection = session.connection;
+    worker->sessions.erase(handle);
+    recycleConnection(worker, connection);
+}
+
+void EventLoop::recycleConnection(Worker* worker, Connection* connection)
+{
+    if (worker->shard != nullptr) worker->shard->countClosed();
+    if (worker->spares.size() < MAX_SPARES)
+    {
+        connection->reset(-1); //this closes the socket but keeps the connection for the next client
+        worker->spares.push_back(connection);
+    }
+    else delete connection; //this closes the socket
+}
+
+#ifdef SF_IO_URING
+/*
+* Everything from here to the #endif is the io_uring engine. Every request we hand the ring is tagged with what it
+* was for and which session it belongs to, so when its completion comes back we know what to do with it. Sessions
+* are looked up by an id rather than by socket: once a socket is closed the OS may give its number to the next
+* client while completions for the old one are still on their way.
+*/
+enum RingTag {ACCEPT_TAG, RECEIVE_TAG, SEND_TAG, WRITABLE_TAG, CLOSE_TAG, CANCEL_TAG, WAKE_TAG, TICK_TAG, SOURCE_TAG};
+const unsigned RING_ENTRIES = 256;
+const unsigned RING_BUFFER_COUNT = 128; //must be a power of two
+const unsigned RING_BUFFER_SIZE = 16384;
+const size_t RING_OUTPUT_LIMIT = 65536; //how much pipelined output we'll queue up before waiting on the client
+
+inline unsigned long long ringTag(int tag, int id, unsigned generation = 0)
+{
+    return ((unsigned long long)(generation & 0xffffff) << 40) | ((unsigned long long)(unsigned)id << 8) | tag;
+}
+
+/*
+* Returns false if this worker can't get a ring going, so it can use epoll instead. Otherwise this runs until stop()
+* is called, and then waits for the kernel to finish with every request before letting go of the sessions.
+*/
+bool EventLoop::runUringWorker(Worker* worker)
+{
+    Uring ring(RING_ENTRIES);
+    if (!ring.provideBuffers(RING_BUFFER_COUNT, RING_BUFFER_SIZE, 0)) return false;
+
+    worker->inFlight = 0;
+    worker->nextSessionId = 0;
+    worker->timers.advance(millisecondsNow(), nullptr); //nothing is on the wheel yet, this just brings its hand up to the clock
+    bool cancelled = false;
+
+    armAccept(worker, ring);
+    armTick(worker, ring);
+    armWake(worker, ring);
+    io_uring_sqe* request;
+
+    while (running || worker->inFlight > 0)
+    {
+        if (!running && !cancelled) //time to go. Hang up on everyone and call back everything we asked for.
+        {
+            cancelled = true;
+            for (auto& [id, session] : worker->sessions)
+            {
+                if (session.connection->getHandle() > -1) shutdown(session.connection->getHandle(), SHUT_RDWR);
+            }
+            request = prepareRequest(worker, ring, IORING_OP_ASYNC_CANCEL, CANCEL_TAG, 0);
+            request->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+        }
+
+        ring.submit(1);
+        io_uring_cqe* completion;
+        while ((completion = ring.peekCompletion()) != nullptr)
+        {
+            io_uring_cqe copy = *completion; //take a copy so the slot can go back to the kernel before we handle it
+            ring.completionSeen();
+            handleCompletion(worker, ring, copy);
+        }
+
+        if (running && drainRequested && !worker->draining) //the accept keeps going on its own, so it has to be called back
+        {
+            request = prepareRequest(worker, ring, IORING_OP_ASYNC_CANCEL, CANCEL_TAG, 0);
+            request->addr = ringTag(ACCEPT_TAG, 0);
+            startDraining(worker);
+            armTick(worker, ring, true); //the idle connections are due to close now, not when the tick was going to be
+        }
+        checkDrained(worker);
+    }
+
+    while (!worker->sessions.empty())
+    {
+        recycleConnection(worker, worker->sessions.begin()->second.connection);
+        worker->sessions.erase(worker->sessions.begin());
+    }
+    return true;
+}
+
+io_uring_sqe* EventLoop::prepareRequest(Worker* worker, Uring& ring, int opcode, int tag, int id)
+{
+    io_uring_sqe* request;
+    while ((request = ring.getRequest()) == nullptr) ring.submit(); //the ring is full, so send what's in it to make room
+    request->opcode = opcode;
+    request->user_data = ringTag(tag, id);
+    worker->inFlight++;
+    return request;
+}
+
+/*
+* A timeout that wakes us up to look at the timer wheel. A deadline set after it's handed to the kernel could come
+* before it, so it never sleeps longer than a quarter of the shortest timeout. When a lot of deadlines are brought
+* forward at once, like drain does, update moves the tick that's already waiting instead of adding another one.
+*/
+void EventLoop::armTick(Worker* worker, Uring& ring, bool update)
+{
+    int longest = clamp(min({limits.idleTimeout, limits.headerTimeout, limits.bodyTimeout, limits.writeTimeout}) / 4, 1, 1000);
+    int timeout = worker->timers.getTimeout(millisecondsNow());
+    int wait = timeout < 0 ? longest : clamp(timeout, 1, longest);
+    worker->tick = {wait / 1000, (wait % 1000) * 1000000LL};
+
+    if (update)
+    {
+        io_uring_sqe* request = prepareRequest(worker, ring, IORING_OP_TIMEOUT_REMOVE, CANCEL_TAG, 0);
+        request->addr = ringTag(TICK_TAG, 0);
+        request->addr2 = (unsigned long long)&worker->tick;
+        request->timeout_flags = IORING_TIMEOUT_UPDATE;
+        return;
+    }
+    io_uring_sqe* request = prepareRequest(worker, ring, IORING_OP_TIMEOUT, TICK_TAG, 0);
+    request->addr = (unsigned long long)&worker->tick;
+    request->len = 1;
+}
+
+//stop() and drain() poke the worker's eventfd to wake us up
+void EventLoop::armWake(Worker* worker, Uring& ring)
+{
+    io_uring_sqe* request = prepareRequest(worker, ring, IORING_OP_POLL_ADD, WAKE_TAG, 0);
+    request->fd = worker->wakeHandle;
+    request->poll32_events = POLLIN;
+}
+
+//One accept that keeps handing us new clients until it's cancelled.
+void EventLoop::armAccept(Worker* worker, Uring& ring)
+{
+    io_uring_sqe* request = prepareRequest(worker, ring, IORING_OP_ACCEPT, ACCEPT_TAG, 0);
+    request->fd = worker->listenHandle;
+    request->ioprio = IORING_ACCEPT_MULTISHOT;
+    request->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+}
+
+//One recv that keeps filling buffers from the ring until the client hangs up or it's cancelled.
+void EventLoop::armReceive(Worker* worker, Uring& ring, Session& session)
+{
+    io_uring_sqe* request = prepareRequest(worker, ring, IORING_OP_RECV, RECEIVE_TAG, session.id);
+    request->fd = session.connection->getHandle();
+    request->ioprio = IORING_RECV_MULTISHOT;
+    request->flags = IOSQE_BUFFER_SELECT;
+    request->buf_group = 0;
+    session.receiving = true;
+    session.inFlight++;
+}
+
+/*
+* A multishot request keeps the IORING_CQE_F_MORE flag on its completions for as long as it's still going. Once that
+* flag is missing, the kernel is done with the request.
+*/
+void EventLoop::handleCompletion(Worker* worker, Uring& ring, const io_uring_cqe& completion)
+{
+    int tag = completion.user_data & 0xff;
+    int id = (completion.user_data >> 8) & 0xffffffff;
+    bool more = completion.flags & IORING_CQE_F_MORE;
+    if (!more) worker->inFlight--;
+
+    if (tag == ACCEPT_TAG)
+    {
+        if (completion.res >= 0)
+        {
+            if (running) acceptRingConnection(worker, ring, completion.res);
+            else close(completion.res);
+        }
+        else if (worker->listener->getHandle() < 0) stop(); //someone closed the port on us, time to go home.
+        if (!more && running && !worker->draining) armAccept(worker, ring);
+        return;
+    }
+    if (tag == WAKE_TAG)
+    {
+        uint64_t poke;
+        read(worker->wakeHandle, &poke, sizeof(poke));
+        if (running) armWake(worker, ring); //that was drain(), stop() may still want us later
+        return;
+    }
+    if (tag == CANCEL_TAG && id == 0) return;
+    if (tag == TICK_TAG)
+    {
+        if (!running) return;
+        worker->timers.advance(millisecondsNow(), [this, worker, &ring](TimerWheel::Timer& timer)
+        {
+            if (&timer == &worker->drainDeadline) stop();
+            else expireRingSession(worker, ring, *(Session*)timer.owner);
+        });
+        armTick(worker, ring);
+        return;
+    }
+
+    if (completion.flags & IORING_CQE_F_BUFFER) //data landed in one of our buffers. Copy it out and lend the buffer back.
+    {
+        unsigned short buffer = completion.flags >> IORING_CQE_BUFFER_SHIFT;
+        auto found = worker->sessions.find(id);
+        if (completion.res > 0 && found != worker->sessions.end())
+        {
+            auto started = chrono::steady_clock::now();
+            found->second.connection->appendInput(ring.getBuffer(buffer), completion.res);
+            if (worker->shard != nullptr) worker->shard->recordPhase(Metrics::READ, nanosecondsSince(started));
+        }
+        ring.recycleBuffer(buffer);
+    }
+
+    auto found = worker->sessions.find(id);
+    if (found == worker->sessions.end()) return;
+    Session& session = found->second;
+    if (!more) session.inFlight--;
+
+    switch (tag)
+    {
+        case RECEIVE_TAG:
+            if (completion.res == 0 || (completion.res < 0 && completion.res != -ENOBUFS && !(completion.res == -ECANCELED && session.inputPaused)))
+            {
+                session.peerClosed = true;
+            }
+            if (!more)
+            {
+                session.receiving = false;
+                session.cancelQueued = false;
+                if (!session.peerClosed && !session.closing && !session.inputPaused && running) armReceive(worker, ring, session); //we ran out of buffers for a moment
+            }
+            break;
+        case SEND_TAG:
+            session.sending = false;
+            if (completion.res < 0) session.broken = true; //the client is gone
+            else session.connection->advanceOutput(completion.res);
+            if (worker->shard != nullptr) worker->shard->recordPhase(Metrics::WRITE, nanosecondsSince(session.sendStarted));
+            break;
+        case WRITABLE_TAG:
+            session.sending = false;
+            break;
+        case CLOSE_TAG:
+            if (completion.res == -ECANCELED) session.closeQueued = false; //the send before it came up short, so we'll close later
+            else session.connection->releaseHandle(); //the kernel closed it for us
+            break;
+        case SOURCE_TAG:
+            if ((completion.user_data >> 40) == (session.sourceGeneration & 0xffffff)) session.sourcePolled = false;
+            break;
+    }
+
+    serviceRingSession(worker, ring, session);
+}
+
+void EventLoop::acceptRingConnection(Worker* worker, Uring& ring, int handle)
+{
+    auto started = chrono::steady_clock::now();
+    Connection* connection;
+    if (worker->spares.empty()) connection = new Connection(handle);
+    else
+    {
+        connection = worker->spares.back();
+        worker->spares.pop_back();
+        connection->reset(handle);
+    }
+    connection->setLimits(limits);
+    connection->setDeferredSend(true); //responses get sent through the ring, not by sendData
+    if (worker->draining) connection->endKeepAlive(); //it got in just before the accept was called back
+
+    int id = ++worker->nextSessionId;
+    if (id <= 0) id = worker->nextSessionId = 1; //ids have to stay positive, 0 is for requests that aren't for a session
+    Session& session = worker->sessions[id];
+    session = Session();
+    session.connection = connection;
+    session.id = id;
+    session.timer.owner = &session;
+    armReceive(worker, ring, session);
+    armDeadline(worker, session);
+
+    if (worker->shard != nullptr)
+    {
+        worker->shard->countOpened();
+        worker->shard->recordPhase(Metrics::ACCEPT, nanosecondsSince(started));
+    }
+}
+
+/*
+* Answer whatever requests have come in, send the answers, and close the connection if we're done with it. This may
+* erase the session, so don't touch it afterwards.
+*/
+void EventLoop::serviceRingSession(Worker* worker, Uring& ring, Session& session)
+{
+    Connection* connection = session.connection;
+    if (!session.closing && !session.broken) handleRequests(worker, session, RING_OUTPUT_LIMIT);
+    if (!session.broken && session.peerClosed && connection->isReceivingBody()) connection->pumpBody(true);
+    if (!session.broken && connection->isStreaming()) //sends are queued here, so this stops once streamBuffer bytes are waiting
+    {
+        connection->pullChunks();
+        if (!connection->isStreaming() && !session.closing) handleRequests(worker, session, RING_OUTPUT_LIMIT);
+    }
+    pollSource(worker, ring, session);
+
+    /*
+    * The recv keeps going on its own, so to stop reading while the handler catches up we cancel it, and start a new
+    * one once there's room again.
+    */
+    bool canReceive = !session.closing && !session.broken && !session.peerClosed && running;
+    if (canReceive && session.receiving && !session.cancelQueued && !connection->wantsInput())
+    {
+        io_uring_sqe* request = prepareRequest(worker, ring, IORING_OP_ASYNC_CANCEL, CANCEL_TAG, session.id);
+        request->addr = ringTag(RECEIVE_TAG, session.id);
+        session.inputPaused = session.cancelQueued = true;
+        session.inFlight++;
+    }
+    else if (session.inputPaused && !session.receiving && connection->wantsInput())
+    {
+        session.inputPaused = false;
+        if (canReceive) armReceive(worker, ring, session);
+    }
+
+    if ((session.closing || session.broken) && session.receiving && !session.cancelQueued) //we won't be reading anything else
+    {
+        io_uring_sqe* request = prepareRequest(worker, ring, IORING_OP_ASYNC_CANCEL, CANCEL_TAG, session.id);
+        request->addr = ringTag(RECEIVE_TAG, session.id);
+        session.cancelQueued = true;
+        session.inFlight++;
+    }
+
+    sendRingOutput(worker, ring, session);
+    reportTraffic(worker, session);
+    if (session.broken) session.timer.cancel(); //all that's left is waiting on the kernel
+    else armDeadline(worker, session);
+    finishRingSession(worker, ring, session);
+}
+
+/*
+* Hand everything queued on the connection to the kernel in one sendmsg. If that's the last thing this connection is
+* ever going to send, the close is linked right behind it, so both happen in the same trip into the kernel. Files
+* can't go through the ring, so they go out with sendfile, and if the socket is full we ask the ring to tell us when
+* it has room.
+*/
+void EventLoop::sendRingOutput(Worker* worker, Uring& ring, Session& session)
+{
+    Connection* connection = session.connection;
+
+    while (!session.sending && !session.broken && connection->hasPendingOutput())
+    {
+        int count = connection->gatherOutput(session.parts, 16);
+        if (count == 0) //there's a file at the front
+        {
+            if (!connection->flushBuffer()) session.broken = true;
+            else if (connection->hasPendingOutput() && connection->gatherOutput(session.parts, 16) == 0)
+            {
+                io_uring_sqe* request = prepareRequest(worker, ring, IORING_OP_POLL_ADD, WRITABLE_TAG, session.id);
+                request->fd = connection->getHandle();
+                request->poll32_events = POLLOUT;
+                session.sending = true;
+                session.inFlight++;
+            }
+            continue;
+        }
+
+        size_t size = 0;
+        for (int i = 0; i < count; i++) size += session.parts[i].iov_len;
+        session.message = msghdr();
+        session.message.msg_iov = session.parts;
+        session.message.msg_iovlen = count;
+
+        io_uring_sqe* request = prepareRequest(worker, ring, IORING_OP_SENDMSG, SEND_TAG, session.id);
+        request->fd = connection->getHandle();
+        request->addr = (unsigned long long)&session.message;
+        request->msg_flags = MSG_NOSIGNAL;
+        session.sendStarted = chrono::steady_clock::now();
+        session.sending = true;
+        session.inFlight++;
+
+        bool last = (session.closing || session.peerClosed) && !connection->isStreaming() && size == connection->getPendingOutputSize();
+        if (last && !session.closeQueued)
+        {
+            request->msg_flags |= MSG_WAITALL; //without it a short send still counts as done, and the close would cut the rest off
+            request->flags |= IOSQE_IO_LINK; //the close only runs if the send went all the way through
+            request = prepareRequest(worker, ring, IORING_OP_CLOSE, CLOSE_TAG, session.id);
+            request->fd = connection->getHandle();
+            session.closeQueued = true;
+            session.inFlight++;
+        }
+    }
+}
+
+/*
+* The ring's version of watchSource. A poll only answers once, so a new one goes in every time the source waits, and
+* the one before it (which may be for a handle the source has since closed, and would then never answer) is called
+* back.
+*/
+void EventLoop::pollSource(Worker* worker, Uring& ring, Session& session)
+{
+    Connection* connection = session.connection;
+    bool waiting = connection->isWaiting() && !session.broken && running;
+    if (session.sourcePolled && (waiting || connection->getWaitHandle() < 0 || session.broken)) cancelSourcePoll(worker, ring, session);
+    if (!waiting) return;
+
+    session.sourceGeneration++;
+    io_uring_sqe* request = prepareRequest(worker, ring, IORING_OP_POLL_ADD, SOURCE_TAG, session.id);
+    request->user_data = ringTag(SOURCE_TAG, session.id, session.sourceGeneration);
+    request->fd = connection->getWaitHandle();
+    request->poll32_events = connection->isWaitingToWrite() ? POLLOUT : POLLIN | POLLRDHUP;
+    session.sourcePolled = true;
+    session.inFlight++;
+}
+
+void EventLoop::cancelSourcePoll(Worker* worker, Uring& ring, Session& session)
+{
+    io_uring_sqe* request = prepareRequest(worker, ring, IORING_OP_ASYNC_CANCEL, CANCEL_TAG, session.id);
+    request->addr = ringTag(SOURCE_TAG, session.id, session.sourceGeneration);
+    session.sourcePolled = false;
+    session.inFlight++;
+}
+
+/*
+* Once a session has nothing left to do, make sure its recv is cancelled and its socket is closed. When the kernel has
+* finished every request for it, the connection goes back on the spares list.
+*/
+void EventLoop::finishRingSession(Worker* worker, Uring& ring, Session& session)
+{
+    Connection* connection = session.connection;
+    bool done = session.broken || ((session.closing || session.peerClosed) && !connection->hasPendingOutput() && !connection->isStreaming());
+    if (!done) return;
+
+    session.closing = true;
+    if (session.receiving && !session.cancelQueued)
+    {
+        io_uring_sqe* request = prepareRequest(worker, ring, IORING_OP_ASYNC_CANCEL, CANCEL_TAG, session.id);
+        request->addr = ringTag(RECEIVE_TAG, session.id);
+        session.cancelQueued = true;
+        session.inFlight++;
+    }
+    if (session.sourcePolled) cancelSourcePoll(worker, ring, session);
+    if (!session.sending && !session.closeQueued && connection->getHandle() > -1)
+    {
+        io_uring_sqe* request = prepareRequest(worker, ring, IORING_OP_CLOSE, CLOSE_TAG, session.id);
+        request->fd = connection->getHandle();
+        session.closeQueued = true;
+        session.inFlight++;
+    }
+
+    if (session.inFlight == 0)
+    {
+        worker->sessions.erase(session.id);
+        recycleConnection(worker, connection);
+    }
+}
+
+/*
+* The ring's version of expireConnection. A send can sit in the kernel for as long as the client doesn't read, so
+* for a client that stopped taking what we send, the socket is shut down, which makes that send give up.
+*/
+void EventLoop::expireRingSession(Worker* worker, Uring& ring, Session& session)
+{
+    if (session.deadline == WRITE_DEADLINE)
+    {
+        if (session.connection->getHandle() > -1) shutdown(session.connection->getHandle(), SHUT_RDWR);
+        session.broken = true;
+    }
+    else timeOut(worker, session);
+    serviceRingSession(worker, ring, session);
+}
+#endif
+
+EventLoop::~EventLoop()
+{
+    for (Worker* worker : workers)
+    {
+        if (worker->thread.joinable()) worker->thread.join();
+        while (!worker->sessions.empty()) closeConnection(worker, worker->sessions.begin()->first);
+        for (Connection* spare : worker->spares) delete spare;
+        close(worker->epollHandle);
+        close(worker->wakeHandle);
+        delete worker;
+    }
+}
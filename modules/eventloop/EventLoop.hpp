@@ -0,0 +1,174 @@
+#ifndef StiltFox_UniversalLibrary_EventLoop
+#define StiltFox_UniversalLibrary_EventLoop
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Metrics.hpp"
+#include "Socket.hpp"
+#include "TimerWheel.hpp"
+#ifdef SF_IO_URING
+    #include <sys/socket.h>
+    #include "Uring.hpp"
+#endif
+
+/*
+* The event loop serves many connections from a handful of threads. Instead of parking one thread in a blocking
+* read per client, every worker asks the operating system (through epoll) which of its sockets are ready, and only
+* touches those. Handlers look exactly like the ones used with a thread per connection: they get a Connection,
+* call receiveData and sendData on it, and return. The loop owns the connection, so handlers must not delete it.
+*
+* Connections are kept open between requests (HTTP keep-alive), and a client may send several requests without
+* waiting for the answers (pipelining). The handler is called once per request and the answers go out in order.
+*
+* A handler can also stream its response: start it with startChunked, hand streamChunks a source and return. The loop
+* pulls more from the source whenever the client has taken what was sent, so a huge response never sits in memory.
+* Big request bodies work the same way in the other direction: the handler hands streamBody a sink and returns, the
+* loop feeds the sink as the body comes in, and stops reading from the client whenever the sink falls behind. A
+* response that comes from somewhere else, like another server, is handed to streamFrom, and the loop watches the
+* handle its source waits on alongside the client, so the worker serves everyone else in the meantime.
+*
+* There are two ways to listen. Given one socket, every worker accepts from it. Given a list of sockets all bound to
+* the same port (SO_REUSEPORT), each worker gets one of them to itself and the kernel deals new clients out between
+* them, so a flood of new connections is accepted on every core at once instead of queueing up behind one socket.
+* Workers can also be pinned to a core each, which keeps a worker's connections in that core's cache.
+*
+* The loop has two engines. EPOLL waits for sockets to be ready and then makes the accept, read and send calls itself.
+* IO_URING (when built with SFUseIoUring) asks the kernel to do the accepting, reading and sending, and only hears
+* back once they're done: one accept and one recv per connection keep going on their own, received bytes land in
+* buffers we lent the kernel, and the last response on a connection is linked to its close. Every one of those is
+* handed over in a single system call per trip around the loop. If the kernel can't do io_uring, setEngine says so
+* and the loop sticks with epoll.
+*
+* Given a Metrics (with setMetrics), each worker counts requests, responses, connections and bytes in a shard of its
+* own, and times every phase of a request. The Metrics needs a shard for every worker, or setMetrics returns false.
+*
+* Every connection has one deadline at a time, for whatever we're waiting on the client for: the next request, the
+* rest of a request's head, more of its body, or room to send. Each worker keeps its deadlines on a timer wheel, so
+* moving one on every request costs next to nothing, even with hundreds of thousands of connections. A client that
+* misses one is answered with a 408 or hung up on (see ConnectionLimits).
+*
+* drain winds the loop down gently instead of all at once, for when the listening sockets have been handed to a new
+* process (see the handover module): no new clients are taken, every connection is closed once it's done with the
+* request it's on, and run returns once they're all gone.
+*/
+class EventLoop
+{
+    public:
+    enum Engine {EPOLL, IO_URING};
+
+    private:
+    enum Deadline {IDLE_DEADLINE, HEAD_DEADLINE, BODY_DEADLINE, WRITE_DEADLINE};
+
+    struct Session
+    {
+        Connection* connection;
+        bool closing; //no more requests will be read, close once the output is flushed
+        bool peerClosed; //the client won't send anything else
+        bool inputPaused; //we've stopped reading until the handler catches up
+        TimerWheel::Timer timer; //goes off when the deadline passes. Its owner is the session.
+        Deadline deadline; //what the timer is for
+        uint64_t reportedIn; //how much of the connection's traffic has been added to the metrics already
+        uint64_t reportedOut;
+        int sourceHandle = -1; //the handle a streamFrom source is waiting on, as registered with epoll
+#ifdef SF_IO_URING
+        //only used by the io_uring engine
+        int id;
+        int inFlight; //requests the kernel is still working on for this session. We can't let go of it until they're done.
+        bool receiving;
+        bool sending;
+        bool cancelQueued; //we've asked the kernel to stop the recv
+        bool closeQueued;
+        bool broken;
+        bool sourcePolled; //a poll is in for the handle the source is waiting on
+        unsigned sourceGeneration; //counts those polls, so a completion for one that was called back can be told apart
+        msghdr message; //the send in flight reads from here, so it has to stay put until it's done
+        iovec parts[16];
+        std::chrono::steady_clock::time_point sendStarted;
+#endif
+    };
+
+    struct Worker
+    {
+        Socket* listener;
+        int listenHandle;
+        int core; //the core this worker is pinned to, if pinning is on
+        int epollHandle;
+        int wakeHandle;
+        std::thread thread;
+        std::unordered_map<int,Session> sessions;
+        std::vector<Connection*> spares; //closed connections kept around to be handed to the next clients
+        Metrics::Shard* shard; //where this worker counts things, or nullptr if nobody asked for metrics
+        TimerWheel timers; //every session's deadline
+        bool draining; //this worker has stopped taking new clients
+        bool drained; //and has let go of all of its old ones
+        TimerWheel::Timer drainDeadline; //when to give up waiting on them
+#ifdef SF_IO_URING
+        int nextSessionId;
+        int inFlight; //every request the ring is still working on, for all sessions
+        __kernel_timespec tick; //when to wake up next to look at the timers. The kernel reads it from here.
+#endif
+    };
+
+    static const size_t MAX_SPARES = 256; //per worker. Past this, closed connections are deleted.
+
+    std::function<void(Connection*)> handler;
+    int workerCount;
+    ConnectionLimits limits;
+    bool pinToCores;
+    Engine engine;
+    std::vector<Worker*> workers;
+    std::atomic<bool> running;
+    std::atomic<bool> drainRequested;
+    std::atomic<int> drainedWorkers;
+    int drainTimeout;
+    Metrics* metrics;
+
+    void createWorkers(const std::vector<Socket*>& listeners);
+
+    void runWorker(Worker* worker);
+    void acceptConnections(Worker* worker);
+    void serviceConnection(Worker* worker, Session& session, unsigned int events);
+    void handleRequests(Worker* worker, Session& session, size_t outputLimit = 0);
+    void streamResponse(Worker* worker, Session& session);
+    void watchSource(Worker* worker, Session& session);
+    void rearmConnection(Worker* worker, int handle);
+    void reportTraffic(Worker* worker, Session& session);
+    void armDeadline(Worker* worker, Session& session);
+    void timeOut(Worker* worker, Session& session);
+    void expireConnection(Worker* worker, Session& session);
+    void startDraining(Worker* worker);
+    void checkDrained(Worker* worker);
+    void closeConnection(Worker* worker, int handle);
+    void recycleConnection(Worker* worker, Connection* connection);
+#ifdef SF_IO_URING
+    bool runUringWorker(Worker* worker);
+    io_uring_sqe* prepareRequest(Worker* worker, Uring& ring, int opcode, int tag, int id);
+    void armTick(Worker* worker, Uring& ring, bool update = false);
+    void armWake(Worker* worker, Uring& ring);
+    void armAccept(Worker* worker, Uring& ring);
+    void armReceive(Worker* worker, Uring& ring, Session& session);
+    void handleCompletion(Worker* worker, Uring& ring, const io_uring_cqe& completion);
+    void acceptRingConnection(Worker* worker, Uring& ring, int handle);
+    void serviceRingSession(Worker* worker, Uring& ring, Session& session);
+    void sendRingOutput(Worker* worker, Uring& ring, Session& session);
+    void pollSource(Worker* worker, Uring& ring, Session& session);
+    void cancelSourcePoll(Worker* worker, Uring& ring, Session& session);
+    void finishRingSession(Worker* worker, Uring& ring, Session& session);
+    void expireRingSession(Worker* worker, Uring& ring, Session& session);
+#endif
+
+    public:
+    EventLoop(Socket* listener, std::function<void(Connection*)> handler, int workerCount = 0, ConnectionLimits limits = {}, bool pinToCores = false);
+    EventLoop(const std::vector<Socket*>& listeners, std::function<void(Connection*)> handler, ConnectionLimits limits = {}, bool pinToCores = false);
+    bool setEngine(Engine engine);
+    Engine getEngine();
+    bool setMetrics(Metrics* metrics);
+    void run();
+    void stop();
+    void drain(int timeout = 30000);
+    ~EventLoop();
+};
+#endif
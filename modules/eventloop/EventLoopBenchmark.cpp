@@ -0,0 +1,141 @@
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "EventLoop.hpp"
+
+/*
+* This compares the two event loop engines on loopback. For each engine it starts a server with a tiny handler and
+* times two kinds of traffic:
+*   keep-alive: every client keeps one connection open and sends its requests one after another on it.
+*   connect per request: every request gets a brand new connection, which is mostly accept and close.
+*
+* Usage: eventloopbenchmark [requests] [clients]
+* The clients run on the same machine as the server, so the numbers are only good for comparing the engines with
+* each other, not for saying how fast the server is.
+*/
+using namespace std;
+
+const char REQUEST[] = "GET /benchmark HTTP/1.1\r\nhost: localhost\r\n\r\n";
+const char CLOSING_REQUEST[] = "GET /benchmark HTTP/1.1\r\nhost: localhost\r\nconnection: close\r\n\r\n";
+const string RESPONSE = "HTTP/1.1 200 OK\r\ncontent-length: 2\r\n\r\nok";
+
+void answer(Connection* connection)
+{
+    connection->receiveView();
+    connection->sendData(HttpMessage(200, {}, "ok"));
+}
+
+int connectTo(int port)
+{
+    int handle = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    if (connect(handle, (sockaddr*)&address, sizeof(address)) < 0)
+    {
+        close(handle);
+        return -1;
+    }
+    return handle;
+}
+
+//read until size bytes have come in, or until the server hangs up if size is 0
+bool readResponse(int handle, size_t size)
+{
+    char buffer[4096];
+    size_t total = 0;
+    while (size == 0 || total < size)
+    {
+        int readBytes = read(handle, buffer, size == 0 ? sizeof(buffer) : min(sizeof(buffer), size - total));
+        if (readBytes <= 0) return size == 0 && readBytes == 0;
+        total += readBytes;
+    }
+    return true;
+}
+
+void keepAliveClient(int port, int requests, atomic<int>* failures)
+{
+    int handle = connectTo(port);
+    for (int i = 0; i < requests; i++)
+    {
+        if (handle < 0 || send(handle, REQUEST, sizeof(REQUEST) - 1, 0) < 0 || !readResponse(handle, RESPONSE.size()))
+        {
+            (*failures)++;
+            break;
+        }
+    }
+    if (handle > -1) close(handle);
+}
+
+void connectingClient(int port, int requests, atomic<int>* failures)
+{
+    for (int i = 0; i < requests; i++)
+    {
+        int handle = connectTo(port);
+        if (handle < 0 || send(handle, CLOSING_REQUEST, sizeof(CLOSING_REQUEST) - 1, 0) < 0 || !readResponse(handle, 0))
+        {
+            (*failures)++;
+        }
+        if (handle > -1) close(handle);
+    }
+}
+
+//run the clients against a fresh server using the given engine, and give back requests per second
+double measure(EventLoop::Engine engine, int port, bool keepAlive, int requests, int clients)
+{
+    Socket listener(port, SOMAXCONN);
+    listener.listenPort();
+    ConnectionLimits limits;
+    limits.maxRequests = requests; //don't let the server hang up on a keep-alive client part way through
+    EventLoop loop(&listener, answer, 0, limits);
+    loop.setEngine(engine);
+    thread server(&EventLoop::run, &loop);
+
+    atomic<int> failures = 0;
+    vector<thread> threads;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < clients; i++)
+    {
+        threads.emplace_back(keepAlive ? keepAliveClient : connectingClient, port, requests / clients, &failures);
+    }
+    for (thread& client : threads) client.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    loop.stop();
+    server.join();
+    if (failures > 0) printf("  (%d clients failed)\n", failures.load());
+    return (requests / clients) * clients / seconds;
+}
+
+int main(int argc, char const* argv[])
+{
+    int requests = argc > 1 ? atoi(argv[1]) : 100000;
+    int clients = argc > 2 ? atoi(argv[2]) : 32;
+    if (requests <= 0 || clients <= 0 || requests < clients) requests = clients = 1;
+
+    EventLoop probe(nullptr, answer, 1);
+    bool uringAvailable = probe.setEngine(EventLoop::IO_URING);
+    printf("%d requests from %d clients over loopback\n", requests, clients);
+    printf("%-10s %22s %22s\n", "engine", "keep-alive req/s", "connect/request req/s");
+
+    int port = 9300;
+    int connections = max(requests / 10, clients); //new connections are a lot slower, so we make fewer of them
+    printf("%-10s %22.0f %22.0f\n", "epoll", measure(EventLoop::EPOLL, port, true, requests, clients),
+           measure(EventLoop::EPOLL, port + 1, false, connections, clients));
+    if (uringAvailable)
+    {
+        printf("%-10s %22.0f %22.0f\n", "io_uring", measure(EventLoop::IO_URING, port + 2, true, requests, clients),
+               measure(EventLoop::IO_URING, port + 3, false, connections, clients));
+    }
+    else printf("io_uring is not available on this machine\n");
+    return 0;
+}
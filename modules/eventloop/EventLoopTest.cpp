@@ -0,0 +1,661 @@
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "EventLoop.hpp"
+
+/*
+* These tests talk to the event loop over a real loopback socket. This helper plays the part of the client: it
+* connects, writes the raw request, and reads until the server hangs up.
+*/
+int connectTo(int port)
+{
+    int handle = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    connect(handle, (sockaddr*)&address, sizeof(address));
+    return handle;
+}
+
+std::string readAll(int handle)
+{
+    std::string output;
+    char buffer[1024];
+    int readBytes;
+    while ((readBytes = read(handle, buffer, sizeof(buffer))) > 0) output.append(buffer, readBytes);
+    return output;
+}
+
+std::string exchange(int port, std::string request)
+{
+    int handle = connectTo(port);
+    send(handle, request.c_str(), request.size(), 0);
+    std::string output = readAll(handle);
+    close(handle);
+    return output;
+}
+
+void echoMethod(Connection* connection)
+{
+    HttpMessage request = connection->receiveData();
+    connection->sendData(HttpMessage(200, {}, request.getHttpMethodAsString()));
+}
+
+void echoUri(Connection* connection)
+{
+    HttpMessage request = connection->receiveData();
+    connection->sendData(HttpMessage(200, {}, request.requestUri));
+}
+
+//counts how many times the needle shows up in the haystack
+int countOf(const std::string& haystack, const std::string& needle)
+{
+    int output = 0;
+    for (size_t pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + 1)) output++;
+    return output;
+}
+
+/*
+* Streams /stream back as 160 chunks of 64KB, each one a single letter, with how many there were in a trailer.
+* Anything else gets its uri echoed back.
+*/
+void streamOrEchoUri(Connection* connection)
+{
+    const HttpRequestView& request = connection->receiveView();
+    if (request.requestUri != "/stream")
+    {
+        connection->sendData(HttpMessage(200, {}, std::string(request.requestUri)));
+        return;
+    }
+
+    connection->startChunked(HttpMessage(200, {{"content-type", "text/plain"}}));
+    auto sent = std::make_shared<int>(0);
+    connection->streamChunks([sent](Connection* connection)
+    {
+        connection->sendChunk(std::string(65536, 'a' + *sent % 26));
+        if (++*sent < 160) return true;
+        connection->finishChunked({{"x-chunks", std::to_string(*sent)}});
+        return false;
+    });
+}
+
+//the body and trailers of a chunked response, put back together. after is set to whatever follows the response.
+std::string unchunk(const std::string& response, std::string& trailers, std::string& after)
+{
+    std::string output;
+    size_t position = response.find("\r\n\r\n") + 4;
+    while (true)
+    {
+        size_t lineEnd = response.find("\r\n", position);
+        size_t size = std::stoul(response.substr(position, lineEnd - position), nullptr, 16);
+        position = lineEnd + 2;
+        if (size == 0) break;
+        output.append(response, position, size);
+        position += size + 2;
+    }
+    size_t end = response.find("\r\n\r\n", position - 2);
+    trailers = response.substr(position, end + 2 - position);
+    after = response.substr(end + 4);
+    return output;
+}
+
+std::string expectedStream()
+{
+    std::string output;
+    for (int i = 0; i < 160; i++) output += std::string(65536, 'a' + i % 26);
+    return output;
+}
+
+/*
+* Takes the body of /upload a piece at a time, checking each byte is the one uploadBody put there, and answers with how
+* many bytes came and the biggest piece it was handed. Anything else gets its uri echoed back.
+*/
+void countUploadOrEchoUri(Connection* connection)
+{
+    const HttpRequestView& request = connection->receiveView();
+    if (request.requestUri != "/upload")
+    {
+        connection->sendData(HttpMessage(200, {}, std::string(request.requestUri)));
+        return;
+    }
+
+    auto received = std::make_shared<size_t>(0);
+    auto biggest = std::make_shared<size_t>(0);
+    connection->streamBody([received, biggest](Connection* connection, std::string_view piece, HttpParser::Status status)
+    {
+        for (char byte : piece) if (byte != (char)('a' + (*received)++ % 26)) return false;
+        *biggest = std::max(*biggest, piece.size());
+        if (status == HttpParser::COMPLETE) connection->sendData(HttpMessage(200, {}, std::to_string(*received) + " " + std::to_string(*biggest)));
+        return true;
+    });
+}
+
+std::string uploadBody()
+{
+    std::string output(8 << 20, 0);
+    for (size_t i = 0; i < output.size(); i++) output[i] = 'a' + i % 26;
+    return output;
+}
+
+//The biggest piece the handler got. The handler's answer is "<bytes> <biggest piece>".
+size_t biggestPiece(const std::string& response)
+{
+    size_t space = response.rfind(' ');
+    return space == std::string::npos ? SIZE_MAX : std::stoul(response.substr(space + 1));
+}
+
+TEST(EventLoop, run_will_answer_a_request_using_the_connection_handler)
+{
+    //given we have an event loop listening on a port
+    Socket listener(9180, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, echoMethod, 1);
+    std::thread server(&EventLoop::run, &loop);
+
+    //when we send it a request
+    std::string actual = exchange(9180, "PUT /an_endpoint HTTP/1.1\r\nconnection: close\r\n\r\n");
+    loop.stop();
+    server.join();
+
+    //then the handler's response comes back with a length and the connection is closed
+    ASSERT_TRUE(actual.starts_with("HTTP/1.1 200 OK\r\n"));
+    ASSERT_NE(actual.find("content-length: 3\r\n"), std::string::npos);
+    ASSERT_TRUE(actual.ends_with("\r\n\r\nPUT"));
+}
+
+TEST(EventLoop, run_will_serve_more_connections_than_there_are_workers)
+{
+    //given we have an event loop with a single worker
+    Socket listener(9181, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, echoMethod, 1);
+    std::thread server(&EventLoop::run, &loop);
+
+    //when many clients are connected at the same time
+    std::vector<int> clients;
+    for (int i = 0; i < 50; i++) clients.push_back(connectTo(9181));
+    for (int client : clients) send(client, "GET / HTTP/1.0\r\n\r\n", 18, 0);
+    std::vector<std::string> actual;
+    for (int client : clients)
+    {
+        actual.push_back(readAll(client));
+        close(client);
+    }
+    loop.stop();
+    server.join();
+
+    //then every one of them gets an answer
+    for (const std::string& response : actual) ASSERT_TRUE(response.ends_with("\r\n\r\nGET"));
+}
+
+TEST(EventLoop, stop_will_make_run_return)
+{
+    //given we have a running event loop with a few workers
+    Socket listener(9182, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, echoMethod, 3);
+    std::thread server(&EventLoop::run, &loop);
+
+    //when we stop it
+    loop.stop();
+
+    //then the run call comes back (if it doesn't, this test hangs)
+    server.join();
+}
+
+TEST(EventLoop, run_will_answer_pipelined_requests_in_order_on_one_connection)
+{
+    //given we have an event loop that echoes the uri back
+    Socket listener(9183, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, echoUri, 1);
+    std::thread server(&EventLoop::run, &loop);
+
+    //when we send three requests at once on the same connection, closing after the last one
+    std::string actual = exchange(9183, "GET /first HTTP/1.1\r\n\r\nPOST /second HTTP/1.1\r\ncontent-length: 4\r\n\r\nbody"
+        "GET /third HTTP/1.1\r\nconnection: close\r\n\r\n");
+    loop.stop();
+    server.join();
+
+    //then we get three answers in the order we asked
+    ASSERT_EQ(countOf(actual, "HTTP/1.1 200 OK"), 3);
+    ASSERT_LT(actual.find("/first"), actual.find("/second"));
+    ASSERT_LT(actual.find("/second"), actual.find("/third"));
+    ASSERT_EQ(countOf(actual, "connection: close"), 1);
+}
+
+TEST(EventLoop, run_will_close_a_connection_after_the_maximum_number_of_requests)
+{
+    //given we have an event loop that only serves two requests per connection
+    Socket listener(9184, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, echoUri, 1, {5000, 2});
+    std::thread server(&EventLoop::run, &loop);
+
+    //when we send three requests on one connection
+    std::string actual = exchange(9184, "GET /1 HTTP/1.1\r\n\r\nGET /2 HTTP/1.1\r\n\r\nGET /3 HTTP/1.1\r\n\r\n");
+    loop.stop();
+    server.join();
+
+    //then only two are answered, and the second tells us the connection is closing
+    ASSERT_EQ(countOf(actual, "HTTP/1.1 200 OK"), 2);
+    ASSERT_EQ(countOf(actual, "connection: close"), 1);
+    ASSERT_EQ(actual.find("/3"), std::string::npos);
+}
+
+TEST(EventLoop, run_will_close_a_keep_alive_connection_that_sits_idle)
+{
+    //given we have an event loop with a short idle timeout
+    Socket listener(9185, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, echoUri, 1, {100, 1000});
+    std::thread server(&EventLoop::run, &loop);
+
+    //when we send a request and then say nothing more
+    auto start = std::chrono::steady_clock::now();
+    std::string actual = exchange(9185, "GET /quiet HTTP/1.1\r\n\r\n");
+    auto waited = std::chrono::steady_clock::now() - start;
+    loop.stop();
+    server.join();
+
+    //then we get our answer, and the server hangs up on us after the timeout
+    ASSERT_EQ(countOf(actual, "HTTP/1.1 200 OK"), 1);
+    ASSERT_GE(waited, std::chrono::milliseconds(100));
+}
+
+TEST(EventLoop, run_will_serve_clients_from_several_sockets_sharing_a_port)
+{
+    //given we have an event loop with a worker for each of three sockets on the same port, pinned to cores
+    Socket first(9186, 64), second(9186, 64), third(9186, 64);
+    bool listening = first.listenPort() && second.listenPort() && third.listenPort();
+    EventLoop loop(std::vector<Socket*>{&first, &second, &third}, echoMethod, {}, true);
+    std::thread server(&EventLoop::run, &loop);
+
+    //when many clients connect to the port
+    std::vector<int> clients;
+    for (int i = 0; i < 50; i++) clients.push_back(connectTo(9186));
+    for (int client : clients) send(client, "POST / HTTP/1.0\r\n\r\n", 19, 0);
+    std::vector<std::string> actual;
+    for (int client : clients)
+    {
+        actual.push_back(readAll(client));
+        close(client);
+    }
+    loop.stop();
+    server.join();
+
+    //then every socket got to listen and every client gets an answer, whichever socket the kernel gave it to
+    ASSERT_TRUE(listening);
+    for (const std::string& response : actual) ASSERT_TRUE(response.ends_with("\r\n\r\nPOST"));
+}
+
+TEST(EventLoop, setMetrics_will_count_requests_responses_and_bytes)
+{
+    //given we have an event loop that keeps metrics
+    Socket listener(9193, 64);
+    listener.listenPort();
+    Metrics metrics(1);
+    EventLoop loop(&listener, echoUri, 1);
+    ASSERT_TRUE(loop.setMetrics(&metrics));
+    std::thread server(&EventLoop::run, &loop);
+
+    //when we send it three requests on one connection
+    std::string request = "GET /first HTTP/1.1\r\n\r\nPOST /second HTTP/1.1\r\ncontent-length: 4\r\n\r\nbody"
+        "GET /third HTTP/1.1\r\nconnection: close\r\n\r\n";
+    std::string actual = exchange(9193, request);
+    loop.stop();
+    server.join();
+
+    //then every request, response and byte was counted, and every phase was timed
+    ASSERT_EQ(metrics.getRequestCount(HttpMessage::GET), 2);
+    ASSERT_EQ(metrics.getRequestCount(HttpMessage::POST), 1);
+    ASSERT_EQ(metrics.getResponseCount(200), 3);
+    ASSERT_EQ(metrics.getActiveConnections(), 0);
+    ASSERT_EQ(metrics.getBytesIn(), request.size());
+    ASSERT_EQ(metrics.getBytesOut(), actual.size());
+    ASSERT_EQ(metrics.getPhase(Metrics::ACCEPT).getCount(), 1);
+    ASSERT_GE(metrics.getPhase(Metrics::READ).getCount(), 1);
+    ASSERT_EQ(metrics.getPhase(Metrics::PARSE).getCount(), 3);
+    ASSERT_EQ(metrics.getPhase(Metrics::HANDLE).getCount(), 3);
+    ASSERT_GE(metrics.getPhase(Metrics::WRITE).getCount(), 1);
+}
+
+TEST(EventLoop, run_will_stream_a_chunked_response_and_answer_what_was_pipelined_behind_it)
+{
+    //given we have an event loop that streams 10MB back for /stream
+    Socket listener(9194, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, streamOrEchoUri, 1);
+    std::thread server(&EventLoop::run, &loop);
+
+    //when we ask for the stream, with another request right behind it on the same connection
+    std::string actual = exchange(9194, "GET /stream HTTP/1.1\r\n\r\nGET /after HTTP/1.1\r\nconnection: close\r\n\r\n");
+    loop.stop();
+    server.join();
+    std::string trailers, after;
+    std::string body = unchunk(actual, trailers, after);
+
+    //then the whole stream arrives in order with its trailer, and then the answer to the second request
+    ASSERT_NE(actual.find("transfer-encoding: chunked\r\n"), std::string::npos);
+    ASSERT_TRUE(body == expectedStream());
+    ASSERT_EQ(trailers, "x-chunks: 160\r\n");
+    ASSERT_TRUE(after.starts_with("HTTP/1.1 200 OK\r\n"));
+    ASSERT_TRUE(after.ends_with("\r\n\r\n/after"));
+}
+
+/*
+* Plays a slow client: sends the first part of a request, waits a bit, sends the second part, and then waits for
+* whatever the server says. waited is how long it was from the first byte until the server hung up.
+*/
+std::string sendSlowly(int port, const std::string& first, const std::string& second, std::chrono::milliseconds& waited)
+{
+    int handle = connectTo(port);
+    auto start = std::chrono::steady_clock::now();
+    send(handle, first.c_str(), first.size(), 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    send(handle, second.c_str(), second.size(), MSG_NOSIGNAL);
+    std::string output = readAll(handle);
+    waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    close(handle);
+    return output;
+}
+
+//Sends a request on a connection that stays open, and reads until the answer ends with what we expect.
+std::string ask(int handle, const std::string& request, const std::string& ending)
+{
+    send(handle, request.c_str(), request.size(), 0);
+    std::string output;
+    char buffer[1024];
+    int readBytes;
+    while (!output.ends_with(ending) && (readBytes = read(handle, buffer, sizeof(buffer))) > 0) output.append(buffer, readBytes);
+    return output;
+}
+
+TEST(EventLoop, run_will_stream_a_big_upload_to_the_handler_without_reading_far_ahead_of_it)
+{
+    //given we have an event loop that streams request bodies over 64KB
+    Socket listener(9196, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, countUploadOrEchoUri, 1, {.bodyBuffer = 65536});
+    std::thread server(&EventLoop::run, &loop);
+
+    //when we upload 8MB, with another request right behind it on the same connection
+    std::string actual = exchange(9196, "POST /upload HTTP/1.1\r\ncontent-length: 8388608\r\n\r\n" + uploadBody() +
+        "GET /after HTTP/1.1\r\nconnection: close\r\n\r\n");
+    loop.stop();
+    server.join();
+    size_t second = actual.find("HTTP/1.1 200 OK", 1);
+
+    //then every byte arrived in order, never much more than 64KB at a time, and the next request was answered after
+    ASSERT_NE(second, std::string::npos);
+    std::string first = actual.substr(0, second);
+    ASSERT_NE(first.find("\r\n\r\n8388608 "), std::string::npos);
+    ASSERT_LE(biggestPiece(first), 65536 + 16384);
+    ASSERT_TRUE(actual.ends_with("\r\n\r\n/after"));
+}
+
+TEST(EventLoop, run_will_answer_408_to_clients_that_take_too_long_with_a_head_or_a_body)
+{
+    //given we have an event loop that gives a request's head 300ms and its body 300ms between pieces
+    Socket listener(9198, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, echoUri, 1, {.headerTimeout = 300, .bodyTimeout = 300});
+    std::thread server(&EventLoop::run, &loop);
+
+    //when one client trickles its headers in, and another sends part of a body and then stops
+    std::chrono::milliseconds headWaited, bodyWaited;
+    std::string head = sendSlowly(9198, "GET /slow HTTP/1.1\r\nhost: a\r\n", "x-more: b\r\n", headWaited);
+    std::string body = sendSlowly(9198, "POST /slow HTTP/1.1\r\ncontent-length: 100\r\n\r\nabc", "def", bodyWaited);
+    loop.stop();
+    server.join();
+
+    //then both are told they took too long. The head's time runs from its first byte, the body's from its last piece.
+    ASSERT_TRUE(head.starts_with("HTTP/1.1 408 Request Timeout\r\n"));
+    ASSERT_NE(head.find("connection: close"), std::string::npos);
+    ASSERT_GE(headWaited, std::chrono::milliseconds(300));
+    ASSERT_LT(headWaited, std::chrono::milliseconds(480));
+    ASSERT_TRUE(body.starts_with("HTTP/1.1 408 Request Timeout\r\n"));
+    ASSERT_GE(bodyWaited, std::chrono::milliseconds(500));
+}
+
+TEST(EventLoop, drain_will_answer_requests_under_way_close_idle_connections_and_make_run_return)
+{
+    //given an event loop with one client sitting idle on a keep-alive connection, and another partway through a request
+    Socket listener(9207, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, echoUri, 1);
+    std::thread server(&EventLoop::run, &loop);
+    int idle = connectTo(9207);
+    std::string first = ask(idle, "GET /first HTTP/1.1\r\n\r\n", "/first");
+    int busy = connectTo(9207);
+    send(busy, "GET /late HTTP/1.1\r\n", 20, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    //when the loop is drained, and then the busy client finishes its request
+    auto start = std::chrono::steady_clock::now();
+    loop.drain(5000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    send(busy, "\r\n", 2, MSG_NOSIGNAL);
+    std::string idleRest = readAll(idle);
+    std::string late = readAll(busy);
+    server.join();
+    auto waited = std::chrono::steady_clock::now() - start;
+    close(idle);
+    close(busy);
+
+    //then the idle client is let go without a word, the busy one is answered and told it's the last, and run returns
+    ASSERT_TRUE(first.ends_with("\r\n\r\n/first"));
+    ASSERT_EQ(idleRest, "");
+    ASSERT_TRUE(late.starts_with("HTTP/1.1 200 OK\r\n"));
+    ASSERT_NE(late.find("connection: close\r\n"), std::string::npos);
+    ASSERT_TRUE(late.ends_with("\r\n\r\n/late"));
+    ASSERT_LT(waited, std::chrono::milliseconds(2000));
+}
+
+#ifdef SF_IO_URING
+TEST(EventLoop, run_will_serve_many_clients_with_the_io_uring_engine)
+{
+    //given we have an event loop using io_uring
+    Socket listener(9187, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, echoMethod, 2);
+    if (!loop.setEngine(EventLoop::IO_URING)) GTEST_SKIP() << "io_uring is not available here";
+    std::thread server(&EventLoop::run, &loop);
+
+    //when many clients are connected at the same time
+    std::vector<int> clients;
+    for (int i = 0; i < 50; i++) clients.push_back(connectTo(9187));
+    for (int client : clients) send(client, "DELETE / HTTP/1.0\r\n\r\n", 21, 0);
+    std::vector<std::string> actual;
+    for (int client : clients)
+    {
+        actual.push_back(readAll(client));
+        close(client);
+    }
+    loop.stop();
+    server.join();
+
+    //then every one of them gets an answer, and the server hangs up on each of them
+    for (const std::string& response : actual) ASSERT_TRUE(response.ends_with("\r\n\r\nDELETE"));
+}
+
+TEST(EventLoop, run_will_answer_pipelined_requests_in_order_with_the_io_uring_engine)
+{
+    //given we have an event loop using io_uring that echoes the uri back
+    Socket listener(9188, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, echoUri, 1);
+    if (!loop.setEngine(EventLoop::IO_URING)) GTEST_SKIP() << "io_uring is not available here";
+    std::thread server(&EventLoop::run, &loop);
+
+    //when we send three requests at once on the same connection, closing after the last one
+    std::string actual = exchange(9188, "GET /first HTTP/1.1\r\n\r\nPOST /second HTTP/1.1\r\ncontent-length: 4\r\n\r\nbody"
+        "GET /third HTTP/1.1\r\nconnection: close\r\n\r\n");
+    loop.stop();
+    server.join();
+
+    //then we get three answers in the order we asked
+    ASSERT_EQ(countOf(actual, "HTTP/1.1 200 OK"), 3);
+    ASSERT_LT(actual.find("/first"), actual.find("/second"));
+    ASSERT_LT(actual.find("/second"), actual.find("/third"));
+    ASSERT_EQ(countOf(actual, "connection: close"), 1);
+}
+
+TEST(EventLoop, run_will_send_large_files_and_close_idle_connections_with_the_io_uring_engine)
+{
+    //given we have an event loop using io_uring with a short idle timeout that answers with a large file
+    Socket listener(9189, 64);
+    listener.listenPort();
+    FILE* file = tmpfile();
+    std::string contents(8 << 20, 'u');
+    fwrite(contents.data(), 1, contents.size(), file);
+    fflush(file);
+    auto body = std::make_shared<FileBody>(dup(fileno(file)), contents.size());
+    fclose(file);
+    EventLoop loop(&listener, [body](Connection* connection)
+    {
+        connection->receiveView();
+        connection->sendFile(HttpMessage(200), body);
+    }, 1, {100, 1000});
+    if (!loop.setEngine(EventLoop::IO_URING)) GTEST_SKIP() << "io_uring is not available here";
+    std::thread server(&EventLoop::run, &loop);
+
+    //when we ask for it on a keep-alive connection, and then say nothing more
+    std::string actual = exchange(9189, "GET /big HTTP/1.1\r\n\r\n");
+    loop.stop();
+    server.join();
+
+    //then the whole file arrives and the server hangs up on us once we've gone quiet
+    ASSERT_TRUE(actual.starts_with("HTTP/1.1 200 OK\r\n"));
+    ASSERT_TRUE(actual.ends_with("\r\n\r\n" + contents));
+}
+
+TEST(EventLoop, run_will_send_all_of_a_large_response_before_closing_with_the_io_uring_engine)
+{
+    //given we have an event loop using io_uring that answers with 8MB
+    Socket listener(9204, 64);
+    listener.listenPort();
+    std::string contents(8 << 20, 'c');
+    EventLoop loop(&listener, [&contents](Connection* connection)
+    {
+        connection->receiveView();
+        connection->sendData(HttpMessage(200, {}, contents));
+    }, 1);
+    if (!loop.setEngine(EventLoop::IO_URING)) GTEST_SKIP() << "io_uring is not available here";
+    std::thread server(&EventLoop::run, &loop);
+
+    //when we ask for it on a connection that closes after the answer
+    std::string actual = exchange(9204, "GET /big HTTP/1.1\r\nconnection: close\r\n\r\n");
+    loop.stop();
+    server.join();
+
+    //then the whole body arrives before the server hangs up
+    ASSERT_TRUE(actual.starts_with("HTTP/1.1 200 OK\r\n"));
+    ASSERT_EQ(actual.size() - (actual.find("\r\n\r\n") + 4), contents.size());
+    ASSERT_TRUE(actual.ends_with("\r\n\r\n" + contents));
+}
+
+TEST(EventLoop, run_will_stream_a_chunked_response_with_the_io_uring_engine)
+{
+    //given we have an event loop using io_uring that streams 10MB back for /stream
+    Socket listener(9195, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, streamOrEchoUri, 1);
+    if (!loop.setEngine(EventLoop::IO_URING)) GTEST_SKIP() << "io_uring is not available here";
+    std::thread server(&EventLoop::run, &loop);
+
+    //when we ask for the stream, with another request right behind it on the same connection
+    std::string actual = exchange(9195, "GET /stream HTTP/1.1\r\n\r\nGET /after HTTP/1.1\r\nconnection: close\r\n\r\n");
+    loop.stop();
+    server.join();
+    std::string trailers, after;
+    std::string body = unchunk(actual, trailers, after);
+
+    //then it all arrives the same as it does with epoll
+    ASSERT_TRUE(body == expectedStream());
+    ASSERT_EQ(trailers, "x-chunks: 160\r\n");
+    ASSERT_TRUE(after.ends_with("\r\n\r\n/after"));
+}
+TEST(EventLoop, run_will_stream_a_big_upload_to_the_handler_with_the_io_uring_engine)
+{
+    //given we have an event loop using io_uring that streams request bodies over 64KB
+    Socket listener(9197, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, countUploadOrEchoUri, 1, {.bodyBuffer = 65536});
+    if (!loop.setEngine(EventLoop::IO_URING)) GTEST_SKIP() << "io_uring is not available here";
+    std::thread server(&EventLoop::run, &loop);
+
+    //when we upload 8MB, with another request right behind it on the same connection
+    std::string actual = exchange(9197, "POST /upload HTTP/1.1\r\ncontent-length: 8388608\r\n\r\n" + uploadBody() +
+        "GET /after HTTP/1.1\r\nconnection: close\r\n\r\n");
+    loop.stop();
+    server.join();
+    size_t second = actual.find("HTTP/1.1 200 OK", 1);
+
+    //then it all arrives the same as it does with epoll
+    ASSERT_NE(second, std::string::npos);
+    std::string first = actual.substr(0, second);
+    ASSERT_NE(first.find("\r\n\r\n8388608 "), std::string::npos);
+    ASSERT_LE(biggestPiece(first), 65536 + 16384);
+    ASSERT_TRUE(actual.ends_with("\r\n\r\n/after"));
+}
+
+TEST(EventLoop, run_will_answer_408_to_clients_that_take_too_long_with_a_head_with_the_io_uring_engine)
+{
+    //given we have an event loop using io_uring that gives a request's head 300ms
+    Socket listener(9199, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, echoUri, 1, {.headerTimeout = 300});
+    if (!loop.setEngine(EventLoop::IO_URING)) GTEST_SKIP() << "io_uring is not available here";
+    std::thread server(&EventLoop::run, &loop);
+
+    //when a client trickles its headers in
+    std::chrono::milliseconds waited;
+    std::string actual = sendSlowly(9199, "GET /slow HTTP/1.1\r\nhost: a\r\n", "x-more: b\r\n", waited);
+    loop.stop();
+    server.join();
+
+    //then it's told it took too long, the same as with epoll
+    ASSERT_TRUE(actual.starts_with("HTTP/1.1 408 Request Timeout\r\n"));
+    ASSERT_GE(waited, std::chrono::milliseconds(300));
+    ASSERT_LT(waited, std::chrono::milliseconds(1000));
+}
+
+TEST(EventLoop, drain_will_give_up_on_stragglers_after_the_timeout_with_the_io_uring_engine)
+{
+    //given an event loop using io_uring with one client idle on a keep-alive connection, and one that never finishes its request
+    Socket listener(9208, 64);
+    listener.listenPort();
+    EventLoop loop(&listener, echoUri, 1);
+    if (!loop.setEngine(EventLoop::IO_URING)) GTEST_SKIP() << "io_uring is not available here";
+    std::thread server(&EventLoop::run, &loop);
+    int idle = connectTo(9208);
+    std::string first = ask(idle, "GET /first HTTP/1.1\r\n\r\n", "/first");
+    int stuck = connectTo(9208);
+    send(stuck, "GET /never HTTP/1.1\r\n", 21, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    //when the loop is drained with a short timeout
+    auto start = std::chrono::steady_clock::now();
+    loop.drain(300);
+    std::string idleRest = readAll(idle);
+    auto idleWaited = std::chrono::steady_clock::now() - start;
+    server.join();
+    auto waited = std::chrono::steady_clock::now() - start;
+    close(idle);
+    close(stuck);
+
+    //then the idle client is let go right away, and run returns once the timeout is up, without waiting on the other
+    ASSERT_TRUE(first.ends_with("\r\n\r\n/first"));
+    ASSERT_EQ(idleRest, "");
+    ASSERT_LT(idleWaited, std::chrono::milliseconds(300));
+    ASSERT_GE(waited, std::chrono::milliseconds(300));
+    ASSERT_LT(waited, std::chrono::milliseconds(2000));
+}
+#endif
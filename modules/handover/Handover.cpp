@@ -0,0 +1,190 @@
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include "Handover.hpp"
+
+//Linux lets us ask send not to raise SIGPIPE if the other end is gone. Other systems don't have the flag.
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+#endif
+
+using namespace std;
+
+/*
+* The message that carries the handles. The handles themselves go in the control part, which is where the kernel
+* looks for SCM_RIGHTS. The buffer is lined up the way a cmsghdr needs it to be, since that's what gets read out of it.
+*/
+struct HandleMessage
+{
+    uint32_t count; //how many handles were sent, so the receiver can tell if some went missing
+    iovec part;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * Handover::MAX_HANDLES)];
+    msghdr message;
+
+    HandleMessage()
+    {
+        count = 0;
+        part = {&count, sizeof(count)};
+        memset(&control, 0, sizeof(control));
+        message = msghdr();
+        message.msg_iov = &part;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+    }
+};
+
+inline bool fillAddress(const string& path, sockaddr_un& address)
+{
+    address = sockaddr_un();
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+//give up on a read or a send that takes longer than timeout milliseconds
+inline void setTimeouts(int handle, int timeout)
+{
+    timeval wait = {timeout / 1000, (timeout % 1000) * 1000};
+    setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+    setsockopt(handle, SOL_SOCKET, SO_SNDTIMEO, &wait, sizeof(wait));
+}
+
+Handover::Handover(const string& socketPath)
+{
+    path = socketPath;
+    listenHandle = -1;
+    handedOver = false;
+    if (pipe(wakeHandles) < 0) wakeHandles[0] = wakeHandles[1] = -1;
+}
+
+/*
+* Start offering our sockets at the path. A file left there by a server that handed over to us, or by one that
+* crashed, is replaced. Nobody can connect until listen is called, so the file's permissions are fixed before that.
+* Returns false if the Unix socket couldn't be made.
+*/
+bool Handover::offer()
+{
+    sockaddr_un address;
+    if (listenHandle > -1) return true;
+    if (!fillAddress(path, address) || (listenHandle = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return false;
+
+    unlink(path.c_str());
+    bool output = bind(listenHandle, (sockaddr*)&address, sizeof(address)) >= 0 &&
+        chmod(path.c_str(), S_IRUSR | S_IWUSR) >= 0 && listen(listenHandle, 4) >= 0;
+    if (!output)
+    {
+        close(listenHandle);
+        listenHandle = -1;
+    }
+    return output;
+}
+
+/*
+* Wait for the next server to connect, and give it the handles. This blocks, so give it a thread of its own. Returns
+* true once the new server says it has them. One that connects and goes away before answering doesn't count, and we
+* go back to waiting. Returns false if we aren't offering, there's nothing to hand over, or withdraw was called.
+*/
+bool Handover::handOver(const vector<int>& handles)
+{
+    if (listenHandle < 0 || handles.empty() || handles.size() > MAX_HANDLES) return false;
+
+    while (true)
+    {
+        pollfd waiting[2] = {{listenHandle, POLLIN, 0}, {wakeHandles[0], POLLIN, 0}};
+        if (poll(waiting, 2, -1) < 0 && errno != EINTR) return false;
+        if (waiting[1].revents != 0) return false; //withdraw was called
+        if (!(waiting[0].revents & POLLIN)) continue;
+
+        int successor = accept(listenHandle, nullptr, nullptr);
+        if (successor < 0) continue;
+        setTimeouts(successor, 5000);
+
+        HandleMessage sending;
+        sending.count = handles.size();
+        sending.message.msg_controllen = CMSG_SPACE(sizeof(int) * handles.size());
+        cmsghdr* header = CMSG_FIRSTHDR(&sending.message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * handles.size());
+        memcpy(CMSG_DATA(header), handles.data(), sizeof(int) * handles.size());
+
+        char answer = 0;
+        bool taken = sendmsg(successor, &sending.message, MSG_NOSIGNAL) == sizeof(sending.count) &&
+            read(successor, &answer, 1) == 1 && answer == 'k';
+        close(successor);
+        if (taken)
+        {
+            handedOver = true;
+            return true;
+        }
+    }
+}
+
+//Stop offering. A handOver that is waiting gives up and returns false. This is safe to call from any thread.
+void Handover::withdraw()
+{
+    char poke = 1;
+    if (wakeHandles[1] > -1) write(wakeHandles[1], &poke, 1);
+}
+
+/*
+* This is the new server's side. Connect to the server offering at path and take its handles. They come back in the
+* order they were given to handOver. Returns nothing if no server is offering there, or it doesn't answer within
+* timeout milliseconds, so the caller can open sockets of its own instead.
+*/
+vector<int> Handover::takeOver(const string& path, int timeout)
+{
+    vector<int> output;
+    sockaddr_un address;
+    int handle;
+    if (!fillAddress(path, address) || (handle = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return output;
+    setTimeouts(handle, timeout);
+
+    HandleMessage receiving;
+    if (connect(handle, (sockaddr*)&address, sizeof(address)) == 0 &&
+        recvmsg(handle, &receiving.message, 0) == sizeof(receiving.count))
+    {
+        for (cmsghdr* header = CMSG_FIRSTHDR(&receiving.message); header != nullptr; header = CMSG_NXTHDR(&receiving.message, header))
+        {
+            if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) continue;
+            size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            size_t start = output.size();
+            output.resize(start + count);
+            memcpy(output.data() + start, CMSG_DATA(header), count * sizeof(int));
+        }
+
+        //If any went missing, or the old server can't hear that we have them, it keeps going and we start from scratch.
+        char answer = 'k';
+        bool whole = output.size() == receiving.count && !(receiving.message.msg_flags & MSG_CTRUNC);
+        if (!whole || write(handle, &answer, 1) != 1)
+        {
+            for (int received : output) close(received);
+            output.clear();
+        }
+    }
+
+    close(handle);
+    return output;
+}
+
+/*
+* Once we've handed over, the file at the path belongs to the new server (it offers its own sockets there), so it's
+* only removed if we didn't.
+*/
+Handover::~Handover()
+{
+    if (listenHandle > -1)
+    {
+        close(listenHandle);
+        if (!handedOver) unlink(path.c_str());
+    }
+    if (wakeHandles[0] > -1) close(wakeHandles[0]);
+    if (wakeHandles[1] > -1) close(wakeHandles[1]);
+}
@@ -0,0 +1,38 @@
+#ifndef StiltFox_UniversalLibrary_Handover
+#define StiltFox_UniversalLibrary_Handover
+#include <string>
+#include <vector>
+
+/*
+* Restarting a server normally means closing its listening sockets, and until the new one opens them again, clients
+* are turned away. A handover avoids that gap. The running server offers its listening sockets on a Unix socket (a
+* socket that is a file on disk rather than a port), and the new server, once it's started, connects to it and is
+* given the very same sockets. Nothing is closed or opened again: both servers are listening on them for a moment,
+* and clients that are waiting to be let in stay queued in the kernel until one of them takes them.
+*
+* Sockets are passed from one process to another with SCM_RIGHTS. The kernel gives the new process its own handles
+* to the same sockets, the same way fork would. The new process answers once it has them, and only then does the old
+* one stop taking new clients and finish up with the ones it has (see EventLoop::drain).
+*
+* The file is only readable and writable by the user that made it, since whoever can connect to it gets our ports.
+*/
+class Handover
+{
+    std::string path;
+    int listenHandle;
+    int wakeHandles[2]; //a pipe withdraw writes to, to wake up a handOver that is waiting
+    bool handedOver;
+
+    public:
+    static const int MAX_HANDLES = 64;
+
+    Handover(const std::string& path);
+    Handover(const Handover&) = delete;
+    Handover& operator=(const Handover&) = delete;
+    bool offer();
+    bool handOver(const std::vector<int>& handles);
+    void withdraw();
+    static std::vector<int> takeOver(const std::string& path, int timeout = 5000);
+    ~Handover();
+};
+#endif
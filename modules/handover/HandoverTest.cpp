@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <thread>
+#include "Handover.hpp"
+#include "Socket.hpp"
+
+using namespace std;
+
+//somewhere only this test run will be offering
+string handoverPath(const string& name)
+{
+    return "/tmp/handovertest-" + name + "-" + to_string(getpid());
+}
+
+TEST(Handover, takeOver_will_get_a_listening_socket_that_new_clients_can_reach)
+{
+    //given a server listening on a port and offering its socket
+    Socket listener(9206, 16);
+    listener.listenPort();
+    Handover handover(handoverPath("take"));
+    bool offered = handover.offer();
+    bool handedOver = false;
+    thread oldServer([&]() { handedOver = handover.handOver({listener.getHandle()}); });
+
+    //when a new server takes it over, and a client connects to the port
+    vector<int> taken = Handover::takeOver(handoverPath("take"));
+    oldServer.join();
+    ASSERT_EQ(taken.size(), 1);
+    Socket adopted(ExistingSocket{taken[0]});
+    Socket client("127.0.0.1", 9206);
+    int clientHandle = client.connectHandle();
+    int accepted = adopted.acceptHandle();
+
+    //then the new server has its own handle to the same socket, which is still listening, and lets the client in
+    ASSERT_TRUE(offered);
+    ASSERT_TRUE(handedOver);
+    ASSERT_NE(taken[0], listener.getHandle());
+    ASSERT_TRUE(adopted.listenPort());
+    ASSERT_GE(clientHandle, 0);
+    ASSERT_GE(accepted, 0);
+    close(clientHandle);
+    close(accepted);
+}
+
+TEST(Handover, takeOver_will_come_back_empty_when_nobody_is_offering)
+{
+    //given nobody offering at a path
+    //when we try to take over from it
+    vector<int> taken = Handover::takeOver(handoverPath("nobody"), 200);
+
+    //then there's nothing, and we'd open sockets of our own
+    ASSERT_TRUE(taken.empty());
+}
+
+TEST(Handover, withdraw_will_stop_a_waiting_handOver_and_remove_the_file)
+{
+    //given a server offering its socket
+    Socket listener(9209, 16);
+    listener.listenPort();
+    string path = handoverPath("withdraw");
+    bool handedOver = true;
+    {
+        Handover handover(path);
+        handover.offer();
+        thread oldServer([&]() { handedOver = handover.handOver({listener.getHandle()}); });
+
+        //when it changes its mind before anyone takes over
+        this_thread::sleep_for(chrono::milliseconds(50));
+        handover.withdraw();
+        oldServer.join();
+    }
+
+    //then nothing was handed over, and the file is gone once the handover is
+    ASSERT_FALSE(handedOver);
+    ASSERT_NE(access(path.c_str(), F_OK), 0);
+}
@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include "Histogram.hpp"
+
+using namespace std;
+
+/*
+* Each bucket needs at least 2 x 10^digits slots to keep that many significant digits, rounded up to a power of two
+* so a value's slot can be found with shifts instead of division. We remember half of that, because the bottom half
+* of every bucket after the first is the same range as the top half of the bucket before it, so it's skipped.
+*/
+Histogram::Histogram(uint64_t highest, int significantDigits)
+{
+    significantDigits = clamp(significantDigits, 1, 5);
+    uint64_t largestExact = 2 * (uint64_t)pow(10, significantDigits);
+    subBucketHalfCountMagnitude = (int)bit_width(largestExact - 1) - 1;
+    subBucketHalfCount = (uint64_t)1 << subBucketHalfCountMagnitude;
+    subBucketMask = subBucketHalfCount * 2 - 1;
+    highestValue = max(highest, subBucketMask);
+    counts.resize(getCountsIndex(highestValue) + 1);
+    reset();
+}
+
+//Buckets double in width. Values that fit in the first bucket's slots as they are all land in bucket 0.
+int Histogram::getBucketIndex(uint64_t value) const
+{
+    return (int)bit_width(value | subBucketMask) - subBucketHalfCountMagnitude - 1;
+}
+
+size_t Histogram::getCountsIndex(uint64_t value) const
+{
+    int bucket = getBucketIndex(value);
+    uint64_t subBucket = value >> bucket;
+    return ((size_t)(bucket + 1) << subBucketHalfCountMagnitude) + (subBucket - subBucketHalfCount);
+}
+
+//The smallest value that lands in this slot.
+uint64_t Histogram::getValueFromIndex(size_t index) const
+{
+    int bucket = (int)(index >> subBucketHalfCountMagnitude) - 1;
+    uint64_t subBucket = (index & (subBucketHalfCount - 1)) + subBucketHalfCount;
+    if (bucket < 0)
+    {
+        subBucket -= subBucketHalfCount;
+        bucket = 0;
+    }
+    return subBucket << bucket;
+}
+
+//The largest value that lands in this slot. Percentiles report this one, so they never read better than the truth.
+uint64_t Histogram::getHighestEquivalentValue(size_t index) const
+{
+    uint64_t value = getValueFromIndex(index);
+    return value + ((uint64_t)1 << getBucketIndex(value)) - 1;
+}
+
+//Values above the highest value we were built for are counted as the highest value.
+void Histogram::record(uint64_t value, uint64_t count)
+{
+    if (count == 0) return;
+    value = min(value, highestValue);
+    counts[getCountsIndex(value)] += count;
+    totalCount += count;
+    minimum = min(minimum, value);
+    maximum = max(maximum, value);
+    total += (long double)value * count;
+}
+
+//Add every value the other histogram has seen to this one. Both need to have been built the same way.
+void Histogram::add(const Histogram& other)
+{
+    if (other.counts.size() != counts.size() || other.subBucketHalfCount != subBucketHalfCount) return;
+
+    for (size_t i = 0; i < counts.size(); i++) counts[i] += other.counts[i];
+    totalCount += other.totalCount;
+    minimum = min(minimum, other.minimum);
+    maximum = max(maximum, other.maximum);
+    total += other.total;
+}
+
+void Histogram::reset()
+{
+    fill(counts.begin(), counts.end(), 0);
+    totalCount = 0;
+    minimum = UINT64_MAX;
+    maximum = 0;
+    total = 0;
+}
+
+uint64_t Histogram::getCount() const
+{
+    return totalCount;
+}
+
+uint64_t Histogram::getMin() const
+{
+    return totalCount == 0 ? 0 : minimum;
+}
+
+uint64_t Histogram::getMax() const
+{
+    return maximum;
+}
+
+double Histogram::getMean() const
+{
+    return totalCount == 0 ? 0 : (double)(total / totalCount);
+}
+
+/*
+* Walk the slots from the smallest up, until we've passed the given percent of everything recorded. The answer is
+* the top of the slot we stopped in, capped at the largest value we actually saw.
+*/
+uint64_t Histogram::getValueAtPercentile(double percentile) const
+{
+    if (totalCount == 0) return 0;
+
+    //99.9 can't be stored exactly as a double, so 99.9% of 1000 comes out a hair over 999. The tiny nudge down
+    //keeps that from rounding up to 1000.
+    percentile = clamp(percentile, 0.0, 100.0);
+    uint64_t wanted = max((uint64_t)ceil(percentile / 100 * totalCount - 1e-6), (uint64_t)1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        seen += counts[i];
+        if (seen >= wanted) return min(getHighestEquivalentValue(i), maximum);
+    }
+    return maximum;
+}
+
+//The usual numbers on one line each, ready to print.
+string Histogram::printSummary(const string& unit) const
+{
+    char line[128];
+    string output;
+    snprintf(line, sizeof(line), "  min   %12llu%s\n", (unsigned long long)getMin(), unit.c_str());
+    output += line;
+    snprintf(line, sizeof(line), "  mean  %12.1f%s\n", getMean(), unit.c_str());
+    output += line;
+    for (auto [name, percentile] : {pair{"p50", 50.0}, pair{"p90", 90.0}, pair{"p99", 99.0}, pair{"p999", 99.9}})
+    {
+        snprintf(line, sizeof(line), "  %-5s %12llu%s\n", name, (unsigned long long)getValueAtPercentile(percentile), unit.c_str());
+        output += line;
+    }
+    snprintf(line, sizeof(line), "  max   %12llu%s\n", (unsigned long long)getMax(), unit.c_str());
+    return output + line;
+}
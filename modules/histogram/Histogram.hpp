@@ -0,0 +1,52 @@
+#ifndef StiltFox_UniversalLibrary_Histogram
+#define StiltFox_UniversalLibrary_Histogram
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+* A histogram counts how many times each value was seen, so afterwards we can ask things like "what was the slowest
+* 1% of requests". Averages hide exactly the requests people complain about, which is why latency is reported as
+* percentiles: p50 is the typical request, p99 is one in a hundred, and p999 is one in a thousand.
+*
+* Keeping a counter for every possible value would take far too much memory, so this works like HdrHistogram:
+* values are grouped into buckets that double in width, and each bucket is split into the same number of slots.
+* Small values land in narrow slots and big values in wide ones, so every value is kept to the same number of
+* significant digits. With 3 digits, 1234 is told apart from 1235 and 1234000 is told apart from 1235000, and the
+* whole thing is a fixed size no matter how many values are recorded.
+*
+* The histogram doesn't care what the values mean. The load generator records microseconds.
+*
+* A histogram belongs to one thread. To combine the results of several threads, give each its own and add them up
+* afterwards with add().
+*/
+class Histogram
+{
+    uint64_t highestValue;
+    int subBucketHalfCountMagnitude; //slots in the top half of a bucket, as a power of two
+    uint64_t subBucketHalfCount;
+    uint64_t subBucketMask;
+    std::vector<uint64_t> counts;
+    uint64_t totalCount;
+    uint64_t minimum;
+    uint64_t maximum;
+    long double total; //for the mean. Kept as a long double so a few billion big values can't overflow it.
+
+    int getBucketIndex(uint64_t value) const;
+    size_t getCountsIndex(uint64_t value) const;
+    uint64_t getValueFromIndex(size_t index) const;
+    uint64_t getHighestEquivalentValue(size_t index) const;
+
+    public:
+    Histogram(uint64_t highestValue = 3600000000, int significantDigits = 3);
+    void record(uint64_t value, uint64_t count = 1);
+    void add(const Histogram& other);
+    void reset();
+    uint64_t getCount() const;
+    uint64_t getMin() const;
+    uint64_t getMax() const;
+    double getMean() const;
+    uint64_t getValueAtPercentile(double percentile) const;
+    std::string printSummary(const std::string& unit = "") const;
+};
+#endif
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include "Histogram.hpp"
+
+TEST(Histogram, getValueAtPercentile_will_give_back_small_values_exactly)
+{
+    //given we have recorded the numbers 1 to 1000
+    Histogram histogram;
+    for (int i = 1; i <= 1000; i++) histogram.record(i);
+
+    //when we ask for some percentiles
+    //then small values fit in a slot of their own, so the answers are exact
+    ASSERT_EQ(histogram.getCount(), 1000);
+    ASSERT_EQ(histogram.getValueAtPercentile(50), 500);
+    ASSERT_EQ(histogram.getValueAtPercentile(99), 990);
+    ASSERT_EQ(histogram.getValueAtPercentile(99.9), 999);
+    ASSERT_EQ(histogram.getValueAtPercentile(100), 1000);
+    ASSERT_EQ(histogram.getMin(), 1);
+    ASSERT_EQ(histogram.getMax(), 1000);
+    ASSERT_DOUBLE_EQ(histogram.getMean(), 500.5);
+}
+
+TEST(Histogram, getValueAtPercentile_will_keep_three_significant_digits_for_big_values)
+{
+    //given we have recorded mostly fast values and a few very slow ones
+    Histogram histogram;
+    histogram.record(1000, 990);
+    histogram.record(123456789, 10);
+
+    //when we ask for the typical and the slow end
+    uint64_t typical = histogram.getValueAtPercentile(50);
+    uint64_t slow = histogram.getValueAtPercentile(99.5);
+
+    //then each is within a thousandth of what was recorded, and never less than it
+    ASSERT_EQ(typical, 1000);
+    ASSERT_GE(slow, 123456789);
+    ASSERT_LE(slow, 123456789 + 123456789 / 1000);
+}
+
+TEST(Histogram, record_will_count_values_that_are_too_big_as_the_highest_value)
+{
+    //given we have a histogram that goes up to 10000
+    Histogram histogram(10000);
+
+    //when we record something bigger
+    histogram.record(5000000);
+
+    //then it's kept as the highest value
+    ASSERT_EQ(histogram.getMax(), 10000);
+    ASSERT_EQ(histogram.getValueAtPercentile(100), 10000);
+}
+
+TEST(Histogram, add_will_combine_what_two_histograms_have_seen)
+{
+    //given we have two histograms with different values in them
+    Histogram first, second;
+    for (int i = 0; i < 100; i++) first.record(10);
+    for (int i = 0; i < 100; i++) second.record(20000);
+
+    //when we add the second to the first
+    first.add(second);
+
+    //then the first has all the values
+    ASSERT_EQ(first.getCount(), 200);
+    ASSERT_EQ(first.getMin(), 10);
+    ASSERT_EQ(first.getMax(), 20000);
+    ASSERT_EQ(first.getValueAtPercentile(50), 10);
+    ASSERT_GE(first.getValueAtPercentile(51), 20000);
+}
+
+TEST(Histogram, getValueAtPercentile_will_be_zero_when_nothing_was_recorded)
+{
+    //given we have an empty histogram
+    Histogram histogram;
+
+    //when we ask about it
+    //then everything is zero
+    ASSERT_EQ(histogram.getValueAtPercentile(99), 0);
+    ASSERT_EQ(histogram.getMin(), 0);
+    ASSERT_EQ(histogram.getMean(), 0);
+}
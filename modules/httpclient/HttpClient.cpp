@@ -0,0 +1,415 @@
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iterator>
+#include "HttpClient.hpp"
+
+using namespace std;
+
+const int MAX_EVENTS = 64;
+
+inline uint64_t millisecondsNow()
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//These don't change anything on the server, so they're the only ones sent down a connection that's already busy.
+inline bool isSafe(HttpMessage::Method method)
+{
+    return method == HttpMessage::GET || method == HttpMessage::HEAD;
+}
+
+inline void fail(HttpClient::ResponseHandler& handler)
+{
+    HttpMessage nothing(0);
+    handler(false, nothing);
+}
+
+//The server's address is looked up once, when the first request for it comes in.
+HttpClient::Pool::Pool(const string& host, int port) : target(host, port) {}
+
+HttpClient::HttpClient(ClientOptions clientOptions) : timers(10, millisecondsNow())
+{
+    options = clientOptions;
+    options.connectionsPerHost = max(options.connectionsPerHost, 1);
+    options.pipelineDepth = max(options.pipelineDepth, 1);
+
+    poller = epoll_create1(0);
+    wakeHandle = eventfd(0, EFD_NONBLOCK);
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr; //every other handle we watch is a Link, so nullptr means it's the wake handle
+    epoll_ctl(poller, EPOLL_CTL_ADD, wakeHandle, &event);
+
+    running = poller > -1 && wakeHandle > -1;
+    if (running) runner = thread(&HttpClient::run, this);
+}
+
+/*
+* Send a request to the server at host and port, and call handler with its response once it's in. This returns right
+* away. A host header is added if the request doesn't have one, and so is a content-length if it has a body.
+*/
+void HttpClient::sendAsync(const string& host, int port, const HttpMessage& request, ResponseHandler handler)
+{
+    string printed = request.printAsRequest();
+    string added;
+    bool hasBody = !request.body.empty() || request.httpMethod == HttpMessage::POST || request.httpMethod == HttpMessage::PUT ||
+        request.httpMethod == HttpMessage::PATCH;
+    if (!request.hasHeader("host")) added.append("host: ").append(host).append(port == 80 ? "" : ":" + to_string(port)).append("\r\n");
+    if (hasBody && !request.hasHeader("content-length") && !request.hasHeader("transfer-encoding"))
+    {
+        added.append("content-length: ").append(to_string(request.body.size())).append("\r\n");
+    }
+    printed.insert(printed.find("\r\n") + 2, added); //right after the request line
+
+    Exchange exchange{request.httpMethod, std::move(printed), std::move(handler)};
+    {
+        lock_guard<mutex> lock(submissionLock);
+        if (running)
+        {
+            submissions.push_back({host, port, std::move(exchange)});
+            uint64_t poke = 1;
+            write(wakeHandle, &poke, sizeof(poke));
+            return;
+        }
+    }
+    fail(exchange.handler); //the client is shutting down, or never got started
+}
+
+/*
+* Send a request and wait for the response. Returns false if none came back, because the server couldn't be reached,
+* hung up, sent something that isn't HTTP, or took longer than the timeout.
+*/
+bool HttpClient::send(const string& host, int port, const HttpMessage& request, HttpMessage& response)
+{
+    promise<bool> answered;
+    future<bool> done = answered.get_future();
+    sendAsync(host, port, request, [&answered, &response](bool received, HttpMessage& answer)
+    {
+        if (received) response = std::move(answer);
+        answered.set_value(received);
+    });
+    return done.get();
+}
+
+/*
+* The client's thread. It sleeps in epoll until a connection has something for it, a request is handed over, or a
+* deadline on the timer wheel comes up.
+*/
+void HttpClient::run()
+{
+    epoll_event events[MAX_EVENTS];
+    while (running)
+    {
+        int count = epoll_wait(poller, events, MAX_EVENTS, timers.getTimeout(millisecondsNow()));
+        for (int i = 0; i < count; i++)
+        {
+            if (events[i].data.ptr == nullptr) takeSubmissions();
+            else handleEvent((Link*)events[i].data.ptr, events[i].events);
+        }
+
+        timers.advance(millisecondsNow(), [this](TimerWheel::Timer& timer)
+        {
+            Link* link = (Link*)timer.owner;
+            if (link->inFlight.empty()) closeLink(link); //a spare nobody has needed in a while
+            else breakLink(link, true);
+        });
+
+        for (Link* link : retired) delete link;
+        retired.clear();
+    }
+    failAll();
+}
+
+void HttpClient::takeSubmissions()
+{
+    uint64_t poke;
+    read(wakeHandle, &poke, sizeof(poke)); //empty it, or epoll would keep telling us about it
+    vector<Submission> taken;
+    {
+        lock_guard<mutex> lock(submissionLock);
+        taken.swap(submissions);
+    }
+
+    for (Submission& submission : taken)
+    {
+        Pool*& pool = pools[submission.host + ":" + to_string(submission.port)];
+        if (pool == nullptr) pool = new Pool(submission.host, submission.port);
+        pool->waiting.push_back(std::move(submission.exchange));
+        dispatch(*pool);
+    }
+}
+
+/*
+* Give the requests waiting in the pool to connections that can take them. An idle connection is best, then a new one
+* if the pool has room for it, and only then a busy one, if pipelining is on. Whatever is left waits for a response
+* to free something up.
+*/
+void HttpClient::dispatch(Pool& pool)
+{
+    while (!pool.waiting.empty())
+    {
+        HttpMessage::Method method = pool.waiting.front().method;
+        Link* link = findLink(pool, method, false);
+        if (link == nullptr && pool.links.size() < (size_t)options.connectionsPerHost && (link = connectLink(pool)) == nullptr)
+        {
+            Exchange lost = std::move(pool.waiting.front()); //we can't even start a connection, the address must be bad
+            pool.waiting.pop_front();
+            fail(lost.handler);
+            continue;
+        }
+        if (link == nullptr) link = findLink(pool, method, true);
+        if (link == nullptr) return;
+
+        link->inFlight.push_back(std::move(pool.waiting.front()));
+        pool.waiting.pop_front();
+        link->outbound += link->inFlight.back().request;
+        armDeadline(link);
+        if (link->connected && !flush(link)) breakLink(link, false);
+    }
+}
+
+HttpClient::Link* HttpClient::findLink(Pool& pool, HttpMessage::Method method, bool pipelining)
+{
+    Link* output = nullptr;
+    for (Link* link : pool.links)
+    {
+        if (link->closing) continue;
+        if (link->inFlight.empty()) return link;
+
+        bool fits = pipelining && isSafe(method) && link->inFlight.size() < (size_t)options.pipelineDepth &&
+            all_of(link->inFlight.begin(), link->inFlight.end(), [](const Exchange& waiting) { return isSafe(waiting.method); });
+        if (fits && (output == nullptr || link->inFlight.size() < output->inFlight.size())) output = link;
+    }
+    return output;
+}
+
+/*
+* Start a new connection to the pool's server. It doesn't wait for the connection to be made: requests given to it
+* wait in outbound, and go out once epoll says it's writable.
+*/
+HttpClient::Link* HttpClient::connectLink(Pool& pool)
+{
+    int handle = pool.target.connectHandle(false);
+    if (handle < 0) return nullptr;
+
+    Link* link = new Link();
+    link->handle = handle;
+    link->pool = &pool;
+    link->timer.owner = link;
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = link;
+    epoll_ctl(poller, EPOLL_CTL_ADD, handle, &event);
+    pool.links.push_back(link);
+    return link;
+}
+
+void HttpClient::handleEvent(Link* link, uint32_t events)
+{
+    if (link->handle < 0) return; //it was closed earlier in this round
+
+    if (!link->connected)
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(link->handle, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0 || (events & EPOLLERR))
+        {
+            breakLink(link, false); //nobody is listening there
+            return;
+        }
+        link->connected = true;
+    }
+
+    if ((events & EPOLLOUT) && !flush(link))
+    {
+        breakLink(link, false);
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) readResponses(link);
+}
+
+//Send as much of outbound as the socket will take. Returns false if the connection is broken.
+bool HttpClient::flush(Link* link)
+{
+    while (link->sent < link->outbound.size())
+    {
+        ssize_t written = ::send(link->handle, link->outbound.data() + link->sent, link->outbound.size() - link->sent, MSG_NOSIGNAL);
+        if (written < 0) return errno == EAGAIN || errno == EWOULDBLOCK; //the rest goes once epoll says there's room
+        link->sent += written;
+        armDeadline(link);
+    }
+    link->outbound.clear();
+    link->sent = 0;
+    return true;
+}
+
+void HttpClient::readResponses(Link* link)
+{
+    char buffer[65536];
+    while (true)
+    {
+        ssize_t readBytes = recv(link->handle, buffer, sizeof(buffer), 0);
+        if (readBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (readBytes < 0 && errno == EINTR) continue;
+        if (readBytes < 0)
+        {
+            breakLink(link, false);
+            return;
+        }
+
+        if (readBytes > 0)
+        {
+            link->inbound.append(buffer, readBytes);
+            armDeadline(link);
+        }
+        if (!deliverResponses(link, readBytes == 0)) return;
+    }
+}
+
+/*
+* Hand every whole response in inbound to the request it answers. ended means the server hung up, which finishes a
+* body that runs until it does. Returns false once the link is closed.
+*/
+bool HttpClient::deliverResponses(Link* link, bool ended)
+{
+    while (!link->inFlight.empty() && !link->closing)
+    {
+        link->parser.expectResponseTo(link->inFlight.front().method);
+        HttpParser::Status status = link->parser.scan(link->inbound);
+        if (status == HttpParser::NEED_MORE && ended && link->parser.isReadingToClose()) status = link->parser.finish();
+        if (status == HttpParser::NEED_MORE) break;
+        if (status != HttpParser::COMPLETE)
+        {
+            breakLink(link, false); //we can't tell where the next response would start
+            return false;
+        }
+
+        HttpRequestView view;
+        link->parser.getView(link->inbound, view);
+        int statusCode = link->parser.getStatusCode();
+        HttpMessage response = view.toResponse(statusCode, link->parser.getReason(link->inbound));
+        link->closing = !link->parser.isPersistent();
+        link->inbound.erase(0, link->parser.getFrameLength());
+        link->parser.reset();
+        if (statusCode < 200) continue; //"100 Continue" and the like come before the real answer
+
+        link->answered++;
+        Exchange finished = std::move(link->inFlight.front());
+        link->inFlight.pop_front();
+        finished.handler(true, response);
+    }
+    if (link->handle < 0) return false; //a request the handler sent went out on this link, and broke it
+
+    if (ended || link->closing || (link->inFlight.empty() && !link->inbound.empty()))
+    {
+        //Anything still waiting was never answered, and won't be. Something we didn't ask for means the server is confused.
+        if (link->inFlight.empty()) closeLink(link);
+        else breakLink(link, false);
+        dispatch(*link->pool);
+        return false;
+    }
+
+    armDeadline(link);
+    dispatch(*link->pool); //the connection may have room for another request now, and may break sending it
+    return link->handle > -1;
+}
+
+/*
+* A connection waiting on a response gets the request timeout. An idle one gets the idle timeout. millisecondsNow drops
+* the part of the millisecond we're in, so one more is added, or the deadline could come a fraction early.
+*/
+void HttpClient::armDeadline(Link* link)
+{
+    timers.schedule(link->timer, millisecondsNow() + 1 + (link->inFlight.empty() ? options.idleTimeout : options.timeout));
+}
+
+/*
+* The connection broke, or the request at the front of it timed out. Requests that can be sent again safely go back to
+* the front of the pool's line, once. That's only done on a connection that has answered before: a request lost on a
+* fresh one most likely means the server is down, and trying again wouldn't help.
+*/
+void HttpClient::breakLink(Link* link, bool timedOut)
+{
+    Pool& pool = *link->pool;
+    bool reused = link->answered > 0;
+    deque<Exchange> lost = std::move(link->inFlight);
+    link->inFlight.clear();
+    closeLink(link);
+
+    deque<Exchange> again;
+    for (size_t i = 0; i < lost.size(); i++)
+    {
+        bool stuck = timedOut && i == 0; //the server had this one, it just never answered
+        if (!stuck && reused && !lost[i].retried && HttpMessage::isIdempotent(lost[i].method))
+        {
+            lost[i].retried = true;
+            again.push_back(std::move(lost[i]));
+        }
+        else fail(lost[i].handler);
+    }
+    pool.waiting.insert(pool.waiting.begin(), make_move_iterator(again.begin()), make_move_iterator(again.end()));
+    dispatch(pool);
+}
+
+/*
+* Hang up and take the link out of its pool. It isn't deleted until the end of the round, since epoll may have handed
+* us events for it that we haven't got to yet. Closing it twice does nothing, so it only goes on the retired list once.
+*/
+void HttpClient::closeLink(Link* link)
+{
+    if (link->handle < 0) return;
+    Pool& pool = *link->pool;
+    pool.links.erase(find(pool.links.begin(), pool.links.end(), link));
+    link->timer.cancel();
+    close(link->handle); //this takes it out of epoll too
+    link->handle = -1;
+    retired.push_back(link);
+}
+
+//We're shutting down. Everything that hasn't been answered yet never will be.
+void HttpClient::failAll()
+{
+    for (auto& [key, pool] : pools)
+    {
+        while (!pool->links.empty())
+        {
+            Link* link = pool->links.back();
+            for (Exchange& exchange : link->inFlight) fail(exchange.handler);
+            link->inFlight.clear();
+            closeLink(link);
+        }
+        for (Exchange& exchange : pool->waiting) fail(exchange.handler);
+        delete pool;
+    }
+    pools.clear();
+    for (Link* link : retired) delete link;
+    retired.clear();
+
+    vector<Submission> left;
+    {
+        lock_guard<mutex> lock(submissionLock);
+        left.swap(submissions);
+    }
+    for (Submission& submission : left) fail(submission.exchange.handler);
+}
+
+//Requests still waiting are failed, on the client's thread, before this returns.
+HttpClient::~HttpClient()
+{
+    {
+        lock_guard<mutex> lock(submissionLock);
+        running = false;
+    }
+    uint64_t poke = 1;
+    if (wakeHandle > -1) write(wakeHandle, &poke, sizeof(poke));
+    if (runner.joinable()) runner.join();
+    if (poller > -1) close(poller);
+    if (wakeHandle > -1) close(wakeHandle);
+}
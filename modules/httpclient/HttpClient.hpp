@@ -0,0 +1,124 @@
+#ifndef StiltFox_UniversalLibrary_HttpClient
+#define StiltFox_UniversalLibrary_HttpClient
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "HttpMessage.hpp"
+#include "HttpParser.hpp"
+#include "Socket.hpp"
+#include "TimerWheel.hpp"
+
+struct ClientOptions
+{
+    int connectionsPerHost = 8; //the most connections we'll have open to any one server at once
+    int pipelineDepth = 1; //how many requests can be waiting on one connection at once. 1 means no pipelining.
+    int timeout = 10000; //milliseconds a request can go without hearing from the server before we give up on it
+    int idleTimeout = 30000; //milliseconds a spare connection is kept around for the next request
+};
+
+/*
+* An HTTP client for talking to other servers. Opening a TCP connection costs a round trip before the request can even
+* be sent, so the client keeps the connections it opens, a pool of them for each host and port, and sends the next
+* request to the same server down one that's already open. Responses are read with the same HttpParser the server
+* uses, so Content-Length, chunked bodies, and bodies that run until the server hangs up all work.
+*
+* Everything happens on one thread of the client's own, which watches every connection with epoll. sendAsync hands a
+* request to that thread and returns right away, and the handler is called on that thread once the response is in.
+* Handlers should be quick, and must never call send, which would wait on the very thread it's running on. send is the
+* blocking version, for code that has nothing better to do while it waits.
+*
+* With a pipelineDepth over 1, a GET or HEAD can be sent down a connection that's still waiting on an earlier answer,
+* once every connection the pool is allowed is busy. Responses come back in the order the requests went out. Nothing
+* else is pipelined, since a request that changes something can't safely be sent again if the connection breaks.
+*
+* A server is allowed to close a kept connection whenever it likes, and a request sent down one just as it does never
+* gets an answer. A GET, HEAD, PUT, DELETE, OPTIONS or TRACE that was lost that way is sent once more on a fresh
+* connection, which is safe because sending one of those twice does the same thing as sending it once.
+*/
+class HttpClient
+{
+    public:
+    //Called once for every request. received is false if no response came back, and response is empty then.
+    typedef std::function<void(bool received, HttpMessage& response)> ResponseHandler;
+
+    private:
+    struct Pool;
+
+    struct Exchange
+    {
+        HttpMessage::Method method;
+        std::string request; //printed and ready to send. It's kept until the answer comes, in case it has to be sent again.
+        ResponseHandler handler;
+        bool retried = false;
+    };
+
+    struct Link
+    {
+        int handle;
+        Pool* pool;
+        bool connected = false;
+        bool closing = false; //the server said its last response is its last
+        size_t answered = 0; //how many responses have come back on this connection
+        std::string outbound; //requests that haven't gone out in full yet
+        size_t sent = 0; //how much of outbound has
+        std::deque<Exchange> inFlight; //requests waiting on an answer, in the order they were sent
+        HttpParser parser;
+        std::string inbound;
+        TimerWheel::Timer timer;
+    };
+
+    struct Pool
+    {
+        Socket target;
+        std::vector<Link*> links;
+        std::deque<Exchange> waiting; //requests none of the connections has room for yet
+
+        Pool(const std::string& host, int port);
+    };
+
+    struct Submission
+    {
+        std::string host;
+        int port;
+        Exchange exchange;
+    };
+
+    ClientOptions options;
+    std::unordered_map<std::string, Pool*> pools; //by "host:port"
+    std::vector<Link*> retired; //links closed while epoll may still have events for them. They're deleted after each round.
+    TimerWheel timers;
+    int poller;
+    int wakeHandle;
+    std::atomic<bool> running;
+    std::mutex submissionLock;
+    std::vector<Submission> submissions; //handed over by sendAsync, waiting for the client's thread to pick them up
+    std::thread runner;
+
+    void run();
+    void takeSubmissions();
+    void dispatch(Pool& pool);
+    Link* findLink(Pool& pool, HttpMessage::Method method, bool pipelining);
+    Link* connectLink(Pool& pool);
+    void handleEvent(Link* link, uint32_t events);
+    bool flush(Link* link);
+    void readResponses(Link* link);
+    bool deliverResponses(Link* link, bool ended);
+    void armDeadline(Link* link);
+    void breakLink(Link* link, bool timedOut);
+    void closeLink(Link* link);
+    void failAll();
+
+    public:
+    HttpClient(ClientOptions options = {});
+    HttpClient(const HttpClient&) = delete;
+    HttpClient& operator=(const HttpClient&) = delete;
+    void sendAsync(const std::string& host, int port, const HttpMessage& request, ResponseHandler handler);
+    bool send(const std::string& host, int port, const HttpMessage& request, HttpMessage& response);
+    ~HttpClient();
+};
+#endif
@@ -0,0 +1,179 @@
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <thread>
+#include "EventLoop.hpp"
+#include "HttpClient.hpp"
+
+/*
+* Each test points the client at a real event loop on loopback. The server answers with the uri it was asked for and
+* the port the client's end of the connection is on, so a test can tell whether two requests shared a connection.
+*/
+void answer(Connection* connection)
+{
+    const HttpRequestView& request = connection->receiveView();
+    sockaddr_in peer{};
+    socklen_t length = sizeof(peer);
+    getpeername(connection->getHandle(), (sockaddr*)&peer, &length);
+    std::string from = "@" + std::to_string(ntohs(peer.sin_port));
+
+    if (request.requestUri == "/chunked")
+    {
+        connection->startChunked(HttpMessage(200));
+        connection->sendChunk("hello ");
+        connection->sendChunk("world");
+        connection->finishChunked();
+    }
+    else if (request.httpMethod == HttpMessage::HEAD) connection->sendData(HttpMessage(200, {{"content-length", "11"}}));
+    else if (request.requestUri == "/close") connection->sendData(HttpMessage(200, {{"connection", "close"}}, "/close" + from));
+    else connection->sendData(HttpMessage(200, {}, std::string(request.requestUri) + from));
+}
+
+struct Server
+{
+    Socket listener;
+    EventLoop loop;
+    std::thread runner;
+
+    Server(int port, ConnectionLimits limits = {}) : listener(port, 64), loop(&listener, answer, 1, limits)
+    {
+        listener.listenPort();
+        runner = std::thread(&EventLoop::run, &loop);
+    }
+
+    ~Server()
+    {
+        loop.stop();
+        runner.join();
+    }
+};
+
+//the port the server saw the request come from
+std::string portOf(const HttpMessage& response)
+{
+    return response.body.substr(response.body.find('@') + 1);
+}
+
+TEST(HttpClient, send_will_reuse_a_kept_connection_for_the_next_request)
+{
+    //given a server and a client
+    Server server(9210);
+    HttpClient client;
+    HttpMessage first(0), second(0), third(0);
+
+    //when we send it a few requests, one after another
+    bool sentFirst = client.send("127.0.0.1", 9210, HttpMessage(HttpMessage::GET, "/one"), first);
+    bool sentSecond = client.send("127.0.0.1", 9210, HttpMessage(HttpMessage::POST, "/two", {}, "a body"), second);
+    bool sentThird = client.send("localhost", 9210, HttpMessage(HttpMessage::GET, "/three"), third);
+
+    //then each gets its own answer, and all of them came down the same connection
+    ASSERT_TRUE(sentFirst && sentSecond && sentThird);
+    ASSERT_EQ(first.statusCode, 200);
+    ASSERT_EQ(first.statusReason, "OK");
+    ASSERT_TRUE(first.body.starts_with("/one@"));
+    ASSERT_TRUE(second.body.starts_with("/two@"));
+    ASSERT_TRUE(third.body.starts_with("/three@"));
+    ASSERT_EQ(portOf(first), portOf(second));
+    ASSERT_NE(portOf(first), portOf(third)); //"localhost" is a pool of its own, even though it's the same server
+}
+
+TEST(HttpClient, sendAsync_will_pipeline_requests_and_answer_each_one_in_order)
+{
+    //given a server and a client allowed one connection, with up to 8 requests waiting on it
+    Server server(9211);
+    ClientOptions options;
+    options.connectionsPerHost = 1;
+    options.pipelineDepth = 8;
+    HttpClient client(options);
+    std::vector<HttpMessage> responses(20, HttpMessage(0));
+    std::atomic<int> remaining = 20;
+    std::promise<void> finished;
+
+    //when we hand it 20 requests at once
+    for (int i = 0; i < 20; i++)
+    {
+        client.sendAsync("127.0.0.1", 9211, HttpMessage(HttpMessage::GET, "/" + std::to_string(i)), [&, i](bool received, HttpMessage& response)
+        {
+            if (received) responses[i] = std::move(response);
+            if (--remaining == 0) finished.set_value();
+        });
+    }
+    bool done = finished.get_future().wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+
+    //then every request got the answer to it, all over the one connection
+    ASSERT_TRUE(done);
+    for (int i = 0; i < 20; i++)
+    {
+        ASSERT_EQ(responses[i].statusCode, 200);
+        ASSERT_TRUE(responses[i].body.starts_with("/" + std::to_string(i) + "@"));
+        ASSERT_EQ(portOf(responses[i]), portOf(responses[0]));
+    }
+}
+
+TEST(HttpClient, send_will_read_chunked_bodies_and_answers_to_head_and_connect_again_after_a_close)
+{
+    //given a server and a client
+    Server server(9212);
+    HttpClient client;
+    HttpMessage chunked(0), head(0), closing(0), after(0);
+
+    //when we ask for a chunked body, then a HEAD, then a response that closes the connection, and then one more
+    bool sentChunked = client.send("127.0.0.1", 9212, HttpMessage(HttpMessage::GET, "/chunked"), chunked);
+    bool sentHead = client.send("127.0.0.1", 9212, HttpMessage(HttpMessage::HEAD, "/anything"), head);
+    bool sentClosing = client.send("127.0.0.1", 9212, HttpMessage(HttpMessage::GET, "/close"), closing);
+    bool sentAfter = client.send("127.0.0.1", 9212, HttpMessage(HttpMessage::GET, "/after"), after);
+
+    //then the chunks are stitched together, the HEAD has no body despite its length, and the last one needed a new connection
+    ASSERT_TRUE(sentChunked && sentHead && sentClosing && sentAfter);
+    ASSERT_EQ(chunked.body, "hello world");
+    ASSERT_EQ(head.getHeader("content-length"), "11");
+    ASSERT_EQ(head.body, "");
+    ASSERT_TRUE(after.body.starts_with("/after@"));
+    ASSERT_NE(portOf(closing), portOf(after));
+}
+
+TEST(HttpClient, send_will_get_through_after_the_server_closed_an_idle_connection)
+{
+    //given a server that hangs up on connections idle for a tenth of a second, and a client that got an answer from it
+    ConnectionLimits limits;
+    limits.idleTimeout = 100;
+    Server server(9213, limits);
+    HttpClient client;
+    HttpMessage first(0), second(0);
+    bool sentFirst = client.send("127.0.0.1", 9213, HttpMessage(HttpMessage::GET, "/first"), first);
+
+    //when we send again once the server has closed that connection
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    bool sentSecond = client.send("127.0.0.1", 9213, HttpMessage(HttpMessage::GET, "/second"), second);
+
+    //then it went out on a new connection
+    ASSERT_TRUE(sentFirst && sentSecond);
+    ASSERT_TRUE(second.body.starts_with("/second@"));
+    ASSERT_NE(portOf(first), portOf(second));
+}
+
+TEST(HttpClient, send_will_give_up_when_nobody_answers_or_nobody_is_listening)
+{
+    //given a port where connections are let in but never answered, a port nobody is listening on, and a short timeout
+    Socket silent(9214, 16);
+    silent.listenPort();
+    ClientOptions options;
+    options.timeout = 200;
+    HttpClient client(options);
+    HttpMessage response(0);
+
+    //when we send a request to each
+    auto start = std::chrono::steady_clock::now();
+    bool answered = client.send("127.0.0.1", 9214, HttpMessage(HttpMessage::GET, "/"), response);
+    auto waited = std::chrono::steady_clock::now() - start;
+    bool refused = client.send("127.0.0.1", 9215, HttpMessage(HttpMessage::GET, "/"), response);
+
+    //then neither comes back, and the silent one is given up on once the timeout is up
+    ASSERT_FALSE(answered);
+    ASSERT_FALSE(refused);
+    ASSERT_GE(waited, std::chrono::milliseconds(200));
+    ASSERT_LT(waited, std::chrono::milliseconds(1500));
+}
@@ -0,0 +1,234 @@
+#include <memory>
+#include <new>
+#include "HttpHeaders.hpp"
+#include "PerfectHash.hpp"
+
+using namespace std;
+
+HttpHeaders::HttpHeaders()
+{
+    entries = (Header*)local;
+    hashes = localHashes;
+}
+
+HttpHeaders::HttpHeaders(initializer_list<pair<string,string>> headers) : HttpHeaders()
+{
+    for (const auto& [name, value] : headers) add(name, value);
+}
+
+HttpHeaders::HttpHeaders(const HttpHeaders& other) : HttpHeaders()
+{
+    *this = other;
+}
+
+HttpHeaders::HttpHeaders(HttpHeaders&& other) noexcept : HttpHeaders()
+{
+    takeFrom(other);
+}
+
+HttpHeaders& HttpHeaders::operator=(const HttpHeaders& other)
+{
+    if (this == &other) return *this;
+    clear();
+    for (const Header& header : other) add(header.name, header.value);
+    return *this;
+}
+
+HttpHeaders& HttpHeaders::operator=(HttpHeaders&& other) noexcept
+{
+    if (this == &other) return *this;
+    clear();
+    release();
+    takeFrom(other);
+    return *this;
+}
+
+HttpHeaders::~HttpHeaders()
+{
+    clear();
+    release();
+}
+
+//The same hash the parser uses to spot known headers, so "Host" and "host" hash the same.
+uint32_t HttpHeaders::hash(string_view name)
+{
+    return hashName(name, 2166136261u);
+}
+
+//Where the first header called name is, starting at from, or count if there isn't one.
+size_t HttpHeaders::indexOf(string_view name, uint32_t nameHash, size_t from) const
+{
+    for (size_t i = from; i < count; i++) if (hashes[i] == nameHash && equalsIgnoringCase(entries[i].name, name)) return i;
+    return count;
+}
+
+/*
+* Double the room once the list is full. The headers are moved over, not copied, so the strings keep their memory and
+* only the little objects that point at it move.
+*/
+void HttpHeaders::makeRoom()
+{
+    size_t larger = capacity * 2;
+    Header* moved = allocator<Header>().allocate(larger);
+    uint32_t* movedHashes = new uint32_t[larger];
+    for (size_t i = 0; i < count; i++)
+    {
+        new (moved + i) Header(std::move(entries[i]));
+        entries[i].~Header();
+        movedHashes[i] = hashes[i];
+    }
+    release();
+    entries = moved;
+    hashes = movedHashes;
+    capacity = larger;
+}
+
+/*
+* Take other's headers, leaving it empty. This has to be empty with nothing of its own allocated. Headers that have
+* spilled out of other go over by handing over the memory they're in, and ones that are still inside other get moved
+* one at a time.
+*/
+void HttpHeaders::takeFrom(HttpHeaders& other)
+{
+    if (other.entries != (Header*)other.local)
+    {
+        entries = other.entries;
+        hashes = other.hashes;
+        capacity = other.capacity;
+        count = other.count;
+        other.entries = (Header*)other.local;
+        other.hashes = other.localHashes;
+        other.capacity = INLINE_HEADERS;
+        other.count = 0;
+        return;
+    }
+
+    for (size_t i = 0; i < other.count; i++)
+    {
+        new (entries + i) Header(std::move(other.entries[i]));
+        hashes[i] = other.hashes[i];
+    }
+    count = other.count;
+    other.clear();
+}
+
+//Give back the memory we got for headers that didn't fit inside, once they've all been moved out or destroyed.
+void HttpHeaders::release()
+{
+    if (entries == (Header*)local) return;
+    allocator<Header>().deallocate(entries, capacity);
+    delete[] hashes;
+    entries = (Header*)local;
+    hashes = localHashes;
+    capacity = INLINE_HEADERS;
+}
+
+//The value of the first header called name. If there isn't one, an empty one is added at the end for you to fill in.
+string& HttpHeaders::operator[](string_view name)
+{
+    uint32_t nameHash = hash(name);
+    size_t index = indexOf(name, nameHash);
+    if (index < count) return entries[index].value;
+    add(string(name), "");
+    return entries[count - 1].value;
+}
+
+//Add a header at the end, even if there's one by that name already.
+void HttpHeaders::add(string name, string value)
+{
+    if (count == capacity) makeRoom();
+    hashes[count] = hash(name);
+    new (entries + count) Header{std::move(name), std::move(value)};
+    count++;
+}
+
+//The value of the first header called name, or nullptr if there isn't one.
+string* HttpHeaders::find(string_view name)
+{
+    size_t index = indexOf(name, hash(name));
+    return index < count ? &entries[index].value : nullptr;
+}
+
+const string* HttpHeaders::find(string_view name) const
+{
+    size_t index = indexOf(name, hash(name));
+    return index < count ? &entries[index].value : nullptr;
+}
+
+//The values of every header called name, in the order they were added.
+vector<string_view> HttpHeaders::findAll(string_view name) const
+{
+    vector<string_view> output;
+    uint32_t nameHash = hash(name);
+    for (size_t i = indexOf(name, nameHash); i < count; i = indexOf(name, nameHash, i + 1)) output.push_back(entries[i].value);
+    return output;
+}
+
+bool HttpHeaders::contains(string_view name) const
+{
+    return find(name) != nullptr;
+}
+
+//Take out every header called name, and say how many there were.
+size_t HttpHeaders::erase(string_view name)
+{
+    uint32_t nameHash = hash(name);
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (hashes[i] == nameHash && equalsIgnoringCase(entries[i].name, name)) continue;
+        if (kept != i)
+        {
+            entries[kept] = std::move(entries[i]);
+            hashes[kept] = hashes[i];
+        }
+        kept++;
+    }
+    size_t removed = count - kept;
+    for (size_t i = kept; i < count; i++) entries[i].~Header();
+    count = kept;
+    return removed;
+}
+
+//Take out one header, keeping the rest in order. Returns where the header after it is now.
+HttpHeaders::Header* HttpHeaders::erase(Header* position)
+{
+    size_t index = position - entries;
+    for (size_t i = index; i + 1 < count; i++)
+    {
+        entries[i] = std::move(entries[i + 1]);
+        hashes[i] = hashes[i + 1];
+    }
+    entries[--count].~Header();
+    return entries + index;
+}
+
+//Take every header out. Memory we got for headers that didn't fit inside is kept, for the next ones.
+void HttpHeaders::clear()
+{
+    for (size_t i = 0; i < count; i++) entries[i].~Header();
+    count = 0;
+}
+
+/*
+* Every header has to have a match in the other list with the same name and value, and no header can be used as the
+* match for two. The lists are short, so checking each one against the rest is fine.
+*/
+bool HttpHeaders::operator==(const HttpHeaders& other) const
+{
+    if (count != other.count) return false;
+    vector<bool> matched(count, false);
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t j = other.indexOf(entries[i].name, hashes[i]);
+        while (j < count && (matched[j] || other.entries[j].value != entries[i].value)) j = other.indexOf(entries[i].name, hashes[i], j + 1);
+        if (j == count) return false;
+        matched[j] = true;
+    }
+    return true;
+}
+
+bool HttpHeaders::operator!=(const HttpHeaders& other) const
+{
+    return !(*this == other);
+}
@@ -0,0 +1,81 @@
+#ifndef StiltFox_UniversalLibrary_HttpHeaders
+#define StiltFox_UniversalLibrary_HttpHeaders
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+* The headers of an HttpMessage. A hash map is overkill for a dozen headers: it allocates a table, and a node for every
+* header, and it forgets the order they came in. HTTP also doesn't care about the case of a header name, which a map of
+* strings does. So the headers are kept in a plain array, in the order they were added, and looked up by walking it.
+*
+* The first INLINE_HEADERS live right inside the object, so a message with no more than that never allocates anything
+* for the list itself (short names and values fit inside their strings too). Next to the headers is an array of their
+* names' hashes, worked out once as each header is added, without case. A lookup hashes the name it's looking for and
+* compares numbers, packed together in a cache line or two, and only compares the names of the ones that match. At these
+* sizes that's quicker than hashing into a table.
+*
+* A name can be in there more than once, like Set-Cookie. operator[] and find go to the first one, add always adds
+* another, and erase takes all of them out. Change names with erase and add rather than through an iterator, or the
+* hash won't match any more. Like a vector, adding a header can move the others, so a reference to a value is only good
+* until the next one is added. Two lists are equal when they have the same headers, in any order.
+*/
+class HttpHeaders
+{
+    public:
+    struct Header
+    {
+        std::string name;
+        std::string value;
+    };
+
+    static const size_t INLINE_HEADERS = 16;
+
+    private:
+    Header* entries; //points at local until there are more headers than fit, then at memory of our own
+    uint32_t* hashes;
+    size_t count = 0;
+    size_t capacity = INLINE_HEADERS;
+    alignas(Header) unsigned char local[INLINE_HEADERS * sizeof(Header)];
+    uint32_t localHashes[INLINE_HEADERS];
+
+    static uint32_t hash(std::string_view name);
+    size_t indexOf(std::string_view name, uint32_t nameHash, size_t from = 0) const;
+    void makeRoom();
+    void takeFrom(HttpHeaders& other);
+    void release();
+
+    public:
+    HttpHeaders();
+    HttpHeaders(std::initializer_list<std::pair<std::string,std::string>> headers);
+    HttpHeaders(const HttpHeaders& other);
+    HttpHeaders(HttpHeaders&& other) noexcept;
+    HttpHeaders& operator=(const HttpHeaders& other);
+    HttpHeaders& operator=(HttpHeaders&& other) noexcept;
+    ~HttpHeaders();
+
+    std::string& operator[](std::string_view name);
+    void add(std::string name, std::string value);
+    std::string* find(std::string_view name);
+    const std::string* find(std::string_view name) const;
+    std::vector<std::string_view> findAll(std::string_view name) const;
+    bool contains(std::string_view name) const;
+    size_t erase(std::string_view name);
+    Header* erase(Header* position);
+    void clear();
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    Header* begin() { return entries; }
+    Header* end() { return entries + count; }
+    const Header* begin() const { return entries; }
+    const Header* end() const { return entries + count; }
+
+    bool operator==(const HttpHeaders& other) const;
+    bool operator!=(const HttpHeaders& other) const;
+};
+#endif
@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include "HttpHeaders.hpp"
+#include "HttpMessage.hpp"
+
+TEST(HttpHeaders, find_will_ignore_the_case_of_the_name_and_operator_brackets_will_not_add_a_second_one)
+{
+    //given headers added with names in mixed case
+    HttpHeaders headers = {{"Content-Type", "text/plain"}, {"X-Request-Id", "42"}};
+
+    //when we set one by a name in different case, and look them up
+    headers["content-type"] = "text/html";
+    headers["cache-control"] = "no-store";
+
+    //then the first one was changed rather than added again, and the new one went on the end
+    ASSERT_EQ(headers.size(), 3);
+    ASSERT_EQ(*headers.find("CONTENT-TYPE"), "text/html");
+    ASSERT_EQ(*headers.find("x-request-id"), "42");
+    ASSERT_EQ(headers.begin()->name, "Content-Type");
+    ASSERT_EQ((headers.end() - 1)->name, "cache-control");
+    ASSERT_EQ(headers.find("x-missing"), nullptr);
+}
+
+TEST(HttpHeaders, add_will_keep_repeated_names_and_erase_will_take_them_all_out)
+{
+    //given a response setting two cookies
+    HttpHeaders headers;
+    headers.add("Set-Cookie", "a=1");
+    headers.add("Content-Length", "0");
+    headers.add("set-cookie", "b=2");
+
+    //when we look for every cookie, and then erase them
+    std::vector<std::string_view> found = headers.findAll("SET-COOKIE");
+    std::vector<std::string> cookies(found.begin(), found.end()); //the views point into the headers, so copy them before erasing
+    size_t erased = headers.erase("set-cookie");
+
+    //then both were there, in order, and only the length is left
+    ASSERT_EQ(cookies, (std::vector<std::string>{"a=1", "b=2"}));
+    ASSERT_EQ(erased, 2);
+    ASSERT_EQ(headers.size(), 1);
+    ASSERT_EQ(headers.begin()->name, "Content-Length");
+}
+
+TEST(HttpHeaders, add_will_keep_every_header_and_its_order_once_there_are_more_than_fit_inside)
+{
+    //given more headers than fit inside the object
+    HttpHeaders headers;
+    size_t total = HttpHeaders::INLINE_HEADERS * 3;
+    for (size_t i = 0; i < total; i++) headers.add("x-header-" + std::to_string(i), std::string(40, 'a' + i % 26));
+
+    //when we copy them, and move the copy
+    HttpHeaders copied = headers;
+    HttpHeaders moved = std::move(copied);
+
+    //then every one is still there, in the order it was added, and can still be found
+    ASSERT_EQ(moved.size(), total);
+    ASSERT_TRUE(copied.empty());
+    size_t i = 0;
+    for (const HttpHeaders::Header& header : moved)
+    {
+        ASSERT_EQ(header.name, "x-header-" + std::to_string(i));
+        ASSERT_EQ(*moved.find("X-Header-" + std::to_string(i)), std::string(40, 'a' + i % 26));
+        i++;
+    }
+    ASSERT_EQ(moved, headers);
+}
+
+TEST(HttpHeaders, printAsResponse_will_write_the_headers_in_the_order_they_were_added)
+{
+    //given a response with headers added out of alphabetical order
+    HttpMessage response(200, {{"zebra", "1"}, {"apple", "2"}, {"mango", "3"}}, "hi");
+
+    //when we print it
+    std::string actual = response.printAsResponse();
+
+    //then the headers come out just as they went in
+    ASSERT_EQ(actual, "HTTP/1.1 200 OK\r\nzebra: 1\r\napple: 2\r\nmango: 3\r\n\r\nhi");
+}
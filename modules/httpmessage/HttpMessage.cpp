@@ -10,32 +10,37 @@
 * Just copy paste the binaries that are output into a central location, along with the header files and you can reference
 * them from another project just like you did in this one without writing something again.
 */
-#include <string.h>
+#include <array>
 #include <iostream>
-#include "StringManip.hpp"
 #include "HttpMessage.hpp"
+#include "HttpParser.hpp"
+#include "PerfectHash.hpp"
 
 using namespace std;
 
 /*
-* Let's take a moment to address this block of functions here. You'll notice they share a few things in common. They're inline,
-* they are not mentioned in the header file, and they are not scoped to the HttpMethod struct. This has a few implications.
-* These functions are effectively private, because there's no definition on the header, the person who consumes this library
-* wont be able to access these.
+* Let's take a moment to address this block of tables here. You'll notice they share a few things in common. They're constexpr,
+* they are not mentioned in the header file, and they are not scoped to the HttpMessage struct. This has a few implications.
+* These tables are effectively private, because there's no mention of them on the header, the person who consumes this library
+* wont be able to access them. They can only get at them through the static functions below, which are on the header.
 *
-* As for the inline keyword, this is a request to the compiler. Inline asks the compiler to copy and paste the code wherever this
-* function is called instead of putting a call on the stack. This can save function over head, and on functions that are not used
-* in a lot of places this can be very helpful. Be careful using inline in programs where file size matters, like micro controllers.
+* As for the constexpr keyword, this is a promise to the compiler that the value can be worked out while compiling. The compiler
+* does the work once, and the program just gets the answer, so none of it happens while the server is running. It's a lot like
+* inline in that way: both trade a little bit of file size for not doing the same work over and over at run time.
 */
 
 /*
-* This function will get a 'reason code' from the provided status code. If you want a default reason you use this function. If
-* the status code is not found in the map we return empty string.
+* Turning 200 into "OK" used to mean building a map of every status code, looking one up, and throwing the map away,
+* on every single response. Now the phrases live in a table with a spot for every status code from 0 to 599, and the
+* status code is the position in the table, so there's nothing to search at all.
+*
+* The table is constexpr: the compiler fills it in while compiling, using the lambda below, and it ends up baked into
+* the program as read only data. string_views of string literals don't allocate, so nothing here ever touches the heap.
 */
-inline string getReasonCode(int statusCode)
+constexpr int MAX_STATUS = 600;
+constexpr array<string_view, MAX_STATUS> REASON_PHRASES = []()
 {
-    //This is a map of all of the standard status codes that we accept.
-    std::unordered_map<int,string> statusCodes = {{100, "Continue"},{101, "Switching Protocols"},{102,"Processing"},
+    const pair<int, string_view> phrases[] = {{100, "Continue"},{101, "Switching Protocols"},{102,"Processing"},
         {103, "Early Hints"},{200,"OK"},{201,"Created"},{202,"Accepted"},{203,"Non-Authoritative Information"},
         {204,"No Content"},{205,"Reset Content"},{206,"Partial Content"},{207,"Multi-Status"},{208,"Already Reported"},
         {226,"IM Used"},{300,"Multiple Choices"},{301,"Moved Permanently"},{302,"Found"},{303,"See Other"},{304,"Not Modified"},
@@ -50,35 +55,57 @@ inline string getReasonCode(int statusCode)
         {503,"Service Unavailable"},{504,"Gateway Timeout"},{505,"HTTP Version Not Supported"},{506,"Variant Also Negotiates"},
         {507, "Insufficient Storage"},{508,"Loop Detected"},{510,"Not Extended"},{511,"Network Authentication Required"}};
 
-    return statusCodes.contains(statusCode) ? statusCodes[statusCode] : ""; //return the reason code if found, if not empty string.
-}
+    array<string_view, MAX_STATUS> output{};
+    for (const auto & [code, phrase] : phrases) output[code] = phrase;
+    return output;
+}();
+static_assert(REASON_PHRASES[200] == "OK" && REASON_PHRASES[404] == "Not Found"); //checked while compiling, so a typo in the table can't ship
 
 /*
-* Because C++ only associates enums with integer values, we need a way to extract a string from one when we print out our http message.
-* We check against all the accepted methods, if we dont find one we return empty string. Very similar to the above function just with 
-* a smaller map.
+* The names of the methods, in the same order as the Method enum, so the enum value is the position of its name. The
+* perfect hash (see PerfectHash.hpp) goes the other way, from a name to its position, with one hash and one compare.
+* The compiler works out the hash while compiling.
+*/
+constexpr array<string_view, HttpMessage::ERROR> METHOD_NAMES = {"GET", "HEAD", "POST", "PUT", "PATCH", "DELETE",
+    "CONNECT", "OPTIONS", "TRACE"};
+constexpr PerfectHash<HttpMessage::ERROR, 16> METHOD_HASH(METHOD_NAMES);
+static_assert(METHOD_HASH.find("DELETE", false) == HttpMessage::DELETE && METHOD_HASH.find("delete", false) == -1);
+
+/*
+* This function will get a 'reason code' from the provided status code. If you want a default reason you use this function. If
+* the status code is not one we know we return an empty string.
 */
-inline string getStringMethod(HttpMessage::Method method)
+string_view HttpMessage::getReasonPhrase(int statusCode)
 {
-    std::unordered_map<HttpMessage::Method,string> methodStrings = {{HttpMessage::Method::GET, "GET"},
-        {HttpMessage::Method::HEAD, "HEAD"},{HttpMessage::Method::POST, "POST"},{HttpMessage::Method::PUT, "PUT"},{HttpMessage::Method::PATCH, "PATCH"},
-        {HttpMessage::Method::DELETE, "DELETE"},{HttpMessage::Method::CONNECT, "CONNECT"},{HttpMessage::Method::OPTIONS, "OPTIONS"},
-        {HttpMessage::Method::TRACE, "TRACE"}};
+    return statusCode >= 0 && statusCode < MAX_STATUS ? REASON_PHRASES[statusCode] : "";
+}
 
-    return methodStrings.contains(method) ? methodStrings[method] : "";
+/*
+* Sending a request with one of these methods twice does the same thing as sending it once, so a client or proxy that
+* lost one to a broken connection can safely send it again.
+*/
+bool HttpMessage::isIdempotent(Method method)
+{
+    return method == GET || method == HEAD || method == PUT || method == DELETE || method == OPTIONS || method == TRACE;
 }
 
 /*
-* This is the same as the above method, except this time we go from a string to a method.
+* Because C++ only associates enums with integer values, we need a way to extract a string from one when we print out our http message.
+* ERROR and NONE aren't real methods, so they get an empty string.
 */
-inline HttpMessage::Method getMethodFromString(string method)
+string_view HttpMessage::getMethodName(Method method)
 {
-    std::unordered_map<string,HttpMessage::Method> stringMethods = {{"GET", HttpMessage::Method::GET},
-        {"HEAD", HttpMessage::Method::HEAD},{"POST", HttpMessage::Method::POST},{"PUT", HttpMessage::Method::PUT},{"PATCH", HttpMessage::Method::PATCH},
-        {"DELETE", HttpMessage::Method::DELETE},{"CONNECT", HttpMessage::Method::CONNECT},{"OPTIONS", HttpMessage::Method::OPTIONS},
-        {"TRACE", HttpMessage::Method::TRACE}};
+    return method >= GET && method < ERROR ? METHOD_NAMES[method] : "";
+}
 
-    return stringMethods.contains(method) ? stringMethods[method] : HttpMessage::Method::ERROR;
+/*
+* This is the same as the above method, except this time we go from a string to a method. This one is called for every
+* request that comes in. Methods are case sensitive, so "get" is an ERROR, not a GET.
+*/
+HttpMessage::Method HttpMessage::getMethodFromString(string_view method)
+{
+    int index = METHOD_HASH.find(method, false);
+    return index < 0 ? ERROR : (Method)index;
 }
 
 /*
@@ -100,122 +127,137 @@ inline HttpMessage::Method getMethodFromString(string method)
 * Anyway this constructor doesn't do anything special other than set the values and the only thing slightly spicy it does
 * is provide a standard reason code if you didn't provide one.
 */
-HttpMessage::HttpMessage(int status, std::unordered_map<std::string,std::string> head, std::string bod, string reason)
+HttpMessage::HttpMessage(int status, HttpHeaders head, std::string bod, string reason)
 {
     statusCode = status;
     httpMethod = Method::NONE;
-    statusReason = reason == "" ? getReasonCode(statusCode) : reason;
-    headers = head;
-    body = bod;
+    statusReason = reason == "" ? string(getReasonPhrase(statusCode)) : reason;
+    headers = std::move(head);
+    body = std::move(bod);
 }
 
 
 // This constructor is also just a simple constructor that sets some values. Nothing fancy here.
-HttpMessage::HttpMessage(Method method, std::string uri, std::unordered_map<std::string,std::string> head, std::string bod)
+HttpMessage::HttpMessage(Method method, std::string uri, HttpHeaders head, std::string bod)
 {
     statusCode = 0;
     httpMethod = method;
     requestUri = uri;
-    headers = head;
-    body = bod;
+    headers = std::move(head);
+    body = std::move(bod);
 }
 
 /*
 * This constructor requires a lot more explanation and the internals will be commented on. This constructor will attempt
-* to parse an Http Response from a socket and a reader function. You'll see that this accepts a function as an input.
+* to parse an Http Request from a socket and a reader function. You'll see that this accepts a function as an input.
 * You can think of it like a lambda function being accepted as an input. It's a way to make it so this class isn't dependant
 * on operating system specific code. The function it takes returns an integer, and takes an integer, character pointer and
 * integer as it's arguments.
+*
+* The real work happens in HttpParser, which knows how to put a message back together no matter how the bytes were split
+* up on the way here. This constructor just keeps feeding it until it has a whole message. Bytes that arrive after the end
+* of the message are dropped, so use HttpParser directly if you expect more than one message on the same socket.
+*
+* Everything, body and all, ends up in memory here, which is no good for a big upload. A server should take requests from
+* a Connection instead, which hands a big body to the handler a piece at a time (see Connection::streamBody).
 */
 HttpMessage::HttpMessage(int socketId, function<int(int,char*,int)> reader)
 {
-    char buffer[1024]; // Because we dont know how much data is being sent to us we will perform a buffered read. This byte
+    HttpParser parser; // a request with no length header has no body, however the bytes were split up on the way.
+    char buffer[4096]; // Because we dont know how much data is being sent to us we will perform a buffered read. This byte
                        // array is the maximum number of bytes we can read per pass through the loop.
-    string requestString; // This is the string where the data will be appended to from the buffer. We will parse this later.
+    int readBytes;
 
     // This is the loop that will read the data from the socket.
     do
     {
-        memset(buffer, 0, sizeof(buffer)); //set the buffer to all zeros. This will clear out any previous data and insure
-                                           //that if partial data is set, that we will eventually end on a 0x00 or unicode
-                                           // null.
-        reader(socketId, buffer, 1024); // we call the reader function passed into here with the socket id and buffer.
-        requestString += buffer; // append the buffer to the output.
-    } while (buffer[1023] != 0); // if the buffer does not end in unicode null, then we loop again to get more data.
+        readBytes = reader(socketId, buffer, sizeof(buffer)); // we call the reader function passed into here with the socket id and buffer.
+        if (readBytes > 0) parser.parse(buffer, readBytes); // and let the parser pick up where it left off.
+    } while (readBytes > 0 && parser.getStatus() == HttpParser::NEED_MORE); // stop when the message is done or the socket is.
 
-    parseString(requestString); //Now that we have the data we parse it.
+    parser.finish(); // Let the parser know that's all there is.
+    *this = parser.takeMessage(); // Now that we have the data we take the parsed message.
 }
 
 /*
-* This is the function that takes the string and converts it into an HTTP message.
+* This is the function that takes the string and converts it into an HTTP message. It used to pick the string apart
+* itself, but HttpParser does the same job without copying pieces of the string around, so we just let it.
 */
 void HttpMessage::parseString(string requestString)
 {
-    statusCode = 0; // because C++ does not initialize variables by default it's best to make sure that there is no
-                    // random garbage stored here.
-    int currentPosition = 0; // This variable keeps track of where we are in the string.
-    string methodString = parseToDelim(requestString, " "); // parseToDelim is defined in stringmanip. //This line grabs the
-                                                            // http method.
-    httpMethod = getMethodFromString(methodString); // This will convert the string to an enum. see function above.
-    currentPosition += methodString.length() + 1;  // Because arrays start at index zero we need to subtract 1 from the length.
+    HttpParser parser; // the same as off a socket: without a length header, there's no body.
+    parser.parse(requestString.data(), requestString.size());
+    parser.finish();
+    *this = parser.takeMessage();
+}
 
-    if (currentPosition < requestString.length()) // Make sure we are not at the end of the request.
-    {
-        requestUri = parseToDelim(requestString.substr(currentPosition), " "); // We grab the request url next.
-        if (requestUri.find("\n") != string::npos) requestUri = ""; // if we for some reason hit end of file this was improperly
-                                                                    // parsed so we set it to empty.
-        currentPosition += requestUri.length() + 1; // update our position again, then check if we're at end of string.
-        if (currentPosition < requestString.length())
-        {
-            currentPosition = requestString.find('\n') + 1; // skip the http version, we don't care.
-            if (0 < currentPosition && currentPosition < requestString.length()) //make sure there's data after the new line.
-            {
-                // If we hit a new line right away we know that there are no headers. So we parse the body.
-                if (requestString.substr(currentPosition).starts_with("\r\n")) 
-                {
-                    body = requestString.substr(currentPosition + 2); // we add 2 to the current position to skip the white space.
-                }
-                else //if we get here that means that we have http headers.
-                {
-                    //we use parse map and parse to delim to get the headers
-                    headers = parseMap(parseToDelim(requestString.substr(currentPosition), "\r\n\r\n"), ": ", "\r\n");
-                    currentPosition = requestString.find("\r\n\r\n"); // then we check if we have a body and parse that.
-                    if (0 < currentPosition && currentPosition+4 < requestString.length())
-                    {
-                        body = requestString.substr(currentPosition+4);
-                    }
-                }
-            }
-        }
-    }
+/*
+* This function writes the headers of the Http Message onto the end of output, one line each. We use append rather than
+* the + operator because every + makes a brand new string, where append adds to the one we already have.
+*/
+void HttpMessage::appendHeaders(string& output) const
+{
+    for (const auto & [name, value] : headers) output.append(name).append(": ").append(value).append("\r\n");
 }
 
 //This function outputs the body and headers of the Http Message to a string.
 string HttpMessage::printBodyAndHeaders() const
 {
     string output;
+    appendHeaders(output);
+    return output.append("\r\n").append(body);
+}
 
-    for (const auto & [key, value] : headers) output += key + ": " + value + "\r\n";
-
-    return output + "\r\n" + body;
+/*
+* This writes the status line and headers of a response onto the end of output, but not the blank line that ends them.
+* Writing into a string the caller already has lets a connection reuse the same memory for every response, and leaving
+* off the blank line lets it add a few headers of its own first.
+*/
+void HttpMessage::appendResponseHead(string& output) const
+{
+    output.append("HTTP/1.1 ").append(to_string(statusCode)).append(" ").append(statusReason).append("\r\n");
+    appendHeaders(output);
 }
 
 // this method outputs a string formatting the Http message as a response.
 string HttpMessage::printAsResponse() const
 {
-    return "HTTP/1.1 " + to_string(statusCode) + " " + statusReason+"\r\n" + printBodyAndHeaders();
+    string output;
+    output.reserve(body.size() + 256); // make room for everything up front so the string doesn't have to keep growing.
+    appendResponseHead(output);
+    return output.append("\r\n").append(body);
 }
 
 // this method outputs a string formatting the Http message as a request.
 string HttpMessage::printAsRequest() const
 {
-    return getStringMethod(httpMethod) + " " + requestUri +" HTTP/1.1\r\n" + printBodyAndHeaders();
+    string output;
+    output.reserve(body.size() + 256);
+    output.append(getMethodName(httpMethod)).append(" ").append(requestUri).append(" HTTP/1.1\r\n");
+    appendHeaders(output);
+    return output.append("\r\n").append(body);
 }
 
 // return the Method as a string instead of an Enum.
 string HttpMessage::getHttpMethodAsString() const
 {
-    return getStringMethod(httpMethod);
+    return string(getMethodName(httpMethod));
+}
+
+/*
+* Header names in HTTP don't care about upper or lower case, so "Content-Length" and "content-length" are the same header.
+* HttpHeaders doesn't care either, so these just ask it.
+*/
+bool HttpMessage::hasHeader(const string& name) const
+{
+    return headers.contains(name);
+}
+
+// returns the value of the header, or empty string if we don't have it.
+string HttpMessage::getHeader(const string& name) const
+{
+    const string* value = headers.find(name);
+    return value == nullptr ? "" : *value;
 }
 
 // Overload the comparison operator to work on two Http Messages
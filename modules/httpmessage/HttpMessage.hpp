@@ -31,8 +31,9 @@
 #ifndef StiltFox_UniversalLibrary_HttpMessage
 #define StiltFox_UniversalLibrary_HttpMessage
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <functional>
+#include "HttpHeaders.hpp"
 
 /*
 * A C++ struct is a lot like an object in other languages. It can contain methods, and fields and can exercise data
@@ -54,7 +55,7 @@ struct HttpMessage {
     Method httpMethod; //This is the method of this message
     std::string requestUri; //This is the request uri. This may or may not have host information
     std::string statusReason; //This is based off of the statusCode typically, but may be set to something other than the default
-    std::unordered_map<std::string,std::string> headers; //this is a set of http headers and values
+    HttpHeaders headers; //the http headers, in the order they were added. See HttpHeaders.hpp
     std::string body; //The body of the http message
 
     /*
@@ -66,8 +67,8 @@ struct HttpMessage {
     * Constructors and functions in C++ can have what is known as default parameters. Default parameters must come last in the
     * parameter list. When the parameter is ot provided it defaults to whatever it was set to here.
     */
-    HttpMessage(int statusCode, std::unordered_map<std::string,std::string> headers = {}, std::string body = "", std::string statusReason = "");
-    HttpMessage(Method method, std::string uri = "*", std::unordered_map<std::string,std::string> headers = {}, std::string body = "");
+    HttpMessage(int statusCode, HttpHeaders headers = {}, std::string body = "", std::string statusReason = "");
+    HttpMessage(Method method, std::string uri = "*", HttpHeaders headers = {}, std::string body = "");
     HttpMessage(int socketId, std::function<int(int,char*,int)> reader);
     
     /*
@@ -77,8 +78,20 @@ struct HttpMessage {
     * parameters.
     */
     std::string getHttpMethodAsString() const;
+    bool hasHeader(const std::string& name) const;
+    std::string getHeader(const std::string& name) const;
+
+    /*
+    * A static function belongs to the struct itself rather than to any one message, so you call it like
+    * HttpMessage::getMethodFromString("GET") without needing a message first.
+    */
+    static Method getMethodFromString(std::string_view method);
+    static std::string_view getMethodName(Method method);
+    static std::string_view getReasonPhrase(int statusCode);
+    static bool isIdempotent(Method method);
     std::string printAsResponse() const;
     std::string printAsRequest() const;
+    void appendResponseHead(std::string& output) const;
 
     /*
     * These are operator overloads.
@@ -100,6 +113,7 @@ struct HttpMessage {
     */
     protected:
     std::string printBodyAndHeaders() const;
+    void appendHeaders(std::string& output) const;
     void parseString(std::string);
 };
 #endif
@@ -7,6 +7,7 @@
 * executable along with some pretty nice console output.
 */
 #include <gtest/gtest.h>
+#include <vector>
 #include "HttpMessage.hpp"
 
 /*
@@ -84,7 +85,7 @@ TEST(HttpMessage, printAsRequest_will_print_a_well_formed_http_request)
     std::string actual = complete.printAsRequest();
 
     //then we get back a well formatted request
-    ASSERT_EQ(actual, "GET /an_endpoint HTTP/1.1\r\nheader2: some_val2\r\nheader: some_value\r\n\r\nthis is my body");
+    ASSERT_EQ(actual, "GET /an_endpoint HTTP/1.1\r\nheader: some_value\r\nheader2: some_val2\r\n\r\nthis is my body");
 }
 
 TEST(HttpMessage, printAsResponse_will_print_a_well_formatted_http_response)
@@ -96,13 +97,13 @@ TEST(HttpMessage, printAsResponse_will_print_a_well_formatted_http_response)
     std::string actual = complete.printAsResponse();
 
     //then we get back a well formatted response
-    ASSERT_EQ(actual,"HTTP/1.1 200 OK\r\nheader2: some_val2\r\nheader: some_value\r\n\r\nThis is a body");
+    ASSERT_EQ(actual,"HTTP/1.1 200 OK\r\nheader: some_value\r\nheader2: some_val2\r\n\r\nThis is a body");
 }
 
 TEST(HttpMessage, reading_from_a_well_formed_socket_request_will_produce_a_well_formed_HttpMessage)
 {
     //given we have a valid data stream
-    std::string dataToStream = "POST /an_endpoint HTTP/1.1\r\nheader2: some_val2\r\nheader: some_value\r\n\r\nthis is my body";
+    std::string dataToStream = "POST /an_endpoint HTTP/1.1\r\nheader2: some_val2\r\nheader: some_value\r\ncontent-length: 15\r\n\r\nthis is my body";
     int currentChunk = 0;
 
     //when we read the socket, let's pretend it's 9080
@@ -114,7 +115,7 @@ TEST(HttpMessage, reading_from_a_well_formed_socket_request_will_produce_a_well_
     });
 
     //then we get back the desired http response
-    ASSERT_EQ(actual, HttpMessage(HttpMessage::POST,"/an_endpoint",{{"header2","some_val2"},{"header","some_value"}},"this is my body"));
+    ASSERT_EQ(actual, HttpMessage(HttpMessage::POST,"/an_endpoint",{{"header2","some_val2"},{"header","some_value"},{"content-length","15"}},"this is my body"));
 }
 
 TEST(HttpMessage, reading_from_a_socket_that_does_not_have_headers_or_a_body_will_parse_properly)
@@ -167,14 +168,14 @@ TEST(HttpMessage, reading_from_a_socket_that_does_not_have_headings_will_parse_p
         return readBytes;
     });
 
-    //then we get back the desired http response
-    ASSERT_EQ(actual, HttpMessage(HttpMessage::POST, "/an_endpoint", {}, "This is a body"));
+    //then we get back the request, without a body, since nothing said how long one was
+    ASSERT_EQ(actual, HttpMessage(HttpMessage::POST, "/an_endpoint"));
 }
 
 TEST(HttpMessage, reading_from_a_socket_request_with_an_unknown_method_will_set_httpMethod_to_error)
 {
     //given we have an http request with an unknown method
-    std::string dataToStream = "PICKLE /an_endpoint HTTP/1.1\r\nheader2: some_val2\r\nheader: some_value\r\n\r\nthis is my body";
+    std::string dataToStream = "PICKLE /an_endpoint HTTP/1.1\r\nheader2: some_val2\r\nheader: some_value\r\ncontent-length: 15\r\n\r\nthis is my body";
     int currentChunk = 0;
 
     //when we read the socket, let's pretend it's 9080
@@ -186,14 +187,14 @@ TEST(HttpMessage, reading_from_a_socket_request_with_an_unknown_method_will_set_
     });
 
     //then we get back that the method is not allowed
-    HttpMessage expectedMessage(HttpMessage::ERROR,"/an_endpoint",{{"header2","some_val2"},{"header","some_value"}},"this is my body");
+    HttpMessage expectedMessage(HttpMessage::ERROR,"/an_endpoint",{{"header2","some_val2"},{"header","some_value"},{"content-length","15"}},"this is my body");
     ASSERT_EQ(actual, expectedMessage);
 }
 
 TEST(HttpMessage, reading_from_a_socket_without_an_endpoint_will_finish_parsing)
 {
     //given we have an http request without an endpoint
-    std::string endpointMissing = "POST  HTTP/1.1\r\nheader2: some_val2\r\nheader: some_value\r\n\r\nthis is my body";
+    std::string endpointMissing = "POST  HTTP/1.1\r\nheader2: some_val2\r\nheader: some_value\r\ncontent-length: 15\r\n\r\nthis is my body";
     int currentChunk = 0;
 
     //when we read the socket, let's pretend it's 9080
@@ -205,14 +206,14 @@ TEST(HttpMessage, reading_from_a_socket_without_an_endpoint_will_finish_parsing)
     });
 
     //then we get back that the message is malformed
-    HttpMessage expectedMessage(HttpMessage::POST,"",{{"header2","some_val2"},{"header","some_value"}},"this is my body");
+    HttpMessage expectedMessage(HttpMessage::POST,"",{{"header2","some_val2"},{"header","some_value"},{"content-length","15"}},"this is my body");
     ASSERT_EQ(actual, expectedMessage);
 }
 
 TEST(HttpMessage, reading_from_a_socket_without_an_endpoint_or_space_will_finish_parsing)
 {
     //given we have an http request without an endpoint
-    std::string endpointMissingWithoutSpace = "POST HTTP/1.1\r\nheader2: some_val2\r\nheader: some_value\r\n\r\nthis is my body";
+    std::string endpointMissingWithoutSpace = "POST HTTP/1.1\r\nheader2: some_val2\r\nheader: some_value\r\ncontent-length: 15\r\n\r\nthis is my body";
     int currentChunk = 0;
 
     //when we read the socket, let's pretend it's 9080
@@ -224,10 +225,77 @@ TEST(HttpMessage, reading_from_a_socket_without_an_endpoint_or_space_will_finish
     });
 
     //then we get back that the message is malformed
-    HttpMessage expectedMessageWithoutSpace(HttpMessage::POST,"",{{"header2","some_val2"},{"header","some_value"}},"this is my body");
+    HttpMessage expectedMessageWithoutSpace(HttpMessage::POST,"",{{"header2","some_val2"},{"header","some_value"},{"content-length","15"}},"this is my body");
     ASSERT_EQ(actualNoSpace, expectedMessageWithoutSpace);
 }
 
+TEST(HttpMessage, reading_from_a_socket_will_stop_at_the_end_of_a_request_without_a_body)
+{
+    //given a request whose head fills a whole read exactly, with another request right behind it
+    std::string head = "GET /first HTTP/1.1\r\nx-padding: ";
+    head += std::string(4096 - head.size() - 4, 'p') + "\r\n\r\n";
+    std::vector<std::string> reads = {head, "GET /second HTTP/1.1\r\n\r\n"};
+    size_t currentRead = 0;
+
+    //when we read the socket, let's pretend it's 9080
+    HttpMessage actual(9080, [&reads, &currentRead](int socketId, char* buffer, int chunksize)
+    {
+        if (currentRead == reads.size()) return -1;
+        memcpy(buffer, reads[currentRead].data(), reads[currentRead].size());
+        return (int)reads[currentRead++].size();
+    });
+
+    //then the first request ends with its head, without waiting for more or taking the second one as its body
+    ASSERT_EQ(actual.requestUri, "/first");
+    ASSERT_EQ(actual.body, "");
+    ASSERT_EQ(currentRead, 1);
+}
+
+TEST(HttpMessage, getHeader_will_find_a_header_regardless_of_case)
+{
+    //given we have a message with a mixed case header
+    HttpMessage message(HttpMessage::GET, "/an_endpoint", {{"Content-Type","application/json"}});
+
+    //when we look it up in lower case
+    std::string actual = message.getHeader("content-type");
+
+    //then we still find it, and missing headers come back empty
+    ASSERT_EQ(actual, "application/json");
+    ASSERT_TRUE(message.hasHeader("CONTENT-TYPE"));
+    ASSERT_FALSE(message.hasHeader("content-length"));
+    ASSERT_EQ(message.getHeader("content-length"), "");
+}
+
+TEST(HttpMessage, getMethodFromString_and_getMethodName_will_agree_on_every_method)
+{
+    //given every real method
+    std::vector<HttpMessage::Method> methods = {HttpMessage::GET, HttpMessage::HEAD, HttpMessage::POST, HttpMessage::PUT,
+        HttpMessage::PATCH, HttpMessage::DELETE, HttpMessage::CONNECT, HttpMessage::OPTIONS, HttpMessage::TRACE};
+
+    //when we turn each into its name and back
+    //then we end up where we started, and anything that isn't exactly a method name is an ERROR
+    for (HttpMessage::Method method : methods) ASSERT_EQ(HttpMessage::getMethodFromString(HttpMessage::getMethodName(method)), method);
+    ASSERT_EQ(HttpMessage::getMethodName(HttpMessage::PATCH), "PATCH");
+    ASSERT_EQ(HttpMessage::getMethodName(HttpMessage::NONE), "");
+    ASSERT_EQ(HttpMessage::getMethodFromString("get"), HttpMessage::ERROR);
+    ASSERT_EQ(HttpMessage::getMethodFromString("GETS"), HttpMessage::ERROR);
+    ASSERT_EQ(HttpMessage::getMethodFromString(""), HttpMessage::ERROR);
+}
+
+TEST(HttpMessage, getReasonPhrase_will_know_the_standard_status_codes)
+{
+    //given some status codes, known and unknown
+    //when we ask for their reason phrases
+    //then the standard ones have one, and anything else is empty instead of out of bounds
+    ASSERT_EQ(HttpMessage::getReasonPhrase(200), "OK");
+    ASSERT_EQ(HttpMessage::getReasonPhrase(418), "I'm a teapot");
+    ASSERT_EQ(HttpMessage::getReasonPhrase(511), "Network Authentication Required");
+    ASSERT_EQ(HttpMessage::getReasonPhrase(299), "");
+    ASSERT_EQ(HttpMessage::getReasonPhrase(-1), "");
+    ASSERT_EQ(HttpMessage::getReasonPhrase(600), "");
+    ASSERT_EQ(HttpMessage(404).statusReason, "Not Found");
+}
+
 /*
 * This last test here is a little weird as it has no asserts. This should logically mean that it will always pass.
 * However we were having issues with segfaults and reading from out of bound arrays when we would receive corrupted data.
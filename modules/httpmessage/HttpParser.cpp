@@ -0,0 +1,535 @@
+#include <ctype.h>
+#include <strings.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "StringManip.hpp"
+#include "HttpParser.hpp"
+#include "PerfectHash.hpp"
+
+using namespace std;
+
+//Strip the spaces and tabs HTTP allows around header values.
+inline string_view trim(string_view text)
+{
+    size_t start = text.find_first_not_of(" \t");
+    if (start == string_view::npos) return {};
+    return text.substr(start, text.find_last_not_of(" \t") - start + 1);
+}
+
+inline bool containsIgnoringCase(string_view text, string_view word)
+{
+    for (size_t i = 0; i + word.size() <= text.size(); i++)
+    {
+        if (strncasecmp(text.data() + i, word.data(), word.size()) == 0) return true;
+    }
+    return false;
+}
+
+/*
+* Read a number written in base 10 or 16 straight out of the buffer. We cap the number of digits so a client can't
+* overflow it, and refuse anything that isn't a digit, including signs and spaces.
+*/
+inline bool parseNumber(string_view text, int base, size_t& output)
+{
+    if (text.empty() || text.size() > 15) return false;
+
+    output = 0;
+    for (char digit : text)
+    {
+        int value = isdigit((unsigned char)digit) ? digit - '0'
+            : base == 16 && isxdigit((unsigned char)digit) ? tolower((unsigned char)digit) - 'a' + 10 : -1;
+        if (value < 0) return false;
+        output = output * base + value;
+    }
+    return true;
+}
+
+HttpParser::HttpParser(bool toClose, size_t maxHead)
+{
+    readToClose = toClose;
+    response = false;
+    answering = HttpMessage::NONE;
+    maxHeadSize = maxHead;
+    streamThreshold = SIZE_MAX;
+    reset();
+}
+
+/*
+* Hand the parser the next bytes from the stream. It returns how many of them it used. Anything it didn't use
+* belongs to the next message (clients are allowed to send several requests back to back), so keep it around
+* and feed it in again after calling takeMessage.
+*/
+size_t HttpParser::parse(const char* data, size_t length)
+{
+    size_t before = owned.size();
+    owned.append(data, length);
+    if (scan(owned) != COMPLETE) return length;
+
+    owned.resize(position); //whatever is past the end of this message isn't ours to keep
+    return position - before;
+}
+
+/*
+* Carry on parsing the buffer from wherever we stopped last time. The buffer must start at the first byte of the
+* message, and hold everything we have seen before plus anything new.
+*/
+HttpParser::Status HttpParser::scan(string_view buffer)
+{
+    while (position < buffer.size() && state != DONE && state != FAILED && !streamingBody)
+    {
+        size_t take = min(remaining, buffer.size() - position);
+
+        switch (state)
+        {
+            case HEAD:
+            {
+                /*
+                * The head of a message (request line and headers) ends at the first blank line. We only search the
+                * new bytes (plus a few old ones in case the blank line was split between two reads), so a head that
+                * trickles in a byte at a time doesn't get searched over and over from the start.
+                */
+                size_t end = buffer.find("\r\n\r\n", position > 3 ? position - 3 : 0);
+                if (end == string_view::npos)
+                {
+                    position = buffer.size();
+                    if (position > maxHeadSize) fail();
+                }
+                else if (end + 4 > maxHeadSize) fail();
+                else parseHead(buffer, end);
+                break;
+            }
+            case BODY:
+                position += take;
+                remaining -= take;
+                if (remaining == 0)
+                {
+                    body.length = position - body.offset;
+                    state = DONE;
+                }
+                break;
+            case CHUNK_DATA:
+                if (decoded.size() + take > streamThreshold) //too big to keep stitching together, so readBody hands out the rest
+                {
+                    streamingBody = true;
+                    break;
+                }
+                decoded.append(buffer.data() + position, take);
+                position += take;
+                remaining -= take;
+                if (remaining == 0) state = CHUNK_END;
+                break;
+            case UNTIL_CLOSE:
+                if (buffer.size() - body.offset > streamThreshold) //it could go on forever, so readBody hands it all out
+                {
+                    position = body.offset;
+                    streamingBody = true;
+                    break;
+                }
+                position = buffer.size();
+                body.length = position - body.offset;
+                break;
+            default: //CHUNK_SIZE, CHUNK_END and TRAILERS are all read a line at a time
+                if (!parseLine(buffer)) return getStatus(); //we don't have the whole line yet
+                break;
+        }
+    }
+
+    return getStatus();
+}
+
+/*
+* Pick the head apart into the request line and headers. We only write down where each piece starts and how long
+* it is; nothing gets copied.
+*/
+void HttpParser::parseHead(string_view buffer, size_t end)
+{
+    string_view head = buffer.substr(0, end + 2); //every line of the head, each still ending in \r\n
+    size_t lineEnd = head.find("\r\n");
+    string_view requestLine = head.substr(0, lineEnd);
+    size_t firstSpace = requestLine.find(' ');
+    size_t lastSpace = requestLine.rfind(' ');
+
+    //The request line is "METHOD uri VERSION". If a piece is missing we leave it empty rather than guess.
+    if (response)
+    {
+        if (!parseStatusLine(requestLine)) fail();
+    }
+    else if (firstSpace == string_view::npos) method = {0, lineEnd};
+    else
+    {
+        method = {0, firstSpace};
+        version = {lastSpace + 1, lineEnd - lastSpace - 1};
+        if (lastSpace > firstSpace) uri = {firstSpace + 1, lastSpace - firstSpace - 1};
+    }
+
+    //scanHeaders (from stringmanip) splits the header lines and checks their names in one pass
+    size_t blockStart = min(lineEnd + 2, head.size());
+    HeaderLine lines[HttpRequestView::MAX_HEADERS];
+    int lineCount = scanHeaders(head.data() + blockStart, head.size() - blockStart, lines, HttpRequestView::MAX_HEADERS);
+
+    if (lineCount < 0) fail();
+    for (int i = 0; i < lineCount; i++) addHeader(buffer, blockStart, lines[i]);
+
+    position = end + 4;
+    body = {position, 0};
+    if (state == FAILED) return;
+
+    /*
+    * HTTP/1.1 connections stay open for more requests unless someone says "Connection: close". HTTP/1.0 is the
+    * other way around: connections close after one request unless the client asks for "Connection: keep-alive".
+    */
+    bool found;
+    string_view connection = findHeader(buffer, HttpRequestView::CONNECTION, found);
+    if (containsIgnoringCase(connection, "close")) persistent = false;
+    else if (containsIgnoringCase(connection, "keep-alive")) persistent = true;
+    else persistent = buffer.substr(version.offset, version.length) != "HTTP/1.0";
+
+    startBody(buffer);
+}
+
+/*
+* A status line is "VERSION code reason", where the code is always three digits and the reason can have spaces in it,
+* or be missing altogether. Returns false if it isn't one.
+*/
+bool HttpParser::parseStatusLine(string_view line)
+{
+    size_t firstSpace = line.find(' ');
+    size_t code;
+    if (!line.starts_with("HTTP/") || firstSpace == string_view::npos || !parseNumber(line.substr(firstSpace + 1, 3), 10, code)) return false;
+    if (line.size() > firstSpace + 4 && line[firstSpace + 4] != ' ') return false;
+
+    version = {0, firstSpace};
+    statusCode = code;
+    if (line.size() > firstSpace + 5) reason = {firstSpace + 5, line.size() - firstSpace - 5};
+    return code >= 100;
+}
+
+/*
+* Write down where a header's name and value are. The line's positions are relative to blockStart. If it's one of the
+* known headers (and the first of its name) we also write down which header it is, so nobody has to look for it later.
+*/
+bool HttpParser::addHeader(string_view buffer, size_t blockStart, const HeaderLine& line)
+{
+    if (headerCount == HttpRequestView::MAX_HEADERS) return false;
+
+    size_t start = blockStart + line.start;
+    size_t colon = blockStart + line.colon;
+    string_view value = trim(buffer.substr(colon + 1, line.end - line.colon - 1));
+    HttpRequestView::KnownHeader known = HttpRequestView::findKnownHeader(buffer.substr(start, colon - start));
+    if (known != HttpRequestView::UNKNOWN_HEADER && knownHeaders[known] == 0) knownHeaders[known] = headerCount + 1;
+    headerNames[headerCount] = {start, colon - start};
+    headerValues[headerCount] = {value.empty() ? colon : (size_t)(value.data() - buffer.data()), value.size()};
+    headerCount++;
+    return true;
+}
+
+string_view HttpParser::findHeader(string_view buffer, HttpRequestView::KnownHeader header, bool& found) const
+{
+    found = knownHeaders[header] > 0;
+    if (!found) return {};
+    const Span& value = headerValues[knownHeaders[header] - 1];
+    return buffer.substr(value.offset, value.length);
+}
+
+/*
+* Is the last coding in a Transfer-Encoding list "chunked"? Only that one counts: "gzip, chunked" is chunked, but
+* "xchunked" or "chunked, gzip" isn't. Neither is "chunked" followed by another Transfer-Encoding header of "gzip".
+*/
+inline bool endsInChunked(string_view encoding)
+{
+    size_t comma = encoding.rfind(',');
+    return equalsIgnoringCase(trim(comma == string_view::npos ? encoding : encoding.substr(comma + 1)), "chunked");
+}
+
+/*
+* Now that we have the headers we can work out how the body is framed. Transfer-Encoding wins over Content-Length
+* when a message has both, because that's what the HTTP spec tells us to do.
+*
+* Anything that can be framed two ways is a way to smuggle a request past a proxy: if the proxy believes one framing
+* and the server behind it the other, the end of one body is read as a whole new request. So several Content-Lengths
+* that don't agree are refused, and a message with both headers is framed by Transfer-Encoding and the connection is
+* closed after it, so nothing after it is read under the wrong framing.
+*/
+void HttpParser::startBody(string_view buffer)
+{
+    bool hasEncoding;
+    bool hasLength;
+    string_view encoding = trim(findHeader(buffer, HttpRequestView::TRANSFER_ENCODING, hasEncoding));
+    string_view length = trim(findHeader(buffer, HttpRequestView::CONTENT_LENGTH, hasLength));
+    bool toClose = readToClose || response;
+
+    //These responses have no body, whatever their headers say. An answer to HEAD has the headers the GET would have had.
+    if (response && (answering == HttpMessage::HEAD || statusCode < 200 || statusCode == 204 || statusCode == 304))
+    {
+        state = DONE;
+        return;
+    }
+
+    if (hasLength)
+    {
+        for (int i = 0; i < headerCount; i++)
+        {
+            string_view name = buffer.substr(headerNames[i].offset, headerNames[i].length);
+            string_view value = buffer.substr(headerValues[i].offset, headerValues[i].length);
+            if (equalsIgnoringCase(name, "content-length") && value != length)
+            {
+                fail();
+                return;
+            }
+        }
+    }
+    if (hasEncoding && hasLength) persistent = false;
+
+    //Several Transfer-Encoding headers make one list, in the order they came, so the last coding is in the last one.
+    for (int i = 0; hasEncoding && i < headerCount; i++)
+    {
+        string_view name = buffer.substr(headerNames[i].offset, headerNames[i].length);
+        if (equalsIgnoringCase(name, "transfer-encoding")) encoding = buffer.substr(headerValues[i].offset, headerValues[i].length);
+    }
+
+    if (hasEncoding)
+    {
+        chunked = endsInChunked(encoding);
+        if (chunked) state = CHUNK_SIZE;
+        else if (toClose) state = UNTIL_CLOSE;
+        else fail(); //we can't tell where a request body like this would end
+    }
+    else if (hasLength)
+    {
+        if (!parseNumber(length, 10, remaining)) fail();
+        else state = remaining > 0 ? BODY : DONE;
+        streamingBody = state == BODY && remaining > streamThreshold;
+    }
+    else state = toClose ? UNTIL_CLOSE : DONE;
+
+    if (response && state == UNTIL_CLOSE) persistent = false; //the server has to hang up to tell us where the body ends
+}
+
+/*
+* Chunked bodies look like this: a line with the chunk size in hex, the chunk itself, a blank line, and so on until
+* a chunk of size zero. After that come optional trailer headers and one last blank line. Returns false when the
+* rest of the line hasn't arrived yet.
+*/
+bool HttpParser::parseLine(string_view buffer)
+{
+    size_t newline = buffer.find('\n', position);
+    if (newline == string_view::npos || newline - position > 4096)
+    {
+        if (buffer.size() - position > 4096) fail(); //nobody needs a line this long
+        return false;
+    }
+
+    size_t start = position;
+    size_t end = newline > start && buffer[newline - 1] == '\r' ? newline - 1 : newline;
+    string_view text = buffer.substr(start, end - start);
+    position = newline + 1;
+
+    if (state == CHUNK_SIZE)
+    {
+        //chunk extensions come after a ; and we ignore them
+        if (!parseNumber(trim(text.substr(0, text.find(';'))), 16, remaining)) fail();
+        else state = remaining > 0 ? CHUNK_DATA : TRAILERS;
+    }
+    else if (state == CHUNK_END)
+    {
+        if (text.empty()) state = CHUNK_SIZE;
+        else fail();
+    }
+    else if (text.empty()) state = DONE; //the blank line after the trailers
+    else if (!streamingBody) //a streamed body's trailers get cut out of the buffer along with it, so there's no keeping them
+    {
+        HeaderLine line;
+        if (scanHeaders(text.data(), text.size(), &line, 1) != 1 || !addHeader(buffer, start, line)) fail();
+    }
+
+    return true;
+}
+
+/*
+* Tell the parser the stream has ended. Bodies that run until the connection closes are complete now. A head that
+* was copied in with parse() but never got its blank line is parsed as best we can, which is the forgiving behaviour
+* the old read loop had. Anything else that was cut off is an error.
+*/
+HttpParser::Status HttpParser::finish()
+{
+    if (state == HEAD && !owned.empty())
+    {
+        owned += "\r\n\r\n";
+        scan(owned);
+        persistent = false; //the stream is over, there won't be another request
+    }
+
+    if (state == UNTIL_CLOSE) state = DONE;
+    else if (state != DONE) fail();
+
+    return getStatus();
+}
+
+HttpParser::Status HttpParser::getStatus() const
+{
+    return state == DONE ? COMPLETE : state == FAILED ? ERROR : streamingBody ? STREAMING : NEED_MORE;
+}
+
+bool HttpParser::isReadingToClose() const
+{
+    return state == UNTIL_CLOSE;
+}
+
+//Whether the sender of the current message expects the connection to stay open afterwards.
+bool HttpParser::isPersistent() const
+{
+    return persistent;
+}
+
+//Whether the head of the message is still being put together, which is where a new parser starts out.
+bool HttpParser::isReadingHead() const
+{
+    return state == HEAD;
+}
+
+//How many bytes at the front of the buffer belong to the message. Only meaningful once it is complete.
+size_t HttpParser::getFrameLength() const
+{
+    return position;
+}
+
+/*
+* Point the view at the pieces of the message in the buffer. This must be the same buffer that was given to scan.
+*/
+void HttpParser::getView(string_view buffer, HttpRequestView& view) const
+{
+    auto piece = [buffer](Span span) { return buffer.substr(min(span.offset, buffer.size()), span.length); };
+
+    view.method = piece(method);
+    view.httpMethod = state == FAILED ? HttpMessage::ERROR : HttpMessage::getMethodFromString(view.method);
+    view.requestUri = piece(uri);
+    view.version = piece(version);
+    view.headerCount = headerCount;
+    for (int i = 0; i < headerCount; i++) view.headers[i] = {piece(headerNames[i]), piece(headerValues[i])};
+    memcpy(view.knownHeaders, knownHeaders, sizeof(knownHeaders));
+    view.body = streamingBody ? string_view() : chunked ? string_view(decoded) : piece(body);
+}
+
+//Hand over the finished message and get ready for the next one.
+HttpMessage HttpParser::takeMessage()
+{
+    HttpRequestView view;
+    getView(owned, view);
+    HttpMessage output = response ? view.toResponse(statusCode, getReason(owned)) : view.toMessage();
+    reset();
+    return output;
+}
+
+/*
+* Bodies bigger than size are streamed instead of waited for. By default nothing is, since a caller has to know to ask
+* for the body with readBody.
+*/
+void HttpParser::streamBodiesOver(size_t size)
+{
+    streamThreshold = size;
+}
+
+/*
+* Hand out the next piece of a streamed body. Chunk sizes and the line breaks between chunks are read past along the
+* way, so piece is only ever body. It points into buffer (or at the part of a chunked body that was stitched together
+* before it got too big), and is only good until the next call. It comes back empty when the next piece hasn't arrived.
+* Returns STREAMING while there's more to come, COMPLETE once piece is the last of it, or ERROR.
+*/
+HttpParser::Status HttpParser::readBody(string_view buffer, string_view& piece)
+{
+    piece = {};
+    if (!streamingBody) return getStatus();
+
+    if (decodedTaken) decoded.clear();
+    else if (!decoded.empty())
+    {
+        decodedTaken = true;
+        piece = decoded;
+        return getStatus();
+    }
+
+    while (piece.empty() && state != DONE && state != FAILED)
+    {
+        if (state == UNTIL_CLOSE) //it's over once finish is called, so everything that's in is body
+        {
+            piece = buffer.substr(min(position, buffer.size()));
+            position += piece.size();
+            break;
+        }
+        else if (state == BODY || state == CHUNK_DATA)
+        {
+            size_t take = min(remaining, buffer.size() - position);
+            if (take == 0) break;
+            piece = buffer.substr(position, take);
+            position += take;
+            remaining -= take;
+            if (remaining == 0) state = state == BODY ? DONE : CHUNK_END;
+        }
+        else if (!parseLine(buffer)) break; //we don't have the whole line yet
+    }
+    return getStatus();
+}
+
+/*
+* Forget every piece of a streamed body that has been handed out, so the caller can cut them out of its buffer. Returns
+* how many bytes to cut, starting at getBodyOffset. The head before them stays put, so views of it are still good.
+*/
+size_t HttpParser::dropBody()
+{
+    size_t output = position - body.offset;
+    position = body.offset;
+    return output;
+}
+
+/*
+* Read responses from now on, starting with the next one, and frame them for a request made with method. Pipelined
+* responses come back in the order the requests went out, so call this again after each reset with the next method.
+*/
+void HttpParser::expectResponseTo(HttpMessage::Method method)
+{
+    response = true;
+    answering = method;
+}
+
+//The status code of the response, ie: 404. 0 until the status line is in, and for requests.
+int HttpParser::getStatusCode() const
+{
+    return statusCode;
+}
+
+//The reason phrase after the status code, ie: "Not Found". It can be empty. This must be the buffer given to scan.
+string_view HttpParser::getReason(string_view buffer) const
+{
+    return buffer.substr(min(reason.offset, buffer.size()), reason.length);
+}
+
+//Where the body starts in the buffer, which is right after the blank line that ends the head.
+size_t HttpParser::getBodyOffset() const
+{
+    return body.offset;
+}
+
+//Forget the current message. Buffers keep their memory, so the next message can reuse it.
+void HttpParser::reset()
+{
+    state = HEAD;
+    persistent = false;
+    chunked = false;
+    streamingBody = false;
+    decodedTaken = false;
+    position = 0;
+    remaining = 0;
+    statusCode = 0;
+    method = uri = version = reason = body = {0, 0};
+    headerCount = 0;
+    memset(knownHeaders, 0, sizeof(knownHeaders));
+    decoded.clear();
+    owned.clear();
+}
+
+void HttpParser::fail()
+{
+    state = FAILED;
+    persistent = false; //after garbage we can't trust where the next request would start
+}
@@ -0,0 +1,106 @@
+#ifndef StiltFox_UniversalLibrary_HttpParser
+#define StiltFox_UniversalLibrary_HttpParser
+#include <string>
+#include <string_view>
+#include "HttpMessage.hpp"
+#include "HttpRequestView.hpp"
+
+struct HeaderLine;
+
+/*
+* The parser turns a stream of bytes into HttpMessages. Bytes can be handed to it in whatever sized pieces the
+* network happens to deliver, even one at a time, and it remembers where it left off between calls. Once the head
+* of the message is in, it uses Content-Length or Transfer-Encoding: chunked to find out where the body ends, so
+* it never has to guess based on how full a read was.
+*
+* Messages without either header have no body, unless the parser was built with readToClose, in which case the
+* body is everything until finish() is called. That is how HTTP responses without a length work. Requests never
+* work that way, so only a parser reading responses should be built with it.
+*
+* There are two ways to use it:
+* - parse() copies the bytes it is given into the parser, and takeMessage() hands back a finished HttpMessage.
+* - scan() reads a buffer that belongs to the caller, and getView() fills in an HttpRequestView that points into that
+*   buffer. Nothing is copied. The caller appends new bytes to the end of the buffer and calls scan again, and must
+*   not drop the front of the buffer until it calls reset(). The parser only remembers offsets, so it doesn't mind if
+*   the buffer moves around in memory as it grows.
+*
+* Bodies bigger than the limit given to streamBodiesOver aren't waited for. Once the head is in, scan says STREAMING,
+* and the body is handed out a piece at a time with readBody instead. The caller throws each piece away (dropBody says
+* how much to cut out of the buffer) once it's done with it, so a 1GB upload never has to be in memory all at once. A
+* chunked body doesn't say how big it is, so it's stitched together as usual until it grows past the limit, and so is
+* one that runs until the connection closes.
+*
+* After expectResponseTo, the parser reads responses instead of requests, for the client side. A response starts with
+* a status line ("HTTP/1.1 404 Not Found") rather than a request line, and its body is framed a little differently: an
+* answer to HEAD, a 1xx, a 204 and a 304 never have one, and one without a length runs until the server hangs up.
+*/
+class HttpParser
+{
+    public:
+    enum Status {NEED_MORE, COMPLETE, ERROR, STREAMING};
+
+    private:
+    enum State {HEAD, BODY, CHUNK_SIZE, CHUNK_DATA, CHUNK_END, TRAILERS, UNTIL_CLOSE, DONE, FAILED};
+
+    //a piece of the buffer, remembered by position so it survives the buffer being reallocated
+    struct Span
+    {
+        size_t offset;
+        size_t length;
+    };
+
+    State state;
+    bool readToClose;
+    bool response; //we're reading responses, not requests
+    HttpMessage::Method answering; //the method of the request the response is to
+    int statusCode;
+    bool persistent;
+    bool chunked;
+    bool streamingBody; //the body is too big to wait for, so it's being handed out with readBody
+    bool decodedTaken; //readBody has handed out what was in decoded already
+    size_t maxHeadSize;
+    size_t streamThreshold; //bodies bigger than this are streamed
+    size_t position; //how far into the buffer we have parsed
+    size_t remaining; //bytes left in the body or in the current chunk
+    Span method;
+    Span uri;
+    Span version;
+    Span reason; //responses only, ie: "Not Found"
+    Span headerNames[HttpRequestView::MAX_HEADERS];
+    Span headerValues[HttpRequestView::MAX_HEADERS];
+    int headerCount;
+    uint8_t knownHeaders[HttpRequestView::KNOWN_HEADER_COUNT]; //where the first of each known header is, plus one
+    Span body;
+    std::string decoded; //chunked bodies are stitched back together here, they can't be viewed in place
+    std::string owned; //the buffer parse() copies into
+
+    void parseHead(std::string_view buffer, size_t end);
+    bool parseStatusLine(std::string_view line);
+    bool parseLine(std::string_view buffer);
+    bool addHeader(std::string_view buffer, size_t blockStart, const HeaderLine& line);
+    std::string_view findHeader(std::string_view buffer, HttpRequestView::KnownHeader header, bool& found) const;
+    void startBody(std::string_view buffer);
+    void fail();
+
+    public:
+    HttpParser(bool readToClose = false, size_t maxHeadSize = 65536);
+    size_t parse(const char* data, size_t length);
+    Status scan(std::string_view buffer);
+    Status finish();
+    Status getStatus() const;
+    bool isReadingToClose() const;
+    bool isPersistent() const;
+    bool isReadingHead() const;
+    size_t getFrameLength() const;
+    void getView(std::string_view buffer, HttpRequestView& view) const;
+    HttpMessage takeMessage();
+    void streamBodiesOver(size_t size);
+    void expectResponseTo(HttpMessage::Method method);
+    int getStatusCode() const;
+    std::string_view getReason(std::string_view buffer) const;
+    Status readBody(std::string_view buffer, std::string_view& piece);
+    size_t dropBody();
+    size_t getBodyOffset() const;
+    void reset();
+};
+#endif
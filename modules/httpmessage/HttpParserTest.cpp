@@ -0,0 +1,445 @@
+#include <gtest/gtest.h>
+#include "HttpParser.hpp"
+
+TEST(HttpParser, parse_will_complete_a_request_fed_one_byte_at_a_time)
+{
+    //given we have a request with a body framed by content-length
+    std::string request = "POST /an_endpoint HTTP/1.1\r\ncontent-length: 15\r\n\r\nthis is my body";
+    HttpParser parser;
+
+    //when we feed it to the parser a single byte at a time
+    std::vector<HttpParser::Status> statuses;
+    for (char byte : request)
+    {
+        parser.parse(&byte, 1);
+        statuses.push_back(parser.getStatus());
+    }
+
+    //then it needs more data until the very last byte, and the message is complete
+    ASSERT_EQ(std::count(statuses.begin(), statuses.end() - 1, HttpParser::NEED_MORE), request.size() - 1);
+    ASSERT_EQ(statuses.back(), HttpParser::COMPLETE);
+    HttpMessage actual = parser.takeMessage();
+    ASSERT_EQ(actual.httpMethod, HttpMessage::POST);
+    ASSERT_EQ(actual.requestUri, "/an_endpoint");
+    ASSERT_EQ(actual.body, "this is my body");
+}
+
+TEST(HttpParser, parse_will_leave_bytes_after_the_content_length_for_the_next_request)
+{
+    //given we have two requests sent back to back
+    std::string requests = "POST /first HTTP/1.1\r\nContent-Length: 3\r\n\r\nabcGET /second HTTP/1.1\r\n\r\n";
+    HttpParser parser;
+
+    //when we parse the first one and then feed what's left over
+    size_t used = parser.parse(requests.data(), requests.size());
+    HttpMessage first = parser.takeMessage();
+    parser.parse(requests.data() + used, requests.size() - used);
+    HttpMessage second = parser.takeMessage();
+
+    //then each request gets only its own bytes
+    ASSERT_EQ(first.requestUri, "/first");
+    ASSERT_EQ(first.body, "abc");
+    ASSERT_EQ(second.httpMethod, HttpMessage::GET);
+    ASSERT_EQ(second.requestUri, "/second");
+    ASSERT_EQ(second.body, "");
+}
+
+TEST(HttpParser, parse_will_decode_a_chunked_body_and_its_trailers)
+{
+    //given we have a chunked request split awkwardly across reads
+    std::string request = "POST /upload HTTP/1.1\r\ntransfer-encoding: chunked\r\n\r\n"
+        "5;name=value\r\nhello\r\n7\r\n, world\r\n0\r\nchecksum: 1234\r\n\r\n";
+    HttpParser parser;
+
+    //when we feed it in pieces of seven bytes
+    for (size_t i = 0; i < request.size(); i += 7) parser.parse(request.data() + i, std::min((size_t)7, request.size() - i));
+
+    //then the body is put back together and the trailer shows up as a header
+    ASSERT_EQ(parser.getStatus(), HttpParser::COMPLETE);
+    HttpMessage actual = parser.takeMessage();
+    ASSERT_EQ(actual.body, "hello, world");
+    ASSERT_EQ(actual.headers["checksum"], "1234");
+}
+
+TEST(HttpParser, parse_will_complete_a_request_without_a_length_at_the_end_of_the_head)
+{
+    //given we have a request with no body headers
+    std::string request = "GET /an_endpoint HTTP/1.1\r\nhost: localhost\r\n\r\n";
+    HttpParser parser;
+
+    //when we parse it
+    parser.parse(request.data(), request.size());
+
+    //then it is complete without waiting for more data
+    ASSERT_EQ(parser.getStatus(), HttpParser::COMPLETE);
+}
+
+TEST(HttpParser, parse_will_report_an_error_for_an_invalid_content_length)
+{
+    //given we have a request with a content-length that is not a number
+    std::string request = "POST /an_endpoint HTTP/1.1\r\ncontent-length: lots\r\n\r\nbody";
+    HttpParser parser;
+
+    //when we parse it
+    parser.parse(request.data(), request.size());
+
+    //then the parser reports an error and the message is marked as one
+    ASSERT_EQ(parser.getStatus(), HttpParser::ERROR);
+    ASSERT_EQ(parser.takeMessage().httpMethod, HttpMessage::ERROR);
+}
+
+TEST(HttpParser, parse_will_report_an_error_for_an_invalid_chunk_size)
+{
+    //given we have a chunked request with a chunk size that is not hex
+    std::string request = "POST /an_endpoint HTTP/1.1\r\ntransfer-encoding: chunked\r\n\r\nzz\r\n";
+    HttpParser parser;
+
+    //when we parse it
+    parser.parse(request.data(), request.size());
+
+    //then the parser reports an error
+    ASSERT_EQ(parser.getStatus(), HttpParser::ERROR);
+}
+
+TEST(HttpParser, parse_will_report_an_error_for_content_lengths_that_disagree)
+{
+    //given one request that says its length twice the same way, and one that says two different lengths
+    std::string agreeing = "POST /an_endpoint HTTP/1.1\r\ncontent-length: 5\r\nContent-Length: 5\r\n\r\nhello";
+    std::string disagreeing = "POST /an_endpoint HTTP/1.1\r\ncontent-length: 5\r\ncontent-length: 50\r\n\r\nhello";
+    HttpParser first, second;
+
+    //when we parse them
+    first.parse(agreeing.data(), agreeing.size());
+    second.parse(disagreeing.data(), disagreeing.size());
+
+    //then the one that agrees with itself is fine, and the other can't be trusted
+    ASSERT_EQ(first.getStatus(), HttpParser::COMPLETE);
+    ASSERT_EQ(first.takeMessage().body, "hello");
+    ASSERT_EQ(second.getStatus(), HttpParser::ERROR);
+}
+
+TEST(HttpParser, parse_will_only_call_a_body_chunked_when_chunked_is_the_last_coding)
+{
+    //given requests whose transfer-encoding ends in chunked, ends in something that only looks like it, and has it first
+    std::string gzipped = "POST /a HTTP/1.1\r\ntransfer-encoding: gzip, Chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n";
+    std::string lookalike = "POST /a HTTP/1.1\r\ntransfer-encoding: xchunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n";
+    std::string notLast = "POST /a HTTP/1.1\r\ntransfer-encoding: chunked, gzip\r\n\r\n3\r\nabc\r\n0\r\n\r\n";
+    HttpParser first, second, third;
+
+    //when we parse them
+    first.parse(gzipped.data(), gzipped.size());
+    second.parse(lookalike.data(), lookalike.size());
+    third.parse(notLast.data(), notLast.size());
+
+    //then only the first is read as chunks, and a request body we can't find the end of is an error
+    ASSERT_EQ(first.getStatus(), HttpParser::COMPLETE);
+    ASSERT_EQ(first.takeMessage().body, "abc");
+    ASSERT_EQ(second.getStatus(), HttpParser::ERROR);
+    ASSERT_EQ(third.getStatus(), HttpParser::ERROR);
+}
+
+TEST(HttpParser, parse_will_read_several_transfer_encoding_headers_as_one_list)
+{
+    //given one request with chunked in its first transfer-encoding header and gzip in its second, and one the other way round
+    std::string chunkedFirst = "POST /a HTTP/1.1\r\ntransfer-encoding: chunked\r\ntransfer-encoding: gzip\r\n\r\n3\r\nabc\r\n0\r\n\r\n";
+    std::string chunkedLast = "POST /a HTTP/1.1\r\nTransfer-Encoding: gzip\r\ntransfer-encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n";
+    HttpParser first, second;
+
+    //when we parse them
+    first.parse(chunkedFirst.data(), chunkedFirst.size());
+    second.parse(chunkedLast.data(), chunkedLast.size());
+
+    //then, like "chunked, gzip", the first isn't chunked and can't be framed, and the second is read as chunks
+    ASSERT_EQ(first.getStatus(), HttpParser::ERROR);
+    ASSERT_EQ(second.getStatus(), HttpParser::COMPLETE);
+    ASSERT_EQ(second.takeMessage().body, "abc");
+}
+
+TEST(HttpParser, parse_will_close_the_connection_after_a_request_with_both_transfer_encoding_and_content_length)
+{
+    //given a request framed both ways, with what would be a second request hiding inside the chunked body
+    std::string request = "POST /a HTTP/1.1\r\ncontent-length: 4\r\ntransfer-encoding: chunked\r\n\r\n"
+        "16\r\nGET /smuggled HTTP/1.1\r\n0\r\n\r\n";
+    HttpParser parser;
+
+    //when we parse it
+    parser.parse(request.data(), request.size());
+
+    //then it's framed by its chunks, and nothing more is read from that connection
+    ASSERT_EQ(parser.getStatus(), HttpParser::COMPLETE);
+    ASSERT_FALSE(parser.isPersistent());
+    ASSERT_EQ(parser.takeMessage().body, "GET /smuggled HTTP/1.1");
+}
+
+TEST(HttpParser, parse_will_report_an_error_when_the_head_is_too_large)
+{
+    //given we have a parser that only accepts small heads
+    HttpParser parser(false, 64);
+    std::string request = "GET /an_endpoint HTTP/1.1\r\nheader: " + std::string(100, 'a');
+
+    //when we feed it a head longer than that
+    parser.parse(request.data(), request.size());
+
+    //then the parser gives up instead of buffering forever
+    ASSERT_EQ(parser.getStatus(), HttpParser::ERROR);
+}
+
+TEST(HttpParser, finish_will_report_an_error_when_the_body_was_cut_off)
+{
+    //given we have a request that promised more body than it sent
+    std::string request = "POST /an_endpoint HTTP/1.1\r\ncontent-length: 100\r\n\r\nshort";
+    HttpParser parser;
+    parser.parse(request.data(), request.size());
+
+    //when the stream ends
+    HttpParser::Status actual = parser.finish();
+
+    //then that is an error
+    ASSERT_EQ(actual, HttpParser::ERROR);
+}
+
+TEST(HttpParser, finish_will_end_a_body_that_reads_to_close)
+{
+    //given we have a parser that reads unframed bodies until the stream ends
+    std::string response = "GET /an_endpoint HTTP/1.1\r\nheader: value\r\n\r\nall of this is body";
+    HttpParser parser(true);
+    parser.parse(response.data(), response.size());
+
+    //when the stream ends
+    HttpParser::Status actual = parser.finish();
+
+    //then the body is everything after the head
+    ASSERT_EQ(actual, HttpParser::COMPLETE);
+    ASSERT_EQ(parser.takeMessage().body, "all of this is body");
+}
+
+TEST(HttpParser, isPersistent_will_follow_the_http_version_and_connection_header)
+{
+    //given we have requests from old and new clients, with and without a connection header
+    std::vector<std::string> requests = {"GET / HTTP/1.1\r\n\r\n", "GET / HTTP/1.1\r\nConnection: close\r\n\r\n",
+        "GET / HTTP/1.0\r\n\r\n", "GET / HTTP/1.0\r\nconnection: keep-alive\r\n\r\n"};
+    std::vector<bool> actual;
+
+    //when we parse each of them
+    for (const std::string& request : requests)
+    {
+        HttpParser parser;
+        parser.parse(request.data(), request.size());
+        actual.push_back(parser.isPersistent());
+    }
+
+    //then HTTP/1.1 stays open unless told to close, and HTTP/1.0 closes unless told to stay open
+    ASSERT_EQ(actual, (std::vector<bool>{true, false, false, true}));
+}
+
+TEST(HttpParser, getView_will_point_into_the_scanned_buffer_without_copying)
+{
+    //given we have a request that arrives in two pieces into a buffer we own
+    std::string buffer = "PATCH /items/7 HTTP/1.1\r\nHost: example\r\nContent-Le";
+    HttpParser parser;
+    HttpParser::Status first = parser.scan(buffer);
+    buffer += "ngth: 4\r\n\r\ndataGET /next HTTP/1.1\r\n\r\n";
+
+    //when we scan the rest and ask for a view
+    HttpParser::Status second = parser.scan(buffer);
+    HttpRequestView view;
+    parser.getView(buffer, view);
+
+    //then every piece of the view lives inside our buffer, and the next request is left alone
+    const char* start = buffer.data();
+    const char* end = buffer.data() + buffer.size();
+    ASSERT_EQ(first, HttpParser::NEED_MORE);
+    ASSERT_EQ(second, HttpParser::COMPLETE);
+    ASSERT_EQ(view.httpMethod, HttpMessage::PATCH);
+    ASSERT_EQ(view.requestUri, "/items/7");
+    ASSERT_EQ(view.version, "HTTP/1.1");
+    ASSERT_EQ(view.getHeader("host"), "example");
+    ASSERT_EQ(view.body, "data");
+    ASSERT_TRUE(view.requestUri.data() >= start && view.requestUri.data() < end);
+    ASSERT_TRUE(view.body.data() >= start && view.body.data() < end);
+    ASSERT_EQ(buffer.substr(parser.getFrameLength()), "GET /next HTTP/1.1\r\n\r\n");
+}
+
+TEST(HttpParser, readBody_will_hand_out_a_big_body_in_pieces_that_can_be_cut_out_of_the_buffer)
+{
+    //given a parser that streams bodies over 10 bytes, and a request whose 26 byte body arrives in two reads
+    std::string buffer = "PUT /file HTTP/1.1\r\ncontent-length: 26\r\n\r\nabcdefghijklm";
+    HttpParser parser;
+    parser.streamBodiesOver(10);
+
+    //when we scan it, take what's there, cut it out, and take the rest once it comes
+    HttpParser::Status head = parser.scan(buffer);
+    HttpRequestView view;
+    parser.getView(buffer, view);
+    std::string uri(view.requestUri);
+    bool noBody = view.body.empty();
+    std::string_view piece;
+    HttpParser::Status first = parser.readBody(buffer, piece);
+    std::string firstPiece(piece);
+    buffer.erase(parser.getBodyOffset(), parser.dropBody());
+    HttpParser::Status nothingYet = parser.readBody(buffer, piece);
+    bool emptyWhileWaiting = piece.empty();
+    buffer += "nopqrstuvwxyzGET /next HTTP/1.1\r\n\r\n";
+    HttpParser::Status last = parser.readBody(buffer, piece);
+
+    //then the head came first with no body, then the body in order, and the buffer only ever held what was new
+    ASSERT_EQ(head, HttpParser::STREAMING);
+    ASSERT_EQ(uri, "/file");
+    ASSERT_TRUE(noBody);
+    ASSERT_EQ(first, HttpParser::STREAMING);
+    ASSERT_EQ(firstPiece, "abcdefghijklm");
+    ASSERT_EQ(nothingYet, HttpParser::STREAMING);
+    ASSERT_TRUE(emptyWhileWaiting);
+    ASSERT_EQ(last, HttpParser::COMPLETE);
+    ASSERT_EQ(piece, "nopqrstuvwxyz");
+    ASSERT_EQ(buffer.substr(parser.getFrameLength()), "GET /next HTTP/1.1\r\n\r\n");
+}
+
+TEST(HttpParser, readBody_will_stream_a_chunked_body_once_it_outgrows_the_limit)
+{
+    //given a parser that streams bodies over 8 bytes, a small chunked body and a big one
+    std::string small = "POST / HTTP/1.1\r\ntransfer-encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n";
+    std::string big = "POST / HTTP/1.1\r\ntransfer-encoding: chunked\r\n\r\n5\r\nhello\r\n7\r\n, world\r\n3\r\n!!!\r\n0\r\nx-sum: 1\r\n\r\n";
+    HttpParser smallParser, bigParser;
+    smallParser.streamBodiesOver(8);
+    bigParser.streamBodiesOver(8);
+
+    //when we scan both and read the big one's body
+    HttpParser::Status smallStatus = smallParser.scan(small);
+    HttpParser::Status bigStatus = bigParser.scan(big);
+    std::string body;
+    std::string_view piece;
+    HttpParser::Status status;
+    do
+    {
+        status = bigParser.readBody(big, piece);
+        body += piece;
+    } while (status == HttpParser::STREAMING && !piece.empty());
+
+    //then the small one is read whole as always, and the big one comes out without its framing
+    ASSERT_EQ(smallStatus, HttpParser::COMPLETE);
+    ASSERT_EQ(bigStatus, HttpParser::STREAMING);
+    ASSERT_EQ(status, HttpParser::COMPLETE);
+    ASSERT_EQ(body, "hello, world!!!");
+    ASSERT_EQ(bigParser.getFrameLength(), big.size());
+}
+
+TEST(HttpParser, readBody_will_stream_a_response_that_runs_until_the_server_hangs_up)
+{
+    //given a parser streaming every body, and a response with no length whose body arrives in two parts
+    std::string buffer = "HTTP/1.0 200 OK\r\n\r\nfirst ";
+    HttpParser parser;
+    parser.streamBodiesOver(0);
+    parser.expectResponseTo(HttpMessage::GET);
+
+    //when we read what's there, cut it out, read the rest once it comes, and then the server hangs up
+    HttpParser::Status head = parser.scan(buffer);
+    std::string_view piece;
+    HttpParser::Status first = parser.readBody(buffer, piece);
+    std::string body(piece);
+    buffer.erase(parser.getBodyOffset(), parser.dropBody());
+    buffer += "second";
+    parser.readBody(buffer, piece);
+    body += piece;
+    buffer.erase(parser.getBodyOffset(), parser.dropBody());
+    HttpParser::Status ended = parser.finish();
+    HttpParser::Status last = parser.readBody(buffer, piece);
+
+    //then the body came out as it arrived, and it's complete once the connection is closed
+    ASSERT_EQ(head, HttpParser::STREAMING);
+    ASSERT_EQ(first, HttpParser::STREAMING);
+    ASSERT_EQ(body, "first second");
+    ASSERT_EQ(ended, HttpParser::COMPLETE);
+    ASSERT_EQ(last, HttpParser::COMPLETE);
+    ASSERT_TRUE(piece.empty());
+    ASSERT_FALSE(parser.isPersistent());
+}
+
+TEST(HttpParser, toMessage_will_copy_a_view_into_an_owning_message)
+{
+    //given we have a view of a request in a buffer
+    std::string buffer = "POST /an_endpoint HTTP/1.1\r\nheader: some_value\r\ncontent-length: 15\r\n\r\nthis is my body";
+    HttpParser parser;
+    parser.scan(buffer);
+    HttpRequestView view;
+    parser.getView(buffer, view);
+
+    //when we turn it into a message and throw the buffer away
+    HttpMessage actual = view.toMessage();
+    buffer.assign(buffer.size(), 'x');
+
+    //then the message still has everything
+    ASSERT_EQ(actual, HttpMessage(HttpMessage::POST, "/an_endpoint", {{"header","some_value"},{"content-length","15"}}, "this is my body"));
+}
+
+TEST(HttpParser, getView_will_put_known_headers_in_their_own_slots)
+{
+    //given a request with known headers in mixed case, a repeated one, and one we don't know
+    std::string buffer = "GET / HTTP/1.1\r\nHOST: example\r\nX-Custom: mine\r\nUser-Agent: first\r\nuser-agent: second\r\n\r\n";
+    HttpParser parser;
+    parser.scan(buffer);
+    HttpRequestView view;
+    parser.getView(buffer, view);
+
+    //when we look them up by slot and by name
+    //then the first of each known header is in its slot, and names still work for every header
+    ASSERT_EQ(view.getHeader(HttpRequestView::HOST), "example");
+    ASSERT_EQ(view.getHeader(HttpRequestView::USER_AGENT), "first");
+    ASSERT_FALSE(view.hasHeader(HttpRequestView::CONTENT_LENGTH));
+    ASSERT_EQ(view.getHeader(HttpRequestView::CONTENT_LENGTH), "");
+    ASSERT_EQ(view.getHeader("Host"), "example");
+    ASSERT_EQ(view.getHeader("x-custom"), "mine");
+    ASSERT_EQ(HttpRequestView::findKnownHeader("Transfer-Encoding"), HttpRequestView::TRANSFER_ENCODING);
+    ASSERT_EQ(HttpRequestView::findKnownHeader("x-custom"), HttpRequestView::UNKNOWN_HEADER);
+    ASSERT_EQ(HttpRequestView::getKnownHeaderName(HttpRequestView::IF_NONE_MATCH), "if-none-match");
+}
+
+TEST(HttpParser, expectResponseTo_will_read_pipelined_responses_framed_the_way_responses_are)
+{
+    //given responses to a GET, a HEAD with a length but no body, a 204, and a GET without a length, all back to back
+    std::string buffer = "HTTP/1.1 404 Not Found\r\ncontent-length: 4\r\n\r\nnope"
+        "HTTP/1.1 200 OK\r\ncontent-length: 1000\r\n\r\n"
+        "HTTP/1.1 204\r\n\r\n"
+        "HTTP/1.0 200 OK\r\n\r\nuntil the end";
+    HttpMessage::Method methods[] = {HttpMessage::GET, HttpMessage::HEAD, HttpMessage::GET, HttpMessage::GET};
+    HttpParser parser;
+    std::vector<HttpMessage> actual;
+    std::vector<bool> persistent;
+
+    //when we read them one after another, telling the parser what each one answers
+    for (HttpMessage::Method method : methods)
+    {
+        parser.expectResponseTo(method);
+        HttpParser::Status status = parser.scan(buffer);
+        if (status == HttpParser::NEED_MORE) status = parser.finish();
+        ASSERT_EQ(status, HttpParser::COMPLETE);
+        HttpRequestView view;
+        parser.getView(buffer, view);
+        actual.push_back(view.toResponse(parser.getStatusCode(), parser.getReason(buffer)));
+        persistent.push_back(parser.isPersistent());
+        buffer.erase(0, parser.getFrameLength());
+        parser.reset();
+    }
+
+    //then each has its status, reason and body, and only the one without a length can't be followed by another
+    ASSERT_EQ(actual[0], HttpMessage(404, {{"content-length", "4"}}, "nope", "Not Found"));
+    ASSERT_EQ(actual[1], HttpMessage(200, {{"content-length", "1000"}}, "", "OK"));
+    ASSERT_EQ(actual[2].statusCode, 204);
+    ASSERT_EQ(actual[2].statusReason, "No Content"); //a missing reason gets the usual one
+    ASSERT_EQ(actual[3].body, "until the end");
+    ASSERT_EQ(persistent, (std::vector<bool>{true, true, true, false}));
+}
+
+TEST(HttpParser, expectResponseTo_will_reject_a_status_line_that_is_not_one)
+{
+    //given a request where a response should be
+    std::string buffer = "GET / HTTP/1.1\r\n\r\n";
+    HttpParser parser;
+    parser.expectResponseTo(HttpMessage::GET);
+
+    //when we scan it
+    HttpParser::Status actual = parser.scan(buffer);
+
+    //then it's an error
+    ASSERT_EQ(actual, HttpParser::ERROR);
+}
@@ -0,0 +1,79 @@
+#include <strings.h>
+#include <array>
+#include "HttpRequestView.hpp"
+#include "PerfectHash.hpp"
+
+using namespace std;
+
+//The names of the known headers, in the same order as the KnownHeader enum. The hash is worked out while compiling.
+constexpr array<string_view, HttpRequestView::KNOWN_HEADER_COUNT> KNOWN_HEADER_NAMES = {"host", "content-length",
+    "content-type", "transfer-encoding", "connection", "accept", "accept-encoding", "accept-language", "user-agent",
+    "cookie", "authorization", "cache-control", "expect", "upgrade", "if-none-match", "if-modified-since", "range",
+    "origin", "referer", "x-forwarded-for"};
+constexpr PerfectHash<HttpRequestView::KNOWN_HEADER_COUNT, 64> KNOWN_HEADER_HASH(KNOWN_HEADER_NAMES);
+static_assert(KNOWN_HEADER_HASH.find("Content-Length") == HttpRequestView::CONTENT_LENGTH);
+
+//Which known header this is, ignoring case, or UNKNOWN_HEADER if it isn't one.
+HttpRequestView::KnownHeader HttpRequestView::findKnownHeader(string_view name)
+{
+    int index = KNOWN_HEADER_HASH.find(name);
+    return index < 0 ? UNKNOWN_HEADER : (KnownHeader)index;
+}
+
+string_view HttpRequestView::getKnownHeaderName(KnownHeader header)
+{
+    return header >= HOST && header < KNOWN_HEADER_COUNT ? KNOWN_HEADER_NAMES[header] : "";
+}
+
+//Header names ignore case, so we compare them with strncasecmp once we know the lengths match.
+inline bool sameName(string_view left, string_view right)
+{
+    return left.size() == right.size() && strncasecmp(left.data(), right.data(), left.size()) == 0;
+}
+
+bool HttpRequestView::hasHeader(KnownHeader header) const
+{
+    return header >= HOST && header < KNOWN_HEADER_COUNT && knownHeaders[header] > 0;
+}
+
+string_view HttpRequestView::getHeader(KnownHeader header) const
+{
+    return hasHeader(header) ? headers[knownHeaders[header] - 1].value : string_view();
+}
+
+//A known header goes straight to its spot. Anything else has to be looked for.
+bool HttpRequestView::hasHeader(string_view name) const
+{
+    KnownHeader known = findKnownHeader(name);
+    if (known != UNKNOWN_HEADER) return hasHeader(known);
+    for (int i = 0; i < headerCount; i++) if (sameName(headers[i].name, name)) return true;
+    return false;
+}
+
+//returns the value of the first header with this name, or an empty view if there isn't one.
+string_view HttpRequestView::getHeader(string_view name) const
+{
+    KnownHeader known = findKnownHeader(name);
+    if (known != UNKNOWN_HEADER) return getHeader(known);
+    for (int i = 0; i < headerCount; i++) if (sameName(headers[i].name, name)) return headers[i].value;
+    return {};
+}
+
+/*
+* Copy everything out of the buffer into a message of its own. This is where the allocations we've been avoiding
+* finally happen, so only do it when the request needs to outlive the buffer.
+*/
+HttpMessage HttpRequestView::toMessage() const
+{
+    HttpMessage output(httpMethod, string(requestUri), {}, string(body));
+    for (int i = 0; i < headerCount; i++) output.headers.add(string(headers[i].name), string(headers[i].value));
+    return output;
+}
+
+//The same thing for a response the parser read on the client side, which has a status where a request has its method.
+HttpMessage HttpRequestView::toResponse(int statusCode, string_view reason) const
+{
+    HttpMessage output(statusCode, {}, string(body), string(reason));
+    for (int i = 0; i < headerCount; i++) output.headers.add(string(headers[i].name), string(headers[i].value));
+    return output;
+}
@@ -0,0 +1,50 @@
+#ifndef StiltFox_UniversalLibrary_HttpRequestView
+#define StiltFox_UniversalLibrary_HttpRequestView
+#include <cstdint>
+#include <string_view>
+#include "HttpMessage.hpp"
+
+/*
+* An HttpRequestView is a read only look at a request that is still sitting in the buffer it was read into. A
+* string_view is just a pointer and a length, so filling one in copies nothing and allocates nothing. The catch is
+* that the view is only good for as long as the buffer is: once the connection moves on to the next request the
+* view points at garbage. A handler that wants to hang on to the request should call toMessage to get its own copy.
+*/
+struct HttpRequestView
+{
+    struct Header
+    {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    static const int MAX_HEADERS = 64; //requests with more headers than this are rejected
+
+    /*
+    * Headers that nearly every request has, or that the server looks at itself. The parser spots these with one hash
+    * each as it reads the head, and writes down where they are in knownHeaders. Asking for one, like
+    * getHeader(HttpRequestView::CONTENT_LENGTH), goes straight to its spot instead of comparing it to every header.
+    */
+    enum KnownHeader {HOST, CONTENT_LENGTH, CONTENT_TYPE, TRANSFER_ENCODING, CONNECTION, ACCEPT, ACCEPT_ENCODING,
+        ACCEPT_LANGUAGE, USER_AGENT, COOKIE, AUTHORIZATION, CACHE_CONTROL, EXPECT, UPGRADE, IF_NONE_MATCH,
+        IF_MODIFIED_SINCE, RANGE, ORIGIN, REFERER, X_FORWARDED_FOR, KNOWN_HEADER_COUNT, UNKNOWN_HEADER = KNOWN_HEADER_COUNT};
+
+    HttpMessage::Method httpMethod = HttpMessage::NONE;
+    std::string_view method; //the method as it was written, ie: "GET"
+    std::string_view requestUri;
+    std::string_view version; //ie: "HTTP/1.1"
+    Header headers[MAX_HEADERS]; //headers in the order they were sent. Only the first headerCount are filled in.
+    int headerCount = 0;
+    uint8_t knownHeaders[KNOWN_HEADER_COUNT] = {}; //where the first of each known header is in headers, plus one. 0 if there isn't one.
+    std::string_view body;
+
+    static KnownHeader findKnownHeader(std::string_view name);
+    static std::string_view getKnownHeaderName(KnownHeader header);
+    bool hasHeader(std::string_view name) const;
+    bool hasHeader(KnownHeader header) const;
+    std::string_view getHeader(std::string_view name) const;
+    std::string_view getHeader(KnownHeader header) const;
+    HttpMessage toMessage() const;
+    HttpMessage toResponse(int statusCode, std::string_view reason) const;
+};
+#endif
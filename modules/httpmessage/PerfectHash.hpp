@@ -0,0 +1,80 @@
+#ifndef StiltFox_UniversalLibrary_PerfectHash
+#define StiltFox_UniversalLibrary_PerfectHash
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/*
+* A perfect hash is a hash function picked for one fixed list of names, so that no two of them land in the same slot.
+* Looking a name up is then one hash, one slot, and one comparison to make sure it really is that name and not
+* something else that happened to hash there. There's no chain of collisions to walk and nothing to allocate.
+*
+* Everything in here is constexpr, which means the compiler can run it while it compiles. Declare a PerfectHash as
+* constexpr and the search for a seed that spreads the names out happens at compile time, and the finished table is
+* baked into the program. If the compiler can't find one, the program doesn't compile, so a bad table can never ship.
+*
+* Names are hashed without regard to case, since header names don't care about case. Methods do, so find can be told
+* to compare them exactly.
+*/
+constexpr char toLowerAscii(char letter)
+{
+    return letter >= 'A' && letter <= 'Z' ? letter + ('a' - 'A') : letter;
+}
+
+/*
+* FNV-1a, with the seed in place of the usual starting value. The low bits of a multiply only depend on the low bits
+* going in, so the high bits are folded down at the end. Otherwise the slot would only ever depend on the last few bits
+* of each letter, and changing the seed wouldn't help.
+*/
+constexpr uint32_t hashName(std::string_view name, uint32_t seed)
+{
+    uint32_t output = seed;
+    for (char letter : name) output = (output ^ (unsigned char)toLowerAscii(letter)) * 16777619u;
+    return output ^ (output >> 16);
+}
+
+constexpr bool equalsIgnoringCase(std::string_view left, std::string_view right)
+{
+    if (left.size() != right.size()) return false;
+    for (size_t i = 0; i < left.size(); i++) if (toLowerAscii(left[i]) != toLowerAscii(right[i])) return false;
+    return true;
+}
+
+//SLOTS has to be a power of two, so picking a slot is a mask instead of a division.
+template<size_t COUNT, size_t SLOTS>
+struct PerfectHash
+{
+    static_assert(SLOTS >= COUNT && (SLOTS & (SLOTS - 1)) == 0, "there has to be a power of two slots, and enough of them");
+
+    std::array<std::string_view, COUNT> names;
+    uint32_t seed = 2166136261u;
+    std::array<uint8_t, SLOTS> slots{}; //which name is in each slot, plus one. 0 is an empty slot.
+
+    //Try seeds until one puts every name in a slot of its own.
+    constexpr PerfectHash(const std::array<std::string_view, COUNT>& tableNames) : names(tableNames)
+    {
+        for (bool clash = true; clash; seed++)
+        {
+            clash = false;
+            slots.fill(0);
+            for (size_t i = 0; i < COUNT && !clash; i++)
+            {
+                uint8_t& slot = slots[hashName(names[i], seed) & (SLOTS - 1)];
+                clash = slot != 0;
+                slot = i + 1;
+            }
+            if (!clash) return;
+        }
+    }
+
+    //The position of the name in the list, or -1 if it isn't one of ours.
+    constexpr int find(std::string_view name, bool ignoreCase = true) const
+    {
+        int index = slots[hashName(name, seed) & (SLOTS - 1)] - 1;
+        if (index < 0) return -1;
+        bool same = ignoreCase ? equalsIgnoringCase(names[index], name) : names[index] == name;
+        return same ? index : -1;
+    }
+};
+#endif
@@ -0,0 +1,290 @@
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <thread>
+#include "LoadGenerator.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+const milliseconds RETRY_DELAY(10); //how long a client waits after an error, so a dead server doesn't get hammered
+
+void LoadReport::add(const LoadReport& other)
+{
+    latencies.add(other.latencies);
+    completed += other.completed;
+    errors += other.errors;
+    badStatuses += other.badStatuses;
+    unsent += other.unsent;
+    seconds = max(seconds, other.seconds);
+}
+
+double LoadReport::getRequestsPerSecond() const
+{
+    return seconds > 0 ? completed / seconds : 0;
+}
+
+string LoadReport::print() const
+{
+    char line[160];
+    snprintf(line, sizeof(line), "%llu requests in %.2fs, %.1f requests/s\n", (unsigned long long)completed, seconds,
+             getRequestsPerSecond());
+    string output = line;
+    snprintf(line, sizeof(line), "%llu errors, %llu responses of 400 or more, %llu requests never sent\n",
+             (unsigned long long)errors, (unsigned long long)badStatuses, (unsigned long long)unsent);
+    output += line;
+    return output + "latency:\n" + latencies.printSummary("us");
+}
+
+/*
+* The request is printed once up front. We fill in the headers a server will want if the caller didn't: host, the
+* body's length, and connection: close when we plan to hang up after every request.
+*/
+LoadGenerator::LoadGenerator(LoadOptions loadOptions) : options(loadOptions), target(loadOptions.host, loadOptions.port)
+{
+    HttpMessage message = options.request;
+    if (!message.hasHeader("host")) message.headers["host"] = options.host + ":" + to_string(options.port);
+    if (!message.body.empty() && !message.hasHeader("content-length"))
+    {
+        message.headers["content-length"] = to_string(message.body.size());
+    }
+    if (!options.keepAlive) message.headers["connection"] = "close";
+    request = message.printAsRequest();
+}
+
+/*
+* The connections (and the rate, for an open loop) are split evenly between the threads. Each thread fills in a report
+* of its own, and they're added up at the end.
+*/
+LoadReport LoadGenerator::run()
+{
+    int connections = max(options.connections, 1);
+    int threads = clamp(options.threads, 1, connections);
+    vector<LoadReport> reports(threads);
+    vector<thread> workers;
+
+    for (int i = 0; i < threads; i++)
+    {
+        int share = connections / threads + (i < connections % threads ? 1 : 0);
+        workers.emplace_back(&LoadGenerator::runWorker, this, share, options.rate * share / connections, &reports[i]);
+    }
+
+    LoadReport output;
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i].join();
+        output.add(reports[i]);
+    }
+    return output;
+}
+
+/*
+* One thread's loop. Each time around we:
+* 1. work out which requests are due (open loop only),
+* 2. hand them to idle clients,
+* 3. sleep in epoll_wait until a socket is ready or the next request is due, and deal with whatever woke us up.
+*
+* In a closed loop a request is "due" the moment a client is free to send it.
+*/
+void LoadGenerator::runWorker(int connections, double rate, LoadReport* report)
+{
+    Worker worker{epoll_create1(0), vector<Client>(connections), {}, report};
+    for (int i = 0; i < connections; i++)
+    {
+        worker.clients[i].index = i;
+        worker.idle.push_back(i);
+    }
+
+    auto start = steady_clock::now();
+    auto end = start + milliseconds(options.duration);
+    auto interval = rate > 0 ? duration_cast<steady_clock::duration>(duration<double>(1 / rate)) : steady_clock::duration::zero();
+    auto nextDue = start;
+    deque<steady_clock::time_point> backlog; //requests that are due but haven't found a free client yet
+    epoll_event events[256];
+
+    for (auto now = start; now < end; now = steady_clock::now())
+    {
+        if (rate > 0) for (; nextDue <= now && nextDue < end; nextDue += interval) backlog.push_back(nextDue);
+
+        auto wakeAt = rate > 0 ? min(nextDue, end) : end;
+        for (size_t i = 0; i < worker.idle.size() && (rate == 0 || !backlog.empty());)
+        {
+            Client& client = worker.clients[worker.idle[i]];
+            if (client.retryAt > now) wakeAt = min(wakeAt, client.retryAt);
+            else if (dispatch(worker, client, rate > 0 ? backlog.front() : now))
+            {
+                if (rate > 0) backlog.pop_front();
+                worker.idle[i] = worker.idle.back();
+                worker.idle.pop_back();
+                continue;
+            }
+            else wakeAt = min(wakeAt, client.retryAt);
+            i++;
+        }
+
+        int timeout = (int)ceil<milliseconds>(max(wakeAt - steady_clock::now(), steady_clock::duration::zero())).count();
+        int ready = epoll_wait(worker.poller, events, 256, timeout);
+        for (int i = 0; i < ready; i++)
+        {
+            Client& client = worker.clients[events[i].data.u32];
+            if (client.state == CONNECTING)
+            {
+                int error = 0;
+                socklen_t size = sizeof(error);
+                if (getsockopt(client.handle, SOL_SOCKET, SO_ERROR, &error, &size) < 0 || error != 0) fail(worker, client);
+                else
+                {
+                    client.state = SENDING;
+                    writeRequest(worker, client);
+                }
+            }
+            else if (client.state == SENDING) writeRequest(worker, client);
+            else readResponse(worker, client);
+        }
+    }
+
+    //whatever is still in flight when time runs out isn't counted either way
+    report->unsent = backlog.size();
+    report->seconds = duration<double>(steady_clock::now() - start).count();
+    for (Client& client : worker.clients) hangUp(client);
+    close(worker.poller);
+}
+
+/*
+* Start the request that was due at the given time on this client, connecting first if it isn't connected. Returns
+* false if the client couldn't take it.
+*/
+bool LoadGenerator::dispatch(Worker& worker, Client& client, steady_clock::time_point due)
+{
+    client.due = due;
+    client.sent = 0;
+    client.parser.expectResponseTo(options.request.httpMethod); //so an answer to HEAD isn't waited on for a body
+
+    if (client.state == DISCONNECTED)
+    {
+        client.handle = target.connectHandle(false);
+        if (client.handle < 0)
+        {
+            fail(worker, client);
+            return false;
+        }
+        client.state = CONNECTING;
+        watch(worker, client, EPOLLOUT); //a connection becomes writable once it's been made
+        return true;
+    }
+
+    client.state = SENDING;
+    writeRequest(worker, client);
+    return true;
+}
+
+void LoadGenerator::writeRequest(Worker& worker, Client& client)
+{
+    while (client.sent < request.size())
+    {
+        ssize_t written = send(client.handle, request.data() + client.sent, request.size() - client.sent, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) watch(worker, client, EPOLLOUT);
+            else fail(worker, client);
+            return;
+        }
+        client.sent += written;
+    }
+
+    client.state = WAITING;
+    watch(worker, client, EPOLLIN);
+}
+
+/*
+* Read what the server sent and let the parser tell us when the response is whole. An idle connection being readable
+* means the server hung up on it (it's allowed to close keep-alive connections whenever it likes), so we just close
+* our end too and connect again on the next request.
+*/
+void LoadGenerator::readResponse(Worker& worker, Client& client)
+{
+    char buffer[65536];
+    while (true)
+    {
+        ssize_t readBytes = recv(client.handle, buffer, sizeof(buffer), 0);
+        if (readBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (client.state != WAITING)
+        {
+            hangUp(client);
+            return;
+        }
+        if (readBytes == 0 && client.parser.isReadingToClose() && client.parser.finish() == HttpParser::COMPLETE)
+        {
+            finishRequest(worker, client); //the body ran until the server hung up, which is how it told us it was done
+            return;
+        }
+        if (readBytes <= 0)
+        {
+            fail(worker, client);
+            return;
+        }
+
+        client.inbound.append(buffer, readBytes);
+        HttpParser::Status status = client.parser.scan(client.inbound);
+        if (status == HttpParser::ERROR) fail(worker, client);
+        if (status != HttpParser::NEED_MORE)
+        {
+            if (status == HttpParser::COMPLETE) finishRequest(worker, client);
+            return;
+        }
+    }
+}
+
+//The response is in. Time it, and get the client ready for the next one.
+void LoadGenerator::finishRequest(Worker& worker, Client& client)
+{
+    LoadReport& report = *worker.report;
+    report.latencies.record(duration_cast<microseconds>(steady_clock::now() - client.due).count());
+    report.completed++;
+    if (client.parser.getStatusCode() >= 400) report.badStatuses++;
+
+    bool reuse = options.keepAlive && client.parser.isPersistent();
+    client.parser.reset();
+    client.inbound.clear();
+    if (reuse)
+    {
+        client.state = IDLE;
+        watch(worker, client, EPOLLIN); //so we notice if the server hangs up on us
+    }
+    else hangUp(client);
+    worker.idle.push_back(client.index);
+}
+
+//Count the error, drop the connection and let the client rest a moment before it tries again.
+void LoadGenerator::fail(Worker& worker, Client& client)
+{
+    bool wasBusy = client.state != DISCONNECTED && client.state != IDLE;
+    worker.report->errors++;
+    hangUp(client);
+    client.retryAt = steady_clock::now() + RETRY_DELAY;
+    if (wasBusy) worker.idle.push_back(client.index);
+}
+
+void LoadGenerator::watch(Worker& worker, Client& client, uint32_t events)
+{
+    epoll_event event{};
+    event.events = events;
+    event.data.u32 = client.index;
+    epoll_ctl(worker.poller, client.watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, client.handle, &event);
+    client.watched = true;
+}
+
+//Closing a handle also takes it out of epoll.
+void LoadGenerator::hangUp(Client& client)
+{
+    if (client.handle > -1) close(client.handle);
+    client.handle = -1;
+    client.watched = false;
+    client.state = DISCONNECTED;
+    client.parser.reset();
+    client.inbound.clear();
+}
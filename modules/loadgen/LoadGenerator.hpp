@@ -0,0 +1,98 @@
+#ifndef StiltFox_UniversalLibrary_LoadGenerator
+#define StiltFox_UniversalLibrary_LoadGenerator
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Histogram.hpp"
+#include "HttpMessage.hpp"
+#include "HttpParser.hpp"
+#include "Socket.hpp"
+
+/*
+* What the load generator should do. There are two ways to drive a server:
+*
+* Closed loop (rate = 0): every connection sends a request, waits for the answer, and sends the next one right away.
+* This finds out how many requests per second the server can take, but the latencies it reports are too kind: while
+* the server is stuck, the clients are stuck waiting with it and don't send anything, so the requests that *would*
+* have been sent during the stall never get timed. That's called coordinated omission.
+*
+* Open loop (rate > 0): requests are due at a fixed rate, whether the server keeps up or not, like real users who
+* don't know about each other. Each request is timed from when it was *due*, not from when a connection was free to
+* send it, so time spent stuck behind a slow server counts against the server like it should.
+*/
+struct LoadOptions
+{
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    HttpMessage request = HttpMessage(HttpMessage::GET, "/");
+    int connections = 64;
+    int threads = 1;
+    bool keepAlive = true; //false opens a new connection for every request
+    double rate = 0; //requests per second over all connections, 0 for as fast as the server answers
+    int duration = 10000; //milliseconds
+};
+
+struct LoadReport
+{
+    Histogram latencies = Histogram(60000000); //microseconds, up to a minute
+    uint64_t completed = 0; //responses that came back whole
+    uint64_t errors = 0; //connections that couldn't be made or broke part way through a request
+    uint64_t badStatuses = 0; //responses with a status of 400 or more
+    uint64_t unsent = 0; //open loop only: requests that were due but never got a connection before time ran out
+    double seconds = 0;
+
+    void add(const LoadReport& other);
+    double getRequestsPerSecond() const;
+    std::string print() const;
+};
+
+/*
+* A load generator built on the client side of Socket. Each thread runs its own epoll loop over its share of the
+* connections, so one machine can keep thousands of requests in flight without a thread per connection. Its numbers
+* are only as good as the machine it runs on: running it next to the server means the two fight over the same CPUs.
+*/
+class LoadGenerator
+{
+    enum State {DISCONNECTED, CONNECTING, SENDING, WAITING, IDLE};
+
+    struct Client
+    {
+        uint32_t index; //where the client is in its worker's list. epoll hands this back to us.
+        int handle = -1;
+        State state = DISCONNECTED;
+        bool watched = false; //whether the handle has been added to epoll yet
+        size_t sent = 0; //how much of the request has gone out
+        std::chrono::steady_clock::time_point due; //when the current request was due. Latency is measured from here.
+        std::chrono::steady_clock::time_point retryAt; //after an error, the client rests until this time
+        HttpParser parser;
+        std::string inbound;
+    };
+
+    //everything one thread works with. Nothing in here is shared with the other threads.
+    struct Worker
+    {
+        int poller;
+        std::vector<Client> clients;
+        std::vector<uint32_t> idle; //clients that are free to send the next request
+        LoadReport* report;
+    };
+
+    LoadOptions options;
+    std::string request; //the request, already printed, so it isn't printed again for every send
+    Socket target;
+
+    void runWorker(int connections, double rate, LoadReport* report);
+    bool dispatch(Worker& worker, Client& client, std::chrono::steady_clock::time_point due);
+    void writeRequest(Worker& worker, Client& client);
+    void readResponse(Worker& worker, Client& client);
+    void finishRequest(Worker& worker, Client& client);
+    void fail(Worker& worker, Client& client);
+    void watch(Worker& worker, Client& client, uint32_t events);
+    void hangUp(Client& client);
+
+    public:
+    LoadGenerator(LoadOptions options);
+    LoadReport run();
+};
+#endif
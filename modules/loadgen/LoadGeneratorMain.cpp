@@ -0,0 +1,106 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "LoadGenerator.hpp"
+
+/*
+* A command line front end for the load generator, so the server can be benchmarked without installing anything else.
+*
+* Usage: loadgen [options] [host:port/path]
+*   -c <connections>   connections to keep open (default 64)
+*   -t <threads>       threads to spread them over (default 1)
+*   -d <seconds>       how long to run for (default 10)
+*   -r <rate>          requests per second to send no matter what (open loop). Leave it out to go as fast as the
+*                      server answers (closed loop).
+*   -m <method>        the method to use (default GET)
+*   -b <body>          a body to send with every request
+*   -H "name: value"   a header to send with every request. Can be given more than once.
+*   -n                 open a new connection for every request instead of keeping them alive
+*
+* For example, to see how testsocket's latency holds up at 20000 requests per second:
+*   loadgen -c 128 -r 20000 -d 30 127.0.0.1:8080/
+*/
+using namespace std;
+
+void printUsage()
+{
+    printf("usage: loadgen [-c connections] [-t threads] [-d seconds] [-r rate] [-m method] [-b body] "
+           "[-H \"name: value\"] [-n] [host:port/path]\n");
+}
+
+//split "host:port/path" into its parts. Any of them can be left out, and a leading http:// is skipped.
+void parseTarget(string target, LoadOptions& options)
+{
+    if (target.starts_with("http://")) target = target.substr(7);
+
+    size_t slash = target.find('/');
+    options.request.requestUri = slash == string::npos ? "/" : target.substr(slash);
+    string address = target.substr(0, slash);
+
+    size_t colon = address.find(':');
+    if (colon != string::npos) options.port = atoi(address.c_str() + colon + 1);
+    if (colon != 0 && !address.empty()) options.host = address.substr(0, colon);
+}
+
+int main(int argc, char const* argv[])
+{
+    LoadOptions options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string argument = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (argument == "-n") options.keepAlive = false;
+        else if (argument == "-h" || argument == "--help")
+        {
+            printUsage();
+            return 0;
+        }
+        else if (argument.size() == 2 && argument[0] == '-' && hasValue)
+        {
+            const char* value = argv[++i];
+            switch (argument[1])
+            {
+                case 'c': options.connections = atoi(value); break;
+                case 't': options.threads = atoi(value); break;
+                case 'd': options.duration = (int)(atof(value) * 1000); break;
+                case 'r': options.rate = atof(value); break;
+                case 'm': options.request.httpMethod = HttpMessage::getMethodFromString(value); break;
+                case 'b': options.request.body = value; break;
+                case 'H':
+                {
+                    const char* colon = strchr(value, ':');
+                    if (colon == nullptr) break;
+                    options.request.headers[string(value, colon)] = colon[1] == ' ' ? colon + 2 : colon + 1;
+                    break;
+                }
+                default:
+                    printUsage();
+                    return 1;
+            }
+        }
+        else if (argument[0] != '-') parseTarget(argument, options);
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (options.connections <= 0 || options.duration <= 0 || options.request.httpMethod == HttpMessage::ERROR)
+    {
+        printUsage();
+        return 1;
+    }
+
+    printf("%s %s:%d%s with %d connections on %d threads for %.1fs, %s\n",
+           options.request.getHttpMethodAsString().c_str(), options.host.c_str(), options.port,
+           options.request.requestUri.c_str(), options.connections, options.threads, options.duration / 1000.0,
+           options.rate > 0 ? (to_string((long)options.rate) + " requests/s").c_str() : "as fast as possible");
+
+    LoadReport report = LoadGenerator(options).run();
+    printf("%s", report.print().c_str());
+    return report.completed > 0 ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include "EventLoop.hpp"
+#include "LoadGenerator.hpp"
+
+/*
+* Each test points the load generator at a real event loop on loopback and checks the report. The runs are short, so
+* the checks are about the counting being right, not about how fast anything is.
+*/
+std::atomic<int> served = 0;
+
+void answer(Connection* connection)
+{
+    const HttpRequestView& request = connection->receiveView();
+    served++;
+    connection->sendData(HttpMessage(request.requestUri == "/missing" ? 404 : 200, {}, "hello"));
+}
+
+struct Server
+{
+    Socket listener;
+    EventLoop loop;
+    std::thread runner;
+
+    Server(int port) : listener(port, 64), loop(&listener, answer, 1)
+    {
+        listener.listenPort();
+        runner = std::thread(&EventLoop::run, &loop);
+    }
+
+    ~Server()
+    {
+        loop.stop();
+        runner.join();
+    }
+};
+
+TEST(LoadGenerator, run_will_time_every_response_in_a_closed_loop)
+{
+    //given we have a server and a load generator with a few keep-alive connections
+    Server server(9200);
+    LoadOptions options;
+    options.port = 9200;
+    options.connections = 4;
+    options.duration = 300;
+
+    //when it runs as fast as the server answers
+    LoadReport report = LoadGenerator(options).run();
+
+    //then requests went through without errors, and every one of them was timed
+    ASSERT_GT(report.completed, 0);
+    ASSERT_EQ(report.errors, 0);
+    ASSERT_EQ(report.badStatuses, 0);
+    ASSERT_EQ(report.latencies.getCount(), report.completed);
+    ASSERT_GT(report.getRequestsPerSecond(), 0);
+}
+
+TEST(LoadGenerator, run_will_send_requests_at_the_given_rate_in_an_open_loop)
+{
+    //given we have a server and a load generator asked for 200 requests a second
+    Server server(9201);
+    LoadOptions options;
+    options.port = 9201;
+    options.connections = 8;
+    options.threads = 2;
+    options.rate = 200;
+    options.duration = 500;
+
+    //when it runs for half a second
+    LoadReport report = LoadGenerator(options).run();
+
+    //then about 100 requests were sent, not as many as the server could take
+    ASSERT_GE(report.completed, 80);
+    ASSERT_LE(report.completed, 101);
+    ASSERT_EQ(report.errors, 0);
+}
+
+TEST(LoadGenerator, run_will_connect_for_every_request_without_keep_alive_and_count_bad_statuses)
+{
+    //given we have a load generator that hangs up after every request for a page that isn't there
+    Server server(9202);
+    LoadOptions options;
+    options.port = 9202;
+    options.connections = 2;
+    options.duration = 200;
+    options.keepAlive = false;
+    options.request.requestUri = "/missing";
+
+    //when it runs
+    LoadReport report = LoadGenerator(options).run();
+
+    //then every response was a 404, and there were no errors from all the connecting and closing
+    ASSERT_GT(report.completed, 0);
+    ASSERT_EQ(report.badStatuses, report.completed);
+    ASSERT_EQ(report.errors, 0);
+}
+
+TEST(LoadGenerator, run_will_not_wait_for_a_body_after_a_head_request)
+{
+    //given we have a server and a load generator sending HEAD on one keep-alive connection
+    Server server(9232);
+    LoadOptions options;
+    options.port = 9232;
+    options.connections = 1;
+    options.duration = 300;
+    options.request = HttpMessage(HttpMessage::HEAD, "/");
+
+    //when it runs as fast as the server answers
+    LoadReport report = LoadGenerator(options).run();
+
+    //then the answers, which say how long the body would be without sending it, don't hold anything up
+    ASSERT_GT(report.completed, 10);
+    ASSERT_EQ(report.errors, 0);
+    ASSERT_EQ(report.badStatuses, 0);
+}
+
+TEST(LoadGenerator, run_will_count_errors_when_nobody_is_listening)
+{
+    //given we have a load generator pointed at a port nobody is on
+    LoadOptions options;
+    options.port = 9203;
+    options.connections = 2;
+    options.duration = 100;
+
+    //when it runs
+    LoadReport report = LoadGenerator(options).run();
+
+    //then nothing completed and the failed connections were counted
+    ASSERT_EQ(report.completed, 0);
+    ASSERT_GT(report.errors, 0);
+}
@@ -0,0 +1,282 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include "Logger.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+atomic<uint64_t> Logger::nextId = 1;
+
+/*
+* Every thread remembers which ring it uses for which logger, so it only has to look it up (under the mutex) the first
+* time. When the thread ends, this lets go of the ring, and the background thread tidies it up once it's empty.
+*/
+struct RingCache
+{
+    uint64_t loggerId = 0;
+    shared_ptr<void> ring;
+};
+thread_local RingCache ringCache;
+
+//Requests that couldn't be parsed are logged as ERROR. Anything else without a method name gets a dash.
+inline string_view getMethodName(uint8_t method)
+{
+    if (method == HttpMessage::ERROR) return "ERROR";
+    string_view name = HttpMessage::getMethodName((HttpMessage::Method)method);
+    return name.empty() ? "-" : name;
+}
+
+Logger::Ring::Ring(thread::id ringOwner, size_t capacity) : owner(ringOwner), entries(bit_ceil(max(capacity, (size_t)2)))
+{
+    mask = entries.size() - 1;
+}
+
+Logger::Logger(LoggerOptions loggerOptions) : options(loggerOptions)
+{
+    id = nextId++;
+    options.sampleEvery = max(options.sampleEvery, 1u);
+    options.flushInterval = max(options.flushInterval, 1);
+    retiredDrops = reportedDrops = 0;
+    stopping = false;
+    output = options.path.empty() ? STDOUT_FILENO : open(options.path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    parseFormat();
+    writer = thread(&Logger::run, this);
+}
+
+//Split the format into text we copy as is and fields we fill in, once, so lines don't have to search it each time.
+void Logger::parseFormat()
+{
+    static const pair<string_view, Field> fieldNames[] = {{"time", TIME}, {"method", METHOD}, {"uri", URI},
+        {"status", STATUS}, {"bytes", BYTES}, {"duration", DURATION}};
+
+    string_view format = options.format;
+    for (size_t i = 0; i < format.size(); i++)
+    {
+        Field field = LITERAL;
+        if (format[i] == '$')
+        {
+            for (const auto& [name, value] : fieldNames)
+            {
+                if (format.substr(i + 1, name.size()) == name)
+                {
+                    field = value;
+                    i += name.size();
+                    break;
+                }
+            }
+        }
+
+        if (field != LITERAL) pieces.push_back({field, ""});
+        else if (pieces.empty() || pieces.back().field != LITERAL) pieces.push_back({LITERAL, string(1, format[i])});
+        else pieces.back().text += format[i];
+    }
+}
+
+bool Logger::isOpen()
+{
+    return output > -1;
+}
+
+//Find this thread's ring, making it one the first time it logs here.
+Logger::Ring* Logger::getRing()
+{
+    if (ringCache.loggerId != id)
+    {
+        lock_guard<mutex> guard(ringsMutex);
+        auto found = find_if(rings.begin(), rings.end(), [](auto& ring) { return ring->owner == this_thread::get_id(); });
+        if (found == rings.end()) found = rings.insert(rings.end(), make_shared<Ring>(this_thread::get_id(), options.bufferSize));
+        ringCache = {id, *found};
+    }
+    return (Ring*)ringCache.ring.get();
+}
+
+/*
+* Copy the entry into the ring if there's room. The tail is only moved (with release) once the entry is written, so
+* the background thread never sees half an entry.
+*/
+bool Logger::push(Ring* ring, const Entry& entry)
+{
+    size_t tail = ring->tail.load(memory_order_relaxed);
+    if (tail - ring->head.load(memory_order_acquire) > ring->mask)
+    {
+        ring->dropped.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    ring->entries[tail & ring->mask] = entry;
+    ring->tail.store(tail + 1, memory_order_release);
+    return true;
+}
+
+/*
+* Log a finished request. This is what request handlers call, so it's kept cheap: it only fills in an entry and drops
+* it in the ring. Returns false if the request was sampled out, or dropped because the log is behind.
+*/
+bool Logger::logAccess(HttpMessage::Method method, string_view uri, int status, size_t bytes, uint32_t duration)
+{
+    Ring* ring = getRing();
+    bool sampled = ring->seen++ % options.sampleEvery == 0;
+    if (!sampled && !(options.keepErrors && status >= 500)) return false;
+
+    Entry entry;
+    entry.time = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+    entry.duration = duration;
+    entry.bytes = (uint32_t)min(bytes, (size_t)UINT32_MAX);
+    entry.status = (uint16_t)status;
+    entry.method = (uint8_t)method;
+    entry.message = false;
+    entry.textLength = (uint16_t)min(uri.size(), TEXT_SIZE);
+    memcpy(entry.text, uri.data(), entry.textLength);
+    return push(ring, entry);
+}
+
+//Log a line of plain text, like "server started". Long lines are cut short the same as uris.
+bool Logger::log(string_view message)
+{
+    Entry entry{};
+    entry.time = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+    entry.message = true;
+    entry.textLength = (uint16_t)min(message.size(), TEXT_SIZE);
+    memcpy(entry.text, message.data(), entry.textLength);
+    return push(getRing(), entry);
+}
+
+/*
+* Turn everything waiting in every ring into text. Rings whose thread has finished are thrown away once they're
+* empty. If entries were dropped since last time, we say so in the log, so a gap in it doesn't go unnoticed.
+*/
+void Logger::drain()
+{
+    lock_guard<mutex> guard(ringsMutex);
+    uint64_t drops = retiredDrops;
+    for (auto ring = rings.begin(); ring != rings.end();)
+    {
+        Ring& current = **ring;
+        size_t head = current.head.load(memory_order_relaxed);
+        size_t tail = current.tail.load(memory_order_acquire);
+        for (; head != tail; head++) format(current.entries[head & current.mask]);
+        current.head.store(head, memory_order_release);
+        drops += current.dropped.load(memory_order_relaxed);
+
+        if (ring->use_count() == 1 && current.tail.load(memory_order_acquire) == head) //nobody else can write to it anymore
+        {
+            retiredDrops += current.dropped.load(memory_order_relaxed);
+            ring = rings.erase(ring);
+        }
+        else ring++;
+    }
+
+    if (drops > reportedDrops)
+    {
+        batch.append("logger fell behind and dropped ").append(to_string(drops - reportedDrops)).append(" entries\n");
+        reportedDrops = drops;
+    }
+}
+
+//Quotes, backslashes and control characters in a uri are escaped, so nobody can sneak a fake log line in with \r\n.
+inline void appendEscaped(string& output, const char* text, size_t length)
+{
+    static const char HEX[] = "0123456789abcdef";
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char letter = text[i];
+        if (letter == '"' || letter == '\\') output.append(1, '\\').append(1, letter);
+        else if (letter < 0x20 || letter == 0x7f) output.append("\\u00").append(1, HEX[letter >> 4]).append(1, HEX[letter & 15]);
+        else output.append(1, letter);
+    }
+}
+
+void Logger::format(const Entry& entry)
+{
+    if (entry.message)
+    {
+        batch.append(entry.text, entry.textLength).append("\n");
+        return;
+    }
+
+    char number[64];
+    for (const Piece& piece : pieces)
+    {
+        switch (piece.field)
+        {
+            case LITERAL: batch.append(piece.text); break;
+            case TIME:
+            {
+                time_t seconds = entry.time / 1000;
+                tm parts;
+                gmtime_r(&seconds, &parts);
+                strftime(number, sizeof(number), "%Y-%m-%dT%H:%M:%S", &parts);
+                batch.append(number);
+                snprintf(number, sizeof(number), ".%03dZ", (int)(entry.time % 1000));
+                batch.append(number);
+                break;
+            }
+            case METHOD: batch.append(getMethodName(entry.method)); break;
+            case URI: appendEscaped(batch, entry.text, entry.textLength); break;
+            case STATUS: batch.append(to_string(entry.status)); break;
+            case BYTES: batch.append(to_string(entry.bytes)); break;
+            case DURATION: batch.append(to_string(entry.duration)); break;
+        }
+    }
+    batch.append("\n");
+}
+
+//One write for the whole batch. A short write just means we go again with the rest.
+void Logger::writeOut()
+{
+    size_t written = 0;
+    while (isOpen() && written < batch.size())
+    {
+        ssize_t result = write(output, batch.data() + written, batch.size() - written);
+        if (result < 0 && errno != EINTR) break;
+        if (result > 0) written += result;
+    }
+    batch.clear();
+}
+
+//Write out everything logged so far, right now. The background thread does this on its own every flushInterval.
+void Logger::flush()
+{
+    lock_guard<mutex> guard(drainMutex);
+    drain();
+    writeOut();
+}
+
+uint64_t Logger::getDroppedCount()
+{
+    lock_guard<mutex> guard(ringsMutex);
+    uint64_t output = retiredDrops;
+    for (auto& ring : rings) output += ring->dropped.load(memory_order_relaxed);
+    return output;
+}
+
+void Logger::run()
+{
+    unique_lock<mutex> lock(wakeMutex);
+    while (!stopping)
+    {
+        wake.wait_for(lock, milliseconds(options.flushInterval), [this]() { return stopping; });
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+//Stop the background thread, and write out whatever it didn't get to.
+Logger::~Logger()
+{
+    {
+        lock_guard<mutex> guard(wakeMutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+    flush();
+    if (output > STDERR_FILENO) close(output);
+}
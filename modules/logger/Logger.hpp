@@ -0,0 +1,127 @@
+#ifndef StiltFox_UniversalLibrary_Logger
+#define StiltFox_UniversalLibrary_Logger
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "HttpMessage.hpp"
+
+/*
+* How the logger should behave.
+*
+* format is the layout of one line, with $ fields filled in for every request:
+*   $time      when the request finished, in UTC, ie: 2024-05-01T13:45:10.123Z
+*   $method    GET, POST, ...
+*   $uri       the uri, with quotes, backslashes and control characters escaped so a client can't forge log lines
+*   $status    the response's status code
+*   $bytes     the size of the response body
+*   $duration  how long the request took, in microseconds
+* Lines from log() (plain messages rather than requests) are written as they are.
+*
+* sampleEvery logs one request out of that many per thread. With keepErrors on, responses of 500 and up are always
+* logged no matter what, since those are the ones somebody will come looking for.
+*/
+struct LoggerOptions
+{
+    std::string path = ""; //the file to append to. Empty for stdout.
+    std::string format = "$time $method $uri $status $bytes $durationus";
+    unsigned sampleEvery = 1;
+    bool keepErrors = true;
+    size_t bufferSize = 4096; //entries each thread can have waiting before new ones get dropped. Rounded up to a power of two.
+    int flushInterval = 20; //milliseconds between writes
+};
+
+/*
+* An access log that never makes a request wait. The old way was to lock a mutex and print to cout, which means every
+* worker takes turns on one lock, and while holding it waits for the terminal to keep up.
+*
+* Instead, every thread gets a ring buffer of its own and drops a small fixed size entry into it: no lock, no
+* formatting, no allocation, and no system call. A background thread comes around every flushInterval, turns
+* everything waiting in every ring into text, and writes it all out in one go.
+*
+* Each ring has one writer (its thread) and one reader (the background thread), which is the easy case for lock free
+* code: the writer only moves the tail, the reader only moves the head, and each reads the other's with acquire so it
+* sees the entries that were written before it moved.
+*
+* If the background thread falls behind and a ring fills up, new entries are thrown away and counted rather than
+* making the request wait. The count shows up in getDroppedCount() and in the log itself.
+*/
+class Logger
+{
+    static constexpr size_t TEXT_SIZE = 200; //uris longer than this are cut short in the log
+
+    enum Field {LITERAL, TIME, METHOD, URI, STATUS, BYTES, DURATION};
+
+    struct Entry
+    {
+        int64_t time; //milliseconds since 1970
+        uint32_t duration;
+        uint32_t bytes;
+        uint16_t status;
+        uint8_t method;
+        bool message; //a plain line of text instead of a request
+        uint16_t textLength;
+        char text[TEXT_SIZE];
+    };
+
+    struct Ring
+    {
+        std::thread::id owner;
+        std::vector<Entry> entries;
+        size_t mask;
+        alignas(64) std::atomic<size_t> head = 0; //next entry to read. Only the background thread moves it.
+        alignas(64) std::atomic<size_t> tail = 0; //next entry to write. Only the owning thread moves it.
+        std::atomic<uint64_t> dropped = 0;
+        uint64_t seen = 0; //requests seen by the owning thread, for sampling
+
+        Ring(std::thread::id owner, size_t capacity);
+    };
+
+    struct Piece
+    {
+        Field field;
+        std::string text;
+    };
+
+    static std::atomic<uint64_t> nextId;
+    uint64_t id; //tells loggers apart in each thread's cache, since an address can be reused by a new logger
+    LoggerOptions options;
+    std::vector<Piece> pieces;
+    int output;
+    std::mutex ringsMutex; //only taken the first time a thread logs, and by the background thread
+    std::vector<std::shared_ptr<Ring>> rings;
+    uint64_t retiredDrops; //drops counted by rings whose threads have finished
+    uint64_t reportedDrops; //drops already mentioned in the log
+    std::mutex drainMutex; //only one thread reads the rings at a time
+    std::string batch; //the text of every entry drained this time around. Reused so it doesn't reallocate.
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::thread writer;
+
+    Ring* getRing();
+    bool push(Ring* ring, const Entry& entry);
+    void parseFormat();
+    void drain();
+    void format(const Entry& entry);
+    void writeOut();
+    void run();
+
+    public:
+    Logger(LoggerOptions options = {});
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+    bool isOpen();
+    bool logAccess(HttpMessage::Method method, std::string_view uri, int status, size_t bytes, uint32_t duration);
+    bool log(std::string_view message);
+    void flush();
+    uint64_t getDroppedCount();
+    ~Logger();
+};
+#endif
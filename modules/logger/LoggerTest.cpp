@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+#include "Logger.hpp"
+
+/*
+* Each test logs to a file of its own, flushes, and reads the file back.
+*/
+struct LogFile
+{
+    std::string path;
+
+    LogFile()
+    {
+        char name[] = "/tmp/loggertestXXXXXX";
+        close(mkstemp(name));
+        path = name;
+    }
+
+    std::string read()
+    {
+        std::stringstream output;
+        output << std::ifstream(path).rdbuf();
+        return output.str();
+    }
+
+    ~LogFile()
+    {
+        unlink(path.c_str());
+    }
+};
+
+//counts how many times the needle shows up in the haystack
+int countOf(const std::string& haystack, const std::string& needle)
+{
+    int output = 0;
+    for (size_t pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + 1)) output++;
+    return output;
+}
+
+TEST(Logger, logAccess_will_write_the_request_in_the_given_format)
+{
+    //given we have a logger with a format of our own
+    LogFile file;
+    Logger logger({file.path, "$method $uri -> $status ($bytes bytes in $durationus)"});
+
+    //when we log a request and flush
+    logger.logAccess(HttpMessage::POST, "/orders?id=7", 201, 42, 1500);
+    logger.flush();
+
+    //then the line is written with every field filled in
+    ASSERT_EQ(file.read(), "POST /orders?id=7 -> 201 (42 bytes in 1500us)\n");
+}
+
+TEST(Logger, logAccess_will_escape_uris_so_they_cant_fake_a_log_line)
+{
+    //given we have a logger
+    LogFile file;
+    Logger logger({file.path, "$uri"});
+
+    //when a client sends a uri with a newline and quotes in it
+    logger.logAccess(HttpMessage::GET, "/a\r\nGET /admin 200\"", 404, 0, 1);
+    logger.flush();
+
+    //then it all stays on one line
+    ASSERT_EQ(file.read(), "/a\\u000d\\u000aGET /admin 200\\\"\n");
+}
+
+TEST(Logger, logAccess_will_keep_one_in_every_sampleEvery_requests_and_every_error)
+{
+    //given we have a logger that keeps one request in ten
+    LogFile file;
+    LoggerOptions options;
+    options.path = file.path;
+    options.format = "$status";
+    options.sampleEvery = 10;
+    Logger logger(options);
+
+    //when we log 100 good requests and 3 failed ones
+    for (int i = 0; i < 100; i++) logger.logAccess(HttpMessage::GET, "/", 200, 0, 1);
+    for (int i = 0; i < 3; i++) logger.logAccess(HttpMessage::GET, "/", 503, 0, 1);
+    logger.flush();
+
+    //then 10 of the good ones and all the failed ones are written
+    std::string actual = file.read();
+    ASSERT_EQ(countOf(actual, "200\n"), 10);
+    ASSERT_EQ(countOf(actual, "503\n"), 3);
+}
+
+TEST(Logger, logAccess_will_drop_and_count_entries_instead_of_waiting_when_the_buffer_is_full)
+{
+    //given we have a logger with a tiny buffer that only writes once a minute
+    LogFile file;
+    LoggerOptions options;
+    options.path = file.path;
+    options.format = "$uri";
+    options.bufferSize = 8;
+    options.flushInterval = 60000;
+    Logger logger(options);
+
+    //when we log more than fits before it gets written
+    int kept = 0;
+    for (int i = 0; i < 20; i++) kept += logger.logAccess(HttpMessage::GET, "/" + std::to_string(i), 200, 0, 1);
+    logger.flush();
+
+    //then the first 8 are kept, the rest are counted, and the log says it dropped some
+    std::string actual = file.read();
+    ASSERT_EQ(kept, 8);
+    ASSERT_EQ(logger.getDroppedCount(), 12);
+    ASSERT_EQ(countOf(actual, "\n/"), 7);
+    ASSERT_NE(actual.find("dropped 12 entries"), std::string::npos);
+}
+
+TEST(Logger, logAccess_will_keep_every_entry_from_many_threads)
+{
+    //given we have a logger and several threads
+    LogFile file;
+    LoggerOptions options;
+    options.path = file.path;
+    options.format = "$uri";
+    options.bufferSize = 8192;
+    std::vector<std::thread> threads;
+
+    //when every thread logs its own requests at the same time, and the logger is closed
+    {
+        Logger logger(options);
+        for (int t = 0; t < 4; t++)
+        {
+            threads.emplace_back([&logger, t]()
+            {
+                for (int i = 0; i < 1000; i++) logger.logAccess(HttpMessage::GET, "/thread" + std::to_string(t), 200, 0, 1);
+            });
+        }
+        for (std::thread& thread : threads) thread.join();
+        logger.log("done");
+    }
+
+    //then every entry was written, each on a line of its own
+    std::string actual = file.read();
+    for (int t = 0; t < 4; t++) ASSERT_EQ(countOf(actual, "/thread" + std::to_string(t) + "\n"), 1000);
+    ASSERT_TRUE(actual.ends_with("done\n"));
+}
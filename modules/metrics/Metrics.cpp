@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <cstdio>
+#include "Metrics.hpp"
+
+using namespace std;
+
+const uint64_t LONGEST_PHASE = 60000000000; //a minute, in nanoseconds. Anything slower is counted as a minute.
+const char* const PHASE_NAMES[] = {"accept", "read", "parse", "handle", "write"};
+
+//Two significant digits keeps each histogram to a few kilobytes, and 12us vs 13us is plenty for spotting trouble.
+Metrics::Shard::Shard() : phases(PHASE_COUNT, Histogram(LONGEST_PHASE, 2)) {}
+
+//Only the shard's own thread writes, so there's nobody to race with and a locked add would be wasted.
+void Metrics::Shard::add(atomic<uint64_t>& counter, uint64_t amount)
+{
+    counter.store(counter.load(memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+void Metrics::Shard::countRequest(HttpMessage::Method method)
+{
+    add(methods[min(method, HttpMessage::NONE)], 1);
+}
+
+void Metrics::Shard::countResponse(int status)
+{
+    if (status >= 0 && status < MAX_STATUS) add(statuses[status], 1);
+}
+
+void Metrics::Shard::countOpened()
+{
+    add(opened, 1);
+}
+
+void Metrics::Shard::countClosed()
+{
+    add(closed, 1);
+}
+
+void Metrics::Shard::countBytes(uint64_t in, uint64_t out)
+{
+    if (in > 0) add(bytesIn, in);
+    if (out > 0) add(bytesOut, out);
+}
+
+void Metrics::Shard::recordPhase(Phase phase, uint64_t nanoseconds)
+{
+    lock_guard<mutex> guard(phasesMutex);
+    phases[phase].record(nanoseconds);
+}
+
+Metrics::Metrics(int shardCount)
+{
+    for (int i = 0; i < max(shardCount, 1); i++) shards.push_back(make_unique<Shard>());
+}
+
+//Each worker should ask for the shard with its own number. There's no shard past the count, since two threads can't share one.
+Metrics::Shard* Metrics::getShard(int index)
+{
+    return index >= 0 && (size_t)index < shards.size() ? shards[index].get() : nullptr;
+}
+
+uint64_t Metrics::getRequestCount(HttpMessage::Method method)
+{
+    uint64_t output = 0;
+    for (auto& shard : shards) output += shard->methods[min(method, HttpMessage::NONE)].load(memory_order_relaxed);
+    return output;
+}
+
+uint64_t Metrics::getResponseCount(int status)
+{
+    uint64_t output = 0;
+    if (status < 0 || status >= Shard::MAX_STATUS) return output;
+    for (auto& shard : shards) output += shard->statuses[status].load(memory_order_relaxed);
+    return output;
+}
+
+//A connection can be opened on one shard and closed on another, so only the total means anything.
+int64_t Metrics::getActiveConnections()
+{
+    int64_t output = 0;
+    for (auto& shard : shards) output += shard->opened.load(memory_order_relaxed) - shard->closed.load(memory_order_relaxed);
+    return max(output, (int64_t)0);
+}
+
+uint64_t Metrics::getBytesIn()
+{
+    uint64_t output = 0;
+    for (auto& shard : shards) output += shard->bytesIn.load(memory_order_relaxed);
+    return output;
+}
+
+uint64_t Metrics::getBytesOut()
+{
+    uint64_t output = 0;
+    for (auto& shard : shards) output += shard->bytesOut.load(memory_order_relaxed);
+    return output;
+}
+
+//Every shard's histogram for the phase, added together. Each shard is only locked long enough to add its part.
+Histogram Metrics::getPhase(Phase phase)
+{
+    Histogram output(LONGEST_PHASE, 2);
+    for (auto& shard : shards)
+    {
+        lock_guard<mutex> guard(shard->phasesMutex);
+        output.add(shard->phases[phase]);
+    }
+    return output;
+}
+
+/*
+* All of the numbers, in the Prometheus text format. It's plain text a person can read, and most monitoring tools can
+* scrape it as is. Times are in seconds, like Prometheus expects. Every number counts up from when the server started.
+*/
+string Metrics::print()
+{
+    char line[256];
+    string output = "# TYPE sf_requests_total counter\n";
+    for (int method = HttpMessage::GET; method < HttpMessage::ERROR; method++)
+    {
+        uint64_t count = getRequestCount((HttpMessage::Method)method);
+        if (count == 0) continue;
+        string_view name = HttpMessage::getMethodName((HttpMessage::Method)method);
+        snprintf(line, sizeof(line), "sf_requests_total{method=\"%.*s\"} %llu\n", (int)name.size(), name.data(),
+                 (unsigned long long)count);
+        output += line;
+    }
+
+    output += "# TYPE sf_responses_total counter\n";
+    for (int status = 0; status < Shard::MAX_STATUS; status++)
+    {
+        uint64_t count = getResponseCount(status);
+        if (count == 0) continue;
+        snprintf(line, sizeof(line), "sf_responses_total{status=\"%d\"} %llu\n", status, (unsigned long long)count);
+        output += line;
+    }
+
+    snprintf(line, sizeof(line), "# TYPE sf_connections_active gauge\nsf_connections_active %lld\n",
+             (long long)getActiveConnections());
+    output += line;
+    snprintf(line, sizeof(line), "# TYPE sf_received_bytes_total counter\nsf_received_bytes_total %llu\n",
+             (unsigned long long)getBytesIn());
+    output += line;
+    snprintf(line, sizeof(line), "# TYPE sf_sent_bytes_total counter\nsf_sent_bytes_total %llu\n",
+             (unsigned long long)getBytesOut());
+    output += line;
+
+    output += "# TYPE sf_phase_seconds summary\n";
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        Histogram histogram = getPhase((Phase)phase);
+        for (double quantile : {0.5, 0.9, 0.99, 0.999})
+        {
+            snprintf(line, sizeof(line), "sf_phase_seconds{phase=\"%s\",quantile=\"%g\"} %.9f\n", PHASE_NAMES[phase],
+                     quantile, histogram.getValueAtPercentile(quantile * 100) / 1e9);
+            output += line;
+        }
+        snprintf(line, sizeof(line), "sf_phase_seconds_sum{phase=\"%s\"} %.9f\nsf_phase_seconds_count{phase=\"%s\"} %llu\n",
+                 PHASE_NAMES[phase], histogram.getMean() * histogram.getCount() / 1e9, PHASE_NAMES[phase],
+                 (unsigned long long)histogram.getCount());
+        output += line;
+    }
+    return output;
+}
@@ -0,0 +1,75 @@
+#ifndef StiltFox_UniversalLibrary_Metrics
+#define StiltFox_UniversalLibrary_Metrics
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Histogram.hpp"
+#include "HttpMessage.hpp"
+
+/*
+* Live numbers about the server: how many requests of each method and responses of each status, how many connections
+* are open, how many bytes went in and out, and how long each phase of a request takes:
+*   accept  setting up a new connection
+*   read    pulling bytes off the socket
+*   parse   finding a whole request in those bytes
+*   handle  the handler, not counting time spent sending
+*   write   sending the response
+*
+* Counting has to be nearly free, because it happens on every request. So the numbers are split into shards, one per
+* worker thread, each on cache lines of its own. Only the shard's own thread writes to it, so a counter is bumped with
+* a plain load and store instead of a locked add, and no two cores ever fight over the same cache line. Two threads
+* doing that to one shard would lose counts, so there's no sharing: ask for as many shards as there are workers. Reading the
+* numbers adds every shard up, which is slower, but only happens when somebody asks for them.
+*
+* The latency histograms can't be read while they're being written, so each shard guards its histograms with a mutex.
+* The shard's thread is the only one that takes it, except for the odd moment somebody asks for the numbers.
+*/
+class Metrics
+{
+    public:
+    enum Phase {ACCEPT, READ, PARSE, HANDLE, WRITE, PHASE_COUNT};
+
+    class alignas(64) Shard
+    {
+        friend class Metrics;
+        static const int MAX_STATUS = 600;
+
+        std::atomic<uint64_t> methods[HttpMessage::NONE + 1] = {};
+        std::atomic<uint64_t> statuses[MAX_STATUS] = {};
+        std::atomic<uint64_t> opened = 0;
+        std::atomic<uint64_t> closed = 0;
+        std::atomic<uint64_t> bytesIn = 0;
+        std::atomic<uint64_t> bytesOut = 0;
+        std::mutex phasesMutex;
+        std::vector<Histogram> phases; //nanoseconds
+
+        void add(std::atomic<uint64_t>& counter, uint64_t amount);
+
+        public:
+        Shard();
+        void countRequest(HttpMessage::Method method);
+        void countResponse(int status);
+        void countOpened();
+        void countClosed();
+        void countBytes(uint64_t in, uint64_t out);
+        void recordPhase(Phase phase, uint64_t nanoseconds);
+    };
+
+    private:
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    public:
+    Metrics(int shardCount);
+    Shard* getShard(int index);
+    uint64_t getRequestCount(HttpMessage::Method method);
+    uint64_t getResponseCount(int status);
+    int64_t getActiveConnections();
+    uint64_t getBytesIn();
+    uint64_t getBytesOut();
+    Histogram getPhase(Phase phase);
+    std::string print();
+};
+#endif
@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include "Metrics.hpp"
+
+using namespace std;
+
+TEST(Metrics, getRequestCount_will_add_up_every_shard)
+{
+    //given two threads counting requests into shards of their own
+    Metrics metrics(2);
+    thread first([&]() { for (int i = 0; i < 1000; i++) metrics.getShard(0)->countRequest(HttpMessage::GET); });
+    thread second([&]() { for (int i = 0; i < 500; i++) metrics.getShard(1)->countRequest(HttpMessage::GET); });
+    first.join();
+    second.join();
+    metrics.getShard(1)->countRequest(HttpMessage::POST);
+
+    //when we ask how many requests there were
+    //then we get the total from both shards
+    ASSERT_EQ(metrics.getRequestCount(HttpMessage::GET), 1500);
+    ASSERT_EQ(metrics.getRequestCount(HttpMessage::POST), 1);
+    ASSERT_EQ(metrics.getRequestCount(HttpMessage::PUT), 0);
+}
+
+TEST(Metrics, getActiveConnections_will_count_connections_closed_on_a_different_shard)
+{
+    //given connections opened on one shard and some of them closed on another
+    Metrics metrics(2);
+    for (int i = 0; i < 5; i++) metrics.getShard(0)->countOpened();
+    for (int i = 0; i < 3; i++) metrics.getShard(1)->countClosed();
+
+    //when we ask how many are open
+    //then the shards are added together
+    ASSERT_EQ(metrics.getActiveConnections(), 2);
+}
+
+TEST(Metrics, getShard_will_not_hand_out_a_shard_past_the_count)
+{
+    //given metrics with 2 shards
+    Metrics metrics(2);
+
+    //when a third worker asks for one
+    Metrics::Shard* third = metrics.getShard(2);
+
+    //then there isn't one for it, since sharing one with another worker would lose counts
+    ASSERT_EQ(third, nullptr);
+    ASSERT_EQ(metrics.getShard(-1), nullptr);
+    ASSERT_NE(metrics.getShard(1), nullptr);
+}
+
+TEST(Metrics, getPhase_will_merge_the_histograms_of_every_shard)
+{
+    //given parse times recorded on two shards
+    Metrics metrics(2);
+    for (int i = 0; i < 99; i++) metrics.getShard(0)->recordPhase(Metrics::PARSE, 1000);
+    metrics.getShard(1)->recordPhase(Metrics::PARSE, 50000);
+
+    //when we get the parse phase
+    Histogram parse = metrics.getPhase(Metrics::PARSE);
+
+    //then it holds the times from both, to within the two significant digits the phases are kept to
+    ASSERT_EQ(parse.getCount(), 100);
+    ASSERT_GE(parse.getValueAtPercentile(50), 1000);
+    ASSERT_LE(parse.getValueAtPercentile(50), 1010);
+    ASSERT_GE(parse.getMax(), 50000);
+    ASSERT_EQ(metrics.getPhase(Metrics::WRITE).getCount(), 0);
+}
+
+TEST(Metrics, print_will_write_the_numbers_in_the_prometheus_text_format)
+{
+    //given a server that has answered a couple of requests
+    Metrics metrics(1);
+    Metrics::Shard* shard = metrics.getShard(0);
+    shard->countOpened();
+    shard->countRequest(HttpMessage::GET);
+    shard->countRequest(HttpMessage::HEAD);
+    shard->countResponse(200);
+    shard->countResponse(404);
+    shard->countBytes(80, 1500);
+    shard->recordPhase(Metrics::HANDLE, 2000000);
+
+    //when we print the metrics
+    string output = metrics.print();
+
+    //then every number is on a line of its own, and times are in seconds
+    ASSERT_NE(output.find("sf_requests_total{method=\"GET\"} 1\n"), string::npos);
+    ASSERT_NE(output.find("sf_requests_total{method=\"HEAD\"} 1\n"), string::npos);
+    ASSERT_EQ(output.find("sf_requests_total{method=\"POST\"}"), string::npos);
+    ASSERT_NE(output.find("sf_responses_total{status=\"200\"} 1\n"), string::npos);
+    ASSERT_NE(output.find("sf_responses_total{status=\"404\"} 1\n"), string::npos);
+    ASSERT_NE(output.find("sf_connections_active 1\n"), string::npos);
+    ASSERT_NE(output.find("sf_received_bytes_total 80\n"), string::npos);
+    ASSERT_NE(output.find("sf_sent_bytes_total 1500\n"), string::npos);
+    ASSERT_NE(output.find("sf_phase_seconds{phase=\"handle\",quantile=\"0.5\"} 0.002"), string::npos);
+    ASSERT_NE(output.find("sf_phase_seconds_count{phase=\"handle\"} 1\n"), string::npos);
+    ASSERT_NE(output.find("sf_phase_seconds_count{phase=\"accept\"} 0\n"), string::npos);
+}
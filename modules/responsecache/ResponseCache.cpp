@@ -0,0 +1,162 @@
+#include <cstring>
+#include "ResponseCache.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+size_t ResponseCache::KeyHash::operator()(string_view key) const
+{
+    return hash<string_view>()(key);
+}
+
+//the key a compressed copy of a response is kept under
+inline string getCompressedKey(string_view key, Compressor::Encoding encoding)
+{
+    return string(key).append(" ").append(Compressor::getEncodingName(encoding));
+}
+
+//ttl is in milliseconds
+ResponseCache::ResponseCache(size_t cacheCapacity, int timeToLive)
+{
+    capacity = max(cacheCapacity, (size_t)1);
+    ttl = milliseconds(timeToLive);
+}
+
+//The compressor has to outlive the cache. Pass nullptr to stop compressing.
+void ResponseCache::setCompressor(Compressor* compressor)
+{
+    this->compressor = compressor;
+}
+
+//this has to be called with the lock held
+void ResponseCache::forget(unordered_map<string, Entry, KeyHash, equal_to<>>::iterator entry)
+{
+    recentlyUsed.erase(entry->second.recentPosition);
+    entries.erase(entry);
+}
+
+//The response kept for the key, or nullptr if there isn't one or it's gone stale.
+shared_ptr<const FrozenResponse> ResponseCache::get(string_view key)
+{
+    lock_guard<mutex> guard(entriesLock);
+    auto found = entries.find(key);
+    if (found == entries.end()) return nullptr;
+    if (found->second.expires <= steady_clock::now())
+    {
+        forget(found);
+        return nullptr;
+    }
+
+    recentlyUsed.splice(recentlyUsed.begin(), recentlyUsed, found->second.recentPosition);
+    return found->second.response;
+}
+
+/*
+* Freeze the response and keep it under the key for ttl milliseconds (the cache's own ttl if it's left out). The frozen
+* response is handed back so it can be sent right away. The freezing happens before taking the lock, so other workers
+* aren't kept waiting on it.
+*/
+shared_ptr<const FrozenResponse> ResponseCache::put(string_view key, const HttpMessage& response, int entryTtl)
+{
+    shared_ptr<const FrozenResponse> frozen = FrozenResponse::freeze(response);
+    auto expires = steady_clock::now() + (entryTtl < 0 ? ttl : milliseconds(entryTtl));
+
+    lock_guard<mutex> guard(entriesLock);
+    auto found = entries.find(key);
+    if (found != entries.end()) forget(found);
+    if (entries.size() >= capacity) forget(entries.find(recentlyUsed.back()));
+
+    recentlyUsed.emplace_front(key);
+    entries.emplace(recentlyUsed.front(), Entry{frozen, expires, recentlyUsed.begin()});
+    return frozen;
+}
+
+//Forget the response kept under the key, and its compressed copies. Returns false if there wasn't any of them.
+bool ResponseCache::invalidate(string_view key)
+{
+    lock_guard<mutex> guard(entriesLock);
+    size_t before = entries.size();
+    auto found = entries.find(key);
+    if (found != entries.end()) forget(found);
+    for (int i = Compressor::IDENTITY + 1; i < Compressor::ENCODING_COUNT; i++)
+    {
+        found = entries.find(getCompressedKey(key, (Compressor::Encoding)i));
+        if (found != entries.end()) forget(found);
+    }
+    return entries.size() < before;
+}
+
+//Forget every response whose key starts with prefix, ie: "/users/" after the list of users changes. Returns how many.
+size_t ResponseCache::invalidatePrefix(string_view prefix)
+{
+    lock_guard<mutex> guard(entriesLock);
+    size_t output = 0;
+    for (auto entry = entries.begin(); entry != entries.end();)
+    {
+        auto next = std::next(entry);
+        if (entry->first.starts_with(prefix))
+        {
+            forget(entry);
+            output++;
+        }
+        entry = next;
+    }
+    return output;
+}
+
+void ResponseCache::clear()
+{
+    lock_guard<mutex> guard(entriesLock);
+    entries.clear();
+    recentlyUsed.clear();
+}
+
+size_t ResponseCache::size()
+{
+    lock_guard<mutex> guard(entriesLock);
+    return entries.size();
+}
+
+/*
+* Turn a handler that makes responses into a route handler that keeps them. A GET is answered from the cache if it
+* can be, and otherwise by the maker, whose response is kept if it's a 200 that doesn't say no-store. A HEAD is
+* answered from the kept GET response too, and the connection leaves the body off. What the maker makes for a HEAD is
+* never kept though, since it might not have a body to give the next GET. Any other method goes straight to the maker,
+* and since it probably changed something, the kept response for its uri is forgotten.
+*
+* With a compressor, the response is compressed for the encoding the client picked before it's kept, and kept under a
+* key of its own, so clients that pick different encodings each get theirs.
+*
+* The cache has to outlive the router the handler is added to.
+*/
+RouteHandler ResponseCache::cached(ResponseMaker maker, int entryTtl)
+{
+    return [this, maker, entryTtl](Connection* connection, const HttpRequestView& request, const RouteParameters& parameters)
+    {
+        if (request.httpMethod != HttpMessage::GET && request.httpMethod != HttpMessage::HEAD)
+        {
+            invalidate(request.requestUri);
+            connection->sendData(maker(request, parameters));
+            return;
+        }
+
+        Compressor::Encoding encoding = compressor != nullptr ? Compressor::chooseEncoding(request) : Compressor::IDENTITY;
+        string compressedKey = encoding != Compressor::IDENTITY ? getCompressedKey(request.requestUri, encoding) : "";
+        string_view key = encoding != Compressor::IDENTITY ? string_view(compressedKey) : request.requestUri;
+
+        shared_ptr<const FrozenResponse> response = get(key);
+        if (response == nullptr)
+        {
+            HttpMessage made = maker(request, parameters);
+            bool keep = request.httpMethod == HttpMessage::GET && made.statusCode == 200 && strcasestr(made.getHeader("cache-control").c_str(), "no-store") == nullptr;
+            if (compressor != nullptr) compressor->compressResponse(request, made, keep);
+            if (!keep)
+            {
+                connection->sendData(std::move(made));
+                return;
+            }
+            response = put(key, made, entryTtl);
+        }
+        connection->sendFrozen(response);
+    };
+}
@@ -0,0 +1,73 @@
+#ifndef StiltFox_UniversalLibrary_ResponseCache
+#define StiltFox_UniversalLibrary_ResponseCache
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "Compression.hpp"
+#include "Router.hpp"
+#include "Socket.hpp"
+
+//A handler that gives back its response instead of sending it, so the response can be kept and sent again.
+typedef std::function<HttpMessage(const HttpRequestView&, const RouteParameters&)> ResponseMaker;
+
+/*
+* ResponseCache keeps frozen copies of GET responses for a while (the ttl), so a handler whose answer doesn't change
+* from one request to the next only has to build it once in a while instead of every time. Responses are kept by key,
+* which for routes wrapped with cached is the uri, query string and all.
+*
+* A response that's gone stale is forgotten the next time it's asked for. A handler that changes something can make
+* the cache forget right away with invalidate, invalidatePrefix or clear, and cached routes do this by themselves
+* when a request other than GET or HEAD comes in for the same uri. When the cache is full, the least recently used
+* response makes room.
+*
+* Only 200 responses are kept, and not if they say "cache-control: no-store", so errors and private answers are
+* always made fresh.
+*
+* Give it a Compressor with setCompressor and cached routes keep a compressed copy for each encoding clients ask for,
+* so a popular answer is compressed once per ttl instead of once per request. The copies are kept under the uri with
+* the encoding on the end, ie: "/users gzip", and invalidate forgets them along with the plain one.
+*
+* The cache is shared by every event loop worker, so it's guarded with a mutex. Lookups don't allocate.
+*/
+class ResponseCache
+{
+    //lets the map be searched with a string_view, so a lookup doesn't have to build a string
+    struct KeyHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view key) const;
+    };
+
+    struct Entry
+    {
+        std::shared_ptr<const FrozenResponse> response;
+        std::chrono::steady_clock::time_point expires;
+        std::list<std::string>::iterator recentPosition; //where this key is in the recently used list
+    };
+
+    size_t capacity;
+    std::chrono::milliseconds ttl;
+    std::unordered_map<std::string, Entry, KeyHash, std::equal_to<>> entries;
+    std::list<std::string> recentlyUsed; //keys, most recently used at the front
+    std::mutex entriesLock;
+    Compressor* compressor = nullptr;
+
+    void forget(std::unordered_map<std::string, Entry, KeyHash, std::equal_to<>>::iterator entry);
+
+    public:
+    ResponseCache(size_t capacity = 1024, int ttl = 1000);
+    void setCompressor(Compressor* compressor);
+    std::shared_ptr<const FrozenResponse> get(std::string_view key);
+    std::shared_ptr<const FrozenResponse> put(std::string_view key, const HttpMessage& response, int ttl = -1);
+    bool invalidate(std::string_view key);
+    size_t invalidatePrefix(std::string_view prefix);
+    void clear();
+    size_t size();
+    RouteHandler cached(ResponseMaker maker, int ttl = -1);
+};
+#endif
@@ -0,0 +1,211 @@
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thread>
+#include "HttpParser.hpp"
+#include "ResponseCache.hpp"
+
+using namespace std;
+
+TEST(ResponseCache, get_will_give_back_what_was_put_until_it_goes_stale)
+{
+    //given a cache with a short ttl, holding one response with the default ttl and one with a long one
+    ResponseCache cache(16, 50);
+    shared_ptr<const FrozenResponse> put = cache.put("/health", HttpMessage(200, {}, "ok"));
+    cache.put("/version", HttpMessage(200, {}, "1.0"), 60000);
+
+    //when we ask for them now, and again once the short ttl is up
+    shared_ptr<const FrozenResponse> fresh = cache.get("/health");
+    this_thread::sleep_for(chrono::milliseconds(80));
+    shared_ptr<const FrozenResponse> stale = cache.get("/health");
+
+    //then we get the same frozen response at first, and nothing once it's stale
+    ASSERT_EQ(fresh, put);
+    ASSERT_TRUE(fresh->bytes.ends_with("content-length: 2\r\n\r\nok"));
+    ASSERT_EQ(stale, nullptr);
+    ASSERT_NE(cache.get("/version"), nullptr);
+    ASSERT_EQ(cache.get("/nothing"), nullptr);
+    ASSERT_EQ(cache.size(), 1);
+}
+
+TEST(ResponseCache, put_will_make_room_by_forgetting_the_least_recently_used)
+{
+    //given a cache that holds 2 responses, both full, where the first was used more recently
+    ResponseCache cache(2);
+    cache.put("/a", HttpMessage(200, {}, "a"));
+    cache.put("/b", HttpMessage(200, {}, "b"));
+    cache.get("/a");
+
+    //when we put a third
+    cache.put("/c", HttpMessage(200, {}, "c"));
+
+    //then the one nobody asked for lately is gone
+    ASSERT_NE(cache.get("/a"), nullptr);
+    ASSERT_EQ(cache.get("/b"), nullptr);
+    ASSERT_NE(cache.get("/c"), nullptr);
+}
+
+TEST(ResponseCache, invalidate_will_forget_a_key_or_every_key_under_a_prefix)
+{
+    //given a cache holding a few responses
+    ResponseCache cache;
+    cache.put("/users/1", HttpMessage(200, {}, "one"));
+    cache.put("/users/2", HttpMessage(200, {}, "two"));
+    cache.put("/posts/1", HttpMessage(200, {}, "post"));
+    cache.put("/about", HttpMessage(200, {}, "about"));
+
+    //when we invalidate some of them
+    bool single = cache.invalidate("/about");
+    bool missing = cache.invalidate("/about");
+    size_t users = cache.invalidatePrefix("/users/");
+
+    //then only those are gone, and clear gets the rest
+    ASSERT_TRUE(single);
+    ASSERT_FALSE(missing);
+    ASSERT_EQ(users, 2);
+    ASSERT_EQ(cache.get("/users/1"), nullptr);
+    ASSERT_NE(cache.get("/posts/1"), nullptr);
+    cache.clear();
+    ASSERT_EQ(cache.size(), 0);
+}
+
+TEST(ResponseCache, cached_will_only_call_the_handler_when_it_has_nothing_fresh)
+{
+    //given a route wrapped by the cache whose handler counts how often it's called, and a connection from a socket pair
+    int handles[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, handles);
+    Connection connection(handles[0]);
+    ResponseCache cache;
+    Router router;
+    int calls = 0;
+    ResponseMaker maker = [&calls](const HttpRequestView& request, const RouteParameters& parameters)
+    {
+        calls++;
+        if (parameters.get("id") == "private") return HttpMessage(200, {{"cache-control", "no-store"}}, "secret");
+        if (parameters.get("id") == "missing") return HttpMessage(404);
+        return HttpMessage(200, {{"content-type", "text/plain"}}, "item " + string(parameters.get("id")) + " #" + to_string(calls));
+    };
+    router.add(HttpMessage::GET, "/items/:id", cache.cached(maker));
+    router.add(HttpMessage::PUT, "/items/:id", cache.cached(maker));
+
+    auto serve = [&](string raw)
+    {
+        HttpParser parser;
+        HttpRequestView view;
+        parser.scan(raw);
+        parser.getView(raw, view);
+        router.serve(&connection, view);
+
+        string output;
+        char buffer[4096];
+        int readBytes;
+        while ((readBytes = recv(handles[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) output.append(buffer, readBytes);
+        return output;
+    };
+
+    //when we ask for the same things more than once, and change one of them in between
+    string first = serve("GET /items/7 HTTP/1.1\r\n\r\n");
+    string second = serve("GET /items/7 HTTP/1.1\r\n\r\n");
+    serve("GET /items/private HTTP/1.1\r\n\r\n");
+    serve("GET /items/private HTTP/1.1\r\n\r\n");
+    serve("GET /items/missing HTTP/1.1\r\n\r\n");
+    serve("GET /items/missing HTTP/1.1\r\n\r\n");
+    serve("PUT /items/7 HTTP/1.1\r\n\r\n");
+    string afterChange = serve("GET /items/7 HTTP/1.1\r\n\r\n");
+    close(handles[1]);
+
+    //then the second request came from the cache, errors and no-store were never kept, and the change was noticed
+    ASSERT_TRUE(first.ends_with("\r\n\r\nitem 7 #1"));
+    ASSERT_EQ(second, first);
+    ASSERT_EQ(calls, 7);
+    ASSERT_TRUE(afterChange.ends_with("\r\n\r\nitem 7 #7"));
+    ASSERT_EQ(cache.size(), 1);
+}
+
+TEST(ResponseCache, cached_will_answer_a_head_request_from_the_kept_get_response_without_its_body)
+{
+    //given a route wrapped by the cache for both GET and HEAD, and a client that sends HEAD, GET and HEAD down one connection
+    int handles[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, handles);
+    Connection connection(handles[0]);
+    ResponseCache cache;
+    Router router;
+    int calls = 0;
+    RouteHandler handler = cache.cached([&calls](const HttpRequestView&, const RouteParameters&)
+    {
+        calls++;
+        return HttpMessage(200, {}, "the report");
+    });
+    router.add(HttpMessage::GET, "/report", handler);
+    router.add(HttpMessage::HEAD, "/report", handler);
+    string requests = "HEAD /report HTTP/1.1\r\n\r\nGET /report HTTP/1.1\r\n\r\nHEAD /report HTTP/1.1\r\n\r\n";
+    send(handles[1], requests.data(), requests.size(), 0);
+
+    //when we serve all three
+    for (int i = 0; i < 3; i++) router.serve(&connection, connection.receiveView());
+    string output;
+    char buffer[4096];
+    int readBytes;
+    while ((readBytes = recv(handles[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) output.append(buffer, readBytes);
+    close(handles[1]);
+
+    //then only the GET got a body, the first HEAD wasn't kept, and the last one came from what the GET kept
+    string head = "HTTP/1.1 200 OK\r\ncontent-length: 10\r\n\r\n";
+    ASSERT_EQ(output, head + head + "the report" + head);
+    ASSERT_EQ(calls, 2);
+    ASSERT_EQ(cache.size(), 1);
+}
+
+TEST(ResponseCache, cached_will_keep_a_compressed_copy_for_each_encoding_clients_ask_for)
+{
+    //given a cached route with a big text answer, a cache with a compressor, and a connection from a socket pair
+    int handles[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, handles);
+    Connection connection(handles[0]);
+    Compressor compressor;
+    ResponseCache cache;
+    cache.setCompressor(&compressor);
+    Router router;
+    int calls = 0;
+    router.add(HttpMessage::GET, "/report", cache.cached([&calls](const HttpRequestView&, const RouteParameters&)
+    {
+        calls++;
+        return HttpMessage(200, {{"content-type", "text/csv"}}, string(8192, ','));
+    }));
+
+    auto serve = [&](string raw)
+    {
+        HttpParser parser;
+        HttpRequestView view;
+        parser.scan(raw);
+        parser.getView(raw, view);
+        router.serve(&connection, view);
+
+        string output;
+        char buffer[16384];
+        int readBytes;
+        while ((readBytes = recv(handles[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) output.append(buffer, readBytes);
+        return output;
+    };
+
+    //when clients that take gzip, deflate and neither ask, twice each
+    string gzip = serve("GET /report HTTP/1.1\r\naccept-encoding: gzip\r\n\r\n");
+    serve("GET /report HTTP/1.1\r\naccept-encoding: gzip\r\n\r\n");
+    string deflate = serve("GET /report HTTP/1.1\r\naccept-encoding: deflate\r\n\r\n");
+    serve("GET /report HTTP/1.1\r\naccept-encoding: deflate\r\n\r\n");
+    string plain = serve("GET /report HTTP/1.1\r\n\r\n");
+    serve("GET /report HTTP/1.1\r\n\r\n");
+    size_t kept = cache.size();
+    bool forgotten = cache.invalidate("/report");
+    close(handles[1]);
+
+    //then each got its own copy, made only once, and invalidating the uri forgets all of them
+    ASSERT_NE(gzip.find("content-encoding: gzip\r\n"), string::npos);
+    ASSERT_NE(deflate.find("content-encoding: deflate\r\n"), string::npos);
+    ASSERT_TRUE(plain.ends_with(string(8192, ',')));
+    ASSERT_NE(plain.find("vary: accept-encoding\r\n"), string::npos);
+    ASSERT_EQ(calls, 3);
+    ASSERT_EQ(kept, 3);
+    ASSERT_TRUE(forgotten);
+    ASSERT_EQ(cache.size(), 0);
+}
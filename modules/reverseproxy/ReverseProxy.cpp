@@ -0,0 +1,620 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include "PerfectHash.hpp"
+#include "ReverseProxy.hpp"
+
+using namespace std;
+
+/*
+* The helpers in here are static, which keeps them to this file. EventLoop.cpp and HttpClient.cpp have a millisecondsNow
+* of their own, and inline functions with the same name have to be the same everywhere they're linked together.
+*/
+static int64_t millisecondsNow()
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+* 64 bit FNV-1a, then mixed up some more. Where a key lands on the ring is decided by the high bits, and FNV on its own
+* barely touches them when keys only differ at the end, like "/users/1" and "/users/2", so they'd all land together.
+*/
+static uint64_t hashKey(string_view key)
+{
+    uint64_t output = 14695981039346656037ull;
+    for (char letter : key) output = (output ^ (unsigned char)letter) * 1099511628211ull;
+    output = (output ^ (output >> 30)) * 0xbf58476d1ce4e5b9ull;
+    output = (output ^ (output >> 27)) * 0x94d049bb133111ebull;
+    return output ^ (output >> 31);
+}
+
+/*
+* Hop-by-hop headers are about the one connection they came in on, not the message, so they aren't passed on. The
+* framing headers aren't either, since a body can go out framed differently from how it came in.
+*/
+static bool isHopByHop(string_view name)
+{
+    static const string_view NAMES[] = {"connection", "keep-alive", "proxy-connection", "te", "trailer", "transfer-encoding",
+                                        "upgrade", "expect", "content-length"};
+    for (string_view hop : NAMES) if (equalsIgnoringCase(name, hop)) return true;
+    return false;
+}
+
+//A client can name more hop-by-hop headers in its connection header, ie: "connection: keep-alive, x-trace"
+static bool isListedIn(string_view list, string_view name)
+{
+    while (!list.empty())
+    {
+        size_t comma = list.find(',');
+        string_view token = list.substr(0, comma);
+        size_t start = token.find_first_not_of(' ');
+        size_t end = token.find_last_not_of(' ');
+        if (start != string_view::npos && equalsIgnoringCase(token.substr(start, end - start + 1), name)) return true;
+        list = comma == string_view::npos ? string_view() : list.substr(comma + 1);
+    }
+    return false;
+}
+
+
+/*
+* One request on its way through the proxy. It's the source of the client's response (see Connection::streamFrom),
+* and each time it's called it carries on from the step it stopped at, until it has to wait on the backend or the
+* client. The steps are:
+* - CONNECTING: wait for a new connection to the backend to go through.
+* - SENDING: send the head of the request, then the body as it's read from the client.
+* - RECEIVING: read until the head of the response is in, and send it on.
+* - RELAYING: pass the body of the response on a piece at a time.
+* Going out of scope closes the connection to the backend, unless it was put back in the pool.
+*/
+struct ReverseProxy::Exchange
+{
+    enum Step {CONNECTING, SENDING, RECEIVING, RELAYING};
+
+    ReverseProxy* proxy;
+    Route* route;
+    HttpMessage::Method method;
+    string key; //what CONSISTENT_HASH picks by
+    vector<Backend*> tried; //backends we couldn't connect to, so we don't try them again
+    Backend* backend = nullptr;
+    int handle = -1;
+    bool reused = false; //the connection came from the pool, so the backend may have closed it while it sat there
+    bool retried = false;
+    Step step = CONNECTING;
+    string request; //the head (plus the body, if it was read whole), kept in case it has to go out again
+    string outbound; //what's left to send: the request, then the body a piece at a time
+    size_t sent = 0;
+    bool bodyStreamed = false; //the body is still coming in from the client, and is read with readBody as we go
+    bool bodyChunked = false; //and it didn't say how long it is, so it goes on in chunks
+    bool bodyDone = false;
+    string inbound;
+    HttpParser parser;
+
+    bool advance(Connection* client);
+    bool connect(Connection* client);
+    bool send(Connection* client);
+    bool receive(Connection* client);
+    bool relay(Connection* client);
+    int readMore();
+    bool retry();
+    void release(bool reusable);
+    ~Exchange();
+};
+
+ReverseProxy::Backend::Backend(const string& backendHost, int backendPort) : target(backendHost, backendPort)
+{
+    host = backendHost;
+    port = backendPort;
+    active = 0;
+    failures = 0;
+    downUntil = 0;
+}
+
+/*
+* Hand out a spare connection, or -1 if there isn't one. A backend may close a connection it has been keeping for us
+* whenever it likes, so we peek at each one first: one with nothing to read is still good, and one that says it's
+* over (or has something to say when nobody asked) is thrown away.
+*/
+int ReverseProxy::Backend::takeIdle()
+{
+    lock_guard<mutex> guard(idleLock);
+    while (!idle.empty())
+    {
+        int handle = idle.back();
+        idle.pop_back();
+        char peek;
+        if (recv(handle, &peek, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return handle;
+        close(handle);
+    }
+    return -1;
+}
+
+void ReverseProxy::Backend::putIdle(int handle, size_t maxIdle)
+{
+    lock_guard<mutex> guard(idleLock);
+    if (idle.size() < maxIdle) idle.push_back(handle);
+    else close(handle);
+}
+
+ReverseProxy::Backend::~Backend()
+{
+    for (int handle : idle) close(handle);
+}
+
+ReverseProxy::ReverseProxy(ProxyOptions proxyOptions)
+{
+    options = proxyOptions;
+}
+
+/*
+* Send every request whose uri starts with prefix to one of backends, a list of host and port pairs, picked the way
+* balance says. Routes have to be added before the proxy starts serving, since they aren't guarded by a lock.
+*/
+void ReverseProxy::addRoute(const string& prefix, const vector<pair<string,int>>& backends, Balance balance)
+{
+    unique_ptr<Route> route = make_unique<Route>();
+    route->prefix = prefix;
+    route->balance = balance;
+    route->next = 0;
+    for (const auto& [host, port] : backends)
+    {
+        route->backends.push_back(make_unique<Backend>(host, port));
+        Backend* backend = route->backends.back().get();
+        for (int i = 0; i < RING_POINTS; i++) route->ring.push_back({hashKey(host + ":" + to_string(port) + "#" + to_string(i)), backend});
+    }
+    sort(route->ring.begin(), route->ring.end());
+
+    auto position = find_if(routes.begin(), routes.end(), [&](const unique_ptr<Route>& other) { return other->prefix.size() < prefix.size(); });
+    routes.insert(position, std::move(route));
+}
+
+ReverseProxy::Route* ReverseProxy::findRoute(string_view uri)
+{
+    for (const unique_ptr<Route>& route : routes) if (uri.starts_with(route->prefix)) return route.get();
+    return nullptr;
+}
+
+bool ReverseProxy::matches(const HttpRequestView& request)
+{
+    return findRoute(request.requestUri) != nullptr;
+}
+
+bool ReverseProxy::isUp(Backend& backend)
+{
+    return backend.downUntil <= millisecondsNow();
+}
+
+void ReverseProxy::markFailed(Backend& backend)
+{
+    if (++backend.failures >= options.maxFails) backend.downUntil = millisecondsNow() + options.failTimeout;
+}
+
+void ReverseProxy::markHealthy(Backend& backend)
+{
+    backend.failures = 0;
+    backend.downUntil = 0;
+}
+
+//Whether a backend is being sent requests at the moment, for tests and status pages. False if there's no such backend.
+bool ReverseProxy::isBackendUp(const string& host, int port)
+{
+    for (const unique_ptr<Route>& route : routes)
+    {
+        for (const unique_ptr<Backend>& backend : route->backends)
+        {
+            if (backend->host == host && backend->port == port) return isUp(*backend);
+        }
+    }
+    return false;
+}
+
+/*
+* Pick the backend for the next request, leaving out the ones that are down and the ones already tried for this
+* request. Returns nullptr if that leaves nobody.
+*/
+ReverseProxy::Backend* ReverseProxy::pick(Route& route, string_view key, const vector<Backend*>& tried)
+{
+    auto usable = [&](Backend* backend) { return isUp(*backend) && find(tried.begin(), tried.end(), backend) == tried.end(); };
+    size_t count = route.backends.size();
+    Backend* output = nullptr;
+    if (count == 0) return output;
+
+    if (route.balance == CONSISTENT_HASH) //walk around the ring from the key's hash to the first point of a usable backend
+    {
+        size_t start = upper_bound(route.ring.begin(), route.ring.end(), make_pair(hashKey(key), (Backend*)nullptr)) - route.ring.begin();
+        for (size_t i = 0; i < route.ring.size() && output == nullptr; i++)
+        {
+            Backend* backend = route.ring[(start + i) % route.ring.size()].second;
+            if (usable(backend)) output = backend;
+        }
+        return output;
+    }
+
+    //Both of the others start at whoever's turn it is, so least connections spreads out ties instead of piling on the first.
+    size_t start = route.next++;
+    for (size_t i = 0; i < count; i++)
+    {
+        Backend* backend = route.backends[(start + i) % count].get();
+        if (!usable(backend)) continue;
+        if (route.balance == ROUND_ROBIN) return backend;
+        if (output == nullptr || backend->active < output->active) output = backend;
+    }
+    return output;
+}
+
+/*
+* Pass the request on, if it's for one of our routes. Returns false if it isn't, so something else can answer it. The
+* head is written out for the backend right away, since the view of the request is only good until we return. The
+* answer is sent later, as it comes back.
+*/
+bool ReverseProxy::serve(Connection* connection, const HttpRequestView& request)
+{
+    Route* route = findRoute(request.requestUri);
+    if (route == nullptr) return false;
+    if (request.hasHeader(HttpRequestView::TRANSFER_ENCODING) && request.hasHeader(HttpRequestView::CONTENT_LENGTH))
+    {
+        //we'd frame the body by its chunks and a backend might go by the length, and the rest would be a request of its own
+        connection->sendData(HttpMessage(400));
+        return true;
+    }
+
+    shared_ptr<Exchange> exchange = make_shared<Exchange>(); //shared, because the source holding it gets copied around
+    exchange->proxy = this;
+    exchange->route = route;
+    exchange->method = request.httpMethod;
+    exchange->key = options.hashHeader.empty() ? request.requestUri : request.getHeader(options.hashHeader);
+    exchange->parser.expectResponseTo(request.httpMethod);
+    exchange->parser.streamBodiesOver(0); //the response body is passed on as it comes, never gathered up
+
+    string_view uri = request.requestUri;
+    if (options.stripPrefix) uri.remove_prefix(route->prefix.size());
+    string& head = exchange->request;
+    head.append(request.method).append(" ");
+    if (!uri.starts_with("/")) head.append("/"); //"/api" stripped off "/api?page=2" leaves "?page=2"
+    head.append(uri).append(" HTTP/1.1\r\n");
+
+    //the client's address goes on the end of x-forwarded-for, so the backend knows who really asked
+    sockaddr_in peer{};
+    socklen_t length = sizeof(peer);
+    char address[INET_ADDRSTRLEN] = "unknown";
+    if (getpeername(connection->getHandle(), (sockaddr*)&peer, &length) == 0) inet_ntop(AF_INET, &peer.sin_addr, address, sizeof(address));
+    string_view forwarded = request.getHeader("x-forwarded-for");
+    string_view connectionHeader = request.getHeader(HttpRequestView::CONNECTION);
+
+    for (int i = 0; i < request.headerCount; i++)
+    {
+        string_view name = request.headers[i].name;
+        if (isHopByHop(name) || isListedIn(connectionHeader, name) || equalsIgnoringCase(name, "x-forwarded-for")) continue;
+        head.append(name).append(": ").append(request.headers[i].value).append("\r\n");
+    }
+    head.append("x-forwarded-for: ");
+    if (!forwarded.empty()) head.append(forwarded).append(", ");
+    head.append(address).append("\r\n");
+
+    /*
+    * A body that was read whole goes out with the head. One that's still coming in keeps its length if that's how it
+    * was framed, and otherwise goes out in chunks of whatever size it arrives in.
+    */
+    exchange->bodyStreamed = connection->getBodyStatus() == HttpParser::STREAMING;
+    bool hasLength = request.hasHeader(HttpRequestView::CONTENT_LENGTH);
+    bool hasEncoding = request.hasHeader(HttpRequestView::TRANSFER_ENCODING);
+    if (exchange->bodyStreamed && hasLength && !hasEncoding) head.append("content-length: ").append(request.getHeader(HttpRequestView::CONTENT_LENGTH)).append("\r\n");
+    else if (exchange->bodyStreamed)
+    {
+        head.append("transfer-encoding: chunked\r\n");
+        exchange->bodyChunked = true;
+    }
+    else if (!request.body.empty() || hasLength || hasEncoding)
+    {
+        head.append("content-length: ").append(to_string(request.body.size())).append("\r\n");
+    }
+    head.append("\r\n");
+    if (!exchange->bodyStreamed) head.append(request.body);
+    exchange->bodyDone = !exchange->bodyStreamed;
+    exchange->outbound = head;
+
+    connection->streamFrom([exchange](Connection* client) { return exchange->advance(client); });
+    return true;
+}
+
+//Carry on from wherever we stopped. Returns false once the client has had its whole answer, or we've given up.
+bool ReverseProxy::Exchange::advance(Connection* client)
+{
+    switch (step)
+    {
+        case CONNECTING: return connect(client);
+        case SENDING: return send(client);
+        case RECEIVING: return receive(client);
+        default: return relay(client);
+    }
+}
+
+/*
+* Get a connection to a backend: a spare one if there is one, or a new one. A backend we can't connect to has failed,
+* and we move on to the next one, since the request never reached it. If they're all down, or all fail, the client
+* gets a 503 (Service Unavailable) or a 502 (Bad Gateway).
+*/
+bool ReverseProxy::Exchange::connect(Connection* client)
+{
+    while (handle < 0)
+    {
+        backend = proxy->pick(*route, key, tried);
+        if (backend == nullptr)
+        {
+            client->sendData(HttpMessage(tried.empty() ? 503 : 502));
+            return false;
+        }
+        tried.push_back(backend);
+        backend->active++;
+        handle = backend->takeIdle();
+        reused = handle > -1;
+        if (!reused) handle = backend->target.connectHandle(false);
+        if (handle > -1) break;
+
+        proxy->markFailed(*backend);
+        release(false);
+    }
+
+    if (!reused) //a new connection has to go through before we can send on it
+    {
+        pollfd connecting = {handle, POLLOUT, 0};
+        if (poll(&connecting, 1, 0) == 0)
+        {
+            client->waitFor(handle, true);
+            return true;
+        }
+
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(handle, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0)
+        {
+            proxy->markFailed(*backend);
+            release(false);
+            return connect(client);
+        }
+    }
+
+    step = SENDING;
+    return send(client);
+}
+
+/*
+* Send whatever is waiting, then the next piece of the body, until it's all gone. A piece of the body that hasn't come
+* in from the client yet is waited on the same way as the backend: the loop calls us again when either has moved.
+*/
+bool ReverseProxy::Exchange::send(Connection* client)
+{
+    while (true)
+    {
+        while (sent < outbound.size())
+        {
+            ssize_t written = ::send(handle, outbound.data() + sent, outbound.size() - sent, MSG_NOSIGNAL);
+            if (written < 0 && errno == EINTR) continue;
+            if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                client->waitFor(handle, true);
+                return true;
+            }
+            if (written <= 0) //the backend is gone
+            {
+                if (retry()) return connect(client);
+                proxy->markFailed(*backend);
+                client->sendData(HttpMessage(502));
+                return false;
+            }
+            sent += written;
+        }
+
+        if (bodyDone) break;
+        string_view piece;
+        bool more = client->readBody(piece);
+        outbound.clear();
+        sent = 0;
+        if (!piece.empty() && bodyChunked)
+        {
+            char sizeLine[24];
+            outbound.append(sizeLine, snprintf(sizeLine, sizeof(sizeLine), "%zx\r\n", piece.size())).append(piece).append("\r\n");
+        }
+        else outbound.append(piece);
+
+        if (!more)
+        {
+            if (client->getBodyStatus() != HttpParser::COMPLETE) //the client hung up partway, so there's nobody to answer
+            {
+                client->cancelStream();
+                return false;
+            }
+            if (bodyChunked) outbound.append("0\r\n\r\n");
+            bodyDone = true;
+        }
+        else if (piece.empty())
+        {
+            client->waitFor(handle); //a backend that answers before the body is all in gets heard too
+            return true;
+        }
+    }
+
+    step = RECEIVING;
+    return receive(client);
+}
+
+/*
+* Wait for the head of the response and send it on. An answer that's all here already goes out whole, and anything else
+* is started as a streamed response and relayed.
+*/
+bool ReverseProxy::Exchange::receive(Connection* client)
+{
+    while (true)
+    {
+        HttpParser::Status status = parser.scan(inbound);
+        if (status == HttpParser::ERROR)
+        {
+            proxy->markFailed(*backend);
+            client->sendData(HttpMessage(502));
+            return false;
+        }
+        if (!parser.isReadingHead())
+        {
+            if (parser.getStatusCode() < 200) //"100 Continue" and the like. The real answer comes after it.
+            {
+                inbound.erase(0, parser.getFrameLength());
+                parser.reset();
+                continue;
+            }
+            break;
+        }
+
+        int result = readMore();
+        if (result < 0)
+        {
+            client->waitFor(handle);
+            return true;
+        }
+        if (result == 0) //it hung up without answering
+        {
+            if (inbound.empty() && retry()) return connect(client);
+            proxy->markFailed(*backend);
+            client->sendData(HttpMessage(502));
+            return false;
+        }
+    }
+
+    proxy->markHealthy(*backend);
+    HttpRequestView view;
+    parser.getView(inbound, view);
+    //The length only tells the client how much is coming if the body is passed on as it is. A chunked answer comes out
+    //of the parser without its chunks, and gets chunked again (or sent whole) on the way out.
+    bool rechunked = view.hasHeader(HttpRequestView::TRANSFER_ENCODING);
+    HttpMessage response(parser.getStatusCode(), {}, "", string(parser.getReason(inbound)));
+    for (int i = 0; i < view.headerCount; i++)
+    {
+        string_view name = view.headers[i].name;
+        if (!isHopByHop(name) || (equalsIgnoringCase(name, "content-length") && !rechunked)) response.headers.add(string(name), string(view.headers[i].value));
+    }
+
+    /*
+    * A small answer is usually all here already, and then it goes out whole, in one write. Sent as a head and then a
+    * chunk, the client's acknowledgement of the head would hold the chunk up. Every body is streamed by the parser, so
+    * an answer with no body (to HEAD, a 204, a 304, or just an empty one) is complete before we start.
+    */
+    string body;
+    string_view piece;
+    HttpParser::Status status = parser.getStatus();
+    while (status == HttpParser::STREAMING)
+    {
+        status = parser.readBody(inbound, piece);
+        body.append(piece);
+        if (piece.empty()) break;
+    }
+    inbound.erase(parser.getBodyOffset(), parser.dropBody());
+
+    if (status == HttpParser::COMPLETE)
+    {
+        response.body = std::move(body);
+        client->sendData(std::move(response));
+        release(parser.isPersistent() && inbound.size() == parser.getFrameLength());
+        return false;
+    }
+    if (status == HttpParser::ERROR)
+    {
+        proxy->markFailed(*backend);
+        client->sendData(HttpMessage(502));
+        return false;
+    }
+
+    //the rest is relayed as it comes
+    client->startChunked(response);
+    if (!body.empty()) client->sendChunk(std::move(body));
+    step = RELAYING;
+    return relay(client);
+}
+
+/*
+* Pass on the next piece of the body. We return after each piece, so the connection can stop asking once the client
+* has fallen behind, and then we read no more from the backend until it catches up.
+*/
+bool ReverseProxy::Exchange::relay(Connection* client)
+{
+    while (true)
+    {
+        string_view piece;
+        HttpParser::Status status = parser.scan(inbound);
+        if (status == HttpParser::STREAMING) status = parser.readBody(inbound, piece);
+        if (!piece.empty()) client->sendChunk(piece);
+        inbound.erase(parser.getBodyOffset(), parser.dropBody());
+
+        if (status == HttpParser::COMPLETE)
+        {
+            client->finishChunked();
+            release(parser.isPersistent() && inbound.size() == parser.getFrameLength());
+            return false;
+        }
+        if (status == HttpParser::ERROR) break;
+        if (!piece.empty()) return true;
+
+        int result = readMore();
+        if (result < 0)
+        {
+            client->waitFor(handle);
+            return true;
+        }
+        if (result == 0 && (!parser.isReadingToClose() || parser.finish() != HttpParser::COMPLETE)) break;
+    }
+
+    //The backend went away partway through. The client has part of an answer already, so all we can do is cut it off.
+    proxy->markFailed(*backend);
+    client->cancelStream();
+    return false;
+}
+
+//Read what the backend has sent. Returns how much came in, 0 if it hung up, or -1 if there's nothing yet.
+int ReverseProxy::Exchange::readMore()
+{
+    static const size_t READ_SIZE = 65536;
+    size_t start = inbound.size();
+    inbound.resize(start + READ_SIZE);
+    ssize_t received;
+    do received = recv(handle, inbound.data() + start, READ_SIZE, 0); while (received < 0 && errno == EINTR);
+    inbound.resize(start + max(received, (ssize_t)0));
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return -1;
+    return max(received, (ssize_t)0);
+}
+
+/*
+* A connection from the pool may have been closed by the backend just as we picked it up, and then the request never
+* got there. If nothing that can't be sent again has gone out on it, try once more on a fresh connection to the same
+* backend. That doesn't count against the backend, since it didn't do anything wrong.
+*/
+bool ReverseProxy::Exchange::retry()
+{
+    if (!reused || retried || bodyStreamed || !HttpMessage::isIdempotent(method)) return false;
+    retried = true;
+    close(handle);
+    handle = backend->target.connectHandle(false);
+    reused = false;
+    outbound = request;
+    sent = 0;
+    step = CONNECTING;
+    return handle > -1;
+}
+
+//Let go of the backend. A connection that's ready for another request goes back in the pool.
+void ReverseProxy::Exchange::release(bool reusable)
+{
+    if (handle > -1)
+    {
+        if (reusable) backend->putIdle(handle, proxy->options.maxIdle);
+        else close(handle);
+    }
+    if (backend != nullptr) backend->active--;
+    handle = -1;
+    backend = nullptr;
+}
+
+ReverseProxy::Exchange::~Exchange()
+{
+    release(false);
+}
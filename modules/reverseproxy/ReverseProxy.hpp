@@ -0,0 +1,101 @@
+#ifndef StiltFox_UniversalLibrary_ReverseProxy
+#define StiltFox_UniversalLibrary_ReverseProxy
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "HttpParser.hpp"
+#include "HttpRequestView.hpp"
+#include "Socket.hpp"
+
+struct ProxyOptions
+{
+    int maxFails = 3; //a backend that fails this many times in a row is left out for a while...
+    int failTimeout = 10000; //...this many milliseconds, and then it gets another chance
+    size_t maxIdle = 32; //spare connections kept open to each backend, for the next request to use
+    bool stripPrefix = false; //send "/api/users" to the backend as "/users" when the prefix is "/api"
+    std::string hashHeader; //what CONSISTENT_HASH hashes: the value of this header, or the uri if this is empty
+};
+
+/*
+* A reverse proxy passes requests on to other servers (backends) and their answers back to the client, so one server
+* can sit in front of several others without a separate proxy in between. Each route is a uri prefix and a pool of
+* backends, and every request that starts with the prefix goes to one of them, picked one of three ways:
+* - ROUND_ROBIN takes turns.
+* - LEAST_CONNECTIONS picks the one with the fewest requests on the go, so a slow backend gets fewer new ones.
+* - CONSISTENT_HASH always sends the same key (the uri, or a header like a user id) to the same backend, which keeps
+*   their caches warm. Each backend gets a lot of points on a ring of hashes, and a key goes to the first point after
+*   its own hash. Taking a backend out only moves the keys that were going to it.
+*
+* Health checks are passive: nothing is sent just to see if a backend is up. A backend that can't be connected to, or
+* hangs up without answering, has failed, and once it has failed maxFails times in a row it's left out for failTimeout
+* milliseconds. A request whose backend can't be connected to goes to the next one instead, since it never got there.
+*
+* Nothing is waited for in between, so a worker keeps serving everyone else while the backend thinks. The request is
+* passed on from the handler with Connection::streamFrom, and the event loop calls back whenever the backend or the
+* client is ready for more. Bodies stream through in both directions a piece at a time, and never sit in memory whole:
+* an upload is read with readBody as the backend takes it, and the answer is sent on with sendChunk as the client takes
+* it. Connections to backends are kept open between requests, a pool for each backend shared by every worker.
+*
+* The backend has as long as the client's writeTimeout to answer, since that's what the loop waits on while the
+* response is on its way.
+*/
+class ReverseProxy
+{
+    public:
+    enum Balance {ROUND_ROBIN, LEAST_CONNECTIONS, CONSISTENT_HASH};
+
+    private:
+    struct Backend
+    {
+        std::string host;
+        int port;
+        Socket target; //the address is looked up once, here
+        std::mutex idleLock;
+        std::vector<int> idle; //open connections nobody is using, newest at the back
+        std::atomic<int> active; //requests being passed to it right now
+        std::atomic<int> failures; //how many times in a row it has failed
+        std::atomic<int64_t> downUntil; //when it gets another chance, in milliseconds on the steady clock
+
+        Backend(const std::string& host, int port);
+        int takeIdle();
+        void putIdle(int handle, size_t maxIdle);
+        ~Backend();
+    };
+
+    struct Route
+    {
+        std::string prefix;
+        Balance balance;
+        std::vector<std::unique_ptr<Backend>> backends;
+        std::atomic<unsigned> next; //whose turn it is
+        std::vector<std::pair<uint64_t, Backend*>> ring; //the points on the hash ring, in order
+    };
+
+    struct Exchange; //one request on its way through, see ReverseProxy.cpp
+
+    static const int RING_POINTS = 160; //per backend. More points spread the keys out more evenly.
+
+    ProxyOptions options;
+    std::vector<std::unique_ptr<Route>> routes; //longest prefix first, so the most specific one wins
+
+    Route* findRoute(std::string_view uri);
+    Backend* pick(Route& route, std::string_view key, const std::vector<Backend*>& tried);
+    bool isUp(Backend& backend);
+    void markFailed(Backend& backend);
+    void markHealthy(Backend& backend);
+
+    public:
+    ReverseProxy(ProxyOptions options = {});
+    ReverseProxy(const ReverseProxy&) = delete;
+    ReverseProxy& operator=(const ReverseProxy&) = delete;
+    void addRoute(const std::string& prefix, const std::vector<std::pair<std::string,int>>& backends, Balance balance = ROUND_ROBIN);
+    bool matches(const HttpRequestView& request);
+    bool serve(Connection* connection, const HttpRequestView& request);
+    bool isBackendUp(const std::string& host, int port);
+};
+#endif
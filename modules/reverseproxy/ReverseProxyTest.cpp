@@ -0,0 +1,312 @@
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <map>
+#include <thread>
+#include "EventLoop.hpp"
+#include "HttpClient.hpp"
+#include "ReverseProxy.hpp"
+
+/*
+* The backends are real event loops on loopback. Each one answers with its own port, the uri it was asked for, and
+* the port the request came from, so a test can tell which backend answered and whether the proxy kept its connection
+* to that backend open. A request for /hold isn't answered until the test pokes the backend's eventfd.
+*/
+struct Backend
+{
+    int port;
+    int release;
+    Socket listener;
+    EventLoop loop;
+    std::thread runner;
+
+    Backend(int backendPort) : port(backendPort), release(eventfd(0, EFD_NONBLOCK)), listener(backendPort, 64),
+                               loop(&listener, [this](Connection* connection) { answer(connection); }, 1)
+    {
+        listener.listenPort();
+        runner = std::thread(&EventLoop::run, &loop);
+    }
+
+    void answer(Connection* connection)
+    {
+        const HttpRequestView& request = connection->receiveView();
+        sockaddr_in peer{};
+        socklen_t length = sizeof(peer);
+        getpeername(connection->getHandle(), (sockaddr*)&peer, &length);
+        std::string body = std::to_string(port) + std::string(request.requestUri) + "@" + std::to_string(ntohs(peer.sin_port));
+
+        if (request.requestUri == "/hold")
+        {
+            int waitOn = release;
+            connection->streamFrom([waitOn, body](Connection* connection)
+            {
+                uint64_t poke;
+                if (read(waitOn, &poke, sizeof(poke)) < 0)
+                {
+                    connection->waitFor(waitOn);
+                    return true;
+                }
+                connection->sendData(HttpMessage(200, {}, body));
+                return false;
+            });
+        }
+        else if (request.requestUri == "/upload") //add up the body as it comes in, and say how big it was and what it added up to
+        {
+            std::shared_ptr<uint64_t> sum = std::make_shared<uint64_t>(0), size = std::make_shared<uint64_t>(0);
+            connection->streamBody([sum, size](Connection* connection, std::string_view piece, HttpParser::Status status)
+            {
+                for (char letter : piece) *sum += (unsigned char)letter;
+                *size += piece.size();
+                if (status == HttpParser::COMPLETE) connection->sendData(HttpMessage(200, {}, std::to_string(*size) + ":" + std::to_string(*sum)));
+                return true;
+            });
+        }
+        else if (request.requestUri == "/download") //3MB of the alphabet, over and over, a chunk at a time
+        {
+            connection->startChunked(HttpMessage(200));
+            connection->streamChunks([sent = 0](Connection* connection) mutable
+            {
+                std::string piece;
+                for (int i = 0; i < 65536; i++) piece += (char)('a' + (sent + i) % 26);
+                sent += piece.size();
+                connection->sendChunk(std::move(piece));
+                return sent < 3 * 1024 * 1024;
+            });
+        }
+        else connection->sendData(HttpMessage(200, {{"x-backend", std::to_string(port)}}, body));
+    }
+
+    void letGo()
+    {
+        uint64_t poke = 1;
+        write(release, &poke, sizeof(poke));
+    }
+
+    ~Backend()
+    {
+        loop.stop();
+        runner.join();
+        close(release);
+    }
+};
+
+struct Proxy
+{
+    ReverseProxy proxy;
+    Socket listener;
+    EventLoop loop;
+    std::thread runner;
+
+    Proxy(int port, ProxyOptions options = {}, ConnectionLimits limits = {}, EventLoop::Engine engine = EventLoop::EPOLL)
+        : proxy(options), listener(port, 64), loop(&listener, [this](Connection* connection)
+        {
+            if (!proxy.serve(connection, connection->receiveView())) connection->sendData(HttpMessage(404));
+        }, 1, limits)
+    {
+        listener.listenPort();
+        loop.setEngine(engine);
+    }
+
+    void start()
+    {
+        runner = std::thread(&EventLoop::run, &loop);
+    }
+
+    ~Proxy()
+    {
+        loop.stop();
+        runner.join();
+    }
+};
+
+//which backend answered, going by the port at the start of the body
+std::string backendOf(const HttpMessage& response)
+{
+    return response.body.substr(0, 4);
+}
+
+//the port the backend saw the request come from, which is the proxy's end of its connection to the backend
+std::string upstreamPortOf(const HttpMessage& response)
+{
+    return response.body.substr(response.body.find('@') + 1);
+}
+
+TEST(ReverseProxy, serve_will_take_turns_between_backends_and_keep_its_connections_to_them_open)
+{
+    //given two backends behind a round robin proxy
+    Backend first(9216), second(9217);
+    Proxy proxy(9218);
+    proxy.proxy.addRoute("/", {{"127.0.0.1", 9216}, {"127.0.0.1", 9217}});
+    proxy.start();
+    HttpClient client;
+    std::vector<HttpMessage> responses(4, HttpMessage(0));
+
+    //when we send it four requests, one after another
+    bool sent = true;
+    for (int i = 0; i < 4; i++) sent = client.send("127.0.0.1", 9218, HttpMessage(HttpMessage::GET, "/" + std::to_string(i)), responses[i]) && sent;
+
+    //then the backends took turns, each answer came back whole, and each backend got its requests down the same connection
+    ASSERT_TRUE(sent);
+    ASSERT_EQ(responses[0].statusCode, 200);
+    ASSERT_EQ(responses[0].getHeader("x-backend"), backendOf(responses[0]));
+    ASSERT_TRUE(responses[1].body.starts_with(backendOf(responses[1]) + "/1@"));
+    ASSERT_NE(backendOf(responses[0]), backendOf(responses[1]));
+    ASSERT_EQ(backendOf(responses[0]), backendOf(responses[2]));
+    ASSERT_EQ(backendOf(responses[1]), backendOf(responses[3]));
+    ASSERT_EQ(upstreamPortOf(responses[0]), upstreamPortOf(responses[2]));
+    ASSERT_EQ(upstreamPortOf(responses[1]), upstreamPortOf(responses[3]));
+}
+
+TEST(ReverseProxy, serve_will_send_new_requests_to_the_backend_with_the_fewest_on_the_go)
+{
+    //given two backends behind a least connections proxy, one of which is holding on to a request
+    Backend first(9219), second(9220);
+    Proxy proxy(9221);
+    proxy.proxy.addRoute("/", {{"127.0.0.1", 9219}, {"127.0.0.1", 9220}}, ReverseProxy::LEAST_CONNECTIONS);
+    proxy.start();
+    HttpClient client;
+    std::promise<HttpMessage> held;
+    client.sendAsync("127.0.0.1", 9221, HttpMessage(HttpMessage::GET, "/hold"), [&](bool, HttpMessage& response) { held.set_value(response); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    //when more requests come in while it's held, and then it's let go
+    std::vector<HttpMessage> responses(3, HttpMessage(0));
+    bool sent = true;
+    for (int i = 0; i < 3; i++) sent = client.send("127.0.0.1", 9221, HttpMessage(HttpMessage::GET, "/quick"), responses[i]) && sent;
+    first.letGo();
+    second.letGo();
+    std::future<HttpMessage> answer = held.get_future();
+    bool answered = answer.wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+
+    //then every one of them went to the backend that wasn't busy, and the held one was answered once it could be
+    ASSERT_TRUE(sent && answered);
+    HttpMessage heldResponse = answer.get();
+    ASSERT_TRUE(heldResponse.body.substr(4).starts_with("/hold@"));
+    for (HttpMessage& response : responses) ASSERT_NE(backendOf(response), backendOf(heldResponse));
+}
+
+TEST(ReverseProxy, serve_will_send_the_same_key_to_the_same_backend_with_consistent_hashing)
+{
+    //given three backends behind a proxy hashing the uri, which it strips its prefix from
+    Backend first(9222), second(9223), third(9224);
+    ProxyOptions options;
+    options.stripPrefix = true;
+    Proxy proxy(9225, options);
+    proxy.proxy.addRoute("/users", {{"127.0.0.1", 9222}, {"127.0.0.1", 9223}, {"127.0.0.1", 9224}}, ReverseProxy::CONSISTENT_HASH);
+    proxy.start();
+    HttpClient client;
+    std::map<std::string, int> answeredBy;
+    bool sent = true, stuck = true;
+
+    //when we ask for 30 different users, twice each
+    for (int round = 0; round < 2; round++)
+    {
+        for (int i = 0; i < 30; i++)
+        {
+            HttpMessage response(0);
+            std::string user = "/" + std::to_string(i);
+            sent = client.send("127.0.0.1", 9225, HttpMessage(HttpMessage::GET, "/users" + user), response) && sent;
+            int backend = atoi(backendOf(response).c_str());
+            if (round == 1) stuck = stuck && answeredBy[user] == backend;
+            answeredBy[user] = backend;
+            ASSERT_TRUE(response.body.substr(4).starts_with(user + "@"));
+        }
+    }
+
+    //then each user went to the same backend both times, and the users were spread over all three
+    ASSERT_TRUE(sent && stuck);
+    std::map<int, int> perBackend;
+    for (auto& [user, backend] : answeredBy) perBackend[backend]++;
+    ASSERT_EQ(perBackend.size(), 3);
+}
+
+TEST(ReverseProxy, serve_will_leave_out_a_backend_that_keeps_failing_and_still_get_every_request_answered)
+{
+    //given a proxy with one backend that's up and one where nobody is listening
+    Backend up(9226);
+    ProxyOptions options;
+    options.maxFails = 2;
+    Proxy proxy(9228, options);
+    proxy.proxy.addRoute("/", {{"127.0.0.1", 9226}, {"127.0.0.1", 9227}});
+    proxy.start();
+    HttpClient client;
+    bool sent = true, allFromUp = true;
+
+    //when we send it a few requests
+    for (int i = 0; i < 6; i++)
+    {
+        HttpMessage response(0);
+        sent = client.send("127.0.0.1", 9228, HttpMessage(HttpMessage::POST, "/", {}, "hello"), response) && sent;
+        allFromUp = allFromUp && response.statusCode == 200 && backendOf(response) == "9226";
+    }
+
+    //then they all went to the one that's up, which the proxy still counts on, and it has given up on the other for now
+    ASSERT_TRUE(sent && allFromUp);
+    ASSERT_TRUE(proxy.proxy.isBackendUp("127.0.0.1", 9226));
+    ASSERT_FALSE(proxy.proxy.isBackendUp("127.0.0.1", 9227));
+}
+
+TEST(ReverseProxy, serve_will_stream_big_bodies_through_in_both_directions)
+{
+    //given a proxy that streams request bodies over 64KB, on the io_uring engine if this kernel has it
+    Backend backend(9229);
+    ConnectionLimits limits;
+    limits.bodyBuffer = 65536;
+    limits.streamBuffer = 65536;
+    Proxy proxy(9230, {}, limits, EventLoop::IO_URING);
+    proxy.proxy.addRoute("/", {{"127.0.0.1", 9229}});
+    proxy.start();
+    HttpClient client;
+    std::string upload(3 * 1024 * 1024, 'x');
+    for (size_t i = 0; i < upload.size(); i += 7) upload[i] = (char)i;
+    uint64_t sum = 0;
+    for (char letter : upload) sum += (unsigned char)letter;
+
+    //when we upload 3MB through it, and download 3MB through it
+    HttpMessage uploaded(0), downloaded(0);
+    bool sentUpload = client.send("127.0.0.1", 9230, HttpMessage(HttpMessage::POST, "/upload", {}, upload), uploaded);
+    bool sentDownload = client.send("127.0.0.1", 9230, HttpMessage(HttpMessage::GET, "/download"), downloaded);
+
+    //then the backend got every byte of the upload, and we got every byte of the download
+    ASSERT_TRUE(sentUpload && sentDownload);
+    ASSERT_EQ(uploaded.body, std::to_string(upload.size()) + ":" + std::to_string(sum));
+    ASSERT_EQ(downloaded.statusCode, 200);
+    ASSERT_EQ(downloaded.body.size(), 3 * 1024 * 1024);
+    bool inOrder = true;
+    for (size_t i = 0; i < downloaded.body.size() && inOrder; i++) inOrder = downloaded.body[i] == (char)('a' + i % 26);
+    ASSERT_TRUE(inOrder);
+}
+
+TEST(ReverseProxy, serve_will_refuse_a_body_with_both_a_length_and_chunks_instead_of_passing_it_on)
+{
+    //given a proxy that streams request bodies, in front of a backend
+    Backend backend(9205);
+    ConnectionLimits limits;
+    limits.bodyBuffer = 4;
+    Proxy proxy(9231, {}, limits);
+    proxy.proxy.addRoute("/", {{"127.0.0.1", 9205}});
+    proxy.start();
+
+    //when we send it a chunked body that also claims a length, with a second request hidden in the chunks
+    int handle = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(9231);
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    connect(handle, (sockaddr*)&address, sizeof(address));
+    std::string request = "POST /upload HTTP/1.1\r\ntransfer-encoding: chunked\r\ncontent-length: 5\r\n\r\n"
+        "1d\r\nhelloGET /hidden HTTP/1.1\r\n\r\n\r\n0\r\n\r\n";
+    send(handle, request.data(), request.size(), 0);
+    std::string actual;
+    char buffer[1024];
+    for (ssize_t got; (got = read(handle, buffer, sizeof(buffer))) > 0;) actual.append(buffer, got);
+    close(handle);
+
+    //then it's turned away, and nothing reaches the backend
+    ASSERT_TRUE(actual.starts_with("HTTP/1.1 400 Bad Request\r\n"));
+    ASSERT_EQ(actual.find("9205"), std::string::npos);
+}
@@ -0,0 +1,190 @@
+#include <algorithm>
+#include "Router.hpp"
+
+using namespace std;
+
+string_view RouteParameters::get(string_view name) const
+{
+    for (int i = 0; i < count; i++) if (parameters[i].name == name) return parameters[i].value;
+    return {};
+}
+
+int RouteParameters::size() const
+{
+    return count;
+}
+
+const RouteParameters::Parameter& RouteParameters::operator[](int index) const
+{
+    return parameters[index];
+}
+
+Router::Node::Node()
+{
+    fill(begin(handlers), end(handlers), -1);
+}
+
+/*
+* Walk down from node along the text, making nodes for whatever isn't in the tree yet, and return the node the text
+* ends at. If the text parts ways with a child partway through the child's path, the child gets split in two at that
+* point, so the part they have in common can be shared.
+*/
+Router::Node* Router::addText(Node* node, string_view text)
+{
+    while (!text.empty())
+    {
+        size_t index = node->indices.find(text[0]);
+        if (index == string::npos) //nothing starts like this yet
+        {
+            node->indices += text[0];
+            node->children.push_back(make_unique<Node>());
+            node->children.back()->path = text;
+            return node->children.back().get();
+        }
+
+        Node* child = node->children[index].get();
+        size_t common = 0;
+        while (common < child->path.size() && common < text.size() && child->path[common] == text[common]) common++;
+
+        if (common < child->path.size())
+        {
+            unique_ptr<Node> middle = make_unique<Node>();
+            middle->path = child->path.substr(0, common);
+            child->path.erase(0, common);
+            middle->indices = child->path.substr(0, 1);
+            middle->children.push_back(move(node->children[index]));
+            node->children[index] = move(middle);
+            child = node->children[index].get();
+        }
+
+        text.remove_prefix(common);
+        node = child;
+    }
+    return node;
+}
+
+/*
+* Add a route. Returns false if the pattern doesn't make sense (it has to start with /, captures have to be whole
+* segments, and a wildcard has to come last), if it has too many captures, if it gives a capture a different name
+* than another route does in the same spot, or if there's already a route for this method and pattern.
+*/
+bool Router::add(HttpMessage::Method method, string_view pattern, RouteHandler handler)
+{
+    if (method < 0 || method >= METHOD_COUNT || !pattern.starts_with('/')) return false;
+
+    Node* node = &root;
+    int captures = 0;
+    size_t position = 0;
+    while (position < pattern.size())
+    {
+        size_t special = pattern.find_first_of(":*", position);
+        node = addText(node, pattern.substr(position, special - position));
+        if (special == string_view::npos) break;
+
+        size_t end = min(pattern.find('/', special), pattern.size());
+        string_view name = pattern.substr(special + 1, end - special - 1);
+        bool wildcard = pattern[special] == '*';
+        if (pattern[special - 1] != '/' || name.empty() || (wildcard && end != pattern.size())) return false;
+        if (++captures > RouteParameters::MAX_PARAMETERS) return false;
+
+        unique_ptr<Node>& child = wildcard ? node->wildcard : node->parameter;
+        if (child == nullptr)
+        {
+            child = make_unique<Node>();
+            child->name = name;
+        }
+        else if (child->name != name) return false;
+
+        node = child.get();
+        position = end;
+    }
+
+    if (node->handlers[method] > -1) return false;
+    node->handlers[method] = handlers.size();
+    node->hasHandler = true;
+    handlers.push_back(move(handler));
+    return true;
+}
+
+/*
+* Find the node that ends a route matching the path, filling in the parameters along the way. Text is tried first,
+* then a parameter, then a wildcard. If a way down comes to a dead end, we back up and try the next one, taking off
+* any parameters it captured.
+*/
+const Router::Node* Router::match(const Node* node, string_view path, RouteParameters& parameters)
+{
+    if (!path.starts_with(node->path)) return nullptr;
+    path.remove_prefix(node->path.size());
+
+    if (path.empty() && node->hasHandler) return node;
+
+    if (!path.empty())
+    {
+        size_t index = node->indices.find(path[0]);
+        if (index != string::npos)
+        {
+            const Node* found = match(node->children[index].get(), path, parameters);
+            if (found != nullptr) return found;
+        }
+
+        string_view segment = path.substr(0, path.find('/'));
+        if (node->parameter != nullptr && !segment.empty() && parameters.count < RouteParameters::MAX_PARAMETERS)
+        {
+            parameters.parameters[parameters.count++] = {node->parameter->name, segment};
+            const Node* found = match(node->parameter.get(), path.substr(segment.size()), parameters);
+            if (found != nullptr) return found;
+            parameters.count--;
+        }
+    }
+
+    if (node->wildcard != nullptr && node->wildcard->hasHandler && parameters.count < RouteParameters::MAX_PARAMETERS)
+    {
+        parameters.parameters[parameters.count++] = {node->wildcard->name, path};
+        return node->wildcard.get();
+    }
+    return nullptr;
+}
+
+/*
+* Find the handler for a method and path (without the query string). Returns nullptr if there isn't one. If the path
+* matches a route but not for this method, and allowed is given, it's filled in with the methods the route does take,
+* ie: "GET, POST", for the allow header of a 405.
+*/
+const RouteHandler* Router::find(HttpMessage::Method method, string_view path, RouteParameters& parameters,
+                                 string* allowed) const
+{
+    parameters.count = 0;
+    const Node* node = match(&root, path, parameters);
+    if (node == nullptr) return nullptr;
+    if (method >= 0 && method < METHOD_COUNT && node->handlers[method] > -1) return &handlers[node->handlers[method]];
+
+    if (allowed != nullptr)
+    {
+        allowed->clear();
+        for (int i = 0; i < METHOD_COUNT; i++)
+        {
+            if (node->handlers[i] < 0) continue;
+            if (!allowed->empty()) allowed->append(", ");
+            allowed->append(HttpMessage::getMethodName((HttpMessage::Method)i));
+        }
+    }
+    return nullptr;
+}
+
+/*
+* Hand the request to the handler of the route it matches. Like StaticFiles::serve, this returns false if no route
+* matches, so the caller can try something else or send a 404. A path that matches but with the wrong method is
+* answered with a 405 here.
+*/
+bool Router::serve(Connection* connection, const HttpRequestView& request) const
+{
+    string_view path = request.requestUri.substr(0, request.requestUri.find_first_of("?#"));
+    RouteParameters parameters;
+    string allowed;
+
+    const RouteHandler* handler = find(request.httpMethod, path, parameters, &allowed);
+    if (handler != nullptr) (*handler)(connection, request, parameters);
+    else if (!allowed.empty()) connection->sendData(HttpMessage(405, {{"allow", allowed}}));
+    else return false;
+    return true;
+}
@@ -0,0 +1,89 @@
+#ifndef StiltFox_UniversalLibrary_Router
+#define StiltFox_UniversalLibrary_Router
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "HttpRequestView.hpp"
+#include "Socket.hpp"
+
+/*
+* The pieces of the uri a route captured, by name. Both the names and the values are views: the names point into the
+* router and the values into the request, so filling these in copies nothing. Like the request view itself, they're
+* only good until the connection moves on to the next request.
+*/
+class RouteParameters
+{
+    friend class Router;
+
+    public:
+    static const int MAX_PARAMETERS = 8; //routes with more captures than this are refused when they're added
+
+    struct Parameter
+    {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    private:
+    Parameter parameters[MAX_PARAMETERS];
+    int count = 0;
+
+    public:
+    std::string_view get(std::string_view name) const; //empty if there's no parameter with that name
+    int size() const;
+    const Parameter& operator[](int index) const;
+};
+
+typedef std::function<void(Connection*, const HttpRequestView&, const RouteParameters&)> RouteHandler;
+
+/*
+* A Router picks the handler for a request from its method and path, so handlers don't have to be one long chain of
+* ifs. Routes are added with a pattern, where a piece of the path can be:
+*   /users/list      text, which has to match exactly
+*   /users/:id       a parameter, which matches one segment (anything up to the next /) and captures it as "id"
+*   *path            a wildcard, which matches the whole rest of the path, slashes and all. It has to come last, so
+*                    "/files/" and then "*path" serves everything under /files.
+* When more than one route could match, text wins over a parameter, and a parameter wins over a wildcard, no matter
+* what order they were added in.
+*
+* With hundreds of routes, trying each one in turn would get slow, so the routes are kept in a radix tree: a tree of
+* path pieces where routes that start the same way share the nodes for the part they have in common, and a node with
+* only one child is merged into it. Finding a route walks down the tree one piece of the path at a time, so it takes
+* time in proportion to the length of the path, not the number of routes, and it doesn't allocate anything.
+*
+* Add every route before the server starts. After that the router is only ever read, so every worker can use it at
+* once without a lock.
+*/
+class Router
+{
+    static const int METHOD_COUNT = HttpMessage::ERROR; //GET up to TRACE
+
+    struct Node
+    {
+        std::string path; //the text this node matches. Empty for parameters and wildcards.
+        std::string indices; //the first letter of each child's path, so we know which child to try without looking at all of them
+        std::vector<std::unique_ptr<Node>> children;
+        std::unique_ptr<Node> parameter; //the :name child, if there is one
+        std::unique_ptr<Node> wildcard; //the *name child, if there is one
+        std::string name; //what a parameter or wildcard node captures as
+        int handlers[METHOD_COUNT]; //index into handlers for each method, or -1
+        bool hasHandler = false;
+
+        Node();
+    };
+
+    Node root;
+    std::vector<RouteHandler> handlers;
+
+    static Node* addText(Node* node, std::string_view text);
+    static const Node* match(const Node* node, std::string_view path, RouteParameters& parameters);
+
+    public:
+    bool add(HttpMessage::Method method, std::string_view pattern, RouteHandler handler);
+    const RouteHandler* find(HttpMessage::Method method, std::string_view path, RouteParameters& parameters,
+                             std::string* allowed = nullptr) const;
+    bool serve(Connection* connection, const HttpRequestView& request) const;
+};
+#endif
@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "HttpParser.hpp"
+#include "Router.hpp"
+
+using namespace std;
+
+//a handler that doesn't do anything. Tests that only call find tell routes apart by which handler comes back.
+void nothing(Connection*, const HttpRequestView&, const RouteParameters&) {}
+
+TEST(Router, find_will_pick_the_right_route_out_of_hundreds)
+{
+    //given a router with a few hundred routes that all start the same way
+    Router router;
+    for (int i = 0; i < 300; i++) ASSERT_TRUE(router.add(HttpMessage::GET, "/api/v1/resource" + to_string(i) + "/list", nothing));
+
+    //when we look some of them up
+    RouteParameters parameters;
+    const RouteHandler* first = router.find(HttpMessage::GET, "/api/v1/resource1/list", parameters);
+    const RouteHandler* tenth = router.find(HttpMessage::GET, "/api/v1/resource10/list", parameters);
+    const RouteHandler* last = router.find(HttpMessage::GET, "/api/v1/resource299/list", parameters);
+
+    //then each finds a route of its own, and paths that only start like a route find nothing
+    ASSERT_NE(first, nullptr);
+    ASSERT_NE(tenth, nullptr);
+    ASSERT_NE(last, nullptr);
+    ASSERT_NE(first, tenth);
+    ASSERT_NE(tenth, last);
+    ASSERT_EQ(router.find(HttpMessage::GET, "/api/v1/resource1", parameters), nullptr);
+    ASSERT_EQ(router.find(HttpMessage::GET, "/api/v1/resource300/list", parameters), nullptr);
+    ASSERT_EQ(router.find(HttpMessage::GET, "/api/v1/resource1/list/more", parameters), nullptr);
+}
+
+TEST(Router, find_will_capture_parameters_and_wildcards)
+{
+    //given routes with parameters and a wildcard
+    Router router;
+    ASSERT_TRUE(router.add(HttpMessage::GET, "/users/:id/posts/:post", nothing));
+    ASSERT_TRUE(router.add(HttpMessage::GET, "/files/*path", nothing));
+
+    //when we look up paths that match them
+    RouteParameters posts;
+    RouteParameters files;
+    RouteParameters folder;
+    const RouteHandler* post = router.find(HttpMessage::GET, "/users/42/posts/hello-world", posts);
+    const RouteHandler* file = router.find(HttpMessage::GET, "/files/css/site.css", files);
+    const RouteHandler* empty = router.find(HttpMessage::GET, "/files/", folder);
+
+    //then the captured pieces come back by name
+    ASSERT_NE(post, nullptr);
+    ASSERT_EQ(posts.size(), 2);
+    ASSERT_EQ(posts.get("id"), "42");
+    ASSERT_EQ(posts.get("post"), "hello-world");
+    ASSERT_EQ(posts[0].name, "id");
+    ASSERT_EQ(posts.get("nope"), "");
+    ASSERT_NE(file, nullptr);
+    ASSERT_EQ(files.get("path"), "css/site.css");
+    ASSERT_NE(empty, nullptr);
+    ASSERT_EQ(folder.get("path"), "");
+    ASSERT_EQ(router.find(HttpMessage::GET, "/users//posts/x", posts), nullptr); //a parameter can't be empty
+}
+
+TEST(Router, find_will_prefer_text_over_parameters_over_wildcards)
+{
+    //given routes that overlap, added with the least specific first
+    Router router;
+    ASSERT_TRUE(router.add(HttpMessage::GET, "/users/*rest", nothing));
+    ASSERT_TRUE(router.add(HttpMessage::GET, "/users/:id", nothing));
+    ASSERT_TRUE(router.add(HttpMessage::GET, "/users/:id/settings", nothing));
+    ASSERT_TRUE(router.add(HttpMessage::GET, "/users/me", nothing));
+    ASSERT_TRUE(router.add(HttpMessage::GET, "/users/mentions/new", nothing));
+
+    //when we look up paths that more than one of them could answer
+    RouteParameters parameters;
+    const RouteHandler* me = router.find(HttpMessage::GET, "/users/me", parameters);
+    ASSERT_EQ(parameters.size(), 0);
+    const RouteHandler* someone = router.find(HttpMessage::GET, "/users/mentions", parameters); //starts like "mentions/new", but isn't
+    ASSERT_EQ(parameters.get("id"), "mentions");
+    const RouteHandler* settings = router.find(HttpMessage::GET, "/users/me/settings", parameters);
+    ASSERT_EQ(parameters.get("id"), "me");
+    const RouteHandler* rest = router.find(HttpMessage::GET, "/users/7/posts/3", parameters);
+
+    //then the most specific route wins, backing up when the text runs into a dead end
+    ASSERT_EQ(parameters.size(), 1);
+    ASSERT_EQ(parameters.get("rest"), "7/posts/3");
+    ASSERT_NE(me, someone);
+    ASSERT_NE(someone, settings);
+    ASSERT_NE(settings, rest);
+    ASSERT_EQ(someone, router.find(HttpMessage::GET, "/users/42", parameters));
+}
+
+TEST(Router, add_will_refuse_patterns_that_dont_make_sense)
+{
+    //given a router with a route in it
+    Router router;
+    ASSERT_TRUE(router.add(HttpMessage::GET, "/users/:id", nothing));
+
+    //when we add routes that are broken or clash with it
+    //then they're refused
+    ASSERT_FALSE(router.add(HttpMessage::GET, "/users/:id", nothing)); //already there
+    ASSERT_FALSE(router.add(HttpMessage::GET, "/users/:name/posts", nothing)); //the same capture by a different name
+    ASSERT_FALSE(router.add(HttpMessage::GET, "users", nothing)); //no leading slash
+    ASSERT_FALSE(router.add(HttpMessage::GET, "/files/*path/more", nothing)); //a wildcard that isn't last
+    ASSERT_FALSE(router.add(HttpMessage::GET, "/user:id", nothing)); //a capture that isn't a whole segment
+    ASSERT_FALSE(router.add(HttpMessage::GET, "/users/:", nothing)); //a capture without a name
+    ASSERT_FALSE(router.add(HttpMessage::ERROR, "/error", nothing));
+    ASSERT_FALSE(router.add(HttpMessage::GET, "/:a/:b/:c/:d/:e/:f/:g/:h/:i", nothing)); //too many captures
+    ASSERT_TRUE(router.add(HttpMessage::POST, "/users/:id", nothing)); //the same path with another method is fine
+}
+
+TEST(Router, serve_will_call_the_handler_or_send_a_405_for_the_wrong_method)
+{
+    //given a router with a route that echoes its parameter, and a connection made from a socket pair
+    int handles[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, handles);
+    Connection connection(handles[0]);
+    Router router;
+    router.add(HttpMessage::GET, "/hello/:name", [](Connection* connection, const HttpRequestView&, const RouteParameters& parameters)
+    {
+        connection->sendData(HttpMessage(200, {}, "hi " + string(parameters.get("name"))));
+    });
+    router.add(HttpMessage::PUT, "/hello/:name", nothing);
+
+    //when we serve a matching request, one with the wrong method, and one that matches nothing
+    auto serve = [&](string raw, bool& served)
+    {
+        HttpParser parser;
+        HttpRequestView view;
+        parser.scan(raw);
+        parser.getView(raw, view);
+        served = router.serve(&connection, view);
+
+        string output;
+        char buffer[4096];
+        int readBytes;
+        while ((readBytes = recv(handles[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) output.append(buffer, readBytes);
+        return output;
+    };
+    bool matched, wrongMethod, missing;
+    string hello = serve("GET /hello/fox?loud=yes HTTP/1.1\r\n\r\n", matched);
+    string deleted = serve("DELETE /hello/fox HTTP/1.1\r\n\r\n", wrongMethod);
+    string nobody = serve("GET /goodbye HTTP/1.1\r\n\r\n", missing);
+    close(handles[1]);
+
+    //then the handler answers the first, the router answers the second, and the third is left for somebody else
+    ASSERT_TRUE(matched);
+    ASSERT_TRUE(hello.ends_with("\r\n\r\nhi fox"));
+    ASSERT_TRUE(wrongMethod);
+    ASSERT_TRUE(deleted.starts_with("HTTP/1.1 405"));
+    ASSERT_NE(deleted.find("allow: GET, PUT\r\n"), string::npos);
+    ASSERT_FALSE(missing);
+    ASSERT_EQ(nobody, "");
+}
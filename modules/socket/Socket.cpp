@@ -3,14 +3,95 @@
 #ifdef MAC
     #include <sys/types.h>
 #endif
+#include <errno.h>
 #include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#include <strings.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "PerfectHash.hpp"
 #include "Socket.hpp"
+#ifdef __linux__
+    #include <sys/sendfile.h>
+#endif
 
-Connection::Connection(int handle)
+/*
+* A socket can either be blocking or non-blocking. A blocking socket puts the thread to
+* sleep when we read and there is nothing there yet. A non-blocking one returns right away
+* with errno set to EAGAIN instead, which lets a single thread juggle many sockets at once.
+*/
+inline bool setBlockingMode(int handle, bool blocking)
+{
+    int flags = fcntl(handle, F_GETFL, 0);
+    if (flags < 0) return false;
+    flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+    return fcntl(handle, F_SETFL, flags) >= 0;
+}
+
+FileBody::FileBody(int handle, size_t size)
 {
     this->handle = handle;
+    this->size = size;
+}
+
+FileBody::~FileBody()
+{
+    if (handle > -1) close(handle);
+}
+
+/*
+* Everything writeHead would add for a response, minus "connection: close", is worked out here once. Whether a
+* connection needs that depends on the connection, so sendFrozen slips it in at headSize when it does.
+*/
+FrozenResponse::FrozenResponse(const HttpMessage& response)
+{
+    bool bodyAllowed = response.statusCode >= 200 && response.statusCode != 204 && response.statusCode != 304;
+    bool addLength = bodyAllowed && !response.hasHeader("content-length") && !response.hasHeader("transfer-encoding");
+
+    statusCode = response.statusCode;
+    bodySize = response.body.size();
+    closes = strcasecmp(response.getHeader("connection").c_str(), "close") == 0;
+    namesConnection = response.hasHeader("connection");
+    response.appendResponseHead(bytes);
+    headSize = bytes.size();
+    if (addLength) bytes.append("content-length: ").append(std::to_string(bodySize)).append("\r\n");
+    bytes.append("\r\n").append(response.body);
+}
+
+std::shared_ptr<const FrozenResponse> FrozenResponse::freeze(const HttpMessage& response)
+{
+    return std::make_shared<const FrozenResponse>(response);
+}
+
+/*
+* The arena has to be built in the initializer list (the part after the :), because it needs to know about
+* arenaBuffer the moment it is created and can't be assigned to afterwards.
+*/
+Connection::Connection(int handle) : arena(arenaBuffer, sizeof(arenaBuffer))
+{
+    this->handle = handle;
+    consumed = 0;
+    broken = false;
+    deferSends = false;
+    requestCount = 0;
+    persistent = keepAliveEnded = false;
+    responseStatus = 0;
+    responseSize = 0;
+    bytesReceived = bytesSent = 0;
+    timeSends = false;
+    sendTime = 0;
+    streaming = chunked = headOnly = false;
+    deferred = waitWritable = waiting = false;
+    waitHandle = -1;
+    chunkBytes = 0;
+    bodyStatus = HttpParser::COMPLETE;
+    bodyTaken = continueWanted = false;
+    parser.streamBodiesOver(limits.bodyBuffer);
 }
 
 int Connection::getHandle()
@@ -18,26 +99,930 @@ int Connection::getHandle()
     return handle;
 }
 
+int Connection::getRequestCount()
+{
+    return requestCount;
+}
+
+//The status code and body size of the last response sent (or queued) on this connection. 0 if there hasn't been one.
+int Connection::getResponseStatus()
+{
+    return responseStatus;
+}
+
+size_t Connection::getResponseSize()
+{
+    return responseSize;
+}
+
+uint64_t Connection::getBytesReceived()
+{
+    return bytesReceived;
+}
+
+uint64_t Connection::getBytesSent()
+{
+    return bytesSent;
+}
+
+/*
+* With send timing on, the connection adds up how long its send calls take. An event loop collecting metrics uses
+* this to tell the time a handler spent working apart from the time it spent waiting on the socket.
+*/
+void Connection::setSendTiming(bool timing)
+{
+    timeSends = timing;
+}
+
+//how many nanoseconds were spent sending since the last time this was called
+uint64_t Connection::takeSendTime()
+{
+    uint64_t output = sendTime;
+    sendTime = 0;
+    return output;
+}
+
+/*
+* HTTP/1.1 lets a client send request after request over the same connection, which saves setting up a new TCP
+* connection every time. This tells the owner of the connection if it should wait for another request after the
+* last response went out.
+*/
+bool Connection::keepAlive()
+{
+    return persistent;
+}
+
+/*
+* Make the request being answered the last one on this connection, or the next one if none is in yet. Its response
+* says "connection: close", unless it went out already. A server that is shutting down gently uses this.
+*/
+void Connection::endKeepAlive()
+{
+    keepAliveEnded = true;
+    persistent = false;
+}
+
+void Connection::setLimits(ConnectionLimits newLimits)
+{
+    limits = newLimits;
+    parser.streamBodiesOver(limits.bodyBuffer);
+}
+
+ConnectionLimits Connection::getLimits()
+{
+    return limits;
+}
+
 /*
-* This method right here is small because HttpMessage does most of the heavy
+* This method right here is small because HttpParser does most of the heavy
 * lifting.
-* This method is how we receive requests from the client.
+* This method is how we receive requests from the client. It gives back a copy
+* of the request that belongs to the caller.
 */
 HttpMessage Connection::receiveData()
 {
-    /*
-    * We pass in the handle to our socket and the read function from sys/socket.h
-    * with this information the HttpMessage will construct itself and return to the
-    * caller.
-    */
-    return HttpMessage(handle, &read);
+    return receiveView().toMessage();
+}
+
+/*
+* This is the fast way to receive a request. We keep reading from the socket until
+* the parser says it has a whole request, then hand back a view that points right
+* into our buffer, so nothing gets copied. The view is only good until the next
+* request is received. If an event loop already pulled the bytes off the socket for
+* us, we never have to read at all.
+*
+* A body bigger than the bodyBuffer limit isn't waited for. The view comes back as
+* soon as the head is in, with an empty body, and the body is taken a piece at a time
+* with streamBody or readBody. If nobody takes it, it's read and thrown away before
+* the next request.
+*/
+const HttpRequestView& Connection::receiveView()
+{
+    while (pollRequest() == HttpParser::NEED_MORE)
+    {
+        int readBytes;
+        do readBytes = fillBuffer(); while (readBytes < 0 && errno == EINTR);
+
+        if (readBytes <= 0) //the client hung up (or has nothing more for us), so make do with what we have.
+        {
+            if (bodyStatus == HttpParser::STREAMING) pumpBody(true); //it was partway through the body of the last request
+            parser.finish();
+            break;
+        }
+    }
+
+    requestCount++;
+    persistent = parser.isPersistent() && requestCount < limits.maxRequests && !keepAliveEnded;
+    parser.getView(inbound, request);
+    bodyStatus = parser.getStatus() == HttpParser::STREAMING ? HttpParser::STREAMING : HttpParser::COMPLETE;
+    bodyTaken = false;
+    continueWanted = bodyStatus == HttpParser::STREAMING && request.version != "HTTP/1.0" &&
+        equalsIgnoringCase(request.getHeader(HttpRequestView::EXPECT), "100-continue");
+    consumed = bodyStatus == HttpParser::STREAMING ? 0 : parser.getStatus() == HttpParser::COMPLETE ? parser.getFrameLength() : inbound.size();
+    return request;
+}
+
+/*
+* The request the last receiveView handed out. Reading more of its body can move the buffer it points into, so the view
+* is pointed at the new place every time that happens. It stays good until the next request is received.
+*/
+const HttpRequestView& Connection::getRequest()
+{
+    return request;
+}
+
+/*
+* Hand whatever we've buffered to the parser and report how it's going. This never
+* touches the socket, so an event loop can use it to check if a request is ready
+* before calling a handler. While the body of the last request is still coming in,
+* it goes to whoever is streaming it first, and the next request has to wait.
+*/
+HttpParser::Status Connection::pollRequest()
+{
+    if (bodyStatus == HttpParser::STREAMING && pumpBody()) return HttpParser::NEED_MORE;
+    if (consumed > 0) //the last request we handed out is done with, so now we can let go of its bytes
+    {
+        inbound.erase(0, consumed);
+        consumed = 0;
+        parser.reset();
+        if (outbound.empty()) arena.release(); //nothing we queued still needs it either
+    }
+
+    return parser.scan(inbound);
+}
+
+/*
+* Here is where we can respond to the client. There are two versions of this. The first one takes a reference to a
+* message that stays the caller's. The second one takes a message the caller is done with, ie: sendData(std::move(msg))
+* or sendData(HttpMessage(...)), and is allowed to keep its body instead of copying it if the socket can't take it all
+* right away. && means "a value nobody else is going to use anymore".
+*/
+void Connection::sendData(const HttpMessage& data)
+{
+    queueResponse(data, nullptr);
+}
+
+void Connection::sendData(HttpMessage&& data)
+{
+    queueResponse(data, &data.body);
+}
+
+/*
+* On a connection that stays open the client can't wait for us to hang up to know the response is over, so we make
+* sure there's a content-length. We also tell the client when this is the last response it's getting on this
+* connection. A handler can close the connection by adding "connection: close".
+*
+* The status line and headers are written into our reusable head buffer, so the body is never glued onto the end of
+* the headers. A streamed response doesn't know its length yet, so it says it's coming in chunks instead.
+*
+* The answer to a HEAD request has the same headers a GET would get, content-length included, but no body. The client
+* isn't expecting one, so a body sent anyway would be read as the start of the next response.
+*/
+void Connection::writeHead(const HttpMessage& data, size_t bodySize, bool streamed)
+{
+    if (strcasecmp(data.getHeader("connection").c_str(), "close") == 0) persistent = false;
+    bool addClose = !persistent && !data.hasHeader("connection");
+    bool bodyAllowed = data.statusCode >= 200 && data.statusCode != 204 && data.statusCode != 304;
+    bool addLength = bodyAllowed && !streamed && !data.hasHeader("content-length") && !data.hasHeader("transfer-encoding");
+
+    responseStatus = data.statusCode;
+    responseSize = bodySize;
+    headOnly = request.httpMethod == HttpMessage::HEAD;
+    head.clear();
+    data.appendResponseHead(head);
+    if (addClose) head.append("connection: close\r\n");
+    if (addLength) head.append("content-length: ").append(std::to_string(bodySize)).append("\r\n");
+    if (streamed && chunked) head.append("transfer-encoding: chunked\r\n");
+    head.append("\r\n");
+}
+
+/*
+* The head and the body are sent straight out of the message, both in one call. Only what the socket doesn't take
+* right away gets copied (or moved) into the outbound queue.
+*/
+void Connection::queueResponse(const HttpMessage& data, std::string* body)
+{
+    writeHead(data, data.body.size());
+    size_t bodySize = headOnly ? 0 : data.body.size();
+
+    size_t sent = 0;
+    if (outbound.empty() && !broken && !deferSends) //nothing is waiting in front of us, so try sending right now
+    {
+        iovec parts[2] = {{head.data(), head.size()}, {(void*)data.body.data(), bodySize}};
+        sent = std::max(sendParts(parts, 2), (ssize_t)0);
+        bytesSent += sent;
+    }
+    if (broken) return;
+
+    size_t bodySent = sent > head.size() ? sent - head.size() : 0;
+    if (sent < head.size()) queueCopy(head.data() + sent, head.size() - sent);
+    if (bodySent < bodySize)
+    {
+        if (body != nullptr) //it's ours now, no need to copy
+        {
+            outbound.push_back({nullptr, body->size(), bodySent, std::move(*body)});
+            outbound.back().data = outbound.back().owned.data(); //only now that it's in the queue for good do we know where it lives
+        }
+        else queueCopy(data.body.data() + bodySent, data.body.size() - bodySent);
+    }
+}
+
+/*
+* Copy some output into the arena to send later. This is a lot cheaper than a string of its own: the arena just
+* bumps a pointer, and all of it is given back in one go at the next request.
+*/
+void Connection::queueCopy(const char* data, size_t size)
+{
+    char* copy = (char*)arena.allocate(size, 1);
+    memcpy(copy, data, size);
+    outbound.push_back({copy, size, 0});
+}
+
+/*
+* This sends a response whose body is a file on disk. The body of the message is ignored; the file is the body. The
+* file goes from the disk cache straight to the socket with sendfile, so its bytes never get copied into our memory.
+* We hold on to the file until it's all been sent, even if whoever gave it to us forgets about it in the meantime.
+*/
+void Connection::sendFile(const HttpMessage& data, std::shared_ptr<FileBody> file)
+{
+    if (broken) return;
+    writeHead(data, file->size);
+    queueCopy(head.data(), head.size());
+    if (file->size > 0 && !headOnly) outbound.push_back({nullptr, file->size, 0, "", std::move(file)});
+    if (!deferSends) flushBuffer();
+}
+
+/*
+* Send a frozen response. Its bytes are sent straight out of it, and if the socket doesn't take all of them, the queue
+* points into it too (holding on to it until it's sent) instead of copying them. A HEAD request gets everything but the
+* body, which is always at the end.
+*/
+void Connection::sendFrozen(const std::shared_ptr<const FrozenResponse>& response)
+{
+    static const char CLOSE_HEADER[] = "connection: close\r\n";
+
+    if (broken) return;
+    if (response->closes) persistent = false;
+    responseStatus = response->statusCode;
+    responseSize = response->bodySize;
+    headOnly = request.httpMethod == HttpMessage::HEAD;
+
+    const char* bytes = response->bytes.data();
+    size_t size = response->bytes.size() - (headOnly ? response->bodySize : 0);
+    iovec parts[3] = {{(void*)bytes, size}};
+    int count = 1;
+    if (!persistent && !response->namesConnection)
+    {
+        parts[0].iov_len = response->headSize;
+        parts[1] = {(void*)CLOSE_HEADER, sizeof(CLOSE_HEADER) - 1};
+        parts[2] = {(void*)(bytes + response->headSize), size - response->headSize};
+        count = 3;
+    }
+
+    size_t sent = 0;
+    if (outbound.empty() && !deferSends)
+    {
+        sent = std::max(sendParts(parts, count), (ssize_t)0);
+        bytesSent += sent;
+    }
+    if (broken) return;
+
+    for (int i = 0; i < count; i++)
+    {
+        size_t partSent = std::min(sent, parts[i].iov_len);
+        sent -= partSent;
+        if (partSent < parts[i].iov_len) outbound.push_back({(const char*)parts[i].iov_base, parts[i].iov_len, partSent, "", nullptr, response});
+    }
+}
+
+/*
+* Some responses are too big to build before sending, like a report that runs to hundreds of megabytes, and the client
+* shouldn't have to wait for all of it to see the start. A streamed response sends its head right away with
+* "transfer-encoding: chunked", and then the body goes out a chunk at a time with sendChunk, each one saying how long
+* it is. finishChunked sends the empty chunk that marks the end, and optionally some trailers: headers that come after
+* the body, for things like a checksum that can only be worked out once it's all been sent.
+*
+* HTTP/1.0 clients don't know about chunks, so they just get the body, and we hang up when it's done to mark the end.
+*
+* If the head already says how long the body is (a response passed on from another server, say), there's no need for
+* chunks at all: the pieces go out as they are, and they had better add up to that content-length.
+*/
+void Connection::startChunked(const HttpMessage& data)
+{
+    if (broken || streaming) return;
+    bool sized = data.hasHeader("content-length");
+    chunked = !sized && request.version != "HTTP/1.0";
+    if (!chunked && !sized) persistent = false;
+    streaming = true;
+    writeHead(data, 0, true);
+
+    iovec part = {head.data(), head.size()};
+    sendPieces(&part, 1);
+}
+
+/*
+* Send the next piece of a streamed response. Returns false if the client is gone or there's no stream going, so
+* whoever is making the response knows to stop. Empty pieces are skipped, since an empty chunk means the end, and so is
+* every piece of an answer to HEAD.
+*/
+bool Connection::sendChunk(std::string_view data)
+{
+    return queueChunk(data, nullptr);
+}
+
+bool Connection::sendChunk(const char* data)
+{
+    return queueChunk(data, nullptr);
+}
+
+bool Connection::sendChunk(std::string&& data)
+{
+    return queueChunk(data, &data);
+}
+
+bool Connection::queueChunk(std::string_view data, std::string* body)
+{
+    if (broken || !streaming) return false;
+    if (data.empty() || headOnly) return true;
+
+    char sizeLine[24]; //the length of the chunk in hex, ie: "1f4\r\n" for 500 bytes
+    int sizeLength = chunked ? snprintf(sizeLine, sizeof(sizeLine), "%zx\r\n", data.size()) : 0;
+    iovec parts[3] = {{sizeLine, (size_t)sizeLength}, {(void*)data.data(), data.size()}, {(void*)"\r\n", chunked ? 2u : 0u}};
+    sendPieces(parts, 3, body);
+
+    chunkBytes += data.size();
+    responseSize += data.size();
+    return !broken;
+}
+
+void Connection::finishChunked(const HttpHeaders& trailers)
+{
+    if (!streaming) return;
+    streaming = false;
+    if (!chunked || broken || headOnly) return; //an HTTP/1.0 client finds out it's over when we hang up
+
+    std::string end = "0\r\n";
+    for (const auto& [name, value] : trailers) end.append(name).append(": ").append(value).append("\r\n");
+    end.append("\r\n");
+    iovec part = {end.data(), end.size()};
+    sendPieces(&part, 1, &end);
+}
+
+/*
+* Have the rest of a streamed response made by source, a piece at a time, as the client takes it. This is the way to
+* stream with an event loop: the handler starts the response, hands over a source and returns, and the loop calls
+* pullChunks whenever the client makes room, so a client that reads slowly only ever has streamBuffer bytes waiting on
+* it. On a blocking connection there's nobody else to do the pulling, so the whole response is sent before this
+* returns, the socket making us wait whenever the client falls behind.
+*/
+void Connection::streamChunks(ChunkSource chunkSource)
+{
+    if (!streaming) return;
+    source = std::move(chunkSource);
+    if (deferSends || (fcntl(handle, F_GETFL) & O_NONBLOCK)) return;
+
+    while (source && isStreaming()) pullChunks();
+}
+
+/*
+* Have the whole response made by source, which is allowed to wait on a handle of its own while it does. This is for
+* responses that come from somewhere slow, like another server: the handler returns right away without answering, and
+* the source starts the response (with startChunked, or all at once with sendData) whenever it's ready to. Until the
+* source returns false, the connection counts as streaming, so the next request waits its turn. With an event loop,
+* the loop watches the handle the source waits on and calls the source again once it's ready. A blocking connection
+* waits on the handle itself, and the whole response is sent before this returns.
+*/
+void Connection::streamFrom(ChunkSource chunkSource)
+{
+    if (broken || streaming || deferred) return;
+    deferred = true;
+    source = std::move(chunkSource);
+    if (deferSends || (fcntl(handle, F_GETFL) & O_NONBLOCK)) return;
+
+    while (source && isStreaming())
+    {
+        pullChunks();
+        if (!source || !waiting) continue;
+
+        pollfd ready = {waitHandle, (short)(waitWritable ? POLLOUT : POLLIN), 0};
+        int result;
+        do result = poll(&ready, 1, limits.writeTimeout); while (result < 0 && errno == EINTR);
+        if (result <= 0) cancelStream(); //it never got ready, so we give up on it
+    }
+    source = nullptr;
+}
+
+/*
+* For the source of streamFrom: there's nothing more to do until handle is ready to be read from (or written to, if
+* writable is true). Call this only after the handle said it would block, then return true. An event loop only hears
+* about the handle getting ready, so one that was ready all along would never wake the source up again.
+*/
+void Connection::waitFor(int waitOn, bool writable)
+{
+    waitHandle = waitOn;
+    waitWritable = writable;
+    waiting = true;
+}
+
+/*
+* Give up on the response partway, ie: when the server it was coming from went away. The end of it is never sent, and
+* the connection is closed once what was sent already is out, so the client can tell it didn't get all of it. It's
+* safe to call from inside the source.
+*/
+void Connection::cancelStream()
+{
+    if (!streaming && !deferred) return;
+    streaming = deferred = false;
+    persistent = false;
+}
+
+/*
+* Ask the source for more while there's room for it. Room means less than streamBuffer bytes waiting to be sent. Even
+* if the socket takes everything as fast as it's made, we stop after streamBuffer bytes, so one fast client can't keep
+* a worker from everyone else. Returns true if the source has more and there's still room, which means the owner
+* should call again soon without waiting for the client to make room.
+*/
+bool Connection::pullChunks()
+{
+    size_t pending = getPendingOutputSize();
+    uint64_t start = chunkBytes;
+    waiting = false;
+    while (source && isStreaming() && !waiting && chunkBytes - start + pending < limits.streamBuffer)
+    {
+        bool more = source(this);
+        if (!more)
+        {
+            finishChunked();
+            deferred = false;
+        }
+        if (!more || !isStreaming()) source = nullptr; //only let go of the source once it has returned
+    }
+    if (!isStreaming()) source = nullptr;
+    if (!source)
+    {
+        deferred = waiting = false;
+        waitHandle = -1;
+    }
+    return source && !waiting && getPendingOutputSize() < limits.streamBuffer;
+}
+
+//true from startChunked (or streamFrom) until the response is finished, unless the client goes away in between
+bool Connection::isStreaming()
+{
+    return (streaming || deferred) && !broken;
+}
+
+//For a handler that pushes chunks itself: true while there's room for more without getting too far ahead of the client.
+bool Connection::wantsChunks()
+{
+    return isStreaming() && getPendingOutputSize() < limits.streamBuffer;
 }
 
-//Here is where we can respond to the client.
-void Connection::sendData(HttpMessage data)
+//true when the source of a streamed response stopped last time to wait on getWaitHandle
+bool Connection::isWaiting()
 {
-    std::string toSend = data.printAsResponse();
-    send(handle, toSend.c_str(), toSend.size(), 0);
+    return waiting && source;
+}
+
+/*
+* The handle the source waited on last, which stays the same until the source is done, so an event loop can keep
+* watching it instead of adding and removing it every time. -1 once the source is done or if it never waited.
+*/
+int Connection::getWaitHandle()
+{
+    return waitHandle;
+}
+
+bool Connection::isWaitingToWrite()
+{
+    return waitWritable;
+}
+
+/*
+* Uploads can be far bigger than we'd ever want in memory. Once the head of a request with a big body is in, the
+* handler can have the body handed to sink a piece at a time as it arrives, and each piece is thrown away as soon as
+* sink is done with it. With an event loop, the handler hands over a sink and returns, and the loop feeds it whenever
+* more of the body comes in. If sink is slow, the loop stops reading once bodyBuffer bytes are waiting on it, the
+* socket's buffer fills up, and TCP tells the client to hold off. On a blocking connection the whole body goes through
+* sink before this returns.
+*
+* A body small enough to have been read whole is handed to sink in one go, so a handler doesn't have to care which
+* kind it got.
+*/
+void Connection::streamBody(BodySink bodySink)
+{
+    if (bodyStatus != HttpParser::STREAMING)
+    {
+        if (!bodyTaken) bodySink(this, request.body, bodyStatus);
+        bodyTaken = true;
+        return;
+    }
+
+    sink = std::move(bodySink);
+    sendContinue();
+    pumpBody();
+    if (deferSends || (fcntl(handle, F_GETFL) & O_NONBLOCK)) return;
+
+    while (pumpBody())
+    {
+        int readBytes;
+        do readBytes = fillBuffer(); while (readBytes < 0 && errno == EINTR);
+        if (readBytes <= 0) pumpBody(true);
+    }
+}
+
+/*
+* The other way to take a body: pull it a piece at a time, ie: while (connection->readBody(piece)) write(file, piece);
+* The piece points into our buffer and is only good until the next call. Returns false once there's nothing left, and
+* getBodyStatus then says whether all of it came. A blocking connection waits for the client when the next piece
+* isn't here yet. A non-blocking one can't, so it hands back an empty piece and true, meaning "ask again later".
+*/
+bool Connection::readBody(std::string_view& piece)
+{
+    piece = {};
+    if (bodyStatus != HttpParser::STREAMING)
+    {
+        if (!bodyTaken) piece = request.body;
+        bodyTaken = true;
+        return !piece.empty();
+    }
+
+    sendContinue();
+    while (bodyStatus == HttpParser::STREAMING)
+    {
+        inbound.erase(parser.getBodyOffset(), parser.dropBody()); //whatever we handed out last time is done with
+        HttpParser::Status status = parser.readBody(inbound, piece);
+        if (status != HttpParser::STREAMING) endBody(status);
+        if (!piece.empty()) return true;
+        if (bodyStatus != HttpParser::STREAMING || deferSends || (fcntl(handle, F_GETFL) & O_NONBLOCK)) break;
+
+        int readBytes;
+        do readBytes = fillBuffer(); while (readBytes < 0 && errno == EINTR);
+        if (readBytes <= 0) endBody(HttpParser::ERROR); //the client hung up partway through
+    }
+    return bodyStatus == HttpParser::STREAMING;
+}
+
+/*
+* Hand whatever has come in of a streamed body to the sink, or throw it away if nobody asked for it. ended says the
+* client has stopped sending, so a body that isn't over yet never will be. Returns true while more is still to come.
+* An event loop calls this whenever it reads more.
+*/
+bool Connection::pumpBody(bool ended)
+{
+    while (bodyStatus == HttpParser::STREAMING)
+    {
+        std::string_view piece;
+        HttpParser::Status status = parser.readBody(inbound, piece);
+        if (status == HttpParser::STREAMING && piece.empty())
+        {
+            if (!ended) break; //the next piece hasn't come in yet
+            status = HttpParser::ERROR;
+        }
+
+        bool wanted = !sink || sink(this, piece, status);
+        if (status != HttpParser::STREAMING) endBody(status);
+        else if (!wanted) endBody(HttpParser::ERROR);
+        else inbound.erase(parser.getBodyOffset(), parser.dropBody());
+    }
+    return bodyStatus == HttpParser::STREAMING;
+}
+
+/*
+* Once a streamed body is over, the head and whatever is left of the body are let go of with the next request. If it
+* didn't all come, or the handler turned it down, we can't tell where the next request would start, so the connection
+* is closed after the response instead.
+*/
+void Connection::endBody(HttpParser::Status status)
+{
+    bodyStatus = status;
+    sink = nullptr;
+    continueWanted = false;
+    if (status == HttpParser::COMPLETE) consumed = parser.getFrameLength();
+    else
+    {
+        consumed = inbound.size();
+        persistent = false;
+    }
+}
+
+/*
+* A client with a big body to send may ask first whether we want it ("Expect: 100-continue"), and wait a moment for
+* the answer before sending. Once the handler starts taking the body, we tell it to go ahead.
+*/
+void Connection::sendContinue()
+{
+    static const char CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    if (!continueWanted) return;
+    continueWanted = false;
+    iovec part = {(void*)CONTINUE, sizeof(CONTINUE) - 1};
+    sendPieces(&part, 1);
+}
+
+//true from when a request with a streamed body is handed out until all of its body has come in (or been given up on)
+bool Connection::isReceivingBody()
+{
+    return bodyStatus == HttpParser::STREAMING;
+}
+
+//Part of the head of the next request has come in, but not all of it
+bool Connection::isReadingHead()
+{
+    return bodyStatus != HttpParser::STREAMING && consumed == 0 && !inbound.empty() && parser.isReadingHead();
+}
+
+//The head of a request is in, but its body isn't yet, whether it's being read whole or streamed to a handler
+bool Connection::isReadingBody()
+{
+    if (bodyStatus == HttpParser::STREAMING) return true;
+    return consumed == 0 && !inbound.empty() && !parser.isReadingHead() && parser.getStatus() == HttpParser::NEED_MORE;
+}
+
+//STREAMING while the body of the last request is still coming in, then COMPLETE, or ERROR if it was cut off or turned down
+HttpParser::Status Connection::getBodyStatus()
+{
+    return bodyStatus;
+}
+
+/*
+* Whether an event loop should read more off the socket. Reading stops once bodyBuffer bytes are waiting behind the
+* request being put together (or behind the part of a streamed body handed out so far), so a client can't get further
+* ahead of the handler than that. The kernel then holds on to what it sends, and TCP slows it down for us.
+*/
+bool Connection::wantsInput()
+{
+    if (bodyStatus == HttpParser::STREAMING) return inbound.size() - parser.getFrameLength() < limits.bodyBuffer;
+    if (consumed > 0) return inbound.size() - consumed < limits.bodyBuffer; //the next request hasn't been looked at yet
+    return parser.scan(inbound) == HttpParser::NEED_MORE || inbound.size() - parser.getFrameLength() < limits.bodyBuffer;
+}
+
+/*
+* Send the parts right away if nothing is waiting in front of them, and queue whatever the socket doesn't take. Queued
+* bytes get strings of their own rather than going in the arena, since the arena isn't given back until the next
+* request and a streamed response can go on for a long time. If body is one of the parts and the caller is done with
+* it, it's moved into the queue instead of copied.
+*/
+void Connection::sendPieces(iovec* parts, int count, std::string* body)
+{
+    size_t sent = 0;
+    if (outbound.empty() && !broken && !deferSends)
+    {
+        sent = std::max(sendParts(parts, count), (ssize_t)0);
+        bytesSent += sent;
+    }
+    if (broken) return;
+
+    std::string rest;
+    for (int i = 0; i < count; i++)
+    {
+        size_t partSent = std::min(sent, parts[i].iov_len);
+        sent -= partSent;
+        if (partSent == parts[i].iov_len) continue;
+
+        if (body != nullptr && parts[i].iov_base == body->data())
+        {
+            if (!rest.empty()) queueString(std::move(rest));
+            rest.clear();
+            queueString(std::move(*body), partSent);
+        }
+        else rest.append((const char*)parts[i].iov_base + partSent, parts[i].iov_len - partSent);
+    }
+    if (!rest.empty()) queueString(std::move(rest));
+}
+
+//queue a string we own, offset bytes of which have already been sent
+void Connection::queueString(std::string&& bytes, size_t offset)
+{
+    outbound.push_back({nullptr, bytes.size(), offset, std::move(bytes)});
+    outbound.back().data = outbound.back().owned.data(); //only now that it's in the queue for good do we know where it lives
+}
+
+/*
+* Hand several pieces of memory to the kernel in a single call (this is what writev does; sendmsg is the socket version
+* of it that also lets us pass MSG_NOSIGNAL). Returns the number of bytes taken, or -1 if the socket is full or broken.
+*/
+ssize_t Connection::sendParts(iovec* parts, int count)
+{
+    msghdr message{};
+    message.msg_iov = parts;
+    message.msg_iovlen = count;
+
+    auto started = timeSends ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    ssize_t written;
+    do written = sendmsg(handle, &message, MSG_NOSIGNAL); while (written < 0 && errno == EINTR);
+    if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK) broken = true; //the client is gone, there's no one left to send to.
+    if (timeSends) sendTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+    return written;
+}
+
+/*
+* Send the next piece of a file. On Linux the kernel copies it from the file to the socket itself. Everywhere else we
+* read a piece of it into a buffer and send that. Returns the bytes taken, or -1 if the socket is full or broken.
+*/
+ssize_t Connection::sendFilePart(Pending& part)
+{
+    ssize_t written;
+#ifdef __linux__
+    auto started = timeSends ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    off_t position = part.offset;
+    do written = sendfile(handle, part.file->handle, &position, part.size - part.offset);
+    while (written < 0 && errno == EINTR);
+    if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK) broken = true;
+    if (timeSends) sendTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+#else
+    char buffer[65536];
+    ssize_t readBytes = pread(part.file->handle, buffer, std::min(sizeof(buffer), part.size - part.offset), part.offset);
+    if (readBytes <= 0)
+    {
+        broken = true; //the file got shorter than we promised the client, so there's no way to finish this response
+        return -1;
+    }
+    iovec piece = {buffer, (size_t)readBytes};
+    written = sendParts(&piece, 1);
+#endif
+    if (written == 0) broken = true; //same thing, the file ran out early
+    return written;
+}
+
+/*
+* A blocking connection also gets timeouts put on the socket itself, so a client that connects and then says nothing
+* can't keep a thread asleep in read forever. A read that times out fails the same way as a client hanging up.
+*/
+bool Connection::setBlocking(bool blocking)
+{
+    if (blocking) applyTimeouts();
+    return setBlockingMode(handle, blocking);
+}
+
+void Connection::applyTimeouts()
+{
+    timeval receiveTimeout = {limits.idleTimeout / 1000, (limits.idleTimeout % 1000) * 1000};
+    timeval sendTimeout = {limits.writeTimeout / 1000, (limits.writeTimeout % 1000) * 1000};
+    setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof(receiveTimeout));
+    setsockopt(handle, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+}
+
+/*
+* This does a single read from the socket and keeps whatever came in for the next
+* receiveData call. The return value is the same as read: the number of bytes, 0 if
+* the client hung up, or -1 on error (EAGAIN just means "nothing more right now").
+*/
+int Connection::fillBuffer()
+{
+    char buffer[16384];
+    int readBytes = read(handle, buffer, sizeof(buffer));
+    if (readBytes > 0) appendInput(buffer, readBytes);
+    return readBytes;
+}
+
+/*
+* Send as much of our pending output as the socket will take. The socket is allowed to
+* take only part of what we give it, so we keep going until either everything is gone or
+* the socket tells us it is full. Returns false if the connection is broken. Files go out
+* with sendFilePart, and any strings queued between them are sent together in one call.
+*/
+bool Connection::flushBuffer()
+{
+    while (!broken && !outbound.empty())
+    {
+        ssize_t written;
+        if (outbound.front().file) written = sendFilePart(outbound.front());
+        else
+        {
+            iovec parts[64];
+            written = sendParts(parts, gatherOutput(parts, 64));
+        }
+        if (written <= 0) break; //full for now, or broken
+        advanceOutput(written);
+    }
+
+    if (broken) outbound.clear();
+    return !broken;
+}
+
+/*
+* Point parts at the output waiting at the front of the queue, up to the first file, and return how many were filled
+* in. This is for when someone other than flushBuffer does the sending, like io_uring. Once it knows how much went
+* out it calls advanceOutput. A file at the front gives 0, and has to go out through flushBuffer.
+*/
+int Connection::gatherOutput(iovec* parts, int maxParts)
+{
+    int count = 0;
+    for (auto next = outbound.begin(); next != outbound.end() && !next->file && count < maxParts; next++, count++)
+    {
+        parts[count] = {(void*)(next->data + next->offset), next->size - next->offset};
+    }
+    return count;
+}
+
+//drop whatever was sent from the front of the queue
+void Connection::advanceOutput(size_t written)
+{
+    bytesSent += written;
+    while (written > 0 && !outbound.empty())
+    {
+        Pending& front = outbound.front();
+        size_t left = front.size - front.offset;
+        if (written < left) front.offset += written;
+        else outbound.pop_front();
+        written -= std::min(written, left);
+    }
+}
+
+bool Connection::hasPendingInput()
+{
+    return !inbound.empty();
+}
+
+bool Connection::hasPendingOutput()
+{
+    return !outbound.empty();
+}
+
+size_t Connection::getPendingOutputSize()
+{
+    size_t output = 0;
+    for (const Pending& part : outbound) output += part.size - part.offset;
+    return output;
+}
+
+/*
+* Bytes that were read off the socket by someone else, like io_uring, are handed to the connection here. fillBuffer
+* hands its bytes over here too.
+*
+* Growing inbound can move it somewhere bigger. While the body of a request is still coming in, the handler is still
+* looking at that request (through the reference receiveView gave it), so the view is pointed at the new place. The
+* parser kept where everything is as offsets, so that's just a matter of asking it again.
+*/
+void Connection::appendInput(const char* data, size_t size)
+{
+    const char* before = inbound.data();
+    inbound.append(data, size);
+    bytesReceived += size;
+    if (inbound.data() != before && bodyStatus == HttpParser::STREAMING) parser.getView(inbound, request);
+}
+
+/*
+* Normally sendData tries to send right away and only queues what the socket won't take. With deferred sends
+* everything is queued, for an owner that sends the queue itself with gatherOutput and advanceOutput.
+*/
+void Connection::setDeferredSend(bool defer)
+{
+    deferSends = defer;
+}
+
+/*
+* A handler that needs some scratch memory while building a response can take it from here, ie:
+* std::pmr::string text(connection->getArena()); Allocating from the arena is just bumping a pointer, and nothing
+* has to be freed: it is all taken back at once when the next request comes in. That also means anything made with
+* it must not be kept past the end of the handler.
+*/
+std::pmr::memory_resource* Connection::getArena()
+{
+    return &arena;
+}
+
+/*
+* Close the socket and make this connection ready to be used for a different client. Its buffers keep their memory,
+* so a connection that gets reused doesn't have to grow them all over again.
+*/
+void Connection::reset(int newHandle)
+{
+    if (handle > -1) close(handle);
+    handle = newHandle;
+    parser.reset();
+    request = HttpRequestView();
+    inbound.clear();
+    outbound.clear();
+    arena.release();
+    consumed = 0;
+    requestCount = 0;
+    persistent = keepAliveEnded = false;
+    broken = false;
+    deferSends = false;
+    responseStatus = 0;
+    responseSize = 0;
+    bytesReceived = bytesSent = 0;
+    sendTime = 0;
+    streaming = chunked = headOnly = false;
+    deferred = waitWritable = waiting = false;
+    waitHandle = -1;
+    chunkBytes = 0;
+    source = nullptr;
+    bodyStatus = HttpParser::COMPLETE;
+    bodyTaken = continueWanted = false;
+    sink = nullptr;
+}
+
+/*
+* Let go of the socket without closing it, and give it to the caller. This is for when the socket gets closed some
+* other way (like a close sent through io_uring), so that we don't close it a second time later.
+*/
+int Connection::releaseHandle()
+{
+    int output = handle;
+    handle = -1;
+    return output;
 }
 
 /*
@@ -71,10 +1056,16 @@ Connection::~Connection()
 {
     //here we close our TCP connection so the operating system can free up that
     //socket for someone else.
-    close(handle);
+    if (handle > -1) close(handle);
     handle = -1; //it is good practice to null or negative handles when done with them.
 }
 
+/*
+* SO_REUSEADDR lets us listen on the port again right after a restart, without waiting for old connections to time
+* out. SO_REUSEPORT lets several sockets listen on the same port at once; the kernel then spreads new clients across
+* them, which is how the event loop gives every worker a listener of its own. Each option is its own setsockopt call:
+* they are numbers, not flags, so they can't be or'ed together.
+*/
 inline bool setOptions(int handle)
 {
     //Mac does not require these options and will error. So we just skip setting this
@@ -83,7 +1074,8 @@ inline bool setOptions(int handle)
         return true;
     #else
         int opt = 1;
-        return setsockopt(handle, SOL_SOCKET,SO_REUSEADDR|SO_REUSEPORT,&opt,sizeof(opt)) >= 0;
+        return setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) >= 0 &&
+               setsockopt(handle, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) >= 0;
     #endif
 }
 
@@ -97,14 +1089,53 @@ Socket::Socket(int portNumber, int queueSize)
 	address.sin_port = htons(portNumber);
 }
 
+/*
+* This constructor is for the client side. Instead of listening on a port of our own, the socket remembers the
+* address of a server so connectHandle can call it. The host can be a name like "localhost" or an address like
+* "10.0.0.7". If it can't be looked up, every connect will fail.
+*/
+Socket::Socket(const std::string& host, int portNumber) : Socket(portNumber)
+{
+    address.sin_addr.s_addr = INADDR_NONE;
+
+    addrinfo hints{};
+    addrinfo* found = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &found) == 0 && found != nullptr)
+    {
+        address.sin_addr = ((sockaddr_in*)found->ai_addr)->sin_addr;
+    }
+    if (found != nullptr) freeaddrinfo(found);
+}
+
+/*
+* This constructor takes charge of a socket somebody else opened, usually a listening socket handed to us by the
+* process we're replacing (see the handover module). The port and address are read back off the socket itself.
+*/
+Socket::Socket(ExistingSocket existing) : Socket(0)
+{
+    socketHandle = existing.handle;
+    socklen_t length = sizeof(address);
+    getsockname(socketHandle, (struct sockaddr*)&address, &length);
+}
+
 //This function sets the socket into listening mode, and tells the operating
-//system to reserve a port for us.
+//system to reserve a port for us. A socket we took over that is already
+//listening is left as it is.
 bool Socket::listenPort()
 {
     bool output = false; //I like to define my output variable first. This
                          //helps me keep track of a function's entrance and
                          //exit.
 
+    if (socketHandle > -1)
+    {
+        int listening = 0;
+        socklen_t length = sizeof(listening);
+        return getsockopt(socketHandle, SOL_SOCKET, SO_ACCEPTCONN, &listening, &length) >= 0 && listening;
+    }
+
     //Tell the operating system we want a tcp socket.
     if ((socketHandle = socket(AF_INET, SOCK_STREAM, 0)) >= 0)
     {
@@ -120,6 +1151,13 @@ bool Socket::listenPort()
     return output; //if for any reason binding to the socket fails we return false
 }
 
+//Once a socket is non-blocking, openConnection returns a closed connection instead of
+//waiting when nobody is knocking.
+bool Socket::setBlocking(bool blocking)
+{
+    return setBlockingMode(socketHandle, blocking);
+}
+
 /*
 * This function creates a connection between us and a potential client. WARNING:
 * calling this function will block the thread until a connection is received or
@@ -131,22 +1169,61 @@ bool Socket::listenPort()
 */
 Connection* Socket::openConnection()
 {
-    int addrlen = sizeof(address);
-    return new Connection(accept(socketHandle,(struct sockaddr*)&address,(socklen_t*)&addrlen));
+    Connection* connection = new Connection(acceptHandle());
+    connection->setBlocking(true); //it already is, this just puts the timeouts on
+    return connection;
+}
+
+//This is the same as openConnection, but gives back the raw handle so the caller can put it in a Connection it already has.
+int Socket::acceptHandle()
+{
+    sockaddr_in client; //the client's address goes here, not into ours. Several threads may accept at once.
+    socklen_t addrlen = sizeof(client);
+    return accept(socketHandle,(struct sockaddr*)&client,&addrlen);
+}
+
+/*
+* This is the client side of acceptHandle: it opens a brand new connection to the address this socket was made with
+* and gives back its handle, or -1 if that didn't work. Every call is a new connection, so one Socket can be used to
+* open as many as we like.
+*
+* A non-blocking connect returns before the server has answered. The handle becomes writable once the connection is
+* made, and getsockopt(SO_ERROR) then says whether it worked.
+*
+* We also turn off Nagle's algorithm (TCP_NODELAY). It holds small writes back hoping to bundle them with the next
+* one, which is a good idea for typing in a terminal and a bad one for a request we want answered right now.
+*/
+int Socket::connectHandle(bool blocking)
+{
+    int handle = socket(AF_INET, SOCK_STREAM, 0);
+    if (handle < 0) return -1;
+
+    int opt = 1;
+    setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    if (!blocking) setBlockingMode(handle, false);
+
+    if (connect(handle, (struct sockaddr*)&address, sizeof(address)) < 0 && (blocking || errno != EINPROGRESS))
+    {
+        close(handle);
+        handle = -1;
+    }
+    return handle;
 }
 
 /*
 * This send method sends a HttpMessage to the server. 
 * This is different from the other send data as this method acts like a client,
 * where as the send data on the connection object is more like a server replying.
+* It opens a connection just for this message and hangs up once it's sent.
 */
-void Socket::sendData(HttpMessage data)
+void Socket::sendData(const HttpMessage& data)
 {
-    int addrlen = sizeof(address);
-    if (connect(socketHandle, (struct sockaddr*)&address, (socklen_t)addrlen) >= 0)
+    int handle = connectHandle();
+    if (handle > -1)
     {
         std::string request = data.printAsRequest();
-        send(socketHandle, request.c_str(), request.length(),0);
+        send(handle, request.c_str(), request.length(), MSG_NOSIGNAL);
+        close(handle);
     }
 }
 
@@ -165,6 +1242,18 @@ int Socket::getHandle()
     return socketHandle;
 }
 
+/*
+* Let go of the socket without shutting it down, and give it to the caller. closePort shuts the socket itself down,
+* for every process that has it open, so a listening socket that was handed to another process is let go of this way
+* instead, and the new process keeps listening on it.
+*/
+int Socket::releaseHandle()
+{
+    int output = socketHandle;
+    socketHandle = -1;
+    return output;
+}
+
 //be sure to close the port if this object is ever freed.
 Socket::~Socket()
 {
@@ -1,19 +1,241 @@
 #ifndef StiltFox_UniversalLibrary_Socket
 #define StiltFox_UniversalLibrary_Socket
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
 #include "HttpMessage.hpp"
+#include "HttpParser.hpp"
+
+//Linux lets us ask send not to raise SIGPIPE when the other end hangs up on us. Other systems don't have the flag, so
+//there we just pass nothing. It's here rather than in Socket.cpp so everything that sends on our sockets gets it.
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+#endif
+
+/*
+* Limits on how long one client may hold on to a connection. A connection is closed once it has sat idle for
+* idleTimeout milliseconds between requests, or once it has served maxRequests requests. A streamed response stops
+* asking for more once streamBuffer bytes of it are waiting on a slow client. A request body bigger than bodyBuffer is
+* streamed to the handler instead of waited for, and no more than bodyBuffer bytes of it are read ahead of the handler.
+*
+* The rest are for clients that are slow on purpose, or broken. The head of a request has to be all there within
+* headerTimeout milliseconds of its first byte, however it trickles in. A body has to keep coming, with no gap longer
+* than bodyTimeout, and a client has to keep taking our responses, with no gap longer than writeTimeout. Either of
+* the first two gets a 408 (Request Timeout), the last just gets hung up on. An event loop keeps all of these. A
+* blocking connection can't tell one wait from another, so it gives up on any read after idleTimeout and any send
+* after writeTimeout.
+*/
+struct ConnectionLimits
+{
+    int idleTimeout = 5000;
+    int maxRequests = 1000;
+    size_t streamBuffer = 256 * 1024;
+    size_t bodyBuffer = 1024 * 1024;
+    int headerTimeout = 10000;
+    int bodyTimeout = 30000;
+    int writeTimeout = 30000;
+};
+
+/*
+* A file that is open and ready to be sent as a response body. It closes itself once the last thing holding on to it
+* lets go, so a cache can forget about a file while a slow client is still being sent a copy of it.
+*/
+struct FileBody
+{
+    int handle;
+    size_t size;
+
+    FileBody(int handle, size_t size);
+    FileBody(const FileBody&) = delete; //two of these closing the same handle would be bad news
+    FileBody& operator=(const FileBody&) = delete;
+    ~FileBody();
+};
+
+/*
+* A response that was turned into bytes once, ahead of time, so it can be sent over and over without building it
+* again. Plenty of responses are the same every time (health checks, fixed JSON, error pages), and for those, building
+* the HttpMessage, looking up its reason phrase and printing its headers is wasted work on every request. A frozen
+* response can't be changed, so any number of connections can send from the same one at once without copying it.
+*
+* Make one with freeze. It is always kept behind a shared_ptr, so a connection that is still sending it keeps it
+* alive even if whoever made it moves on to a new one.
+*/
+struct FrozenResponse
+{
+    std::string bytes; //the status line, headers, blank line and body, exactly as they go out
+    size_t headSize; //where the headers we added start, which is where "connection: close" goes when a connection needs it
+    int statusCode;
+    size_t bodySize;
+    bool closes; //the response says "connection: close" itself
+    bool namesConnection; //the response has a connection header of its own, so we shouldn't add one
+
+    FrozenResponse(const HttpMessage& response);
+    static std::shared_ptr<const FrozenResponse> freeze(const HttpMessage& response);
+};
+
+class Connection;
+
+/*
+* Hands a streamed response its next piece. It's called whenever the connection has room for more, and sends the
+* next chunk with sendChunk. A call can send nothing (a compressor that's still filling up, say) as long as later ones
+* do, but the source can't wait on anything: it's called again right away until there's no more room. Return false
+* once there's nothing left, and the response is finished for you (or call finishChunked yourself first, to add
+* trailers).
+*
+* A source given to streamFrom is allowed to wait, on one handle of its own (a connection to another server, say).
+* When it can't go on until that handle is ready, it calls waitFor and returns true, and it's called again once the
+* handle is ready (or the client made room, or sent more of its body).
+*/
+typedef std::function<bool(Connection*)> ChunkSource;
+
+/*
+* Takes a streamed request body a piece at a time, as it comes in. status is STREAMING while there's more to come,
+* COMPLETE for the last piece (which can be empty), and ERROR if the client hung up partway or sent garbage. The piece
+* is thrown away once the sink returns, so keep a copy of anything you need. Return false to turn the rest of the body
+* down, ie: once it's bigger than you allow. The rest won't be read, and the connection closes after the response.
+*/
+typedef std::function<bool(Connection*, std::string_view piece, HttpParser::Status status)> BodySink;
+
 class Connection
 {
+    /*
+    * A piece of output the socket hasn't taken yet. The bytes are either a copy in the arena, a body that was handed
+    * to us with std::move (kept in owned), a file, or part of a frozen response (kept alive by frozen).
+    */
+    struct Pending
+    {
+        const char* data;
+        size_t size;
+        size_t offset; //how much has been sent already
+        std::string owned;
+        std::shared_ptr<FileBody> file;
+        std::shared_ptr<const FrozenResponse> frozen;
+    };
+
+    static const size_t ARENA_SIZE = 8192;
+
     int handle;
+    HttpParser parser; //picks up where it left off every time more bytes come in
+    HttpRequestView request; //the last request we handed out. It points into inbound.
+    size_t consumed; //how much of the front of inbound belongs to that request
+    ConnectionLimits limits;
+    int requestCount; //how many requests have been received on this connection
+    bool persistent; //whether we plan to keep the connection open after the current response
+    bool keepAliveEnded; //endKeepAlive was called, so the current request (or the next, if none is in) is the last
+    std::string inbound; //bytes read off the socket that have not been turned into a request yet
+    std::deque<Pending> outbound; //responses, in order, that the socket could not take yet
+    std::string head; //the status line and headers of a response are written here. Reused for every response.
+    bool broken; //a send failed, so the client is gone
+    bool deferSends; //queue every response instead of trying to send it right away
+    int responseStatus; //the status and body size of the last response, for access logs
+    size_t responseSize;
+    uint64_t bytesReceived; //everything that has come in and gone out since the connection was opened
+    uint64_t bytesSent;
+    bool timeSends; //add up how long the send calls take, for metrics
+    uint64_t sendTime; //nanoseconds spent sending since the last takeSendTime
+    bool streaming; //a chunked response has been started and not finished yet
+    bool chunked; //the stream is sent in chunks. HTTP/1.0 clients don't know chunks, so theirs is sent as is.
+    bool headOnly; //the response is to a HEAD request, so it gets its headers (length and all) but never its body
+    bool deferred; //streamFrom was called, and the source hasn't said it's done yet
+    int waitHandle; //the handle the source last waited on, or -1
+    bool waitWritable; //whether it waited to write to that handle, rather than to read from it
+    bool waiting; //the source is waiting on waitHandle, so there's no point calling it until that's ready
+    uint64_t chunkBytes; //how much has been handed to sendChunk, over the life of the connection
+    ChunkSource source; //where the rest of the streamed response comes from, if anywhere
+    HttpParser::Status bodyStatus; //STREAMING while the body of the last request is still coming in
+    bool bodyTaken; //streamBody or readBody has handed out the body of a request that was read whole
+    bool continueWanted; //the client is waiting for "100 Continue" before it sends the body
+    BodySink sink; //where the rest of the streamed request body goes. Nowhere, if nobody asked for it.
+    alignas(std::max_align_t) std::byte arenaBuffer[ARENA_SIZE]; //the arena hands this out first, before going to the heap
+    std::pmr::monotonic_buffer_resource arena; //scratch memory that is thrown away all at once between requests
+
+    void queueCopy(const char* data, size_t size);
+    void writeHead(const HttpMessage& data, size_t bodySize, bool streamed = false);
+    void queueResponse(const HttpMessage& data, std::string* body);
+    void sendPieces(iovec* parts, int count, std::string* body = nullptr);
+    void queueString(std::string&& bytes, size_t offset = 0);
+    bool queueChunk(std::string_view data, std::string* body);
+    void sendContinue();
+    void endBody(HttpParser::Status status);
+    void applyTimeouts();
+    ssize_t sendParts(iovec* parts, int count);
+    ssize_t sendFilePart(Pending& part);
 
     public:
     Connection(int handle);
     HttpMessage receiveData();
-    void sendData(HttpMessage data);
+    const HttpRequestView& receiveView();
+    const HttpRequestView& getRequest();
+    HttpParser::Status pollRequest();
+    void sendData(const HttpMessage& data);
+    void sendData(HttpMessage&& data);
+    void sendFile(const HttpMessage& data, std::shared_ptr<FileBody> file);
+    void sendFrozen(const std::shared_ptr<const FrozenResponse>& response);
+    void startChunked(const HttpMessage& data);
+    bool sendChunk(std::string_view data);
+    bool sendChunk(const char* data); //without this, "text" could be either of the others
+    bool sendChunk(std::string&& data);
+    void finishChunked(const HttpHeaders& trailers = {});
+    void streamChunks(ChunkSource source);
+    void streamFrom(ChunkSource source);
+    void waitFor(int handle, bool writable = false);
+    void cancelStream();
+    bool pullChunks();
+    bool isStreaming();
+    bool wantsChunks();
+    bool isWaiting();
+    int getWaitHandle();
+    bool isWaitingToWrite();
+    void streamBody(BodySink sink);
+    bool readBody(std::string_view& piece);
+    bool pumpBody(bool ended = false);
+    bool isReceivingBody();
+    bool isReadingHead();
+    bool isReadingBody();
+    HttpParser::Status getBodyStatus();
+    bool wantsInput();
     int getHandle();
+    int getRequestCount();
+    int getResponseStatus();
+    size_t getResponseSize();
+    uint64_t getBytesReceived();
+    uint64_t getBytesSent();
+    void setSendTiming(bool timing);
+    uint64_t takeSendTime();
+    bool keepAlive();
+    void endKeepAlive();
+    void setLimits(ConnectionLimits limits);
+    ConnectionLimits getLimits();
+    bool setBlocking(bool blocking);
+    int fillBuffer();
+    bool flushBuffer();
+    bool hasPendingInput();
+    bool hasPendingOutput();
+    size_t getPendingOutputSize();
+    void appendInput(const char* data, size_t size);
+    void setDeferredSend(bool defer);
+    int gatherOutput(iovec* parts, int maxParts);
+    void advanceOutput(size_t written);
+    std::pmr::memory_resource* getArena();
+    void reset(int handle);
+    int releaseHandle();
     ~Connection();
 };
 
+//A socket handle that is already open, ie: one passed over from another process, for Socket to take charge of.
+struct ExistingSocket
+{
+    int handle;
+};
+
 class Socket
 {
     int socketHandle;
@@ -22,11 +244,17 @@ class Socket
     
     public:
     Socket(int portNumber, int queueSize = 3);
+    Socket(const std::string& host, int portNumber);
+    Socket(ExistingSocket existing);
     bool listenPort();
+    bool setBlocking(bool blocking);
     Connection* openConnection();
+    int acceptHandle();
+    int connectHandle(bool blocking = true);
     int getHandle();
-    void sendData(HttpMessage data);
+    void sendData(const HttpMessage& data);
     void closePort();
+    int releaseHandle();
     ~Socket();
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,513 @@
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+#include "Socket.hpp"
+
+/*
+* A socket pair is two sockets already connected to each other, which lets us test a Connection without any
+* networking. The connection gets one end and the test plays the client on the other.
+*/
+struct SocketPair
+{
+    int server;
+    int client;
+
+    SocketPair()
+    {
+        int handles[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, handles);
+        server = handles[0];
+        client = handles[1];
+    }
+
+    ~SocketPair()
+    {
+        close(client);
+    }
+};
+
+//read whatever the client end has waiting for it, giving the connection a chance to flush in between
+std::string drain(int client, Connection& connection)
+{
+    std::string output;
+    char buffer[65536];
+    while (true)
+    {
+        connection.flushBuffer();
+        int readBytes = recv(client, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (readBytes > 0) output.append(buffer, readBytes);
+        else if (!connection.hasPendingOutput()) break;
+    }
+    return output;
+}
+
+/*
+* Undo chunked transfer encoding: each chunk is its length in hex, a line break, that many bytes and another line break,
+* until a chunk of length 0. Whatever comes after that (the trailers) goes in trailers.
+*/
+std::string unchunk(const std::string& chunks, std::string* trailers = nullptr)
+{
+    std::string output;
+    size_t position = 0;
+    while (position < chunks.size())
+    {
+        size_t lineEnd = chunks.find("\r\n", position);
+        size_t size = std::stoul(chunks.substr(position, lineEnd - position), nullptr, 16);
+        position = lineEnd + 2;
+        if (size == 0) break;
+        output.append(chunks, position, size);
+        position += size + 2;
+    }
+    if (trailers != nullptr) *trailers = chunks.substr(std::min(position, chunks.size()));
+    return output;
+}
+
+TEST(Socket, sendData_will_send_the_whole_response_when_the_socket_only_takes_part_of_it)
+{
+    //given we have a non-blocking connection and a response much larger than the socket buffer
+    SocketPair pair;
+    Connection connection(pair.server);
+    connection.setBlocking(false);
+    HttpMessage response(200, {{"content-type","text/plain"}}, std::string(4 << 20, 'b'));
+
+    //when we send it and the client reads it all
+    connection.sendData(response);
+    bool queued = connection.hasPendingOutput();
+    std::string actual = drain(pair.client, connection);
+
+    //then some of it had to wait, and the client still gets every byte in order
+    ASSERT_TRUE(queued);
+    ASSERT_FALSE(connection.hasPendingOutput());
+    ASSERT_TRUE(actual.starts_with("HTTP/1.1 200 OK\r\n"));
+    ASSERT_NE(actual.find("content-length: 4194304\r\n"), std::string::npos);
+    ASSERT_TRUE(actual.ends_with("\r\n\r\n" + std::string(4 << 20, 'b')));
+}
+
+TEST(Socket, sendData_will_keep_responses_in_order_when_a_moved_body_is_queued)
+{
+    //given we have a connection whose socket is already backed up with a large moved response
+    SocketPair pair;
+    Connection connection(pair.server);
+    connection.setBlocking(false);
+    connection.sendData(HttpMessage(200, {}, std::string(2 << 20, 'a')));
+
+    //when we send a second, small response behind it
+    connection.sendData(HttpMessage(201, {}, "second"));
+    std::string actual = drain(pair.client, connection);
+
+    //then the second response arrives whole, after the first one
+    ASSERT_EQ(actual.find("HTTP/1.1 201 Created"), actual.find(std::string(2 << 20, 'a')) + (2 << 20));
+    ASSERT_TRUE(actual.ends_with("\r\n\r\nsecond"));
+}
+
+TEST(Socket, flushBuffer_will_report_a_broken_connection_when_the_client_is_gone)
+{
+    //given we have a connection with output waiting, and a client that hung up
+    SocketPair pair;
+    Connection connection(pair.server);
+    connection.setBlocking(false);
+    connection.sendData(HttpMessage(200, {}, std::string(4 << 20, 'c')));
+    close(pair.client);
+    pair.client = -1;
+
+    //when we try to send the rest
+    bool actual = connection.flushBuffer();
+
+    //then we are told the connection is broken, and nothing is left waiting
+    ASSERT_FALSE(actual);
+    ASSERT_FALSE(connection.hasPendingOutput());
+}
+
+TEST(Socket, sendData_will_leave_the_body_off_the_answer_to_a_pipelined_head_request)
+{
+    //given a client that sends a HEAD and a GET down the same connection, one right after the other
+    SocketPair pair;
+    Connection connection(pair.server);
+    std::string requests = "HEAD / HTTP/1.1\r\n\r\nGET /health HTTP/1.1\r\n\r\n";
+    send(pair.client, requests.data(), requests.size(), 0);
+
+    //when we answer each of them with a body
+    std::string firstUri(connection.receiveView().requestUri);
+    connection.sendData(HttpMessage(200, {}, "{\"message\":\"the same body both times\"}"));
+    std::string secondUri(connection.receiveView().requestUri);
+    connection.sendData(HttpMessage(200, {}, "{\"message\":\"the same body both times\"}"));
+    std::string actual = drain(pair.client, connection);
+
+    //then the HEAD gets the length of the body but not the body, so the GET's answer starts right after its head
+    ASSERT_EQ(firstUri, "/");
+    ASSERT_EQ(secondUri, "/health");
+    ASSERT_EQ(actual, "HTTP/1.1 200 OK\r\ncontent-length: 38\r\n\r\n"
+        "HTTP/1.1 200 OK\r\ncontent-length: 38\r\n\r\n{\"message\":\"the same body both times\"}");
+}
+
+TEST(Socket, sendFile_will_send_the_whole_file_and_keep_later_responses_behind_it)
+{
+    //given we have a non-blocking connection and a file much larger than the socket buffer
+    SocketPair pair;
+    Connection connection(pair.server);
+    connection.setBlocking(false);
+    FILE* file = tmpfile();
+    std::string contents(4 << 20, 'f');
+    fwrite(contents.data(), 1, contents.size(), file);
+    fflush(file);
+    auto body = std::make_shared<FileBody>(dup(fileno(file)), contents.size());
+    fclose(file);
+
+    //when we send the file and then a small response behind it
+    connection.sendFile(HttpMessage(200, {{"content-type","text/plain"}}), body);
+    bool queued = connection.hasPendingOutput();
+    connection.sendData(HttpMessage(201, {}, "after"));
+    std::string actual = drain(pair.client, connection);
+
+    //then the file arrives whole with its length, followed by the second response
+    ASSERT_TRUE(queued);
+    ASSERT_TRUE(actual.starts_with("HTTP/1.1 200 OK\r\n"));
+    ASSERT_NE(actual.find("content-length: 4194304\r\n"), std::string::npos);
+    ASSERT_EQ(actual.find("HTTP/1.1 201 Created"), actual.find(contents) + contents.size());
+    ASSERT_TRUE(actual.ends_with("\r\n\r\nafter"));
+}
+
+TEST(Socket, sendFrozen_will_send_the_same_bytes_as_sendData_without_copying_them)
+{
+    //given we have a large response, frozen, and two connections
+    SocketPair frozenPair;
+    SocketPair plainPair;
+    Connection frozenConnection(frozenPair.server);
+    Connection plainConnection(plainPair.server);
+    frozenConnection.setBlocking(false);
+    plainConnection.setBlocking(false);
+    HttpMessage response(200, {{"content-type","text/plain"}}, std::string(2 << 20, 'z'));
+    std::shared_ptr<const FrozenResponse> frozen = FrozenResponse::freeze(response);
+
+    //when one connection sends the frozen response twice and the other sends the message the usual way
+    frozenConnection.sendFrozen(frozen);
+    frozenConnection.sendFrozen(frozen);
+    bool shared = frozen.use_count() > 1; //the queue is pointing into the frozen response rather than a copy of it
+    std::string actual = drain(frozenPair.client, frozenConnection);
+    plainConnection.sendData(response);
+    std::string expected = drain(plainPair.client, plainConnection);
+
+    //then the client can't tell the difference, connection: close included, and the queue lets go once it's sent
+    ASSERT_TRUE(shared);
+    ASSERT_EQ(actual, expected + expected);
+    ASSERT_NE(expected.find("connection: close\r\n"), std::string::npos);
+    ASSERT_EQ(frozenConnection.getResponseStatus(), 200);
+    ASSERT_EQ(frozenConnection.getResponseSize(), 2 << 20);
+    ASSERT_EQ(frozen.use_count(), 1);
+}
+
+TEST(Socket, startChunked_will_send_the_head_right_away_then_each_chunk_and_the_trailers)
+{
+    //given we have a connection
+    SocketPair pair;
+    Connection connection(pair.server);
+    connection.setBlocking(false);
+    char buffer[4096];
+
+    //when we start a streamed response, check what the client has, then send a few chunks and finish with a trailer
+    connection.startChunked(HttpMessage(200, {{"content-type", "text/csv"}}));
+    int headBytes = recv(pair.client, buffer, sizeof(buffer), MSG_DONTWAIT);
+    std::string head(buffer, std::max(headBytes, 0));
+    connection.sendChunk("a,b\n");
+    connection.sendChunk(std::string(1000, 'c'));
+    bool empty = connection.sendChunk("");
+    connection.finishChunked({{"x-rows", "2"}});
+    bool afterFinish = connection.sendChunk("too late");
+    std::string body = drain(pair.client, connection);
+    std::string trailers;
+
+    //then the head came first, saying the body comes in chunks, and the chunks and trailer followed it
+    ASSERT_TRUE(head.starts_with("HTTP/1.1 200 OK\r\n"));
+    ASSERT_TRUE(head.ends_with("transfer-encoding: chunked\r\n\r\n"));
+    ASSERT_EQ(head.find("content-length"), std::string::npos);
+    ASSERT_TRUE(body.starts_with("4\r\na,b\n\r\n3e8\r\nccc"));
+    ASSERT_EQ(unchunk(body, &trailers), "a,b\n" + std::string(1000, 'c'));
+    ASSERT_EQ(trailers, "x-rows: 2\r\n\r\n");
+    ASSERT_TRUE(empty);
+    ASSERT_FALSE(afterFinish);
+    ASSERT_FALSE(connection.isStreaming());
+    ASSERT_EQ(connection.getResponseSize(), 1004);
+}
+
+TEST(Socket, pullChunks_will_stop_asking_the_source_for_more_while_the_client_is_behind)
+{
+    //given we have a connection that only lets 64KB of a stream wait on the client, and a source of 100 16KB chunks
+    SocketPair pair;
+    Connection connection(pair.server);
+    connection.setBlocking(false);
+    connection.setLimits({5000, 1000, 65536});
+    int calls = 0;
+    connection.startChunked(HttpMessage(200));
+    connection.streamChunks([&calls](Connection* connection)
+    {
+        connection->sendChunk(std::string(16384, 'a' + calls % 26));
+        return ++calls < 100;
+    });
+
+    //when the connection pulls for as long as it says there's room, then once more, then the client reads it all
+    int callsBefore = calls;
+    while (connection.pullChunks()) {}
+    int callsWhileBehind = calls;
+    bool room = connection.pullChunks();
+    int callsAfter = calls;
+    size_t mostWaiting = connection.getPendingOutputSize();
+    std::string received;
+    char buffer[8192];
+    while (connection.isStreaming() || connection.hasPendingOutput())
+    {
+        int readBytes = recv(pair.client, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (readBytes > 0) received.append(buffer, readBytes);
+        connection.flushBuffer();
+        connection.pullChunks();
+        mostWaiting = std::max(mostWaiting, connection.getPendingOutputSize());
+    }
+    received += drain(pair.client, connection);
+
+    //then nothing was pulled until asked, it stopped once the client fell behind, never got far ahead, and it all arrived
+    std::string expected;
+    for (int i = 0; i < 100; i++) expected += std::string(16384, 'a' + i % 26);
+    ASSERT_EQ(callsBefore, 0);
+    ASSERT_GT(callsWhileBehind, 0);
+    ASSERT_LT(callsWhileBehind, 100);
+    ASSERT_FALSE(room);
+    ASSERT_EQ(callsAfter, callsWhileBehind);
+    ASSERT_LT(mostWaiting, 65536 + 16384 + 16);
+    ASSERT_EQ(calls, 100);
+    ASSERT_EQ(unchunk(received.substr(received.find("\r\n\r\n") + 4)), expected);
+}
+
+TEST(Socket, startChunked_will_send_the_body_as_it_is_and_hang_up_after_for_an_http_1_0_client)
+{
+    //given we have a connection to an HTTP/1.0 client that asked for something
+    SocketPair pair;
+    Connection connection(pair.server);
+    connection.setBlocking(false);
+    std::string request = "GET /old HTTP/1.0\r\n\r\n";
+    write(pair.client, request.data(), request.size());
+    connection.receiveView();
+
+    //when we stream the answer
+    connection.startChunked(HttpMessage(200));
+    connection.sendChunk("hello ");
+    connection.sendChunk("there");
+    connection.finishChunked({{"x-ignored", "yes"}});
+    std::string actual = drain(pair.client, connection);
+
+    //then it doesn't come in chunks, and the connection is closed to mark the end
+    ASSERT_EQ(actual.find("transfer-encoding"), std::string::npos);
+    ASSERT_NE(actual.find("connection: close\r\n"), std::string::npos);
+    ASSERT_TRUE(actual.ends_with("\r\n\r\nhello there"));
+    ASSERT_FALSE(connection.keepAlive());
+}
+
+TEST(Socket, readBody_will_pull_a_big_body_after_saying_continue_and_then_read_the_next_request)
+{
+    //given a blocking connection that streams bodies over 1000 bytes, and a client that waits to be told to send its body
+    SocketPair pair;
+    Connection connection(pair.server);
+    connection.setLimits({.bodyBuffer = 1000});
+    std::string body;
+    for (int i = 0; body.size() < 100000; i++) body += std::to_string(i) + ",";
+    std::string continued;
+    std::thread client([&]()
+    {
+        std::string head = "PUT /big HTTP/1.1\r\nexpect: 100-continue\r\ncontent-length: " + std::to_string(body.size()) + "\r\n\r\n";
+        send(pair.client, head.data(), head.size(), 0);
+        char buffer[64] = {};
+        recv(pair.client, buffer, 25, MSG_WAITALL);
+        continued = buffer;
+        std::string rest = body + "GET /next HTTP/1.1\r\n\r\n";
+        send(pair.client, rest.data(), rest.size(), 0);
+    });
+
+    //when we take the head, pull the body a piece at a time, and then receive the next request
+    std::string uri(connection.receiveView().requestUri);
+    bool streamed = connection.isReceivingBody();
+    std::string received;
+    size_t biggest = 0;
+    std::string_view piece;
+    while (connection.readBody(piece))
+    {
+        received += piece;
+        biggest = std::max(biggest, piece.size());
+    }
+    client.join();
+    std::string next(connection.receiveView().requestUri);
+
+    //then the client was told to go ahead, the body came a read at a time, and the next request was left whole
+    ASSERT_EQ(uri, "/big");
+    ASSERT_TRUE(streamed);
+    ASSERT_EQ(continued, "HTTP/1.1 100 Continue\r\n\r\n");
+    ASSERT_TRUE(received == body);
+    ASSERT_LE(biggest, 16384);
+    ASSERT_EQ(connection.getBodyStatus(), HttpParser::COMPLETE);
+    ASSERT_EQ(next, "/next");
+}
+
+TEST(Socket, streamBody_will_keep_the_request_view_good_while_a_big_body_is_read_on_a_blocking_connection)
+{
+    //given a blocking connection that streams bodies over 1000 bytes, and a client uploading 4MB
+    SocketPair pair;
+    Connection connection(pair.server);
+    connection.setLimits({.bodyBuffer = 1000});
+    std::string body(4 << 20, 'b');
+    std::thread client([&]()
+    {
+        std::string upload = "POST /upload HTTP/1.1\r\nx-name: report.csv\r\ncontent-length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+        send(pair.client, upload.data(), upload.size(), 0);
+    });
+
+    //when we take the head, and then the whole body through a sink, which has to read far more than the buffer held
+    const HttpRequestView& view = connection.receiveView();
+    size_t received = 0;
+    connection.streamBody([&received](Connection*, std::string_view piece, HttpParser::Status) { received += piece.size(); return true; });
+    client.join();
+
+    //then the view we got at the start still points at the request, even though the buffer under it moved
+    ASSERT_EQ(received, body.size());
+    ASSERT_EQ(view.requestUri, "/upload");
+    ASSERT_EQ(view.getHeader("x-name"), "report.csv");
+}
+
+TEST(Socket, streamBody_will_stop_taking_a_body_the_sink_turns_down)
+{
+    //given a non-blocking connection that streams bodies over 1000 bytes, with 3000 bytes of a 5000 byte body waiting
+    SocketPair pair;
+    Connection connection(pair.server);
+    connection.setBlocking(false);
+    connection.setLimits({.bodyBuffer = 1000});
+    std::string request = "POST /upload HTTP/1.1\r\ncontent-length: 5000\r\n\r\n" + std::string(3000, 'u');
+    write(pair.client, request.data(), request.size());
+    connection.fillBuffer();
+
+    //when the request is polled and received, and a sink that takes at most 2000 bytes is handed the body
+    HttpParser::Status polled = connection.pollRequest();
+    bool wantedMore = connection.wantsInput();
+    connection.receiveView();
+    std::vector<size_t> pieces;
+    connection.streamBody([&pieces](Connection*, std::string_view piece, HttpParser::Status)
+    {
+        pieces.push_back(piece.size());
+        return piece.size() <= 2000;
+    });
+
+    //then the head was ready before the body, no more was read while the body waited, and the rest of it is given up on
+    ASSERT_EQ(polled, HttpParser::STREAMING);
+    ASSERT_FALSE(wantedMore);
+    ASSERT_EQ(pieces, std::vector<size_t>{3000});
+    ASSERT_EQ(connection.getBodyStatus(), HttpParser::ERROR);
+    ASSERT_FALSE(connection.isReceivingBody());
+    ASSERT_FALSE(connection.keepAlive());
+}
+
+TEST(Socket, receiveView_will_throw_away_a_streamed_body_nobody_read)
+{
+    //given a connection that streams bodies over 1000 bytes, with a big chunked request and another one behind it
+    SocketPair pair;
+    Connection connection(pair.server);
+    connection.setLimits({.bodyBuffer = 1000});
+    std::string requests = "POST /ignored HTTP/1.1\r\ntransfer-encoding: chunked\r\n\r\n";
+    for (int i = 0; i < 5; i++) requests += "3e8\r\n" + std::string(1000, 'i') + "\r\n";
+    requests += "0\r\n\r\nGET /next HTTP/1.1\r\n\r\n";
+    write(pair.client, requests.data(), requests.size());
+
+    //when the first request is received but its body is never asked for, and then the next one is received
+    std::string first(connection.receiveView().requestUri);
+    std::string second(connection.receiveView().requestUri);
+
+    //then the body was read past, and the next request was found behind it
+    ASSERT_EQ(first, "/ignored");
+    ASSERT_EQ(second, "/next");
+    ASSERT_EQ(connection.getBodyStatus(), HttpParser::COMPLETE);
+    ASSERT_TRUE(connection.keepAlive());
+}
+
+TEST(Socket, getArena_will_hand_out_the_same_memory_again_once_the_next_request_comes_in)
+{
+    //given we have a connection with two requests waiting on it
+    SocketPair pair;
+    Connection connection(pair.server);
+    std::string requests = "GET /one HTTP/1.1\r\n\r\nGET /two HTTP/1.1\r\n\r\n";
+    write(pair.client, requests.data(), requests.size());
+
+    //when a handler takes some scratch memory for each request
+    connection.receiveView();
+    void* first = connection.getArena()->allocate(100);
+    std::string secondUri(connection.receiveView().requestUri);
+    void* second = connection.getArena()->allocate(100);
+
+    //then the second request gets the memory the first one was done with
+    ASSERT_EQ(secondUri, "/two");
+    ASSERT_EQ(first, second);
+}
+
+TEST(Socket, reset_will_hang_up_on_the_old_client_and_serve_the_new_one)
+{
+    //given we have a connection that is halfway through reading a request from its client
+    SocketPair oldPair;
+    SocketPair newPair;
+    Connection connection(oldPair.server);
+    connection.setBlocking(false);
+    write(oldPair.client, "GET /old HTT", 12);
+    connection.fillBuffer();
+
+    //when it is reset to a new client
+    connection.reset(newPair.server);
+    write(newPair.client, "GET /new HTTP/1.1\r\n\r\n", 21);
+    std::string uri(connection.receiveView().requestUri);
+    char buffer[16];
+
+    //then the old client is hung up on, and none of its bytes end up in the new client's request
+    ASSERT_EQ(read(oldPair.client, buffer, sizeof(buffer)), 0);
+    ASSERT_EQ(uri, "/new");
+    ASSERT_EQ(connection.getRequestCount(), 1);
+}
+
+TEST(Socket, listenPort_will_let_several_sockets_listen_on_the_same_port)
+{
+    //given we have two sockets for the same port
+    Socket first(9190);
+    Socket second(9190);
+
+    //when both start listening
+    bool firstListening = first.listenPort();
+    bool secondListening = second.listenPort();
+
+    //then neither is turned away
+    ASSERT_TRUE(firstListening);
+    ASSERT_TRUE(secondListening);
+}
+
+TEST(Socket, sendData_will_connect_to_the_server_and_send_the_request)
+{
+    //given we have a server listening and a client socket pointed at it
+    Socket server(9191);
+    server.listenPort();
+    Socket client("localhost", 9191);
+
+    //when the client sends a request and the server accepts it
+    client.sendData(HttpMessage(HttpMessage::POST, "/orders", {{"content-length", "4"}}, "milk"));
+    Connection* connection = server.openConnection();
+    HttpMessage actual = connection->receiveData();
+
+    //then the server gets the request as it was sent
+    ASSERT_EQ(actual.httpMethod, HttpMessage::POST);
+    ASSERT_EQ(actual.requestUri, "/orders");
+    ASSERT_EQ(actual.body, "milk");
+    delete connection;
+}
+
+TEST(Socket, connectHandle_will_fail_when_nobody_is_listening)
+{
+    //given we have a client socket pointed at a port nobody listens on
+    Socket client("127.0.0.1", 9192);
+
+    //when we try to connect
+    int handle = client.connectHandle();
+
+    //then we don't get a handle
+    ASSERT_EQ(handle, -1);
+}
@@ -0,0 +1,224 @@
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include "StaticFiles.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+//Linux and Mac keep the time a file was last changed under different names.
+inline timespec modifiedTime(const struct stat& info)
+{
+#ifdef __APPLE__
+    return info.st_mtimespec;
+#else
+    return info.st_mtim;
+#endif
+}
+
+/*
+* Browsers go by the Content-Type header, not the end of the file name, to know what they were sent. These are the
+* types a website is most likely to need. Anything else is sent as plain old bytes.
+*/
+constexpr pair<string_view, string_view> CONTENT_TYPES[] =
+{
+    {"html", "text/html"}, {"htm", "text/html"}, {"css", "text/css"}, {"js", "text/javascript"},
+    {"mjs", "text/javascript"}, {"json", "application/json"}, {"txt", "text/plain"}, {"xml", "application/xml"},
+    {"svg", "image/svg+xml"}, {"png", "image/png"}, {"jpg", "image/jpeg"}, {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"}, {"webp", "image/webp"}, {"ico", "image/x-icon"}, {"woff", "font/woff"},
+    {"woff2", "font/woff2"}, {"wasm", "application/wasm"}, {"pdf", "application/pdf"}
+};
+
+StaticFiles::StaticFiles(string prefix, string directory, size_t capacity, int revalidateAfter)
+{
+    this->prefix = prefix;
+    this->directory = directory;
+    this->capacity = capacity > 0 ? capacity : 1;
+    this->revalidateAfter = milliseconds(revalidateAfter);
+}
+
+string_view StaticFiles::getContentType(string_view path)
+{
+    size_t dot = path.find_last_of("./");
+    if (dot != string_view::npos && path[dot] == '.')
+    {
+        string_view extension = path.substr(dot + 1);
+        for (const auto& [name, type] : CONTENT_TYPES)
+        {
+            if (name.size() == extension.size() && strncasecmp(name.data(), extension.data(), name.size()) == 0) return type;
+        }
+    }
+    return "application/octet-stream";
+}
+
+//The compressor has to outlive the StaticFiles. Pass nullptr to send every file as it is again.
+void StaticFiles::setCompressor(Compressor* compressor)
+{
+    this->compressor = compressor;
+}
+
+bool StaticFiles::matches(const HttpRequestView& request) const
+{
+    return request.requestUri.starts_with(prefix);
+}
+
+size_t StaticFiles::getCachedFileCount()
+{
+    lock_guard<mutex> guard(cacheLock);
+    return cache.size();
+}
+
+//drop a file from the cache. The caller must hold cacheLock.
+void StaticFiles::forget(const string& path)
+{
+    auto found = cache.find(path);
+    if (found != cache.end())
+    {
+        recentlyUsed.erase(found->second.recentPosition);
+        cache.erase(found);
+    }
+}
+
+/*
+* Find an open copy of the file at path. A file we checked on recently is handed right back without talking to the
+* disk at all. Otherwise we open it (outside the lock, so other workers aren't stuck waiting on the disk) and either
+* keep the copy we had, if it turns out to be the same file, or swap the new one in. When the cache is full the file
+* that was used the longest time ago gets pushed out. Returns nullptr if there's no file we can send.
+*/
+shared_ptr<FileBody> StaticFiles::lookup(const string& path, string& contentType)
+{
+    auto now = steady_clock::now();
+    {
+        lock_guard<mutex> guard(cacheLock);
+        auto found = cache.find(path);
+        if (found != cache.end() && now - found->second.checked < revalidateAfter)
+        {
+            recentlyUsed.splice(recentlyUsed.begin(), recentlyUsed, found->second.recentPosition);
+            contentType = found->second.contentType;
+            return found->second.body;
+        }
+    }
+
+    int handle = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (handle > -1 && (fstat(handle, &info) < 0 || !S_ISREG(info.st_mode)))
+    {
+        close(handle); //directories and the like aren't something we can send
+        handle = -1;
+    }
+
+    lock_guard<mutex> guard(cacheLock);
+    if (handle < 0)
+    {
+        forget(path);
+        return nullptr;
+    }
+
+    auto fresh = make_shared<FileBody>(handle, info.st_size);
+    timespec modified = modifiedTime(info);
+    auto found = cache.find(path);
+    if (found != cache.end())
+    {
+        CachedFile& cached = found->second;
+        if (cached.device == info.st_dev && cached.inode == info.st_ino && cached.body->size == fresh->size &&
+            cached.modified.tv_sec == modified.tv_sec && cached.modified.tv_nsec == modified.tv_nsec)
+        {
+            cached.checked = now; //nothing changed, so keep the copy we have and let the new one close
+            recentlyUsed.splice(recentlyUsed.begin(), recentlyUsed, cached.recentPosition);
+            contentType = cached.contentType;
+            return cached.body;
+        }
+        forget(path);
+    }
+
+    contentType = getContentType(path);
+    recentlyUsed.push_front(path);
+    cache[path] = {fresh, contentType, info.st_dev, info.st_ino, modified, now, recentlyUsed.begin(), {}};
+    if (cache.size() > capacity) forget(recentlyUsed.back());
+    return fresh;
+}
+
+/*
+* The file compressed with the encoding, frozen into a whole response. It's kept with the open file, so the next client
+* that wants it this way gets the same bytes, and a file that changes gets compressed again. Reading and compressing
+* happen outside the lock. Returns nullptr if the file couldn't be read.
+*/
+shared_ptr<const FrozenResponse> StaticFiles::compress(const string& path, const shared_ptr<FileBody>& file,
+                                                       const string& contentType, Compressor::Encoding encoding)
+{
+    {
+        lock_guard<mutex> guard(cacheLock);
+        auto found = cache.find(path);
+        if (found != cache.end() && found->second.body == file && found->second.compressed[encoding] != nullptr)
+        {
+            return found->second.compressed[encoding];
+        }
+    }
+
+    string contents(file->size, '\0');
+    for (size_t position = 0; position < contents.size();)
+    {
+        ssize_t readBytes = pread(file->handle, contents.data() + position, contents.size() - position, position);
+        if (readBytes <= 0) return nullptr; //the file got shorter while we were reading it
+        position += readBytes;
+    }
+    shared_ptr<const FrozenResponse> frozen = compressor->freeze(HttpMessage(200, {{"content-type", contentType}}, std::move(contents)), encoding);
+
+    lock_guard<mutex> guard(cacheLock);
+    auto found = cache.find(path);
+    if (found != cache.end() && found->second.body == file) found->second.compressed[encoding] = frozen;
+    return frozen;
+}
+
+/*
+* Answer the request with a file, if it's one of ours. Returns false if the uri isn't under our prefix, so the caller
+* can go on and handle the request some other way.
+*
+* Anything after a ? or # in the uri is for the page, not for us, so it's cut off. Paths with ".." in them are turned
+* away, otherwise "/static/../../etc/passwd" would let anyone read any file on the machine. A path that ends in / gets
+* the index.html in that folder.
+*
+* Files that are worth compressing say they vary by accept-encoding, even when they're sent as they are, so a cache
+* in between us and the client doesn't hand the compressed copy to somebody who can't read it.
+*/
+bool StaticFiles::serve(Connection* connection, const HttpRequestView& request)
+{
+    if (!matches(request)) return false;
+
+    string_view relative = request.requestUri.substr(prefix.size());
+    relative = relative.substr(0, relative.find_first_of("?#"));
+    if (request.httpMethod != HttpMessage::GET && request.httpMethod != HttpMessage::HEAD)
+    {
+        connection->sendData(HttpMessage(405, {{"allow", "GET, HEAD"}}));
+        return true;
+    }
+
+    string path = directory + "/" + string(relative);
+    if (relative.empty() || relative.ends_with('/')) path += "index.html";
+
+    string contentType;
+    shared_ptr<FileBody> file;
+    if (relative.find("..") == string_view::npos && relative.find('\0') == string_view::npos) file = lookup(path, contentType);
+
+    if (file == nullptr)
+    {
+        connection->sendData(HttpMessage(404));
+        return true;
+    }
+
+    bool compressible = compressor != nullptr && compressor->shouldCompress(contentType, file->size) &&
+                        file->size <= compressor->getOptions().maximumCachedSize;
+    HttpMessage response(200, {{"content-type", contentType}});
+    if (compressible) response.headers["vary"] = "accept-encoding";
+
+    Compressor::Encoding encoding = compressible ? Compressor::chooseEncoding(request) : Compressor::IDENTITY;
+    shared_ptr<const FrozenResponse> compressed;
+    if (encoding != Compressor::IDENTITY) compressed = compress(path, file, contentType, encoding);
+
+    //HEAD has to get the same headers GET would, so it gets the same response, and the connection leaves the body off
+    if (compressed != nullptr) connection->sendFrozen(compressed);
+    else connection->sendFile(response, file);
+    return true;
+}
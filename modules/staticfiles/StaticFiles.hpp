@@ -0,0 +1,68 @@
+#ifndef StiltFox_UniversalLibrary_StaticFiles
+#define StiltFox_UniversalLibrary_StaticFiles
+#include <sys/types.h>
+#include <time.h>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "Compression.hpp"
+#include "HttpRequestView.hpp"
+#include "Socket.hpp"
+
+/*
+* StaticFiles serves the files in a directory on disk. Every request whose uri starts with the prefix is looked up
+* in the directory, so with a prefix of "/static/" and a directory of "public", "/static/css/site.css" is answered
+* with the file "public/css/site.css".
+*
+* Opening a file and asking the OS how big it is costs a trip into the kernel each time. Since the same handful of
+* files tend to get asked for over and over, we keep the most recently used ones open, along with their size and
+* when they were last changed. Every so often (revalidateAfter) we check that the file on disk is still the one we
+* have open, so edits to the files show up without a restart.
+*
+* Give it a Compressor with setCompressor and text files are sent compressed to clients that can take it. Each file is
+* compressed once per encoding, the first time somebody asks for it that way, and the compressed response is kept
+* with the open file until the file changes.
+*
+* The cache is shared by every event loop worker, so it's guarded with a mutex.
+*/
+class StaticFiles
+{
+    struct CachedFile
+    {
+        std::shared_ptr<FileBody> body;
+        std::string contentType;
+        dev_t device; //device and inode tell us which file this is, even if it gets replaced under the same name
+        ino_t inode;
+        timespec modified;
+        std::chrono::steady_clock::time_point checked; //when we last made sure the file on disk hasn't changed
+        std::list<std::string>::iterator recentPosition; //where this file is in the recently used list
+        std::shared_ptr<const FrozenResponse> compressed[Compressor::ENCODING_COUNT]; //made the first time each is asked for
+    };
+
+    std::string prefix;
+    std::string directory;
+    size_t capacity;
+    std::chrono::milliseconds revalidateAfter;
+    std::unordered_map<std::string, CachedFile> cache;
+    std::list<std::string> recentlyUsed; //paths in cache, most recently used at the front
+    std::mutex cacheLock;
+    Compressor* compressor = nullptr;
+
+    std::shared_ptr<FileBody> lookup(const std::string& path, std::string& contentType);
+    std::shared_ptr<const FrozenResponse> compress(const std::string& path, const std::shared_ptr<FileBody>& file,
+                                                   const std::string& contentType, Compressor::Encoding encoding);
+    void forget(const std::string& path);
+
+    public:
+    StaticFiles(std::string prefix, std::string directory, size_t capacity = 256, int revalidateAfter = 1000);
+    void setCompressor(Compressor* compressor);
+    bool matches(const HttpRequestView& request) const;
+    bool serve(Connection* connection, const HttpRequestView& request);
+    size_t getCachedFileCount();
+    static std::string_view getContentType(std::string_view path);
+};
+#endif
@@ -0,0 +1,224 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "StaticFiles.hpp"
+
+/*
+* Each test gets its own folder of files and a connection made from a socket pair. The test reads the response from
+* the other end of the pair.
+*/
+struct Fixture
+{
+    std::string directory;
+    int client;
+    Connection* connection;
+
+    Fixture()
+    {
+        char folder[] = "/tmp/staticfilestestXXXXXX";
+        directory = mkdtemp(folder);
+        int handles[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, handles);
+        connection = new Connection(handles[0]);
+        client = handles[1];
+    }
+
+    void write(std::string name, std::string contents)
+    {
+        std::ofstream(directory + "/" + name) << contents;
+    }
+
+    //send the raw request down the connection, ask the files to serve it, and collect what the client would see
+    std::string request(StaticFiles& files, std::string raw, bool* served = nullptr)
+    {
+        send(client, raw.data(), raw.size(), 0);
+        bool handled = files.serve(connection, connection->receiveView());
+        if (served != nullptr) *served = handled;
+
+        std::string output;
+        char buffer[4096];
+        int readBytes;
+        while ((readBytes = recv(client, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) output.append(buffer, readBytes);
+        return output;
+    }
+
+    ~Fixture()
+    {
+        delete connection;
+        close(client);
+        system(("rm -rf " + directory).c_str());
+    }
+};
+
+TEST(StaticFiles, serve_will_send_the_file_with_its_length_and_type)
+{
+    //given we have a file in the served folder
+    Fixture fixture;
+    fixture.write("site.css", "body { color: red; }");
+    StaticFiles files("/static/", fixture.directory);
+
+    //when we ask for it
+    std::string actual = fixture.request(files, "GET /static/site.css?v=3 HTTP/1.1\r\n\r\n");
+
+    //then we get the file with the right headers
+    ASSERT_TRUE(actual.starts_with("HTTP/1.1 200 OK\r\n"));
+    ASSERT_NE(actual.find("content-type: text/css\r\n"), std::string::npos);
+    ASSERT_NE(actual.find("content-length: 20\r\n"), std::string::npos);
+    ASSERT_TRUE(actual.ends_with("\r\n\r\nbody { color: red; }"));
+}
+
+TEST(StaticFiles, serve_will_send_only_the_headers_for_a_head_request)
+{
+    //given we have a file in the served folder
+    Fixture fixture;
+    fixture.write("index.html", "<h1>hi</h1>");
+    StaticFiles files("/", fixture.directory);
+
+    //when we ask for the folder with HEAD
+    std::string actual = fixture.request(files, "HEAD / HTTP/1.1\r\n\r\n");
+
+    //then we get the length of index.html but not the file itself
+    ASSERT_NE(actual.find("content-type: text/html\r\n"), std::string::npos);
+    ASSERT_NE(actual.find("content-length: 11\r\n"), std::string::npos);
+    ASSERT_TRUE(actual.ends_with("\r\n\r\n"));
+}
+
+TEST(StaticFiles, serve_will_answer_head_with_the_headers_get_would_have_for_a_compressed_file)
+{
+    //given we serve a big text file, with a compressor
+    Fixture fixture;
+    std::string page;
+    for (int i = 0; i < 500; i++) page += "<p>paragraph " + std::to_string(i) + "</p>\n";
+    fixture.write("page.html", page);
+    Compressor compressor;
+    StaticFiles files("/", fixture.directory);
+    files.setCompressor(&compressor);
+
+    //when a client that takes gzip asks for it with GET, and then with HEAD
+    std::string get = fixture.request(files, "GET /page.html HTTP/1.1\r\naccept-encoding: gzip\r\n\r\n");
+    std::string head = fixture.request(files, "HEAD /page.html HTTP/1.1\r\naccept-encoding: gzip\r\n\r\n");
+
+    //then HEAD gets exactly the head GET got, compressed length and all, and no body
+    ASSERT_NE(head.find("content-encoding: gzip\r\n"), std::string::npos);
+    ASSERT_EQ(head, get.substr(0, get.find("\r\n\r\n") + 4));
+}
+
+TEST(StaticFiles, serve_will_answer_404_for_missing_files_and_paths_that_leave_the_folder)
+{
+    //given we have a folder with one file in it
+    Fixture fixture;
+    fixture.write("a.txt", "a");
+    StaticFiles files("/static/", fixture.directory + "/");
+
+    //when we ask for a file that isn't there, and try to climb out of the folder
+    std::string missing = fixture.request(files, "GET /static/b.txt HTTP/1.1\r\n\r\n");
+    std::string escaped = fixture.request(files, "GET /static/../etc/passwd HTTP/1.1\r\n\r\n");
+
+    //then both are not found
+    ASSERT_TRUE(missing.starts_with("HTTP/1.1 404 Not Found\r\n"));
+    ASSERT_TRUE(escaped.starts_with("HTTP/1.1 404 Not Found\r\n"));
+}
+
+TEST(StaticFiles, serve_will_leave_requests_outside_the_prefix_alone)
+{
+    //given we serve files under /static/
+    Fixture fixture;
+    StaticFiles files("/static/", fixture.directory);
+    bool served = true;
+
+    //when a request comes in for something else
+    std::string actual = fixture.request(files, "GET /api/users HTTP/1.1\r\n\r\n", &served);
+
+    //then it isn't ours and nothing is sent
+    ASSERT_FALSE(served);
+    ASSERT_EQ(actual, "");
+}
+
+TEST(StaticFiles, serve_will_push_out_the_least_recently_used_file_when_the_cache_is_full)
+{
+    //given we have a cache that only holds two files
+    Fixture fixture;
+    fixture.write("a.txt", "a");
+    fixture.write("b.txt", "b");
+    fixture.write("c.txt", "c");
+    StaticFiles files("/", fixture.directory, 2, 60000);
+
+    //when we ask for three different files, and the first one again after its been pushed out and deleted
+    fixture.request(files, "GET /a.txt HTTP/1.1\r\n\r\n");
+    fixture.request(files, "GET /b.txt HTTP/1.1\r\n\r\n");
+    fixture.request(files, "GET /b.txt HTTP/1.1\r\n\r\n");
+    fixture.request(files, "GET /c.txt HTTP/1.1\r\n\r\n");
+    unlink((fixture.directory + "/a.txt").c_str());
+    unlink((fixture.directory + "/b.txt").c_str());
+    std::string first = fixture.request(files, "GET /a.txt HTTP/1.1\r\n\r\n");
+    std::string second = fixture.request(files, "GET /b.txt HTTP/1.1\r\n\r\n");
+
+    //then only two are kept, the pushed out one had to be opened again, and the cached one is sent from the cache
+    ASSERT_EQ(files.getCachedFileCount(), 2);
+    ASSERT_TRUE(first.starts_with("HTTP/1.1 404 Not Found\r\n"));
+    ASSERT_TRUE(second.ends_with("\r\n\r\nb"));
+}
+
+TEST(StaticFiles, serve_will_pick_up_a_changed_file_once_it_is_due_for_a_check)
+{
+    //given we have a cached file that gets checked on every request
+    Fixture fixture;
+    fixture.write("data.json", "{\"version\":1}");
+    StaticFiles files("/", fixture.directory, 16, 0);
+    fixture.request(files, "GET /data.json HTTP/1.1\r\n\r\n");
+
+    //when the file is replaced with a new one
+    fixture.write("data.json.new", "{\"version\":22}");
+    rename((fixture.directory + "/data.json.new").c_str(), (fixture.directory + "/data.json").c_str());
+    std::string actual = fixture.request(files, "GET /data.json HTTP/1.1\r\n\r\n");
+
+    //then the new file is sent
+    ASSERT_NE(actual.find("content-type: application/json\r\n"), std::string::npos);
+    ASSERT_TRUE(actual.ends_with("\r\n\r\n{\"version\":22}"));
+}
+
+TEST(StaticFiles, serve_will_send_text_compressed_to_clients_that_take_it)
+{
+    //given we serve a big text file and a picture, with a compressor
+    Fixture fixture;
+    std::string page;
+    for (int i = 0; i < 500; i++) page += "<p>paragraph " + std::to_string(i) + "</p>\n";
+    fixture.write("page.html", page);
+    fixture.write("logo.png", std::string(4096, 'p'));
+    Compressor compressor;
+    StaticFiles files("/", fixture.directory);
+    files.setCompressor(&compressor);
+
+    //when clients that take gzip ask for both, twice, and one that doesn't asks for the page
+    std::string first = fixture.request(files, "GET /page.html HTTP/1.1\r\naccept-encoding: gzip\r\n\r\n");
+    std::string second = fixture.request(files, "GET /page.html HTTP/1.1\r\naccept-encoding: gzip\r\n\r\n");
+    std::string plain = fixture.request(files, "GET /page.html HTTP/1.1\r\n\r\n");
+    std::string picture = fixture.request(files, "GET /logo.png HTTP/1.1\r\naccept-encoding: gzip\r\n\r\n");
+
+    //then the page comes gzipped, compressed only the once, the plain client gets the file, and the picture is left alone
+    size_t bodyStart = first.find("\r\n\r\n") + 4;
+    ASSERT_NE(first.find("content-encoding: gzip\r\n"), std::string::npos);
+    ASSERT_NE(first.find("vary: accept-encoding\r\n"), std::string::npos);
+    ASSERT_EQ(first.substr(bodyStart, 2), "\x1f\x8b");
+    ASSERT_LT(first.size() - bodyStart, page.size() / 2);
+    ASSERT_EQ(second, first);
+    ASSERT_EQ(compressor.getCachedBodyCount(), 1);
+    ASSERT_EQ(plain.find("content-encoding"), std::string::npos);
+    ASSERT_NE(plain.find("vary: accept-encoding\r\n"), std::string::npos);
+    ASSERT_TRUE(plain.ends_with(page));
+    ASSERT_EQ(picture.find("content-encoding"), std::string::npos);
+    ASSERT_EQ(picture.find("vary"), std::string::npos);
+}
+
+TEST(StaticFiles, getContentType_will_go_by_the_extension_and_fall_back_to_bytes)
+{
+    //given we have some file names
+    //when we look up their types
+    //then known extensions get their type, whatever the case, and the rest are plain bytes
+    ASSERT_EQ(StaticFiles::getContentType("logo.PNG"), "image/png");
+    ASSERT_EQ(StaticFiles::getContentType("/js/app.js"), "text/javascript");
+    ASSERT_EQ(StaticFiles::getContentType("archive.tar.xyz"), "application/octet-stream");
+    ASSERT_EQ(StaticFiles::getContentType("folder.d/README"), "application/octet-stream");
+}
@@ -1,3 +1,9 @@
+#include <string.h>
+#include <string_view>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define SF_X86_SIMD
+#endif
 #include "StringManip.hpp"
 
 using namespace std;
@@ -9,28 +15,249 @@ string parseLine(const string& inputStr)
 
 string parseToDelim(const string& toParse, const string& delim, bool matchAny)
 {
-    int pos = matchAny ? toParse.find_first_of(delim) : toParse.find(delim);
-    return pos > -1 ? toParse.substr(0,pos) : toParse;
+    size_t pos = matchAny ? toParse.find_first_of(delim) : toParse.find(delim);
+    return pos != string::npos ? toParse.substr(0,pos) : toParse;
 }
 
 unordered_map<string,string> parseMap(const string& toParse, const string& valueDelim, const string& entryDelim)
 {
     unordered_map<string,string> output;
 
-    int currentPos = 0;
+    size_t currentPos = 0;
 
+    //we search from where we are instead of cutting off the front of the string every time, that copy made this slow
     while(currentPos < toParse.length())
     {
         string value;
-        string key = parseToDelim(toParse.substr(currentPos), valueDelim);
-        currentPos += key.length() + valueDelim.length();
-        if (currentPos < toParse.length()) 
+        size_t keyEnd = min(toParse.find(valueDelim, currentPos), toParse.length());
+        string key = toParse.substr(currentPos, keyEnd - currentPos);
+        currentPos = keyEnd + valueDelim.length();
+        if (currentPos < toParse.length())
         {
-            value = parseToDelim((const string)toParse.substr(currentPos), entryDelim);
-            currentPos += value.length() + entryDelim.length();
-        } 
+            size_t valueEnd = min(toParse.find(entryDelim, currentPos), toParse.length());
+            value = toParse.substr(currentPos, valueEnd - currentPos);
+            currentPos = valueEnd + entryDelim.length();
+        }
         output[key] = value;
     }
 
     return output;
-}
\ No newline at end of file
+}
+
+/*
+* Header names are made of "token" characters: letters, digits and a handful of symbols. Anything else (spaces,
+* control characters, separators like ( or @, and bytes above 127) is not allowed.
+*/
+constexpr bool tokenChar(unsigned char c)
+{
+    return c > 0x20 && c < 0x7F && string_view("\"(),/:;<=>?@[\\]{}").find(c) == string_view::npos;
+}
+
+/*
+* To check 32 characters at once we split every byte into its high and low 4 bits and look both halves up in a
+* 16 entry table. Token characters only have high halves 2 through 7, so each of those gets a bit. The low table
+* says which of those high halves make a token with this low half. A byte is a token when the two lookups share a bit.
+*/
+struct NibbleTables
+{
+    unsigned char low[16];
+    unsigned char high[16];
+};
+
+constexpr NibbleTables makeNibbleTables()
+{
+    NibbleTables output{};
+    for (int high = 2; high < 8; high++)
+    {
+        output.high[high] = 1 << (high - 2);
+        for (int low = 0; low < 16; low++) if (tokenChar(high << 4 | low)) output.low[low] |= 1 << (high - 2);
+    }
+    return output;
+}
+
+constexpr NibbleTables TOKEN_TABLES = makeNibbleTables();
+
+/*
+* A classifier reads exactly 32 bytes and sets one bit per byte in each mask: where the newlines are, where the colons
+* are, and which bytes are not token characters.
+*/
+typedef void (*Classifier)(const char* data, unsigned int& newlines, unsigned int& colons, unsigned int& nonToken);
+
+inline void classifyScalar(const char* data, unsigned int& newlines, unsigned int& colons, unsigned int& nonToken)
+{
+    newlines = colons = nonToken = 0;
+    for (int i = 0; i < 32; i++)
+    {
+        unsigned char c = data[i];
+        newlines |= (unsigned int)(c == '\n') << i;
+        colons |= (unsigned int)(c == ':') << i;
+        nonToken |= (unsigned int)!(TOKEN_TABLES.low[c & 0x0F] & TOKEN_TABLES.high[c >> 4]) << i;
+    }
+}
+
+#ifdef SF_X86_SIMD
+/*
+* These use compiler intrinsics, functions that map straight onto single CPU instructions. The target attribute lets
+* us compile them for newer CPUs without requiring that CPU for the rest of the program. We only call them after
+* checking the CPU really has the instructions.
+*/
+__attribute__((target("sse4.2")))
+inline unsigned int classify16(__m128i bytes, __m128i match, __m128i low, __m128i high, unsigned int& colons, unsigned int& nonToken)
+{
+    __m128i nibbles = _mm_set1_epi8(0x0F);
+    __m128i lows = _mm_shuffle_epi8(low, _mm_and_si128(bytes, nibbles));
+    __m128i highs = _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibbles));
+    colons = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(':')));
+    nonToken = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lows, highs), _mm_setzero_si128()));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, match));
+}
+
+__attribute__((target("sse4.2")))
+inline void classifySse42(const char* data, unsigned int& newlines, unsigned int& colons, unsigned int& nonToken)
+{
+    __m128i low = _mm_loadu_si128((const __m128i*)TOKEN_TABLES.low);
+    __m128i high = _mm_loadu_si128((const __m128i*)TOKEN_TABLES.high);
+    __m128i newline = _mm_set1_epi8('\n');
+    unsigned int upperColons, upperNonToken;
+
+    newlines = classify16(_mm_loadu_si128((const __m128i*)data), newline, low, high, colons, nonToken);
+    newlines |= classify16(_mm_loadu_si128((const __m128i*)(data + 16)), newline, low, high, upperColons, upperNonToken) << 16;
+    colons |= upperColons << 16;
+    nonToken |= upperNonToken << 16;
+}
+
+__attribute__((target("avx2")))
+inline void classifyAvx2(const char* data, unsigned int& newlines, unsigned int& colons, unsigned int& nonToken)
+{
+    __m256i bytes = _mm256_loadu_si256((const __m256i*)data);
+    __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)TOKEN_TABLES.low));
+    __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)TOKEN_TABLES.high));
+    __m256i nibbles = _mm256_set1_epi8(0x0F);
+    __m256i lows = _mm256_shuffle_epi8(low, _mm256_and_si256(bytes, nibbles));
+    __m256i highs = _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibbles));
+
+    newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')));
+    colons = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(':')));
+    nonToken = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(lows, highs), _mm256_setzero_si256()));
+}
+#endif
+
+inline ScanLevel supportedLevel()
+{
+    #ifdef SF_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return AVX2;
+        if (__builtin_cpu_supports("sse4.2")) return SSE42;
+    #endif
+    return SCALAR;
+}
+
+inline Classifier classifierFor(ScanLevel level)
+{
+    #ifdef SF_X86_SIMD
+        if (level == AVX2) return classifyAvx2;
+        if (level == SSE42) return classifySse42;
+    #endif
+    return classifyScalar;
+}
+
+static ScanLevel scanLevel = supportedLevel();
+static Classifier classifier = classifierFor(scanLevel);
+
+ScanLevel getScanLevel()
+{
+    return scanLevel;
+}
+
+//Returns the level actually in use, which is lower than asked for if the CPU can't do it. Don't change this while
+//other threads are scanning.
+ScanLevel setScanLevel(ScanLevel level)
+{
+    scanLevel = min(level, supportedLevel());
+    classifier = classifierFor(scanLevel);
+    return scanLevel;
+}
+
+//the bits from "from" up to (not including) "to"
+inline unsigned int bitRange(unsigned int from, unsigned int to)
+{
+    unsigned int below = to >= 32 ? ~0u : (1u << to) - 1;
+    return below & ~((1u << from) - 1);
+}
+
+/*
+* Split a block of headers into lines and find the colon in each, in a single pass. Each line must have a name made
+* of token characters followed by a colon. The block is the headers without the blank line that ends them. Returns
+* how many lines were found, or -1 if a line is malformed or there are more than maxLines of them.
+*
+* The classifier tells us where every newline and colon in the next 32 bytes is. We walk those bits in order, so
+* the bytes in between never have to be looked at one by one.
+*/
+int scanHeaders(const char* block, size_t length, HeaderLine* lines, int maxLines)
+{
+    const size_t NONE = (size_t)-1;
+    int count = 0;
+    size_t lineStart = 0;
+    size_t colon = NONE;
+    bool validName = true;
+
+    auto endLine = [&](size_t pos)
+    {
+        size_t end = pos > lineStart && block[pos - 1] == '\r' ? pos - 1 : pos;
+        if (colon == NONE || colon == lineStart || !validName || count == maxLines) return false;
+        lines[count++] = {lineStart, colon, end};
+        lineStart = pos + 1;
+        colon = NONE;
+        return true;
+    };
+
+    for (size_t offset = 0; offset < length; offset += 32)
+    {
+        unsigned int size = min(length - offset, (size_t)32);
+        unsigned int newlines, colons, nonToken;
+
+        if (size == 32) classifier(block + offset, newlines, colons, nonToken);
+        else
+        {
+            char tail[32] = {}; //the classifiers always read 32 bytes, so the last piece gets copied somewhere safe
+            memcpy(tail, block + offset, size);
+            classifier(tail, newlines, colons, nonToken);
+            newlines &= bitRange(0, size);
+            colons &= bitRange(0, size);
+            nonToken &= bitRange(0, size);
+        }
+
+        unsigned int events = newlines | colons;
+        unsigned int cursor = 0; //bits before this have already been checked
+
+        while (events != 0)
+        {
+            unsigned int bit = __builtin_ctz(events);
+            events &= events - 1;
+
+            if (colon == NONE && (nonToken & bitRange(cursor, bit))) validName = false;
+            cursor = bit + 1;
+
+            if (colons & (1u << bit))
+            {
+                if (colon == NONE) colon = offset + bit; //only the first colon counts, values can have them too
+            }
+            else
+            {
+                if (!endLine(offset + bit)) return -1;
+                validName = true;
+            }
+        }
+
+        if (colon == NONE && cursor < size && (nonToken & bitRange(cursor, size))) validName = false;
+    }
+
+    if (lineStart < length && !endLine(length)) return -1; //the last line didn't end in a newline
+    return count;
+}
+
+bool isToken(const char* text, size_t length)
+{
+    for (size_t i = 0; i < length; i++) if (!tokenChar(text[i])) return false;
+    return length > 0;
+}
@@ -1,9 +1,33 @@
 #ifndef StiltFox_UniversalLibrary_StringManipulation
 #define StiltFox_UniversalLibrary_StringManipulation
+#include <cstddef>
 #include <string>
 #include <unordered_map>
 
 std::string parseLine(const std::string&);
 std::string parseToDelim(const std::string& toParse, const std::string& delim, bool matchAny = false);
 std::unordered_map<std::string,std::string> parseMap(const std::string& toParse, const std::string& valueDelim, const std::string& entryDelim);
-#endif
\ No newline at end of file
+
+/*
+* One line of a header block as found by scanHeaders. The positions are offsets from the start of the block.
+* The name runs from start to colon, and the value from just after the colon up to end (the \r\n is not included).
+*/
+struct HeaderLine
+{
+    size_t start;
+    size_t colon;
+    size_t end;
+};
+
+/*
+* scanHeaders looks at 32 bytes at a time using the vector instructions of the CPU when it has them. Which ones
+* get used is picked once when the program starts, but can be lowered (never raised past what the CPU supports)
+* with setScanLevel, which is handy for testing and benchmarking each version.
+*/
+enum ScanLevel {SCALAR, SSE42, AVX2};
+
+int scanHeaders(const char* block, size_t length, HeaderLine* lines, int maxLines);
+bool isToken(const char* text, size_t length);
+ScanLevel getScanLevel();
+ScanLevel setScanLevel(ScanLevel level);
+#endif
@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include <vector>
 #include "StringManip.hpp"
 
 TEST(StringManip, parseLine_can_parse_out_a_line_from_the_string_linux)
@@ -108,4 +109,92 @@ TEST(StringManip, parseMap_will_parse_a_properly_deliminated_map)
 
     //then we get back a map of strings
     ASSERT_EQ(actual,(std::unordered_map<std::string,std::string>{{"pickle", "sandwitch"},{"portal","to nowhere"},{" ultra safe\nlines", "factory\tcharacters"}}));
-}
\ No newline at end of file
+}
+/*
+* The header scanner has a plain version and vectorized versions for CPUs that support them. Every test below runs
+* against each version the machine can do, and they must all agree.
+*/
+std::vector<ScanLevel> availableScanLevels()
+{
+    std::vector<ScanLevel> output;
+    ScanLevel original = getScanLevel();
+    for (ScanLevel level : {SCALAR, SSE42, AVX2}) if (setScanLevel(level) == level) output.push_back(level);
+    setScanLevel(original);
+    return output;
+}
+
+//Puts the scan level back the way the test found it when the test ends, even if an ASSERT ends it early.
+struct ScanLevelRestorer
+{
+    ScanLevel original = getScanLevel();
+    ~ScanLevelRestorer() { setScanLevel(original); }
+};
+
+TEST(StringManip, scanHeaders_will_find_the_name_and_value_of_every_line)
+{
+    //given we have a header block longer than one vector, with a colon inside a value
+    std::string block = "Host: example.com\r\nX-Forwarded-For: 10.0.0.1, 10.0.0.2\r\nReferer: http://example.com/a:b\r\n"
+        "a-very-long-header-name-that-crosses-the-thirty-two-byte-boundary:v";
+
+    ScanLevelRestorer restorer;
+    for (ScanLevel level : availableScanLevels())
+    {
+        setScanLevel(level);
+
+        //when we scan it
+        HeaderLine lines[8];
+        int actual = scanHeaders(block.data(), block.size(), lines, 8);
+
+        //then we get every line with its name and value
+        ASSERT_EQ(actual, 4);
+        ASSERT_EQ(block.substr(lines[0].start, lines[0].colon - lines[0].start), "Host");
+        ASSERT_EQ(block.substr(lines[1].colon + 1, lines[1].end - lines[1].colon - 1), " 10.0.0.1, 10.0.0.2");
+        ASSERT_EQ(block.substr(lines[2].colon + 1, lines[2].end - lines[2].colon - 1), " http://example.com/a:b");
+        ASSERT_EQ(block.substr(lines[3].start, lines[3].colon - lines[3].start), "a-very-long-header-name-that-crosses-the-thirty-two-byte-boundary");
+        ASSERT_EQ(lines[3].end, block.size());
+    }
+}
+
+TEST(StringManip, scanHeaders_will_reject_a_name_with_characters_that_are_not_allowed)
+{
+    //given we have headers with a space, a separator, and a byte above 127 in their names
+    std::vector<std::string> blocks = {"Good: yes\r\nBad Name: no\r\n", "Bad@Name: no\r\n",
+        "Header: fine\r\n" + std::string(40, 'x') + "\xC3\xA9: no\r\n"};
+
+    ScanLevelRestorer restorer;
+    for (ScanLevel level : availableScanLevels())
+    {
+        setScanLevel(level);
+        for (const std::string& block : blocks)
+        {
+            //when we scan it
+            HeaderLine lines[8];
+            int actual = scanHeaders(block.data(), block.size(), lines, 8);
+
+            //then the block is rejected
+            ASSERT_EQ(actual, -1);
+        }
+    }
+}
+
+TEST(StringManip, scanHeaders_will_reject_a_line_without_a_colon_or_too_many_lines)
+{
+    //given we have a line missing its colon, and a block with more lines than we have room for
+    std::string missingColon = "Header: fine\r\nno colon here\r\n";
+    std::string tooMany = "a: 1\r\nb: 2\r\nc: 3\r\n";
+
+    ScanLevelRestorer restorer;
+    for (ScanLevel level : availableScanLevels())
+    {
+        setScanLevel(level);
+
+        //when we scan them
+        HeaderLine lines[2];
+        int actualMissing = scanHeaders(missingColon.data(), missingColon.size(), lines, 2);
+        int actualTooMany = scanHeaders(tooMany.data(), tooMany.size(), lines, 2);
+
+        //then both are rejected
+        ASSERT_EQ(actualMissing, -1);
+        ASSERT_EQ(actualTooMany, -1);
+    }
+}
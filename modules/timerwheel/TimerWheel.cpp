@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include "TimerWheel.hpp"
+
+using namespace std;
+
+TimerWheel::Timer::Timer(void* timerOwner)
+{
+    next = previous = nullptr;
+    wheel = nullptr;
+    expires = 0;
+    level = slot = 0;
+    owner = timerOwner;
+}
+
+/*
+* A copy gets the owner, but not the place on the wheel. Two timers can't be in the same spot in a list, and the
+* original is still the one that was scheduled.
+*/
+TimerWheel::Timer::Timer(const Timer& other) : Timer(other.owner) {}
+
+TimerWheel::Timer& TimerWheel::Timer::operator=(const Timer& other)
+{
+    if (this != &other)
+    {
+        cancel();
+        owner = other.owner;
+    }
+    return *this;
+}
+
+bool TimerWheel::Timer::isScheduled() const
+{
+    return wheel != nullptr;
+}
+
+//When the timer is due, in the wheel's time, rounded up to a whole tick. 0 if it isn't scheduled.
+uint64_t TimerWheel::Timer::getDeadline() const
+{
+    return wheel == nullptr ? 0 : expires * wheel->tickLength;
+}
+
+//Take the timer off its wheel, if it's on one. It's safe to cancel a timer that isn't scheduled.
+void TimerWheel::Timer::cancel()
+{
+    if (wheel == nullptr) return;
+    wheel->unlink(*this);
+    wheel->count--;
+    wheel = nullptr;
+}
+
+TimerWheel::Timer::~Timer()
+{
+    cancel();
+}
+
+/*
+* start is the time right now, so the hand starts in the right place. Ticks can be any length, but the shorter they
+* are, the more often a caller waiting on getTimeout wakes up.
+*/
+TimerWheel::TimerWheel(uint64_t length, uint64_t start)
+{
+    tickLength = max<uint64_t>(length, 1);
+    now = start / tickLength;
+    count = 0;
+    for (int level = 0; level < LEVELS; level++)
+    {
+        occupied[level] = 0;
+        for (Timer& head : slots[level]) head.next = head.previous = &head;
+    }
+}
+
+/*
+* Set the timer to go off at deadline. A timer that was already scheduled is moved, so there's no need to cancel it
+* first. A deadline that has passed already goes off on the next tick.
+*/
+void TimerWheel::schedule(Timer& timer, uint64_t deadline)
+{
+    timer.cancel();
+    uint64_t tick = deadline / tickLength + (deadline % tickLength != 0); //rounded up, so it never goes off early
+    timer.expires = max(tick, now + 1);
+    timer.wheel = this;
+    place(timer);
+    count++;
+}
+
+/*
+* Put the timer in the slot of the first wheel wide enough to reach it. Level 0 reaches 64 ticks ahead, level 1 reaches
+* 64 * 64, and so on. Anything further off than the last level reaches is parked at the far end of it.
+*/
+void TimerWheel::place(Timer& timer)
+{
+    uint64_t tick = max(timer.expires, now);
+    uint64_t ahead = tick - now;
+    int level = 0;
+    while (level < LEVELS - 1 && ahead >= 1ull << (SLOT_BITS * (level + 1))) level++;
+    if (ahead >= 1ull << (SLOT_BITS * LEVELS)) tick = now + (1ull << (SLOT_BITS * LEVELS)) - 1;
+
+    timer.level = level;
+    timer.slot = (tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+    Timer& head = slots[level][timer.slot];
+    timer.previous = head.previous;
+    timer.next = &head;
+    head.previous->next = &timer;
+    head.previous = &timer;
+    occupied[level] |= 1ull << timer.slot;
+}
+
+void TimerWheel::unlink(Timer& timer)
+{
+    timer.previous->next = timer.next;
+    timer.next->previous = timer.previous;
+    timer.next = timer.previous = nullptr;
+
+    Timer& head = slots[timer.level][timer.slot];
+    if (head.next == &head) occupied[timer.level] &= ~(1ull << timer.slot);
+}
+
+/*
+* The hand of a slower wheel has just moved onto a new slot. Everything in it is due within one turn of the wheel in
+* front, so it's all placed again, and lands on the faster wheels.
+*/
+void TimerWheel::cascade(int level)
+{
+    Timer& head = slots[level][(now >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    while (head.next != &head)
+    {
+        Timer& timer = *head.next;
+        unlink(timer);
+        place(timer);
+    }
+}
+
+/*
+* The next tick anything can happen on: either a slot ahead of the hand on the first wheel has timers in it, or the
+* hand comes back around to the start and the slower wheels move on. Ticks in between can be skipped.
+*/
+uint64_t TimerWheel::nextTick() const
+{
+    unsigned index = now & (SLOTS - 1);
+    uint64_t ahead = index == SLOTS - 1 ? 0 : occupied[0] & (~0ull << (index + 1));
+    if (ahead != 0) return (now & ~(uint64_t)(SLOTS - 1)) + countr_zero(ahead);
+    return (now | (SLOTS - 1)) + 1;
+}
+
+/*
+* Move the hand up to time, calling expired for every timer that came due on the way, in the order they came due.
+* Each timer is taken off the wheel before expired is called, so expired is free to schedule it again, or to cancel
+* or schedule any other timer. Returns how many went off.
+*/
+size_t TimerWheel::advance(uint64_t time, const function<void(Timer&)>& expired)
+{
+    uint64_t target = time / tickLength;
+    size_t fired = 0;
+
+    while (now < target)
+    {
+        uint64_t next = count == 0 ? UINT64_MAX : nextTick();
+        if (next > target)
+        {
+            now = target; //nothing happens between here and there
+            break;
+        }
+
+        now = next;
+        for (int level = 1; level < LEVELS && (now & ((1ull << (SLOT_BITS * level)) - 1)) == 0; level++) cascade(level);
+
+        Timer& head = slots[0][now & (SLOTS - 1)];
+        while (head.next != &head)
+        {
+            Timer& timer = *head.next;
+            unlink(timer);
+            if (timer.expires > now) //it was parked, and still isn't due
+            {
+                place(timer);
+                continue;
+            }
+            timer.wheel = nullptr;
+            count--;
+            fired++;
+            expired(timer);
+        }
+    }
+    return fired;
+}
+
+/*
+* How long from time until the wheel next needs advancing, ready to hand to something like epoll_wait. -1 means there
+* are no timers, so there's nothing to wake up for.
+*/
+int TimerWheel::getTimeout(uint64_t time) const
+{
+    if (count == 0) return -1;
+    uint64_t due = nextTick() * tickLength;
+    return due <= time ? 0 : (int)min<uint64_t>(due - time, INT_MAX);
+}
+
+//The time the hand is on, rounded down to a whole tick
+uint64_t TimerWheel::getTime() const
+{
+    return now * tickLength;
+}
+
+//How many timers are scheduled
+size_t TimerWheel::size() const
+{
+    return count;
+}
+
+//Any timers still on the wheel are let go of, so they don't try to take themselves off it later.
+TimerWheel::~TimerWheel()
+{
+    for (int level = 0; level < LEVELS; level++)
+    {
+        for (Timer& head : slots[level])
+        {
+            while (head.next != &head)
+            {
+                Timer& timer = *head.next;
+                unlink(timer);
+                timer.wheel = nullptr;
+            }
+        }
+    }
+}
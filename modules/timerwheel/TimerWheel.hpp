@@ -0,0 +1,79 @@
+#ifndef StiltFox_UniversalLibrary_TimerWheel
+#define StiltFox_UniversalLibrary_TimerWheel
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+/*
+* A timer wheel keeps track of a lot of deadlines at once, like one per connection, and tells us when they pass. The
+* usual way is a heap sorted by deadline, but every insert and every cancel on a heap costs a trip up or down it, and
+* a busy server moves its deadlines around on almost every request. Here adding and cancelling a timer is a handful
+* of pointer swaps, whether there are ten timers or a million.
+*
+* Think of a clock face with 64 slots, where the hand moves one slot every tick. A timer due in 5 ticks goes in the
+* slot 5 ahead of the hand, and when the hand gets there, everything in that slot is due. That only covers 64 ticks,
+* so there are more wheels behind the first one, each with slots 64 times as wide as the one in front of it. A timer
+* due in an hour sits in a wide slot on a slow wheel, and when the hand of that wheel gets to it, the timers in it are
+* spread out over the faster wheels. With 4 wheels of 64 slots and 10ms ticks, that covers nearly two days. Timers
+* further off than that are parked at the far end and placed again when it comes around.
+*
+* Time is whatever the caller says it is. The event loop uses milliseconds from the steady clock. A timer never goes
+* off early, but may go off up to a tick late.
+*
+* A timer lives wherever its owner puts it, usually right inside the thing it's timing, so the wheel never allocates.
+* The slots are lists threaded through the timers themselves. A timer that is destroyed takes itself off the wheel.
+* A wheel belongs to one thread.
+*/
+class TimerWheel
+{
+    public:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS; //per level. 64, so which slots are in use fits in one 64 bit number.
+
+    class Timer
+    {
+        friend class TimerWheel;
+        Timer* next;
+        Timer* previous;
+        TimerWheel* wheel; //the wheel this is waiting on, or nullptr if it isn't scheduled
+        uint64_t expires; //the tick it's due on
+        uint8_t level;
+        uint8_t slot;
+
+        public:
+        void* owner; //whatever the timer is for, so whoever handles it going off can find it. The wheel doesn't touch it.
+
+        Timer(void* owner = nullptr);
+        Timer(const Timer& other); //copies are never scheduled, even if the original is
+        Timer& operator=(const Timer& other);
+        bool isScheduled() const;
+        uint64_t getDeadline() const;
+        void cancel();
+        ~Timer();
+    };
+
+    private:
+    Timer slots[LEVELS][SLOTS]; //each slot is the head of a ring of timers. An empty slot points at itself.
+    uint64_t occupied[LEVELS]; //one bit for each slot that has timers in it
+    uint64_t tickLength;
+    uint64_t now; //the tick the hand is on
+    size_t count;
+
+    void place(Timer& timer);
+    void unlink(Timer& timer);
+    void cascade(int level);
+    uint64_t nextTick() const;
+
+    public:
+    TimerWheel(uint64_t tickLength = 10, uint64_t start = 0);
+    TimerWheel(const TimerWheel&) = delete; //the timers point at their slots, so a copy would be trouble
+    TimerWheel& operator=(const TimerWheel&) = delete;
+    void schedule(Timer& timer, uint64_t deadline);
+    size_t advance(uint64_t time, const std::function<void(Timer&)>& expired);
+    int getTimeout(uint64_t time) const;
+    uint64_t getTime() const;
+    size_t size() const;
+    ~TimerWheel();
+};
+#endif
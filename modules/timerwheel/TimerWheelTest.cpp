@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+#include "TimerWheel.hpp"
+
+using namespace std;
+
+TEST(TimerWheel, advance_will_fire_timers_in_order_and_never_early_on_every_level)
+{
+    //given timers due soon, in a few minutes, in a few hours, and further off than the wheels reach
+    TimerWheel wheel(10, 1000);
+    uint64_t deadlines[] = {1005, 1640, 200000, 5000000, 400000000};
+    vector<TimerWheel::Timer> timers(5);
+    for (int i = 4; i >= 0; i--)
+    {
+        timers[i].owner = &deadlines[i];
+        wheel.schedule(timers[i], deadlines[i]);
+    }
+
+    //when we move the clock along a bit at a time, noting when each one goes off
+    vector<pair<uint64_t, uint64_t>> fired;
+    for (uint64_t time = 1000; time <= 400000100; time += time < 300000 ? 7 : 9999)
+    {
+        wheel.advance(time, [&fired, time](TimerWheel::Timer& timer)
+        {
+            fired.push_back({*(uint64_t*)timer.owner, time});
+        });
+    }
+
+    //then they all went off once, in order, no earlier than they were due and no more than a step late
+    ASSERT_EQ(fired.size(), 5);
+    for (int i = 0; i < 5; i++)
+    {
+        ASSERT_EQ(fired[i].first, deadlines[i]);
+        ASSERT_GE(fired[i].second, deadlines[i]);
+        ASSERT_LT(fired[i].second, deadlines[i] + (deadlines[i] < 300000 ? 17 : 10009));
+        ASSERT_FALSE(timers[i].isScheduled());
+    }
+    ASSERT_EQ(wheel.size(), 0);
+}
+
+TEST(TimerWheel, cancel_and_schedule_will_move_timers_and_destroyed_timers_will_take_themselves_off)
+{
+    //given a few timers on a wheel
+    TimerWheel wheel;
+    TimerWheel::Timer cancelled, moved, copied;
+    auto destroyed = make_unique<TimerWheel::Timer>();
+    wheel.schedule(cancelled, 500);
+    wheel.schedule(moved, 500);
+    wheel.schedule(copied, 500);
+    wheel.schedule(*destroyed, 500);
+
+    //when one is cancelled, one is pushed back, one is copied and one goes away
+    cancelled.cancel();
+    wheel.schedule(moved, 90000);
+    TimerWheel::Timer copy = copied;
+    destroyed.reset();
+    int count = 0;
+    TimerWheel::Timer* first = nullptr;
+    size_t early = wheel.advance(1000, [&](TimerWheel::Timer& timer) { first = &timer; count++; });
+    size_t late = wheel.advance(100000, [&](TimerWheel::Timer&) { count++; });
+
+    //then only the timers still scheduled go off, each at its own time, and the copy was never scheduled
+    ASSERT_EQ(early, 1);
+    ASSERT_EQ(first, &copied);
+    ASSERT_EQ(late, 1);
+    ASSERT_EQ(count, 2);
+    ASSERT_FALSE(copy.isScheduled());
+    ASSERT_FALSE(cancelled.isScheduled());
+}
+
+TEST(TimerWheel, getTimeout_will_say_how_long_until_the_next_timer_needs_looking_at)
+{
+    //given an empty wheel, and then one with a timer 35ms off
+    TimerWheel wheel(10, 0);
+    int empty = wheel.getTimeout(0);
+    TimerWheel::Timer timer;
+    wheel.schedule(timer, 35);
+
+    //when we ask how long to wait, from a few points in time
+    //then there's nothing to wait for at first, then it rounds up to the tick the timer is on, and then it's due
+    ASSERT_EQ(empty, -1);
+    ASSERT_EQ(wheel.getTimeout(0), 40);
+    ASSERT_EQ(wheel.getTimeout(38), 2);
+    ASSERT_EQ(wheel.getTimeout(45), 0);
+    ASSERT_EQ(timer.getDeadline(), 40);
+}
+
+TEST(TimerWheel, advance_will_handle_a_lot_of_timers_being_rescheduled_as_they_go_off)
+{
+    //given a hundred thousand timers spread over the next few minutes
+    TimerWheel wheel(10, 0);
+    vector<TimerWheel::Timer> timers(100000);
+    for (size_t i = 0; i < timers.size(); i++) wheel.schedule(timers[i], (i * 7919) % 300000);
+
+    //when every timer that goes off puts itself back once, a second later
+    size_t fired = 0;
+    vector<int> rounds(timers.size());
+    for (uint64_t time = 0; time <= 400000; time += 1000)
+    {
+        fired += wheel.advance(time, [&](TimerWheel::Timer& timer)
+        {
+            size_t index = &timer - timers.data();
+            if (rounds[index]++ == 0) wheel.schedule(timer, time + 1000);
+        });
+    }
+
+    //then each went off exactly twice, and nothing is left on the wheel
+    ASSERT_EQ(fired, 200000);
+    for (int count : rounds) ASSERT_EQ(count, 2);
+    ASSERT_EQ(wheel.size(), 0);
+}
@@ -0,0 +1,238 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "Uring.hpp"
+
+using namespace std;
+
+/*
+* There's no wrapper for these in the C library, so we make the system calls ourselves. That's all liburing does
+* under the hood too.
+*/
+inline int uringSetup(unsigned entries, io_uring_params* params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+inline int uringEnter(int handle, unsigned toSubmit, unsigned waitFor, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, handle, toSubmit, waitFor, flags, nullptr, 0);
+}
+
+inline int uringRegister(int handle, unsigned opcode, void* argument, unsigned count)
+{
+    return syscall(__NR_io_uring_register, handle, opcode, argument, count);
+}
+
+//the ring is shared with the kernel, so reads and writes of its head and tail need to be ordered with the kernel's
+inline unsigned loadAcquire(unsigned* value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+inline void storeRelease(unsigned* value, unsigned newValue)
+{
+    __atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+}
+
+/*
+* The kernel tells us where everything lives in the shared memory with a set of offsets. With IORING_FEAT_SINGLE_MMAP
+* (every kernel since 5.4) both rings live in one mapping.
+*/
+Uring::Uring(unsigned requestedEntries)
+{
+    submitRing = completeRing = MAP_FAILED;
+    requests = (io_uring_sqe*)MAP_FAILED;
+    bufferRing = (io_uring_buf_ring*)MAP_FAILED;
+    bufferMemory = nullptr;
+    bufferCount = bufferSize = 0;
+    bufferTail = 0;
+    nextRequest = 0;
+    entries = 0;
+
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = requestedEntries * 4; //multishot requests can produce many completions each
+    ringHandle = uringSetup(requestedEntries, &params);
+    if (ringHandle < 0) return;
+
+    entries = params.sq_entries;
+    submitRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    completeRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap) submitRingSize = completeRingSize = max(submitRingSize, completeRingSize);
+
+    submitRing = mmap(nullptr, submitRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringHandle, IORING_OFF_SQ_RING);
+    completeRing = singleMap ? submitRing :
+        mmap(nullptr, completeRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringHandle, IORING_OFF_CQ_RING);
+    requestsSize = params.sq_entries * sizeof(io_uring_sqe);
+    requests = (io_uring_sqe*)mmap(nullptr, requestsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringHandle, IORING_OFF_SQES);
+
+    if (submitRing == MAP_FAILED || completeRing == MAP_FAILED || requests == MAP_FAILED)
+    {
+        close(ringHandle);
+        ringHandle = -1;
+        return;
+    }
+
+    char* submitBase = (char*)submitRing;
+    submitHead = (unsigned*)(submitBase + params.sq_off.head);
+    submitTail = (unsigned*)(submitBase + params.sq_off.tail);
+    submitMask = (unsigned*)(submitBase + params.sq_off.ring_mask);
+    submitArray = (unsigned*)(submitBase + params.sq_off.array);
+    char* completeBase = (char*)completeRing;
+    completeHead = (unsigned*)(completeBase + params.cq_off.head);
+    completeTail = (unsigned*)(completeBase + params.cq_off.tail);
+    completeMask = (unsigned*)(completeBase + params.cq_off.ring_mask);
+    completions = (io_uring_cqe*)(completeBase + params.cq_off.cqes);
+    nextRequest = *submitTail;
+}
+
+bool Uring::isOpen()
+{
+    return ringHandle > -1;
+}
+
+/*
+* Get an empty request to fill in. If the ring is full we hand what's in it to the kernel first to make room. The
+* request isn't seen by the kernel until the next submit.
+*/
+io_uring_sqe* Uring::getRequest()
+{
+    if (nextRequest - loadAcquire(submitHead) >= entries)
+    {
+        submit();
+        if (nextRequest - loadAcquire(submitHead) >= entries) return nullptr;
+    }
+
+    unsigned index = nextRequest & *submitMask;
+    io_uring_sqe* request = &requests[index];
+    memset(request, 0, sizeof(io_uring_sqe));
+    submitArray[index] = index;
+    nextRequest++;
+    return request;
+}
+
+/*
+* Hand every request we've filled in to the kernel, and if waitFor is more than zero, sleep until at least that many
+* completions are ready. This is the only system call the ring needs.
+*/
+int Uring::submit(unsigned waitFor)
+{
+    storeRelease(submitTail, nextRequest);
+    unsigned toSubmit = nextRequest - loadAcquire(submitHead);
+    int output;
+    do output = uringEnter(ringHandle, toSubmit, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0);
+    while (output < 0 && errno == EINTR && waitFor == 0);
+    return output;
+}
+
+//The oldest completion we haven't looked at yet, or nullptr if there are none.
+io_uring_cqe* Uring::peekCompletion()
+{
+    unsigned head = *completeHead;
+    if (head == loadAcquire(completeTail)) return nullptr;
+    return &completions[head & *completeMask];
+}
+
+//Tell the kernel we're done with the completion from peekCompletion, so it can reuse the slot.
+void Uring::completionSeen()
+{
+    storeRelease(completeHead, *completeHead + 1);
+}
+
+/*
+* Lend the kernel count buffers of size bytes each. recv requests with IOSQE_BUFFER_SELECT and this group pick one
+* when data arrives, and the completion says which one they took (cqe->flags >> IORING_CQE_BUFFER_SHIFT). From then on
+* the buffer is ours to read, until recycleBuffer lends it out again. count must be a power of two.
+*/
+bool Uring::provideBuffers(unsigned count, unsigned size, unsigned short group)
+{
+    if (!isOpen() || bufferMemory != nullptr || count == 0 || (count & (count - 1)) != 0) return false;
+
+    bufferRingSize = count * sizeof(io_uring_buf);
+    bufferRing = (io_uring_buf_ring*)mmap(nullptr, bufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufferRing == MAP_FAILED) return false;
+
+    io_uring_buf_reg registration{};
+    registration.ring_addr = (unsigned long long)bufferRing;
+    registration.ring_entries = count;
+    registration.bgid = group;
+    if (uringRegister(ringHandle, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+    {
+        munmap(bufferRing, bufferRingSize);
+        bufferRing = (io_uring_buf_ring*)MAP_FAILED;
+        return false;
+    }
+
+    bufferCount = count;
+    bufferSize = size;
+    bufferMemory = new char[(size_t)count * size];
+    for (unsigned id = 0; id < count; id++) recycleBuffer(id);
+    return true;
+}
+
+char* Uring::getBuffer(unsigned short id)
+{
+    return bufferMemory + (size_t)id * bufferSize;
+}
+
+//Give a buffer back to the kernel once we've copied what was in it.
+void Uring::recycleBuffer(unsigned short id)
+{
+    //the ring is just an array of io_uring_buf. We don't use bufferRing->bufs because in C++ the kernel header puts
+    //it 8 bytes too far in. The tail is tucked into the unused end of the first entry.
+    io_uring_buf& buffer = ((io_uring_buf*)bufferRing)[bufferTail & (bufferCount - 1)];
+    buffer.addr = (unsigned long long)getBuffer(id);
+    buffer.len = bufferSize;
+    buffer.bid = id;
+    bufferTail++;
+    __atomic_store_n(&bufferRing->tail, bufferTail, __ATOMIC_RELEASE);
+}
+
+/*
+* Check, once, if this kernel can do everything the event loop asks of io_uring. Containers often block io_uring
+* outright, older kernels are missing the operations, and provided buffer rings and multishot recv need 5.19 and 6.0.
+* The opcode probe can't tell us about the multishot flags, so for those we go by the kernel version.
+*/
+bool Uring::isSupported()
+{
+    static const bool supported = []()
+    {
+        utsname name;
+        int major = 0, minor = 0;
+        if (uname(&name) < 0 || sscanf(name.release, "%d.%d", &major, &minor) != 2 || major < 6) return false;
+
+        Uring ring(8);
+        if (!ring.isOpen()) return false;
+
+        vector<char> memory(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* probe = (io_uring_probe*)memory.data();
+        if (uringRegister(ring.ringHandle, IORING_REGISTER_PROBE, probe, 256) < 0) return false;
+
+        for (int operation : {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_CLOSE, IORING_OP_POLL_ADD,
+                              IORING_OP_TIMEOUT, IORING_OP_ASYNC_CANCEL})
+        {
+            if (operation > probe->last_op || !(probe->ops[operation].flags & IO_URING_OP_SUPPORTED)) return false;
+        }
+        return ring.provideBuffers(1, 64, 0);
+    }();
+    return supported;
+}
+
+//The ring is closed first, so the kernel has let go of the buffers before we free them.
+Uring::~Uring()
+{
+    if (ringHandle > -1) close(ringHandle);
+    if (requests != MAP_FAILED) munmap(requests, requestsSize);
+    if (completeRing != MAP_FAILED && completeRing != submitRing) munmap(completeRing, completeRingSize);
+    if (submitRing != MAP_FAILED) munmap(submitRing, submitRingSize);
+    if (bufferRing != MAP_FAILED) munmap(bufferRing, bufferRingSize);
+    delete[] bufferMemory;
+}
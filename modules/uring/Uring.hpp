@@ -0,0 +1,62 @@
+#ifndef StiltFox_UniversalLibrary_Uring
+#define StiltFox_UniversalLibrary_Uring
+#include <linux/io_uring.h>
+#include <cstddef>
+
+/*
+* io_uring is a newer way of talking to the Linux kernel. Instead of making a system call for every accept, read and
+* send, we write what we'd like done into a ring of requests that we share with the kernel, and it writes what
+* happened into a second ring of completions. One io_uring_enter call can hand over a whole batch of work and wait
+* for results at the same time, and with "multishot" requests a single accept or recv keeps producing results until
+* it's cancelled.
+*
+* This class is a thin wrapper over the raw system calls: it sets the rings up, gives out empty requests (sqes), hands
+* them to the kernel, and lets us walk the completions (cqes). It also manages a ring of provided buffers: memory we
+* lend the kernel up front, so a recv can pick a buffer itself once data actually shows up instead of us tying one up
+* per connection while it waits.
+*
+* Each ring belongs to one thread. None of this is thread safe.
+*/
+class Uring
+{
+    int ringHandle;
+    unsigned entries;
+    void* submitRing;
+    size_t submitRingSize;
+    void* completeRing;
+    size_t completeRingSize;
+    io_uring_sqe* requests;
+    size_t requestsSize;
+    unsigned* submitHead;
+    unsigned* submitTail;
+    unsigned* submitMask;
+    unsigned* submitArray;
+    unsigned* completeHead;
+    unsigned* completeTail;
+    unsigned* completeMask;
+    io_uring_cqe* completions;
+    unsigned nextRequest; //where the next request goes. The kernel can't see it until submit moves submitTail up to here.
+
+    io_uring_buf_ring* bufferRing;
+    size_t bufferRingSize;
+    char* bufferMemory;
+    unsigned bufferCount;
+    unsigned bufferSize;
+    unsigned short bufferTail;
+
+    public:
+    Uring(unsigned entries = 256);
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+    bool isOpen();
+    io_uring_sqe* getRequest();
+    int submit(unsigned waitFor = 0);
+    io_uring_cqe* peekCompletion();
+    void completionSeen();
+    bool provideBuffers(unsigned count, unsigned size, unsigned short group);
+    char* getBuffer(unsigned short id);
+    void recycleBuffer(unsigned short id);
+    static bool isSupported();
+    ~Uring();
+};
+#endif
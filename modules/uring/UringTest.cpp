@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include "Uring.hpp"
+
+//wait for the next completion and take a copy of it, so the slot can go back to the kernel
+io_uring_cqe nextCompletion(Uring& ring)
+{
+    io_uring_cqe* completion;
+    while ((completion = ring.peekCompletion()) == nullptr) ring.submit(1);
+    io_uring_cqe output = *completion;
+    ring.completionSeen();
+    return output;
+}
+
+TEST(Uring, submit_will_hand_requests_to_the_kernel_and_bring_back_their_completions)
+{
+    //given we have a ring on a kernel that supports it
+    if (!Uring::isSupported()) GTEST_SKIP() << "io_uring is not available here";
+    Uring ring(4);
+
+    //when we submit a request that does nothing
+    io_uring_sqe* request = ring.getRequest();
+    request->opcode = IORING_OP_NOP;
+    request->user_data = 42;
+    io_uring_cqe actual = nextCompletion(ring);
+
+    //then it comes back done, with our tag on it
+    ASSERT_EQ(actual.user_data, 42);
+    ASSERT_EQ(actual.res, 0);
+}
+
+TEST(Uring, provideBuffers_will_let_a_multishot_recv_pick_its_own_buffers)
+{
+    //given we have a ring with two small buffers lent to the kernel, and a socket to read from
+    if (!Uring::isSupported()) GTEST_SKIP() << "io_uring is not available here";
+    Uring ring(4);
+    bool provided = ring.provideBuffers(2, 16, 3);
+    int handles[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, handles);
+
+    //when one recv is left waiting and data shows up twice
+    io_uring_sqe* request = ring.getRequest();
+    request->opcode = IORING_OP_RECV;
+    request->fd = handles[0];
+    request->ioprio = IORING_RECV_MULTISHOT;
+    request->flags = IOSQE_BUFFER_SELECT;
+    request->buf_group = 3;
+    ring.submit();
+    write(handles[1], "hello", 5);
+    io_uring_cqe first = nextCompletion(ring);
+    std::string firstText(ring.getBuffer(first.flags >> IORING_CQE_BUFFER_SHIFT), first.res);
+    ring.recycleBuffer(first.flags >> IORING_CQE_BUFFER_SHIFT);
+    write(handles[1], "world!", 6);
+    io_uring_cqe second = nextCompletion(ring);
+    std::string secondText(ring.getBuffer(second.flags >> IORING_CQE_BUFFER_SHIFT), second.res);
+    ring.recycleBuffer(second.flags >> IORING_CQE_BUFFER_SHIFT);
+    close(handles[1]);
+    io_uring_cqe last = nextCompletion(ring);
+    close(handles[0]);
+
+    //then each piece lands in a buffer of its own, and the recv keeps going until the other end hangs up
+    ASSERT_TRUE(provided);
+    ASSERT_EQ(firstText, "hello");
+    ASSERT_EQ(secondText, "world!");
+    ASSERT_TRUE(first.flags & IORING_CQE_F_MORE);
+    ASSERT_NE(first.flags >> IORING_CQE_BUFFER_SHIFT, second.flags >> IORING_CQE_BUFFER_SHIFT);
+    ASSERT_EQ(last.res, 0);
+    ASSERT_FALSE(last.flags & IORING_CQE_F_MORE);
+}